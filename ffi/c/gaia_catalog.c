@@ -0,0 +1,2231 @@
+#include "gaia_catalog.h"
+#include "gaia_kernels.h"
+#include "healpix.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define PAGE_ALIGN(x) (((x) + 4095ULL) & ~4095ULL)
+
+struct gaia_catalog_writer {
+    int fd;
+    uint8_t* map;
+    uint64_t map_size;
+    catalog_header* header;
+    uint64_t* index;
+    uint64_t cursor;
+    int64_t last_source_id;
+    uint32_t num_values;
+    int ra_value;
+    int dec_value;
+    int flux_value;
+};
+
+static __thread char last_error[256];
+
+static void set_error(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(last_error, sizeof(last_error), fmt, args);
+    va_end(args);
+}
+
+const char* catalog_last_error(void) {
+    return last_error;
+}
+
+// Same minimal ["col1","col2"] parser as parse_gzipped_csv. Stores at
+// most `max` names but returns the full count, so callers can reject
+// lists that don't fit.
+static int parse_columns(const char* columns_json, char names[][CATALOG_NAME_LEN], int max) {
+    int count = 0;
+    const char* p = strchr(columns_json, '[');
+    if (!p) return 0;
+    p++;
+    while (*p && *p != ']') {
+        while (*p && isspace(*p)) p++;
+        if (*p != '"') break;
+        p++;
+        size_t i = 0;
+        while (*p && *p != '"') {
+            if (count < max && i < CATALOG_NAME_LEN - 1) names[count][i++] = *p;
+            p++;
+        }
+        if (count < max) names[count][i] = '\0';
+        count++;
+        if (*p == '"') p++;
+        while (*p && (*p == ',' || isspace(*p))) p++;
+    }
+    return count;
+}
+
+static uint64_t index_size(uint32_t order) {
+    return ((uint64_t)healpix_npix(order) + 1) * sizeof(uint64_t);
+}
+
+// Writer
+
+gaia_catalog_writer* catalog_writer_open(const char* path, const char* columns_json, uint32_t order, uint64_t num_rows) {
+    if (order > GAIA_HEALPIX_ORDER) {
+        set_error("Catalog order must be between 0 and %d", GAIA_HEALPIX_ORDER);
+        return NULL;
+    }
+
+    char names[CATALOG_MAX_COLUMNS][CATALOG_NAME_LEN];
+    strcpy(names[0], "source_id");
+    // Leave room for the derived unit-vector columns
+    int num_values = parse_columns(columns_json, names + 1, CATALOG_MAX_COLUMNS - 4);
+    if (num_values > CATALOG_MAX_COLUMNS - 4) {
+        set_error("Catalogs hold at most %d value columns, got %d", CATALOG_MAX_COLUMNS - 4, num_values);
+        return NULL;
+    }
+
+    int ra_value = -1, dec_value = -1, flux_value = -1;
+    for (int i = 0; i < num_values; i++) {
+        if (strcmp(names[i + 1], "ra") == 0) ra_value = i;
+        if (strcmp(names[i + 1], "dec") == 0) dec_value = i;
+        if (strcmp(names[i + 1], "phot_g_mean_flux") == 0) flux_value = i;
+    }
+    if (ra_value < 0 || dec_value < 0) {
+        set_error("Catalog columns must include ra and dec");
+        return NULL;
+    }
+
+    strcpy(names[num_values + 1], "ux");
+    strcpy(names[num_values + 2], "uy");
+    strcpy(names[num_values + 3], "uz");
+    uint32_t num_columns = (uint32_t)num_values + 4;
+
+    uint64_t index_offset = CATALOG_HEADER_SIZE;
+    uint64_t data_offset = PAGE_ALIGN(index_offset + index_size(order));
+    uint64_t map_size = data_offset + (uint64_t)num_columns * num_rows * sizeof(double);
+    uint64_t flux_order_offset = 0, flux_rank_offset = 0;
+    if (flux_value >= 0) {
+        flux_order_offset = PAGE_ALIGN(map_size);
+        map_size = flux_order_offset + num_rows * sizeof(uint32_t);
+        flux_rank_offset = PAGE_ALIGN(map_size);
+        map_size = flux_rank_offset + num_rows * sizeof(uint64_t);
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        set_error("Failed to create %s", path);
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t)map_size) != 0) {
+        set_error("Failed to size %s to %llu bytes", path, (unsigned long long)map_size);
+        close(fd);
+        return NULL;
+    }
+
+    uint8_t* map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        set_error("Failed to map %s", path);
+        close(fd);
+        return NULL;
+    }
+
+    gaia_catalog_writer* writer = calloc(1, sizeof(gaia_catalog_writer));
+    if (!writer) {
+        set_error("Out of memory opening %s", path);
+        munmap(map, map_size);
+        close(fd);
+        return NULL;
+    }
+    writer->fd = fd;
+    writer->map = map;
+    writer->map_size = map_size;
+    writer->header = (catalog_header*)map;
+    writer->index = (uint64_t*)(map + index_offset);
+    writer->last_source_id = INT64_MIN;
+    writer->num_values = (uint32_t)num_values;
+    writer->ra_value = ra_value;
+    writer->dec_value = dec_value;
+    writer->flux_value = flux_value;
+
+    catalog_header* header = writer->header;
+    memcpy(header->magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+    header->version = CATALOG_VERSION;
+    header->order = order;
+    header->num_rows = num_rows;
+    header->num_columns = num_columns;
+    header->index_offset = index_offset;
+    header->data_offset = data_offset;
+    header->flux_order_offset = flux_order_offset;
+    header->flux_rank_offset = flux_rank_offset;
+    if (flux_value >= 0) header->flags |= CATALOG_FLAG_FLUX_ORDER | CATALOG_FLAG_FLUX_RANK;
+    for (uint32_t i = 0; i < num_columns; i++) {
+        memcpy(header->columns[i], names[i], CATALOG_NAME_LEN);
+    }
+
+    return writer;
+}
+
+int catalog_writer_append(gaia_catalog_writer* writer, const int64_t* source_ids, const double* values, uint64_t count) {
+    catalog_header* header = writer->header;
+    uint32_t num_values = writer->num_values;
+
+    if (writer->cursor + count > header->num_rows) {
+        set_error("Appending %llu rows overflows the declared %llu rows",
+                  (unsigned long long)count, (unsigned long long)header->num_rows);
+        return -1;
+    }
+
+    int64_t* ids = (int64_t*)(writer->map + header->data_offset);
+    double* data = (double*)(writer->map + header->data_offset);
+
+    for (uint64_t i = 0; i < count; i++) {
+        // Strictly increasing, as catalog_find_source binary-searches them
+        if (source_ids[i] <= writer->last_source_id) {
+            set_error("Rows must be appended in increasing source_id order");
+            return -1;
+        }
+        int64_t pixel = gaia_source_healpix(source_ids[i], (int)header->order);
+        if (pixel < 0 || pixel >= healpix_npix((int)header->order)) {
+            set_error("Source %lld is outside the HEALPix index", (long long)source_ids[i]);
+            return -1;
+        }
+        writer->last_source_id = source_ids[i];
+        // Count rows per pixel, turned into offsets on close
+        writer->index[pixel + 1]++;
+
+        uint64_t row = writer->cursor + i;
+        ids[row] = source_ids[i];
+        const double* row_values = values + i * num_values;
+        for (uint32_t c = 0; c < num_values; c++) {
+            data[(uint64_t)(c + 1) * header->num_rows + row] = row_values[c];
+        }
+
+        // Unit vector computed once here so queries only need dot products
+        double v[3];
+        radec_to_vec(row_values[writer->ra_value], row_values[writer->dec_value], v);
+        for (int k = 0; k < 3; k++) {
+            data[(uint64_t)(num_values + 1 + k) * header->num_rows + row] = v[k];
+        }
+    }
+
+    writer->cursor += count;
+    return 0;
+}
+
+static __thread const double* sort_flux;
+
+// Brightest first, NaN last
+static int compare_flux_desc(const void* a, const void* b) {
+    double fa = sort_flux[*(const uint32_t*)a];
+    double fb = sort_flux[*(const uint32_t*)b];
+    if (isnan(fa)) return isnan(fb) ? 0 : 1;
+    if (isnan(fb)) return -1;
+    return (fa < fb) - (fa > fb);
+}
+
+static int compare_rank_desc(const void* a, const void* b) {
+    double fa = sort_flux[*(const uint64_t*)a];
+    double fb = sort_flux[*(const uint64_t*)b];
+    if (isnan(fa)) return isnan(fb) ? 0 : 1;
+    if (isnan(fb)) return -1;
+    return (fa < fb) - (fa > fb);
+}
+
+static void write_flux_order(gaia_catalog_writer* writer) {
+    catalog_header* header = writer->header;
+    const double* flux = (const double*)(writer->map + header->data_offset)
+        + (uint64_t)(writer->flux_value + 1) * header->num_rows;
+    uint32_t* order = (uint32_t*)(writer->map + header->flux_order_offset);
+
+    uint64_t npix = (uint64_t)healpix_npix((int)header->order);
+    for (uint64_t p = 0; p < npix; p++) {
+        uint64_t start = writer->index[p];
+        uint64_t count = writer->index[p + 1] - start;
+        for (uint64_t i = 0; i < count; i++) order[start + i] = (uint32_t)i;
+        sort_flux = flux + start;
+        qsort(order + start, count, sizeof(uint32_t), compare_flux_desc);
+    }
+}
+
+static void write_flux_rank(gaia_catalog_writer* writer) {
+    catalog_header* header = writer->header;
+    uint64_t* rank = (uint64_t*)(writer->map + header->flux_rank_offset);
+    for (uint64_t i = 0; i < header->num_rows; i++) rank[i] = i;
+    sort_flux = (const double*)(writer->map + header->data_offset)
+        + (uint64_t)(writer->flux_value + 1) * header->num_rows;
+    qsort(rank, header->num_rows, sizeof(uint64_t), compare_rank_desc);
+}
+
+int catalog_writer_close(gaia_catalog_writer* writer) {
+    catalog_header* header = writer->header;
+    int result = 0;
+
+    if (writer->cursor != header->num_rows) {
+        set_error("Catalog declared %llu rows but received %llu",
+                  (unsigned long long)header->num_rows, (unsigned long long)writer->cursor);
+        result = -1;
+    }
+
+    uint64_t npix = (uint64_t)healpix_npix((int)header->order);
+    for (uint64_t p = 1; p <= npix; p++) {
+        writer->index[p] += writer->index[p - 1];
+    }
+    if (result == 0 && header->flags & CATALOG_FLAG_FLUX_ORDER) {
+        write_flux_order(writer);
+    }
+    if (result == 0 && header->flags & CATALOG_FLAG_FLUX_RANK) {
+        write_flux_rank(writer);
+    }
+
+    msync(writer->map, writer->map_size, MS_SYNC);
+    munmap(writer->map, writer->map_size);
+    close(writer->fd);
+    free(writer);
+    return result;
+}
+
+// Reader
+
+gaia_catalog* catalog_open(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        set_error("Failed to open %s", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < CATALOG_HEADER_SIZE) {
+        set_error("%s is not a Gaia catalog", path);
+        close(fd);
+        return NULL;
+    }
+
+    uint64_t map_size = (uint64_t)st.st_size;
+    uint8_t* map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        set_error("Failed to map %s", path);
+        close(fd);
+        return NULL;
+    }
+
+    const catalog_header* header = (const catalog_header*)map;
+    if (memcmp(header->magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0 || header->version != CATALOG_VERSION) {
+        set_error("%s is not a version %d Gaia catalog", path, CATALOG_VERSION);
+        munmap(map, map_size);
+        close(fd);
+        return NULL;
+    }
+
+    // Check the layout against the mapping, so a foreign or truncated file
+    // fails here rather than faulting on a read past its end
+    if (header->order > GAIA_HEALPIX_ORDER || header->num_columns == 0 ||
+        header->num_columns > CATALOG_MAX_COLUMNS) {
+        set_error("%s has an invalid header", path);
+        munmap(map, map_size);
+        close(fd);
+        return NULL;
+    }
+
+    uint64_t index_entries = (uint64_t)healpix_npix((int)header->order) + 1;
+    uint64_t row_bytes = (uint64_t)header->num_columns * sizeof(double);
+    if (header->index_offset > map_size || header->data_offset > map_size ||
+        index_entries > (map_size - header->index_offset) / sizeof(uint64_t) ||
+        header->num_rows > (map_size - header->data_offset) / row_bytes) {
+        set_error("%s is truncated", path);
+        munmap(map, map_size);
+        close(fd);
+        return NULL;
+    }
+
+    const uint64_t* index = (const uint64_t*)(map + header->index_offset);
+    if (index[index_entries - 1] > header->num_rows) {
+        set_error("%s has a pixel index past its last row", path);
+        munmap(map, map_size);
+        close(fd);
+        return NULL;
+    }
+
+    gaia_catalog* catalog = calloc(1, sizeof(gaia_catalog));
+    if (!catalog) {
+        set_error("Out of memory opening %s", path);
+        munmap(map, map_size);
+        close(fd);
+        return NULL;
+    }
+    catalog->fd = fd;
+    catalog->map = map;
+    catalog->map_size = map_size;
+    catalog->header = header;
+    catalog->index = index;
+    catalog->source_ids = (const int64_t*)(map + header->data_offset);
+    for (uint32_t c = 0; c < header->num_columns; c++) {
+        catalog->columns[c] = (const double*)(map + header->data_offset) + (uint64_t)c * header->num_rows;
+    }
+    if (header->flags & CATALOG_FLAG_FLUX_ORDER && header->flux_order_offset <= map_size &&
+        header->num_rows * sizeof(uint32_t) <= map_size - header->flux_order_offset) {
+        catalog->flux_order = (const uint32_t*)(map + header->flux_order_offset);
+    }
+    if (header->flags & CATALOG_FLAG_FLUX_RANK && header->flux_rank_offset <= map_size &&
+        header->num_rows * sizeof(uint64_t) <= map_size - header->flux_rank_offset) {
+        catalog->flux_rank = (const uint64_t*)(map + header->flux_rank_offset);
+    }
+
+    catalog->ra_col = catalog_column_index(catalog, "ra");
+    catalog->dec_col = catalog_column_index(catalog, "dec");
+    catalog->flux_col = catalog_column_index(catalog, "phot_g_mean_flux");
+    catalog->ux_col = catalog_column_index(catalog, "ux");
+    catalog->uy_col = catalog_column_index(catalog, "uy");
+    catalog->uz_col = catalog_column_index(catalog, "uz");
+    catalog->pmra_col = catalog_column_index(catalog, "pmra");
+    catalog->pmdec_col = catalog_column_index(catalog, "pmdec");
+    if (catalog->ra_col < 0 || catalog->dec_col < 0) {
+        set_error("%s has no ra/dec columns", path);
+        catalog_close(catalog);
+        return NULL;
+    }
+
+    return catalog;
+}
+
+void catalog_close(gaia_catalog* catalog) {
+    if (!catalog) return;
+    munmap(catalog->map, catalog->map_size);
+    close(catalog->fd);
+    free(catalog);
+}
+
+uint64_t catalog_num_rows(const gaia_catalog* catalog) {
+    return catalog->header->num_rows;
+}
+
+uint32_t catalog_num_columns(const gaia_catalog* catalog) {
+    return catalog->header->num_columns;
+}
+
+const char* catalog_column_name(const gaia_catalog* catalog, uint32_t column) {
+    if (column >= catalog->header->num_columns) return NULL;
+    return catalog->header->columns[column];
+}
+
+int32_t catalog_column_index(const gaia_catalog* catalog, const char* name) {
+    for (uint32_t c = 0; c < catalog->header->num_columns; c++) {
+        if (strncmp(catalog->header->columns[c], name, CATALOG_NAME_LEN) == 0) {
+            return (int32_t)c;
+        }
+    }
+    return -1;
+}
+
+// Rowsets
+
+int rowset_reserve(gaia_rowset* rowset, uint64_t additional) {
+    if (rowset->count + additional <= rowset->capacity) return 0;
+    uint64_t capacity = rowset->capacity ? rowset->capacity : 1024;
+    while (capacity < rowset->count + additional) capacity *= 2;
+    uint64_t* rows = realloc(rowset->rows, capacity * sizeof(uint64_t));
+    if (!rows) return -1;
+    rowset->rows = rows;
+    rowset->capacity = capacity;
+    return 0;
+}
+
+gaia_rowset* rowset_create(const uint64_t* rows, uint64_t count) {
+    gaia_rowset* rowset = calloc(1, sizeof(gaia_rowset));
+    if (!rowset) return NULL;
+    if (count && rowset_reserve(rowset, count) != 0) {
+        free(rowset);
+        return NULL;
+    }
+    memcpy(rowset->rows, rows, count * sizeof(uint64_t));
+    rowset->count = count;
+    return rowset;
+}
+
+gaia_rowset* rowset_slice(const gaia_rowset* rowset, uint64_t start, uint64_t count) {
+    if (start > rowset->count) start = rowset->count;
+    if (count > rowset->count - start) count = rowset->count - start;
+    gaia_rowset* slice = rowset_create(rowset->rows + start, count);
+    if (!slice) set_error("Out of memory");
+    return slice;
+}
+
+int rowset_push(gaia_rowset* rowset, uint64_t row) {
+    if (rowset_reserve(rowset, 1) != 0) return -1;
+    rowset->rows[rowset->count++] = row;
+    return 0;
+}
+
+uint64_t rowset_count(const gaia_rowset* rowset) {
+    return rowset->count;
+}
+
+void rowset_free(gaia_rowset* rowset) {
+    if (!rowset) return;
+    free(rowset->rows);
+    free(rowset);
+}
+
+// Queries
+
+static int passes_flux(const gaia_catalog* catalog, uint64_t row, double flux_min, double flux_max) {
+    if (catalog->flux_col < 0) return 1;
+    double flux = catalog->columns[catalog->flux_col][row];
+    if (!isnan(flux_min) && !(flux > flux_min)) return 0;
+    if (!isnan(flux_max) && !(flux < flux_max)) return 0;
+    return 1;
+}
+
+// Cone search stopping once `limit` rows are found
+static gaia_rowset* cone_search_rows(const gaia_catalog* catalog, double ra, double dec, double radius, double flux_min, double flux_max, uint64_t limit) {
+    if (isnan(ra) || isnan(dec) || isnan(radius)) {
+        set_error("Cone search requires numeric ra, dec and radius");
+        return NULL;
+    }
+
+    hpx_cone cone;
+    radec_to_vec(ra, dec, cone.center);
+    cone.radius = radius * M_PI / 180.0;
+    double cos_radius = cos(cone.radius);
+
+    hpx_ranges ranges = {0};
+    if (healpix_query_region((int)catalog->header->order, healpix_classify_cone, &cone, &ranges) != 0) {
+        set_error("Out of memory building pixel coverage");
+        hpx_ranges_free(&ranges);
+        return NULL;
+    }
+
+    gaia_rowset* rowset = calloc(1, sizeof(gaia_rowset));
+    if (!rowset) {
+        hpx_ranges_free(&ranges);
+        set_error("Out of memory during cone search");
+        return NULL;
+    }
+    int filter_flux = catalog->flux_col >= 0 && (!isnan(flux_min) || !isnan(flux_max));
+    int has_vectors = catalog->ux_col >= 0 && catalog->uy_col >= 0 && catalog->uz_col >= 0;
+    int failed = 0;
+    const double* ras = catalog->columns[catalog->ra_col];
+    const double* decs = catalog->columns[catalog->dec_col];
+
+    for (size_t r = 0; r < ranges.count && rowset->count < limit && !failed; r++) {
+        uint64_t start = catalog->index[ranges.items[r].lo];
+        uint64_t end = catalog->index[ranges.items[r].hi];
+        int inside = ranges.items[r].inside;
+
+        if (!inside && has_vectors) {
+            // Edge pixels: vectorized dot-product test over the contiguous
+            // block, then drop rows outside the flux range in place
+            if (rowset_reserve(rowset, end - start) != 0) {
+                failed = 1;
+                break;
+            }
+            uint64_t* out = rowset->rows + rowset->count;
+            uint64_t n = cone_filter_block(
+                catalog->columns[catalog->ux_col], catalog->columns[catalog->uy_col],
+                catalog->columns[catalog->uz_col], start, end, cone.center, cos_radius, out);
+            if (filter_flux) {
+                uint64_t kept = 0;
+                for (uint64_t i = 0; i < n; i++) {
+                    out[kept] = out[i];
+                    kept += passes_flux(catalog, out[i], flux_min, flux_max);
+                }
+                n = kept;
+            }
+            rowset->count += n;
+            continue;
+        }
+
+        for (uint64_t row = start; row < end; row++) {
+            if (filter_flux && !passes_flux(catalog, row, flux_min, flux_max)) continue;
+            if (!inside) {
+                double v[3];
+                radec_to_vec(ras[row], decs[row], v);
+                double dot = v[0] * cone.center[0] + v[1] * cone.center[1] + v[2] * cone.center[2];
+                if (dot < cos_radius) continue;
+            }
+            if (rowset_push(rowset, row) != 0) {
+                failed = 1;
+                break;
+            }
+            if (rowset->count >= limit) break;
+        }
+    }
+
+    hpx_ranges_free(&ranges);
+    if (failed) {
+        rowset_free(rowset);
+        set_error("Out of memory during cone search");
+        return NULL;
+    }
+    if (rowset->count > limit) rowset->count = limit;
+    return rowset;
+}
+
+gaia_rowset* catalog_cone_search(const gaia_catalog* catalog, double ra, double dec, double radius, double flux_min, double flux_max) {
+    return cone_search_rows(catalog, ra, dec, radius, flux_min, flux_max, UINT64_MAX);
+}
+
+#define COUNT_BLOCK_ROWS 4096
+
+// Number of rows a cone search would return, without building the rows:
+// pixels fully inside the cone are counted from the pixel index (or a
+// scan of the flux column), and only edge pixels are tested row by row
+int64_t catalog_cone_count(const gaia_catalog* catalog, double ra, double dec, double radius, double flux_min, double flux_max) {
+    if (isnan(ra) || isnan(dec) || isnan(radius)) {
+        set_error("Cone count requires numeric ra, dec and radius");
+        return -1;
+    }
+
+    hpx_cone cone;
+    radec_to_vec(ra, dec, cone.center);
+    cone.radius = radius * M_PI / 180.0;
+    double cos_radius = cos(cone.radius);
+
+    hpx_ranges ranges = {0};
+    if (healpix_query_region((int)catalog->header->order, healpix_classify_cone, &cone, &ranges) != 0) {
+        set_error("Out of memory building pixel coverage");
+        hpx_ranges_free(&ranges);
+        return -1;
+    }
+
+    int filter_flux = catalog->flux_col >= 0 && (!isnan(flux_min) || !isnan(flux_max));
+    int has_vectors = catalog->ux_col >= 0 && catalog->uy_col >= 0 && catalog->uz_col >= 0;
+    uint64_t* scratch = NULL;
+    if (has_vectors) {
+        scratch = malloc(COUNT_BLOCK_ROWS * sizeof(uint64_t));
+        if (!scratch) {
+            hpx_ranges_free(&ranges);
+            set_error("Out of memory during cone count");
+            return -1;
+        }
+    }
+    const double* ras = catalog->columns[catalog->ra_col];
+    const double* decs = catalog->columns[catalog->dec_col];
+
+    uint64_t count = 0;
+    for (size_t r = 0; r < ranges.count; r++) {
+        uint64_t start = catalog->index[ranges.items[r].lo];
+        uint64_t end = catalog->index[ranges.items[r].hi];
+        int inside = ranges.items[r].inside;
+
+        if (inside && !filter_flux) {
+            count += end - start;
+            continue;
+        }
+        if (!inside && has_vectors) {
+            for (uint64_t block = start; block < end; block += COUNT_BLOCK_ROWS) {
+                uint64_t block_end = end - block > COUNT_BLOCK_ROWS ? block + COUNT_BLOCK_ROWS : end;
+                uint64_t n = cone_filter_block(
+                    catalog->columns[catalog->ux_col], catalog->columns[catalog->uy_col],
+                    catalog->columns[catalog->uz_col], block, block_end, cone.center, cos_radius, scratch);
+                if (!filter_flux) {
+                    count += n;
+                    continue;
+                }
+                for (uint64_t i = 0; i < n; i++) {
+                    count += passes_flux(catalog, scratch[i], flux_min, flux_max);
+                }
+            }
+            continue;
+        }
+
+        for (uint64_t row = start; row < end; row++) {
+            if (filter_flux && !passes_flux(catalog, row, flux_min, flux_max)) continue;
+            if (!inside) {
+                double v[3];
+                radec_to_vec(ras[row], decs[row], v);
+                double dot = v[0] * cone.center[0] + v[1] * cone.center[1] + v[2] * cone.center[2];
+                if (dot < cos_radius) continue;
+            }
+            count++;
+        }
+    }
+
+    free(scratch);
+    hpx_ranges_free(&ranges);
+    return (int64_t)count;
+}
+
+// Epoch propagation
+
+static void catalog_row_vec(const gaia_catalog* catalog, uint64_t row, double v[3]);
+
+#define EPOCH_BLOCK_ROWS 4096
+
+// Epoch cone coverage: pixels outside the widened cone are skipped, and
+// pixels inside the cone shrunk by the same margin hold only stars that
+// stay inside wherever they move, so they are taken without propagating
+typedef struct {
+    hpx_cone outer;
+    double inner_radius;
+} epoch_cone;
+
+static int classify_epoch_cone(const void* region, const double center[3], double pixrad) {
+    const epoch_cone* cone = (const epoch_cone*)region;
+    double d = vec_angle(cone->outer.center, center);
+    if (d > cone->outer.radius + pixrad) return HPX_OUTSIDE;
+    if (d + pixrad <= cone->inner_radius) return HPX_INSIDE;
+    return HPX_PARTIAL;
+}
+
+gaia_rowset* catalog_cone_search_epoch(const gaia_catalog* catalog, double ra, double dec, double radius, double flux_min, double flux_max, double years) {
+    if (years == 0.0) return catalog_cone_search(catalog, ra, dec, radius, flux_min, flux_max);
+    if (isnan(ra) || isnan(dec) || isnan(radius) || isnan(years)) {
+        set_error("Cone search requires numeric ra, dec, radius and epoch");
+        return NULL;
+    }
+    if (catalog->pmra_col < 0 || catalog->pmdec_col < 0) {
+        set_error("Epoch propagation requires pmra and pmdec in the catalog");
+        return NULL;
+    }
+
+    // Anything that can move into the cone starts within the widened one
+    epoch_cone region;
+    hpx_cone* cone = &region.outer;
+    radec_to_vec(ra, dec, cone->center);
+    double cos_radius = cos(radius * M_PI / 180.0);
+    double margin = fabs(years) * GAIA_MAX_PM_MAS_YR / 3.6e6;
+    cone->radius = (radius + margin) * M_PI / 180.0;
+    if (cone->radius > M_PI) cone->radius = M_PI;
+    region.inner_radius = (radius - margin) * M_PI / 180.0;
+
+    hpx_ranges ranges = {0};
+    if (healpix_query_region((int)catalog->header->order, classify_epoch_cone, &region, &ranges) != 0) {
+        set_error("Out of memory building pixel coverage");
+        hpx_ranges_free(&ranges);
+        return NULL;
+    }
+
+    gaia_rowset* rowset = calloc(1, sizeof(gaia_rowset));
+    double* scratch = malloc(6 * EPOCH_BLOCK_ROWS * sizeof(double));
+    if (!rowset || !scratch) {
+        free(rowset);
+        free(scratch);
+        hpx_ranges_free(&ranges);
+        set_error("Out of memory during cone search");
+        return NULL;
+    }
+    double* px = scratch;
+    double* py = scratch + EPOCH_BLOCK_ROWS;
+    double* pz = scratch + 2 * EPOCH_BLOCK_ROWS;
+    double* vx = scratch + 3 * EPOCH_BLOCK_ROWS;
+    double* vy = scratch + 4 * EPOCH_BLOCK_ROWS;
+    double* vz = scratch + 5 * EPOCH_BLOCK_ROWS;
+
+    int filter_flux = catalog->flux_col >= 0 && (!isnan(flux_min) || !isnan(flux_max));
+    int has_vectors = catalog->ux_col >= 0 && catalog->uy_col >= 0 && catalog->uz_col >= 0;
+    const double* pmra = catalog->columns[catalog->pmra_col];
+    const double* pmdec = catalog->columns[catalog->pmdec_col];
+    int failed = 0;
+
+    for (size_t r = 0; r < ranges.count && !failed; r++) {
+        uint64_t range_start = catalog->index[ranges.items[r].lo];
+        uint64_t range_end = catalog->index[ranges.items[r].hi];
+
+        if (ranges.items[r].inside) {
+            if (rowset_reserve(rowset, range_end - range_start) != 0) {
+                failed = 1;
+                break;
+            }
+            for (uint64_t row = range_start; row < range_end; row++) {
+                rowset->rows[rowset->count] = row;
+                rowset->count += !filter_flux || passes_flux(catalog, row, flux_min, flux_max);
+            }
+            continue;
+        }
+
+        for (uint64_t start = range_start; start < range_end; start += EPOCH_BLOCK_ROWS) {
+            uint64_t end = start + EPOCH_BLOCK_ROWS < range_end ? start + EPOCH_BLOCK_ROWS : range_end;
+            uint64_t n = end - start;
+
+            // Propagate the block, then run the exact cap test on the
+            // moved positions
+            if (has_vectors) {
+                propagate_block(catalog->columns[catalog->ux_col], catalog->columns[catalog->uy_col],
+                    catalog->columns[catalog->uz_col], pmra, pmdec, start, end, years, px, py, pz);
+            } else {
+                radec_to_unit_vectors(catalog->columns[catalog->ra_col] + start,
+                    catalog->columns[catalog->dec_col] + start, n, vx, vy, vz);
+                propagate_block(vx, vy, vz, pmra + start, pmdec + start, 0, n, years, px, py, pz);
+            }
+
+            if (rowset_reserve(rowset, n) != 0) {
+                failed = 1;
+                break;
+            }
+            uint64_t* out = rowset->rows + rowset->count;
+            uint64_t found = cone_filter_block(px, py, pz, 0, n, cone->center, cos_radius, out);
+            uint64_t kept = 0;
+            for (uint64_t i = 0; i < found; i++) {
+                out[kept] = out[i] + start;
+                kept += !filter_flux || passes_flux(catalog, out[kept], flux_min, flux_max);
+            }
+            rowset->count += kept;
+        }
+    }
+
+    free(scratch);
+    hpx_ranges_free(&ranges);
+    if (failed) {
+        rowset_free(rowset);
+        set_error("Out of memory during cone search");
+        return NULL;
+    }
+    return rowset;
+}
+
+int catalog_propagate_rows(const gaia_catalog* catalog, const gaia_rowset* rowset, double years, double* out_ra, double* out_dec) {
+    if (years != 0.0 && (catalog->pmra_col < 0 || catalog->pmdec_col < 0)) {
+        set_error("Epoch propagation requires pmra and pmdec in the catalog");
+        return -1;
+    }
+    for (uint64_t i = 0; i < rowset->count; i++) {
+        uint64_t row = rowset->rows[i];
+        double v[3];
+        catalog_row_vec(catalog, row, v);
+        if (years != 0.0) {
+            propagate_vec(v, catalog->columns[catalog->pmra_col][row], catalog->columns[catalog->pmdec_col][row], years, v);
+        }
+        double ra_deg = atan2(v[1], v[0]) * 180.0 / M_PI;
+        out_ra[i] = ra_deg < 0 ? ra_deg + 360.0 : ra_deg;
+        out_dec[i] = asin(v[2] > 1.0 ? 1.0 : v[2] < -1.0 ? -1.0 : v[2]) * 180.0 / M_PI;
+    }
+    return 0;
+}
+
+// Box and polygon search
+
+typedef int (*row_test_fn)(const gaia_catalog* catalog, const void* region, uint64_t row);
+
+static int polygon_contains_row(const gaia_catalog* catalog, const void* region, uint64_t row) {
+    double v[3];
+    catalog_row_vec(catalog, row, v);
+    return hpx_polygon_contains((const hpx_polygon*)region, v);
+}
+
+static int box_contains_row(const gaia_catalog* catalog, const void* region, uint64_t row) {
+    return hpx_box_contains((const hpx_box*)region, catalog->columns[catalog->ra_col][row],
+                            catalog->columns[catalog->dec_col][row]);
+}
+
+// Scan the pixel coverage of a region: rows of inside pixels are taken
+// as they are, rows of edge pixels go through the exact `contains` test
+static gaia_rowset* region_search(const gaia_catalog* catalog, hpx_classify_fn classify, row_test_fn contains, const void* region, double flux_min, double flux_max) {
+    hpx_ranges ranges = {0};
+    if (healpix_query_region((int)catalog->header->order, classify, region, &ranges) != 0) {
+        set_error("Out of memory building pixel coverage");
+        hpx_ranges_free(&ranges);
+        return NULL;
+    }
+
+    gaia_rowset* rowset = calloc(1, sizeof(gaia_rowset));
+    int filter_flux = catalog->flux_col >= 0 && (!isnan(flux_min) || !isnan(flux_max));
+    int failed = !rowset;
+
+    for (size_t r = 0; r < ranges.count && !failed; r++) {
+        uint64_t end = catalog->index[ranges.items[r].hi];
+        int inside = ranges.items[r].inside;
+        for (uint64_t row = catalog->index[ranges.items[r].lo]; row < end; row++) {
+            if (filter_flux && !passes_flux(catalog, row, flux_min, flux_max)) continue;
+            if (!inside && !contains(catalog, region, row)) continue;
+            if (rowset_push(rowset, row) != 0) {
+                failed = 1;
+                break;
+            }
+        }
+    }
+
+    hpx_ranges_free(&ranges);
+    if (failed) {
+        rowset_free(rowset);
+        set_error("Out of memory during region search");
+        return NULL;
+    }
+    return rowset;
+}
+
+gaia_rowset* catalog_polygon_search(const gaia_catalog* catalog, const double* vertices, uint32_t count, double flux_min, double flux_max) {
+    hpx_polygon polygon;
+    if (hpx_polygon_init(&polygon, vertices, (int)count) != 0) {
+        set_error("Polygon must be convex with 3 to %d distinct vertices", HPX_MAX_POLYGON_VERTICES);
+        return NULL;
+    }
+    return region_search(catalog, healpix_classify_polygon, polygon_contains_row, &polygon, flux_min, flux_max);
+}
+
+gaia_rowset* catalog_box_search(const gaia_catalog* catalog, double ra_min, double ra_max, double dec_min, double dec_max, double flux_min, double flux_max) {
+    if (isnan(ra_min) || isnan(ra_max) || isnan(dec_min) || isnan(dec_max) || dec_min > dec_max) {
+        set_error("Box search requires numeric bounds with dec_min <= dec_max");
+        return NULL;
+    }
+    hpx_box box = {ra_min, ra_max, dec_min, dec_max};
+    return region_search(catalog, healpix_classify_box, box_contains_row, &box, flux_min, flux_max);
+}
+
+// Pixel queries
+
+int64_t catalog_cone_pixels(int order, double ra, double dec, double radius, int64_t* out_pixels, uint8_t* out_inside, uint64_t capacity) {
+    if (order < 0 || order > GAIA_HEALPIX_ORDER) {
+        set_error("HEALPix order must be between 0 and %d", GAIA_HEALPIX_ORDER);
+        return -1;
+    }
+    if (isnan(ra) || isnan(dec) || isnan(radius)) {
+        set_error("Cone pixels require numeric ra, dec and radius");
+        return -1;
+    }
+
+    hpx_cone cone;
+    radec_to_vec(ra, dec, cone.center);
+    cone.radius = radius * M_PI / 180.0;
+    hpx_ranges ranges = {0};
+    if (healpix_query_region(order, healpix_classify_cone, &cone, &ranges) != 0) {
+        set_error("Out of memory");
+        return -1;
+    }
+
+    uint64_t count = 0;
+    for (size_t r = 0; r < ranges.count; r++) {
+        for (int64_t pixel = ranges.items[r].lo; pixel < ranges.items[r].hi; pixel++, count++) {
+            if (count >= capacity) continue;
+            out_pixels[count] = pixel;
+            out_inside[count] = ranges.items[r].inside != 0;
+        }
+    }
+    hpx_ranges_free(&ranges);
+    return (int64_t)count;
+}
+
+int64_t catalog_polygon_ranges(int order, const double* vertices, uint32_t count, int64_t* out_ranges, uint8_t* out_inside, uint64_t capacity) {
+    if (order < 0 || order > GAIA_HEALPIX_ORDER) {
+        set_error("HEALPix order must be between 0 and %d", GAIA_HEALPIX_ORDER);
+        return -1;
+    }
+    hpx_polygon polygon;
+    if (hpx_polygon_init(&polygon, vertices, (int)count) != 0) {
+        set_error("Polygon must be convex with 3 to %d distinct vertices", HPX_MAX_POLYGON_VERTICES);
+        return -1;
+    }
+    hpx_ranges ranges = {0};
+    if (healpix_query_region(order, healpix_classify_polygon, &polygon, &ranges) != 0) {
+        hpx_ranges_free(&ranges);
+        set_error("Out of memory");
+        return -1;
+    }
+
+    for (size_t r = 0; r < ranges.count && r < capacity; r++) {
+        out_ranges[2 * r] = ranges.items[r].lo;
+        out_ranges[2 * r + 1] = ranges.items[r].hi;
+        out_inside[r] = ranges.items[r].inside != 0;
+    }
+    int64_t total = (int64_t)ranges.count;
+    hpx_ranges_free(&ranges);
+    return total;
+}
+
+gaia_rowset* catalog_pixel_search(const gaia_catalog* catalog, int order, int64_t pixel, double flux_min, double flux_max) {
+    if (order < 0 || order > GAIA_HEALPIX_ORDER || pixel < 0 || pixel >= healpix_npix(order)) {
+        set_error("Invalid HEALPix pixel %lld at order %d", (long long)pixel, order);
+        return NULL;
+    }
+    gaia_rowset* rowset = rowset_create(NULL, 0);
+    if (!rowset) {
+        set_error("Out of memory");
+        return NULL;
+    }
+
+    // Rows are sorted by source_id, which starts with the level 12 pixel
+    int shift = GAIA_HEALPIX_SHIFT + 2 * (GAIA_HEALPIX_ORDER - order);
+    int64_t first = pixel << shift, end = (pixel + 1) << shift;
+    uint64_t lo = 0, hi = catalog->header->num_rows;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (catalog->source_ids[mid] < first) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for (uint64_t row = lo; row < catalog->header->num_rows && catalog->source_ids[row] < end; row++) {
+        if (passes_flux(catalog, row, flux_min, flux_max) && rowset_push(rowset, row) != 0) {
+            rowset_free(rowset);
+            set_error("Out of memory");
+            return NULL;
+        }
+    }
+    return rowset;
+}
+
+// Batched cone search
+
+typedef struct {
+    uint64_t target;
+    int64_t pixel;
+} batch_target;
+
+typedef struct {
+    const gaia_catalog* catalog;
+    const double* ra;
+    const double* dec;
+    const double* radius;
+    double flux_min;
+    double flux_max;
+    const batch_target* targets;
+    uint64_t count;
+    gaia_rowset** results; // indexed by original target
+    int failed;
+    char error[256];
+} batch_worker;
+
+static int compare_batch_targets(const void* a, const void* b) {
+    int64_t pa = ((const batch_target*)a)->pixel;
+    int64_t pb = ((const batch_target*)b)->pixel;
+    return pa < pb ? -1 : pa > pb;
+}
+
+// Pair each target with its pixel at the catalog order and sort, so each
+// thread's contiguous share covers a compact patch of sky
+static batch_target* sort_targets(const gaia_catalog* catalog, const double* ra, const double* dec, uint64_t count) {
+    batch_target* targets = malloc((count ? count : 1) * sizeof(batch_target));
+    if (!targets) return NULL;
+    int order = (int)catalog->header->order;
+    for (uint64_t t = 0; t < count; t++) {
+        targets[t].target = t;
+        targets[t].pixel = isnan(ra[t]) || isnan(dec[t]) ? -1 : healpix_ang2pix_nest(order, ra[t], dec[t]);
+    }
+    qsort(targets, count, sizeof(batch_target), compare_batch_targets);
+    return targets;
+}
+
+static uint32_t clamp_threads(uint32_t threads, uint64_t count) {
+    if (threads < 1) threads = 1;
+    if (threads > count) threads = count ? (uint32_t)count : 1;
+    return threads;
+}
+
+// Run `fn` once per worker struct (`size` bytes apart), all but the first
+// on new threads; a worker whose thread fails to start runs inline
+static void run_workers(void* (*fn)(void*), void* workers, size_t size, uint32_t threads) {
+    pthread_t* ids = calloc(threads, sizeof(pthread_t));
+    int* started = calloc(threads, sizeof(int));
+    for (uint32_t i = 1; i < threads; i++) {
+        void* worker = (char*)workers + i * size;
+        if (ids && started) started[i] = pthread_create(&ids[i], NULL, fn, worker) == 0;
+        if (!started || !started[i]) fn(worker);
+    }
+    fn(workers);
+    for (uint32_t i = 1; i < threads; i++) {
+        if (started && started[i]) pthread_join(ids[i], NULL);
+    }
+    free(ids);
+    free(started);
+}
+
+static void* batch_worker_run(void* arg) {
+    batch_worker* worker = arg;
+    for (uint64_t i = 0; i < worker->count; i++) {
+        uint64_t t = worker->targets[i].target;
+        gaia_rowset* rows = catalog_cone_search(
+            worker->catalog, worker->ra[t], worker->dec[t], worker->radius[t],
+            worker->flux_min, worker->flux_max);
+        if (!rows) {
+            // Errors are thread-local, carry the message back to the caller
+            snprintf(worker->error, sizeof(worker->error), "%s", last_error);
+            worker->failed = 1;
+            return NULL;
+        }
+        worker->results[t] = rows;
+    }
+    return NULL;
+}
+
+gaia_batch* catalog_cone_search_batch(const gaia_catalog* catalog, const double* ra, const double* dec, const double* radius, uint64_t count, double flux_min, double flux_max, uint32_t threads) {
+    threads = clamp_threads(threads, count);
+    batch_target* targets = sort_targets(catalog, ra, dec, count);
+    gaia_rowset** results = calloc(count ? count : 1, sizeof(gaia_rowset*));
+    batch_worker* workers = calloc(threads, sizeof(batch_worker));
+    if (!targets || !results || !workers) {
+        free(targets);
+        free(results);
+        free(workers);
+        set_error("Out of memory preparing %llu targets", (unsigned long long)count);
+        return NULL;
+    }
+
+    uint64_t per_thread = (count + threads - 1) / threads;
+
+    for (uint32_t i = 0; i < threads; i++) {
+        uint64_t start = (uint64_t)i * per_thread;
+        uint64_t end = start + per_thread < count ? start + per_thread : count;
+        workers[i] = (batch_worker){
+            .catalog = catalog, .ra = ra, .dec = dec, .radius = radius,
+            .flux_min = flux_min, .flux_max = flux_max,
+            .targets = targets + start, .count = start < end ? end - start : 0,
+            .results = results,
+        };
+    }
+    run_workers(batch_worker_run, workers, sizeof(batch_worker), threads);
+
+    int failed = 0;
+    for (uint32_t i = 0; i < threads; i++) {
+        if (workers[i].failed && !failed) {
+            set_error("%s", workers[i].error);
+            failed = 1;
+        }
+    }
+
+    gaia_batch* batch = NULL;
+    uint64_t total = 0;
+    for (uint64_t t = 0; t < count; t++) {
+        if (results[t]) total += results[t]->count;
+    }
+
+    if (!failed) {
+        // Concatenate per-target rows in the caller's target order
+        batch = calloc(1, sizeof(gaia_batch));
+        if (batch) {
+            batch->rowset = calloc(1, sizeof(gaia_rowset));
+            batch->offsets = malloc((count + 1) * sizeof(uint64_t));
+            batch->num_targets = count;
+        }
+        if (!batch || !batch->rowset || !batch->offsets ||
+            (total && rowset_reserve(batch->rowset, total) != 0)) {
+            set_error("Out of memory collecting batch results");
+            batch_free(batch);
+            batch = NULL;
+        } else {
+            batch->offsets[0] = 0;
+            for (uint64_t t = 0; t < count; t++) {
+                const gaia_rowset* rows = results[t];
+                memcpy(batch->rowset->rows + batch->rowset->count, rows->rows, rows->count * sizeof(uint64_t));
+                batch->rowset->count += rows->count;
+                batch->offsets[t + 1] = batch->rowset->count;
+            }
+        }
+    }
+
+    for (uint64_t t = 0; t < count; t++) rowset_free(results[t]);
+    free(results);
+    free(targets);
+    free(workers);
+    return batch;
+}
+
+// Cross-match
+
+typedef struct {
+    const gaia_catalog* catalog;
+    const double* ra;
+    const double* dec;
+    double radius;
+    double years;
+    const batch_target* targets;
+    uint64_t count;
+    int64_t* out_rows;
+    double* out_separation;
+    int64_t matched;
+    int failed;
+} xmatch_worker;
+
+static void catalog_row_vec(const gaia_catalog* catalog, uint64_t row, double v[3]) {
+    if (catalog->ux_col >= 0 && catalog->uy_col >= 0 && catalog->uz_col >= 0) {
+        v[0] = catalog->columns[catalog->ux_col][row];
+        v[1] = catalog->columns[catalog->uy_col][row];
+        v[2] = catalog->columns[catalog->uz_col][row];
+    } else {
+        radec_to_vec(catalog->columns[catalog->ra_col][row], catalog->columns[catalog->dec_col][row], v);
+    }
+}
+
+typedef struct {
+    double v[3];
+    uint64_t row;
+} xmatch_candidate;
+
+static int compare_candidate_z(const void* a, const void* b) {
+    double za = ((const xmatch_candidate*)a)->v[2];
+    double zb = ((const xmatch_candidate*)b)->v[2];
+    return (za > zb) - (za < zb);
+}
+
+// Slack on the dot-product and z prefilters, so rounding never rejects a
+// row the exact separation test would keep
+#define XMATCH_SLACK 1e-12
+
+// Rows that may match any target in `pixel`, at their propagated
+// positions and sorted by z: the pixel's cone widened by the tolerance
+// and the proper-motion margin, with rows outside it rejected by a dot
+// product before they are propagated
+static int xmatch_candidates(const xmatch_worker* worker, int64_t pixel, double reach, hpx_ranges* ranges,
+                             xmatch_candidate** items, uint64_t* count, uint64_t* capacity) {
+    const gaia_catalog* catalog = worker->catalog;
+    int order = (int)catalog->header->order;
+    hpx_cone cone;
+    healpix_pix2vec_nest(order, pixel, cone.center);
+    cone.radius = healpix_max_pixrad(order) + reach;
+    if (cone.radius > M_PI) cone.radius = M_PI;
+    double cos_radius = cos(cone.radius) - XMATCH_SLACK;
+    if (healpix_query_region(order, healpix_classify_cone, &cone, ranges) != 0) return -1;
+
+    *count = 0;
+    for (size_t r = 0; r < ranges->count; r++) {
+        uint64_t end = catalog->index[ranges->items[r].hi];
+        for (uint64_t row = catalog->index[ranges->items[r].lo]; row < end; row++) {
+            double v[3];
+            catalog_row_vec(catalog, row, v);
+            if (v[0] * cone.center[0] + v[1] * cone.center[1] + v[2] * cone.center[2] < cos_radius) continue;
+            if (worker->years != 0.0) {
+                propagate_vec(v, catalog->columns[catalog->pmra_col][row],
+                              catalog->columns[catalog->pmdec_col][row], worker->years, v);
+            }
+            if (isnan(v[0]) || isnan(v[1]) || isnan(v[2])) continue;
+
+            if (*count == *capacity) {
+                uint64_t grown = *capacity ? *capacity * 2 : 4096;
+                xmatch_candidate* resized = realloc(*items, grown * sizeof(xmatch_candidate));
+                if (!resized) return -1;
+                *items = resized;
+                *capacity = grown;
+            }
+            (*items)[*count] = (xmatch_candidate){{v[0], v[1], v[2]}, row};
+            (*count)++;
+        }
+    }
+    qsort(*items, *count, sizeof(xmatch_candidate), compare_candidate_z);
+    return 0;
+}
+
+// Targets arrive sorted by pixel: each run of targets in one pixel loads
+// and propagates the rows around it once, then every target only reads
+// the candidates in its z band
+static void* xmatch_worker_run(void* arg) {
+    xmatch_worker* worker = arg;
+    double tolerance = worker->radius * M_PI / 180.0;
+    double cos_tolerance = cos(tolerance) - XMATCH_SLACK;
+    // Stars can move up to the fastest proper motion into the tolerance
+    double margin = worker->years != 0.0 ? fabs(worker->years) * GAIA_MAX_PM_MAS_YR / 3.6e6 * M_PI / 180.0 : 0.0;
+
+    hpx_ranges ranges = {0};
+    xmatch_candidate* candidates = NULL;
+    uint64_t num_candidates = 0, capacity = 0;
+    int64_t loaded = -1;
+
+    for (uint64_t i = 0; i < worker->count; i++) {
+        uint64_t t = worker->targets[i].target;
+        int64_t pixel = worker->targets[i].pixel;
+        worker->out_rows[t] = -1;
+        worker->out_separation[t] = NAN;
+        if (pixel < 0) continue;
+
+        if (pixel != loaded) {
+            if (xmatch_candidates(worker, pixel, tolerance + margin, &ranges,
+                                  &candidates, &num_candidates, &capacity) != 0) {
+                worker->failed = 1;
+                break;
+            }
+            loaded = pixel;
+        }
+
+        double center[3];
+        radec_to_vec(worker->ra[t], worker->dec[t], center);
+        double dec = asin(center[2] > 1.0 ? 1.0 : center[2] < -1.0 ? -1.0 : center[2]);
+        double z_lo = dec - tolerance <= -M_PI / 2 ? -2.0 : sin(dec - tolerance) - XMATCH_SLACK;
+        double z_hi = dec + tolerance >= M_PI / 2 ? 2.0 : sin(dec + tolerance) + XMATCH_SLACK;
+
+        uint64_t lo = 0, hi = num_candidates;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (candidates[mid].v[2] < z_lo) lo = mid + 1;
+            else hi = mid;
+        }
+
+        int64_t best = -1;
+        double best_separation = tolerance;
+        for (uint64_t c = lo; c < num_candidates && candidates[c].v[2] <= z_hi; c++) {
+            const double* v = candidates[c].v;
+            if (v[0] * center[0] + v[1] * center[1] + v[2] * center[2] < cos_tolerance) continue;
+            double separation = vec_angle(center, v);
+            if (separation < best_separation || (separation == best_separation &&
+                                                  (best < 0 || candidates[c].row < (uint64_t)best))) {
+                best = (int64_t)candidates[c].row;
+                best_separation = separation;
+            }
+        }
+
+        if (best >= 0) {
+            worker->out_rows[t] = best;
+            worker->out_separation[t] = best_separation * 180.0 / M_PI;
+            worker->matched++;
+        }
+    }
+
+    free(candidates);
+    hpx_ranges_free(&ranges);
+    return NULL;
+}
+
+int64_t catalog_xmatch(const gaia_catalog* catalog, const double* ra, const double* dec, uint64_t count, double radius, double years, uint32_t threads, int64_t* out_rows, double* out_separation) {
+    if (isnan(radius) || radius <= 0 || isnan(years)) {
+        set_error("Cross-match requires a positive radius and a numeric epoch offset");
+        return -1;
+    }
+    if (years != 0.0 && (catalog->pmra_col < 0 || catalog->pmdec_col < 0)) {
+        set_error("Epoch propagation needs pmra and pmdec in the catalog");
+        return -1;
+    }
+
+    threads = clamp_threads(threads, count);
+    batch_target* targets = sort_targets(catalog, ra, dec, count);
+    xmatch_worker* workers = calloc(threads, sizeof(xmatch_worker));
+    if (!targets || !workers) {
+        free(targets);
+        free(workers);
+        set_error("Out of memory preparing %llu positions", (unsigned long long)count);
+        return -1;
+    }
+
+    uint64_t per_thread = (count + threads - 1) / threads;
+    for (uint32_t i = 0; i < threads; i++) {
+        uint64_t start = (uint64_t)i * per_thread;
+        uint64_t end = start + per_thread < count ? start + per_thread : count;
+        workers[i] = (xmatch_worker){
+            .catalog = catalog, .ra = ra, .dec = dec, .radius = radius, .years = years,
+            .targets = targets + start, .count = start < end ? end - start : 0,
+            .out_rows = out_rows, .out_separation = out_separation,
+        };
+    }
+    run_workers(xmatch_worker_run, workers, sizeof(xmatch_worker), threads);
+
+    int64_t matched = 0;
+    for (uint32_t i = 0; i < threads; i++) {
+        if (workers[i].failed) {
+            matched = -1;
+            set_error("Out of memory building pixel coverage");
+            break;
+        }
+        matched += workers[i].matched;
+    }
+
+    free(targets);
+    free(workers);
+    return matched;
+}
+
+gaia_rowset* batch_rowset(const gaia_batch* batch) {
+    return batch->rowset;
+}
+
+int batch_read_offsets(const gaia_batch* batch, uint64_t* out) {
+    memcpy(out, batch->offsets, (batch->num_targets + 1) * sizeof(uint64_t));
+    return 0;
+}
+
+void batch_free(gaia_batch* batch) {
+    if (!batch) return;
+    rowset_free(batch->rowset);
+    free(batch->offsets);
+    free(batch);
+}
+
+// Nearest neighbours
+
+typedef struct {
+    double key;
+    uint64_t id;
+    int order;
+} heap_item;
+
+typedef struct {
+    heap_item* items;
+    size_t count;
+    size_t capacity;
+    int max_heap;
+} heap;
+
+static int heap_before(const heap* h, const heap_item* a, const heap_item* b) {
+    return h->max_heap ? a->key > b->key : a->key < b->key;
+}
+
+static void heap_sift_down(heap* h, size_t i) {
+    for (;;) {
+        size_t best = i, left = 2 * i + 1, right = left + 1;
+        if (left < h->count && heap_before(h, &h->items[left], &h->items[best])) best = left;
+        if (right < h->count && heap_before(h, &h->items[right], &h->items[best])) best = right;
+        if (best == i) return;
+        heap_item tmp = h->items[i];
+        h->items[i] = h->items[best];
+        h->items[best] = tmp;
+        i = best;
+    }
+}
+
+static int heap_push(heap* h, heap_item item) {
+    if (h->count == h->capacity) {
+        size_t capacity = h->capacity ? h->capacity * 2 : 64;
+        heap_item* items = realloc(h->items, capacity * sizeof(heap_item));
+        if (!items) return -1;
+        h->items = items;
+        h->capacity = capacity;
+    }
+    size_t i = h->count++;
+    h->items[i] = item;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!heap_before(h, &h->items[i], &h->items[parent])) break;
+        heap_item tmp = h->items[i];
+        h->items[i] = h->items[parent];
+        h->items[parent] = tmp;
+        i = parent;
+    }
+    return 0;
+}
+
+static heap_item heap_pop(heap* h) {
+    heap_item top = h->items[0];
+    h->items[0] = h->items[--h->count];
+    heap_sift_down(h, 0);
+    return top;
+}
+
+// Drain a heap back to front into a new rowset, so a max-heap comes out
+// smallest key first and a min-heap largest key first. Frees the heap.
+static gaia_rowset* drain_heap(heap* h) {
+    gaia_rowset* rowset = calloc(1, sizeof(gaia_rowset));
+    if (!rowset || (h->count > 0 && rowset_reserve(rowset, h->count) != 0)) {
+        free(h->items);
+        free(rowset);
+        return NULL;
+    }
+    rowset->count = h->count;
+    for (uint64_t i = h->count; i > 0; i--) {
+        rowset->rows[i - 1] = heap_pop(h).id;
+    }
+    free(h->items);
+    return rowset;
+}
+
+// The k rows closest to (ra, dec) no farther than max_angle radians
+static gaia_rowset* nearest_rows(const gaia_catalog* catalog, double ra, double dec, uint64_t k, double max_angle, double flux_min, double flux_max) {
+    if (isnan(ra) || isnan(dec)) {
+        set_error("Nearest neighbour search requires numeric ra and dec");
+        return NULL;
+    }
+
+    double center[3];
+    radec_to_vec(ra, dec, center);
+    int order = (int)catalog->header->order;
+    int filter_flux = catalog->flux_col >= 0 && (!isnan(flux_min) || !isnan(flux_max));
+    int has_vectors = catalog->ux_col >= 0 && catalog->uy_col >= 0 && catalog->uz_col >= 0;
+
+    // Best-first walk of the pixel hierarchy: `pixels` is ordered by the
+    // smallest separation any star in the pixel could have, `found` keeps
+    // the k closest stars so far with the farthest on top
+    heap pixels = {0};
+    heap found = {.max_heap = 1};
+    int failed = 0;
+
+    for (uint64_t face = 0; face < 12 && k > 0; face++) {
+        failed |= heap_push(&pixels, (heap_item){0.0, face, 0});
+    }
+
+    while (!failed && pixels.count > 0) {
+        heap_item pixel = heap_pop(&pixels);
+        // Everything left is farther than the current k-th star, or
+        // outside the search radius
+        if (found.count == k && pixel.key >= found.items[0].key) break;
+        if (pixel.key > max_angle) break;
+
+        int shift = 2 * (order - pixel.order);
+        uint64_t start = catalog->index[pixel.id << shift];
+        uint64_t end = catalog->index[(pixel.id + 1) << shift];
+        if (start == end) continue;
+
+        if (pixel.order < order) {
+            double pixrad = healpix_max_pixrad(pixel.order + 1);
+            for (uint64_t child = pixel.id * 4; child < pixel.id * 4 + 4; child++) {
+                double v[3];
+                healpix_pix2vec_nest(pixel.order + 1, (int64_t)child, v);
+                double bound = vec_angle(center, v) - pixrad;
+                failed |= heap_push(&pixels, (heap_item){bound > 0 ? bound : 0, child, pixel.order + 1});
+            }
+            continue;
+        }
+
+        for (uint64_t row = start; row < end; row++) {
+            if (filter_flux && !passes_flux(catalog, row, flux_min, flux_max)) continue;
+            double v[3];
+            if (has_vectors) {
+                v[0] = catalog->columns[catalog->ux_col][row];
+                v[1] = catalog->columns[catalog->uy_col][row];
+                v[2] = catalog->columns[catalog->uz_col][row];
+            } else {
+                radec_to_vec(catalog->columns[catalog->ra_col][row], catalog->columns[catalog->dec_col][row], v);
+            }
+            double separation = vec_angle(center, v);
+            if (isnan(separation) || separation > max_angle) continue;
+
+            if (found.count < k) {
+                failed |= heap_push(&found, (heap_item){separation, row, 0});
+            } else if (separation < found.items[0].key) {
+                found.items[0] = (heap_item){separation, row, 0};
+                heap_sift_down(&found, 0);
+            }
+        }
+    }
+
+    free(pixels.items);
+    if (failed) {
+        free(found.items);
+        set_error("Out of memory during nearest neighbour search");
+        return NULL;
+    }
+
+    // The max-heap drains nearest first
+    gaia_rowset* rowset = drain_heap(&found);
+    if (!rowset) set_error("Out of memory during nearest neighbour search");
+    return rowset;
+}
+
+gaia_rowset* catalog_nearest(const gaia_catalog* catalog, double ra, double dec, uint32_t k, double flux_min, double flux_max) {
+    return nearest_rows(catalog, ra, dec, k, INFINITY, flux_min, flux_max);
+}
+
+// Brightest-first cone search keeping the k brightest matches in a
+// min-heap. With the per-pixel flux order, each pixel is read brightest
+// first and abandoned once its next row can't displace the heap top.
+static gaia_rowset* brightest_rows(const gaia_catalog* catalog, double ra, double dec, double radius, double flux_min, double flux_max, uint64_t k) {
+    if (catalog->flux_col < 0) {
+        set_error("Brightest-first ordering requires phot_g_mean_flux in the catalog");
+        return NULL;
+    }
+    if (isnan(ra) || isnan(dec) || isnan(radius)) {
+        set_error("Cone search requires numeric ra, dec and radius");
+        return NULL;
+    }
+
+    hpx_cone cone;
+    radec_to_vec(ra, dec, cone.center);
+    cone.radius = radius * M_PI / 180.0;
+    double cos_radius = cos(cone.radius);
+
+    hpx_ranges ranges = {0};
+    if (healpix_query_region((int)catalog->header->order, healpix_classify_cone, &cone, &ranges) != 0) {
+        set_error("Out of memory building pixel coverage");
+        hpx_ranges_free(&ranges);
+        return NULL;
+    }
+
+    const double* flux = catalog->columns[catalog->flux_col];
+    heap found = {0};
+    int failed = 0;
+
+    for (size_t r = 0; r < ranges.count && !failed; r++) {
+        int inside = ranges.items[r].inside;
+        for (int64_t p = ranges.items[r].lo; p < ranges.items[r].hi; p++) {
+            uint64_t start = catalog->index[p];
+            uint64_t count = catalog->index[p + 1] - start;
+
+            for (uint64_t i = 0; i < count; i++) {
+                uint64_t row = catalog->flux_order ? start + catalog->flux_order[start + i] : start + i;
+                double key = isnan(flux[row]) ? -INFINITY : flux[row];
+                if (catalog->flux_order) {
+                    // The rest of this pixel is no brighter
+                    if (found.count == k && !(key > found.items[0].key)) break;
+                    if (!isnan(flux_min) && !(key > flux_min)) break;
+                }
+                if (!passes_flux(catalog, row, flux_min, flux_max)) continue;
+                if (found.count == k && !(key > found.items[0].key)) continue;
+                if (!inside) {
+                    double v[3];
+                    catalog_row_vec(catalog, row, v);
+                    if (v[0] * cone.center[0] + v[1] * cone.center[1] + v[2] * cone.center[2] < cos_radius) continue;
+                }
+
+                if (found.count < k) {
+                    failed |= heap_push(&found, (heap_item){key, row, 0});
+                } else {
+                    found.items[0] = (heap_item){key, row, 0};
+                    heap_sift_down(&found, 0);
+                }
+            }
+        }
+    }
+
+    hpx_ranges_free(&ranges);
+    if (failed) {
+        free(found.items);
+        set_error("Out of memory during cone search");
+        return NULL;
+    }
+
+    // The min-heap drains brightest first
+    gaia_rowset* rowset = drain_heap(&found);
+    if (!rowset) set_error("Out of memory during cone search");
+    return rowset;
+}
+
+gaia_rowset* catalog_cone_search_limit(const gaia_catalog* catalog, double ra, double dec, double radius, double flux_min, double flux_max, uint64_t limit, int order) {
+    uint64_t k = limit ? limit : UINT64_MAX;
+    switch (order) {
+    case CATALOG_ORDER_NONE:
+        return cone_search_rows(catalog, ra, dec, radius, flux_min, flux_max, k);
+    case CATALOG_ORDER_BRIGHTEST:
+        return brightest_rows(catalog, ra, dec, radius, flux_min, flux_max, k);
+    case CATALOG_ORDER_NEAREST:
+        return nearest_rows(catalog, ra, dec, k, radius * M_PI / 180.0, flux_min, flux_max);
+    default:
+        set_error("Unknown result order %d", order);
+        return NULL;
+    }
+}
+
+// Brightness search
+
+// First position in the brightest-first rank whose flux is below `bound`
+// (at or below it when `inclusive`); NaN fluxes sort last and count as below
+static uint64_t rank_partition(const uint64_t* rank, const double* flux, uint64_t n, double bound, int inclusive) {
+    uint64_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        double f = flux[rank[mid]];
+        int below = isnan(f) || (inclusive ? f <= bound : f < bound);
+        if (below) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+gaia_rowset* catalog_brightness_search(const gaia_catalog* catalog, double flux_min, double flux_max, uint64_t limit) {
+    if (catalog->flux_col < 0) {
+        set_error("Brightness search requires phot_g_mean_flux");
+        return NULL;
+    }
+    const double* flux = catalog->columns[catalog->flux_col];
+    uint64_t n = catalog->header->num_rows;
+    gaia_rowset* rowset = calloc(1, sizeof(gaia_rowset));
+    if (!rowset) {
+        set_error("Out of memory");
+        return NULL;
+    }
+
+    if (catalog->flux_rank) {
+        // Bounds are exclusive, as in passes_flux, and any bound drops the
+        // NaN fluxes at the end
+        const uint64_t* rank = catalog->flux_rank;
+        uint64_t start = isnan(flux_max) ? 0 : rank_partition(rank, flux, n, flux_max, 0);
+        uint64_t end = !isnan(flux_min) ? rank_partition(rank, flux, n, flux_min, 1)
+                     : !isnan(flux_max) ? rank_partition(rank, flux, n, -INFINITY, 0)
+                     : n;
+        uint64_t count = end > start ? end - start : 0;
+        if (limit && count > limit) count = limit;
+        if (count && rowset_reserve(rowset, count) != 0) {
+            rowset_free(rowset);
+            set_error("Out of memory");
+            return NULL;
+        }
+        memcpy(rowset->rows, catalog->flux_rank + start, count * sizeof(uint64_t));
+        rowset->count = count;
+        return rowset;
+    }
+
+    for (uint64_t row = 0; row < n; row++) {
+        if (passes_flux(catalog, row, flux_min, flux_max) && rowset_push(rowset, row) != 0) {
+            rowset_free(rowset);
+            set_error("Out of memory");
+            return NULL;
+        }
+    }
+    sort_flux = flux;
+    qsort(rowset->rows, rowset->count, sizeof(uint64_t), compare_rank_desc);
+    if (limit && rowset->count > limit) rowset->count = limit;
+    return rowset;
+}
+
+// 3D neighbourhood index
+
+#define KDTREE_LEAF_SIZE 8
+
+typedef struct {
+    double p[3];
+    uint64_t row;
+} kd_point;
+
+struct gaia_kdtree {
+    const gaia_catalog* catalog;
+    kd_point* points;
+    uint8_t* axes;
+    uint64_t count;
+    int parallax_col;
+    int over_error_col;
+    int error_col;
+};
+
+// Parallax S/N of a row from whichever columns the catalog stores
+static double parallax_snr(const gaia_kdtree* tree, uint64_t row) {
+    const gaia_catalog* catalog = tree->catalog;
+    return tree->over_error_col >= 0
+        ? catalog->columns[tree->over_error_col][row]
+        : catalog->columns[tree->parallax_col][row] / catalog->columns[tree->error_col][row];
+}
+
+static void kdtree_select(kd_point* points, uint64_t lo, uint64_t hi, uint64_t nth, int axis) {
+    // Quickselect on [lo, hi): afterwards points[nth] is in sorted
+    // position and everything left of it is <= it along `axis`
+    while (hi - lo > 1) {
+        double pivot = points[lo + (hi - lo) / 2].p[axis];
+        uint64_t i = lo, j = hi - 1;
+        while (i <= j) {
+            while (points[i].p[axis] < pivot) i++;
+            while (points[j].p[axis] > pivot) j--;
+            if (i <= j) {
+                kd_point tmp = points[i];
+                points[i] = points[j];
+                points[j] = tmp;
+                i++;
+                if (j == 0) break;
+                j--;
+            }
+        }
+        if (nth <= j) hi = j + 1;
+        else if (nth >= i) lo = i;
+        else return;
+    }
+}
+
+static void kdtree_build_range(gaia_kdtree* tree, uint64_t lo, uint64_t hi) {
+    while (hi - lo > KDTREE_LEAF_SIZE) {
+        // Split on the widest axis of this subtree's bounding box
+        double min[3] = {INFINITY, INFINITY, INFINITY};
+        double max[3] = {-INFINITY, -INFINITY, -INFINITY};
+        for (uint64_t i = lo; i < hi; i++) {
+            for (int a = 0; a < 3; a++) {
+                if (tree->points[i].p[a] < min[a]) min[a] = tree->points[i].p[a];
+                if (tree->points[i].p[a] > max[a]) max[a] = tree->points[i].p[a];
+            }
+        }
+        int axis = 0;
+        for (int a = 1; a < 3; a++) {
+            if (max[a] - min[a] > max[axis] - min[axis]) axis = a;
+        }
+
+        uint64_t mid = lo + (hi - lo) / 2;
+        kdtree_select(tree->points, lo, hi, mid, axis);
+        tree->axes[mid] = (uint8_t)axis;
+        kdtree_build_range(tree, lo, mid);
+        lo = mid + 1;
+    }
+}
+
+gaia_kdtree* catalog_kdtree_build(const gaia_catalog* catalog, double min_parallax_over_error) {
+    int parallax_col = catalog_column_index(catalog, "parallax");
+    int over_error_col = catalog_column_index(catalog, "parallax_over_error");
+    int error_col = catalog_column_index(catalog, "parallax_error");
+    if (parallax_col < 0) {
+        set_error("3D queries require a parallax column in the catalog");
+        return NULL;
+    }
+    if (min_parallax_over_error > 0 && over_error_col < 0 && error_col < 0) {
+        set_error("A parallax S/N cut requires parallax_error or parallax_over_error in the catalog");
+        return NULL;
+    }
+
+    uint64_t num_rows = catalog->header->num_rows;
+    gaia_kdtree* tree = calloc(1, sizeof(gaia_kdtree));
+    if (!tree) {
+        set_error("Out of memory building 3D index");
+        return NULL;
+    }
+    tree->catalog = catalog;
+    tree->parallax_col = parallax_col;
+    tree->over_error_col = over_error_col;
+    tree->error_col = error_col;
+    tree->points = malloc((num_rows ? num_rows : 1) * sizeof(kd_point));
+    if (!tree->points) {
+        free(tree);
+        set_error("Out of memory building 3D index");
+        return NULL;
+    }
+
+    const double* parallaxes = catalog->columns[parallax_col];
+    int has_vectors = catalog->ux_col >= 0 && catalog->uy_col >= 0 && catalog->uz_col >= 0;
+    for (uint64_t row = 0; row < num_rows; row++) {
+        double parallax = parallaxes[row];
+        if (!(parallax > 0)) continue;
+        if (min_parallax_over_error > 0 && !(parallax_snr(tree, row) >= min_parallax_over_error)) continue;
+
+        double v[3];
+        if (has_vectors) {
+            v[0] = catalog->columns[catalog->ux_col][row];
+            v[1] = catalog->columns[catalog->uy_col][row];
+            v[2] = catalog->columns[catalog->uz_col][row];
+        } else {
+            radec_to_vec(catalog->columns[catalog->ra_col][row], catalog->columns[catalog->dec_col][row], v);
+        }
+        if (isnan(v[0]) || isnan(v[1]) || isnan(v[2])) continue;
+
+        double distance = 1000.0 / parallax;
+        kd_point* point = &tree->points[tree->count++];
+        point->p[0] = v[0] * distance;
+        point->p[1] = v[1] * distance;
+        point->p[2] = v[2] * distance;
+        point->row = row;
+    }
+
+    tree->axes = calloc(tree->count ? tree->count : 1, 1);
+    if (!tree->axes) {
+        kdtree_free(tree);
+        set_error("Out of memory building 3D index");
+        return NULL;
+    }
+    kdtree_build_range(tree, 0, tree->count);
+    return tree;
+}
+
+uint64_t kdtree_count(const gaia_kdtree* tree) {
+    return tree->count;
+}
+
+void kdtree_free(gaia_kdtree* tree) {
+    if (!tree) return;
+    free(tree->points);
+    free(tree->axes);
+    free(tree);
+}
+
+static double kd_distance2(const kd_point* point, const double q[3]) {
+    double dx = point->p[0] - q[0], dy = point->p[1] - q[1], dz = point->p[2] - q[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+typedef struct {
+    const gaia_kdtree* tree;
+    double q[3];
+    double radius2;
+    double min_snr;
+    double flux_min;
+    double flux_max;
+    gaia_rowset* rowset;
+    heap* found;
+    uint32_t k;
+    int failed;
+} kd_query;
+
+static void kd_visit(kd_query* query, const kd_point* point) {
+    double d2 = kd_distance2(point, query->q);
+    if (d2 > query->radius2) return;
+    if (!passes_flux(query->tree->catalog, point->row, query->flux_min, query->flux_max)) return;
+    if (query->min_snr > 0 && !(parallax_snr(query->tree, point->row) >= query->min_snr)) return;
+
+    if (!query->found) {
+        query->failed |= rowset_push(query->rowset, point->row);
+    } else if (query->found->count < query->k) {
+        query->failed |= heap_push(query->found, (heap_item){d2, point->row, 0});
+        if (query->found->count == query->k) query->radius2 = query->found->items[0].key;
+    } else {
+        query->found->items[0] = (heap_item){d2, point->row, 0};
+        heap_sift_down(query->found, 0);
+        query->radius2 = query->found->items[0].key;
+    }
+}
+
+// Shared walk for sphere and k-nearest queries: k-nearest shrinks
+// radius2 to the current k-th distance as it goes
+static void kd_search(kd_query* query, uint64_t lo, uint64_t hi) {
+    while (hi - lo > KDTREE_LEAF_SIZE) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        const kd_point* split = &query->tree->points[mid];
+        int axis = query->tree->axes[mid];
+        double diff = query->q[axis] - split->p[axis];
+
+        kd_visit(query, split);
+        if (diff < 0) {
+            kd_search(query, lo, mid);
+            if (diff * diff > query->radius2) return;
+            lo = mid + 1;
+        } else {
+            kd_search(query, mid + 1, hi);
+            if (diff * diff > query->radius2) return;
+            hi = mid;
+        }
+    }
+    for (uint64_t i = lo; i < hi; i++) {
+        kd_visit(query, &query->tree->points[i]);
+    }
+}
+
+static int kdtree_check_snr(const gaia_kdtree* tree, double min_parallax_over_error) {
+    if (min_parallax_over_error > 0 && tree->over_error_col < 0 && tree->error_col < 0) {
+        set_error("A parallax S/N cut requires parallax_error or parallax_over_error in the catalog");
+        return -1;
+    }
+    return 0;
+}
+
+gaia_rowset* kdtree_sphere(const gaia_kdtree* tree, double x, double y, double z, double radius, double min_parallax_over_error, double flux_min, double flux_max) {
+    if (isnan(x) || isnan(y) || isnan(z) || !(radius >= 0)) {
+        set_error("Sphere search requires a numeric center and a non-negative radius");
+        return NULL;
+    }
+    if (kdtree_check_snr(tree, min_parallax_over_error) != 0) return NULL;
+    kd_query query = {tree, {x, y, z}, radius * radius, min_parallax_over_error, flux_min, flux_max, NULL, NULL, 0, 0};
+    query.rowset = calloc(1, sizeof(gaia_rowset));
+    if (!query.rowset) {
+        set_error("Out of memory during sphere search");
+        return NULL;
+    }
+    kd_search(&query, 0, tree->count);
+    if (query.failed) {
+        rowset_free(query.rowset);
+        set_error("Out of memory during sphere search");
+        return NULL;
+    }
+    return query.rowset;
+}
+
+gaia_rowset* kdtree_nearest(const gaia_kdtree* tree, double x, double y, double z, uint32_t k, double min_parallax_over_error, double flux_min, double flux_max) {
+    if (isnan(x) || isnan(y) || isnan(z)) {
+        set_error("3D nearest neighbour search requires a numeric center");
+        return NULL;
+    }
+    if (kdtree_check_snr(tree, min_parallax_over_error) != 0) return NULL;
+    heap found = {.max_heap = 1};
+    kd_query query = {tree, {x, y, z}, INFINITY, min_parallax_over_error, flux_min, flux_max, NULL, &found, k, 0};
+    if (k > 0) kd_search(&query, 0, tree->count);
+
+    gaia_rowset* rowset = calloc(1, sizeof(gaia_rowset));
+    if (query.failed || !rowset || (found.count > 0 && rowset_reserve(rowset, found.count) != 0)) {
+        free(found.items);
+        rowset_free(rowset);
+        set_error("Out of memory during 3D nearest neighbour search");
+        return NULL;
+    }
+    rowset->count = found.count;
+    for (uint64_t i = found.count; i > 0; i--) {
+        rowset->rows[i - 1] = heap_pop(&found).id;
+    }
+    free(found.items);
+    return rowset;
+}
+
+int64_t catalog_find_source(const gaia_catalog* catalog, int64_t source_id) {
+    // Rows are sorted by source_id
+    uint64_t lo = 0, hi = catalog->header->num_rows;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (catalog->source_ids[mid] < source_id) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < catalog->header->num_rows && catalog->source_ids[lo] == source_id) return (int64_t)lo;
+    return -1;
+}
+
+// Column predicates
+
+#define FILTER_BLOCK_ROWS 4096
+#define AGGREGATE_MAX_AXES 4
+
+static int check_filter_terms(const gaia_catalog* catalog, uint32_t num_terms, const uint32_t* columns) {
+    uint32_t num_columns = catalog->header->num_columns;
+    for (uint32_t t = 0; t < num_terms; t++) {
+        uint32_t column = columns[2 * t], divisor = columns[2 * t + 1];
+        if (column == 0 || column >= num_columns ||
+            (divisor != CATALOG_NO_COLUMN && (divisor == 0 || divisor >= num_columns))) {
+            set_error("Term %u does not name numeric columns", t);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Filter rows[0, count) into out (which may be rows itself), gathering
+// each block's columns into scratch for the kernel. Returns rows kept.
+static uint64_t filter_segment(
+    const gaia_catalog* catalog, const uint64_t* rows, uint64_t count, uint64_t* out,
+    uint32_t num_terms, const uint32_t* columns, const double* bounds, double* scratch
+) {
+    double* values = scratch;
+    double* divisors = scratch + FILTER_BLOCK_ROWS;
+    uint8_t* mask = (uint8_t*)(scratch + 2 * FILTER_BLOCK_ROWS);
+
+    uint64_t kept = 0;
+    for (uint64_t start = 0; start < count; start += FILTER_BLOCK_ROWS) {
+        uint64_t n = count - start;
+        if (n > FILTER_BLOCK_ROWS) n = FILTER_BLOCK_ROWS;
+        const uint64_t* block = rows + start;
+        memset(mask, 1, n);
+
+        for (uint32_t t = 0; t < num_terms; t++) {
+            const double* column = catalog->columns[columns[2 * t]];
+            for (uint64_t i = 0; i < n; i++) values[i] = column[block[i]];
+
+            const double* divisor = NULL;
+            if (columns[2 * t + 1] != CATALOG_NO_COLUMN) {
+                const double* source = catalog->columns[columns[2 * t + 1]];
+                for (uint64_t i = 0; i < n; i++) divisors[i] = source[block[i]];
+                divisor = divisors;
+            }
+            range_mask_block(values, divisor, n, bounds[2 * t], bounds[2 * t + 1], mask);
+        }
+
+        // out never runs ahead of the block being read
+        for (uint64_t i = 0; i < n; i++) {
+            out[kept] = block[i];
+            kept += mask[i];
+        }
+    }
+    return kept;
+}
+
+static double* filter_scratch(void) {
+    double* scratch = malloc(2 * FILTER_BLOCK_ROWS * sizeof(double) + FILTER_BLOCK_ROWS);
+    if (!scratch) set_error("Out of memory");
+    return scratch;
+}
+
+int64_t catalog_filter_rows(const gaia_catalog* catalog, gaia_rowset* rowset, uint32_t num_terms, const uint32_t* columns, const double* bounds) {
+    if (check_filter_terms(catalog, num_terms, columns) != 0) return -1;
+    if (num_terms == 0) return (int64_t)rowset->count;
+
+    double* scratch = filter_scratch();
+    if (!scratch) return -1;
+    rowset->count = filter_segment(catalog, rowset->rows, rowset->count, rowset->rows,
+        num_terms, columns, bounds, scratch);
+    free(scratch);
+    return (int64_t)rowset->count;
+}
+
+int64_t batch_filter_rows(const gaia_catalog* catalog, gaia_batch* batch, uint32_t num_terms, const uint32_t* columns, const double* bounds) {
+    if (check_filter_terms(catalog, num_terms, columns) != 0) return -1;
+    gaia_rowset* rowset = batch->rowset;
+    if (num_terms == 0) return (int64_t)rowset->count;
+
+    double* scratch = filter_scratch();
+    if (!scratch) return -1;
+    // Compact target by target, moving each target's start offset down
+    uint64_t kept = 0;
+    for (uint64_t i = 0; i < batch->num_targets; i++) {
+        uint64_t begin = batch->offsets[i], end = batch->offsets[i + 1];
+        batch->offsets[i] = kept;
+        kept += filter_segment(catalog, rowset->rows + begin, end - begin, rowset->rows + kept,
+            num_terms, columns, bounds, scratch);
+    }
+    batch->offsets[batch->num_targets] = kept;
+    rowset->count = kept;
+    free(scratch);
+    return (int64_t)kept;
+}
+
+// Random samples
+
+// The `count` rows of a cone with the smallest random_index that pass the
+// flux range and filter terms, in random_index order, in one scan: a
+// max-heap keeps the sample, and its top is the random_index cut each
+// pixel is scanned with, so rows that can't enter never reach the filter
+gaia_rowset* catalog_cone_sample(const gaia_catalog* catalog, double ra, double dec, double radius, double flux_min, double flux_max, uint32_t num_terms, const uint32_t* columns, const double* bounds, uint64_t count) {
+    int32_t random_col = catalog_column_index(catalog, "random_index");
+    if (random_col < 0) {
+        set_error("Sampling requires random_index in the catalog");
+        return NULL;
+    }
+    if (isnan(ra) || isnan(dec) || isnan(radius)) {
+        set_error("Cone search requires numeric ra, dec and radius");
+        return NULL;
+    }
+    if (check_filter_terms(catalog, num_terms, columns) != 0) return NULL;
+
+    hpx_cone cone;
+    radec_to_vec(ra, dec, cone.center);
+    cone.radius = radius * M_PI / 180.0;
+    double cos_radius = cos(cone.radius);
+
+    hpx_ranges ranges = {0};
+    if (healpix_query_region((int)catalog->header->order, healpix_classify_cone, &cone, &ranges) != 0) {
+        set_error("Out of memory building pixel coverage");
+        hpx_ranges_free(&ranges);
+        return NULL;
+    }
+
+    uint64_t* candidates = malloc(FILTER_BLOCK_ROWS * sizeof(uint64_t));
+    double* scratch = num_terms ? filter_scratch() : NULL;
+    if (!candidates || (num_terms && !scratch)) {
+        free(candidates);
+        free(scratch);
+        hpx_ranges_free(&ranges);
+        set_error("Out of memory during cone sample");
+        return NULL;
+    }
+
+    const double* random_index = catalog->columns[random_col];
+    heap found = {.max_heap = 1};
+    int failed = 0;
+
+    for (size_t r = 0; r < ranges.count && count > 0 && !failed; r++) {
+        uint64_t start = catalog->index[ranges.items[r].lo];
+        uint64_t end = catalog->index[ranges.items[r].hi];
+        int inside = ranges.items[r].inside;
+
+        for (uint64_t block = start; block < end && !failed; block += FILTER_BLOCK_ROWS) {
+            uint64_t block_end = end - block > FILTER_BLOCK_ROWS ? block + FILTER_BLOCK_ROWS : end;
+            double cut = found.count == count ? found.items[0].key : INFINITY;
+            uint64_t n = 0;
+            for (uint64_t row = block; row < block_end; row++) {
+                if (!(random_index[row] < cut)) continue;
+                if (!passes_flux(catalog, row, flux_min, flux_max)) continue;
+                if (!inside) {
+                    double v[3];
+                    catalog_row_vec(catalog, row, v);
+                    if (v[0] * cone.center[0] + v[1] * cone.center[1] + v[2] * cone.center[2] < cos_radius) continue;
+                }
+                candidates[n++] = row;
+            }
+            if (num_terms) {
+                n = filter_segment(catalog, candidates, n, candidates, num_terms, columns, bounds, scratch);
+            }
+
+            for (uint64_t i = 0; i < n; i++) {
+                double key = random_index[candidates[i]];
+                if (found.count < count) {
+                    failed |= heap_push(&found, (heap_item){key, candidates[i], 0});
+                } else if (key < found.items[0].key) {
+                    found.items[0] = (heap_item){key, candidates[i], 0};
+                    heap_sift_down(&found, 0);
+                }
+            }
+        }
+    }
+
+    free(candidates);
+    free(scratch);
+    hpx_ranges_free(&ranges);
+    if (failed) {
+        free(found.items);
+        set_error("Out of memory during cone sample");
+        return NULL;
+    }
+
+    // The max-heap drains smallest random_index first
+    gaia_rowset* rowset = drain_heap(&found);
+    if (!rowset) set_error("Out of memory during cone sample");
+    return rowset;
+}
+
+// Aggregates
+
+// Value of an aggregate axis for each row of a block: column (/ divisor),
+// or zeropoint - 2.5 log10 of it, NaN where undefined
+static void aggregate_values(
+    const gaia_catalog* catalog, const uint64_t* block, uint64_t n,
+    uint32_t column, uint32_t divisor, double zeropoint, double* out
+) {
+    const double* values = catalog->columns[column];
+    for (uint64_t i = 0; i < n; i++) out[i] = values[block[i]];
+
+    if (divisor != CATALOG_NO_COLUMN) {
+        const double* divisors = catalog->columns[divisor];
+        for (uint64_t i = 0; i < n; i++) out[i] /= divisors[block[i]];
+    }
+    if (!isnan(zeropoint)) {
+        for (uint64_t i = 0; i < n; i++) {
+            out[i] = out[i] > 0 ? zeropoint - 2.5 * log10(out[i]) : NAN;
+        }
+    }
+}
+
+int64_t catalog_aggregate_rows(
+    const gaia_catalog* catalog, const gaia_rowset* rowset, uint32_t num_axes,
+    const uint32_t* columns, const double* axes, double* out_range, uint64_t* out_counts
+) {
+    if (num_axes > AGGREGATE_MAX_AXES) {
+        set_error("At most %d aggregate axes are supported", AGGREGATE_MAX_AXES);
+        return -1;
+    }
+    if (check_filter_terms(catalog, num_axes, columns) != 0) return -1;
+    if (num_axes == 0) return (int64_t)rowset->count;
+
+    // Bin counts only when every axis has bins, first axis slowest
+    uint64_t num_bins = 1;
+    double scale[AGGREGATE_MAX_AXES];
+    for (uint32_t a = 0; a < num_axes; a++) {
+        const double* axis = axes + 4 * a;
+        uint64_t bins = (uint64_t)axis[3];
+        num_bins *= bins;
+        scale[a] = axis[2] > axis[1] ? (double)bins / (axis[2] - axis[1]) : 0;
+        out_range[2 * a] = INFINITY;
+        out_range[2 * a + 1] = -INFINITY;
+    }
+    if (num_bins > 0) memset(out_counts, 0, num_bins * sizeof(uint64_t));
+
+    double* values = malloc((size_t)num_axes * FILTER_BLOCK_ROWS * sizeof(double));
+    if (!values) {
+        set_error("Out of memory");
+        return -1;
+    }
+
+    uint64_t counted = 0;
+    for (uint64_t start = 0; start < rowset->count; start += FILTER_BLOCK_ROWS) {
+        uint64_t n = rowset->count - start;
+        if (n > FILTER_BLOCK_ROWS) n = FILTER_BLOCK_ROWS;
+        for (uint32_t a = 0; a < num_axes; a++) {
+            aggregate_values(catalog, rowset->rows + start, n, columns[2 * a], columns[2 * a + 1],
+                axes[4 * a], values + a * FILTER_BLOCK_ROWS);
+        }
+
+        for (uint64_t i = 0; i < n; i++) {
+            int finite = 1;
+            for (uint32_t a = 0; a < num_axes; a++) {
+                finite &= isfinite(values[a * FILTER_BLOCK_ROWS + i]);
+            }
+            if (!finite) continue;
+            counted++;
+
+            // The top edge belongs to the last bin
+            uint64_t bin = 0;
+            int inside = num_bins > 0;
+            for (uint32_t a = 0; a < num_axes; a++) {
+                const double* axis = axes + 4 * a;
+                double v = values[a * FILTER_BLOCK_ROWS + i];
+                if (v < out_range[2 * a]) out_range[2 * a] = v;
+                if (v > out_range[2 * a + 1]) out_range[2 * a + 1] = v;
+
+                uint64_t bins = (uint64_t)axis[3];
+                if (!inside || v < axis[1] || v > axis[2]) {
+                    inside = 0;
+                    continue;
+                }
+                uint64_t b = (uint64_t)((v - axis[1]) * scale[a]);
+                bin = bin * bins + (b < bins ? b : bins - 1);
+            }
+            if (inside) out_counts[bin]++;
+        }
+    }
+    free(values);
+
+    if (counted == 0) {
+        for (uint32_t a = 0; a < 2 * num_axes; a++) out_range[a] = NAN;
+    }
+    return (int64_t)counted;
+}
+
+int catalog_read_source_ids(const gaia_catalog* catalog, const gaia_rowset* rowset, int64_t* out) {
+    for (uint64_t i = 0; i < rowset->count; i++) {
+        out[i] = catalog->source_ids[rowset->rows[i]];
+    }
+    return 0;
+}
+
+int catalog_read_column(const gaia_catalog* catalog, const gaia_rowset* rowset, uint32_t column, double* out) {
+    if (column == 0 || column >= catalog->header->num_columns) {
+        set_error("Column %u is not a numeric column", column);
+        return -1;
+    }
+    const double* values = catalog->columns[column];
+    for (uint64_t i = 0; i < rowset->count; i++) {
+        out[i] = values[rowset->rows[i]];
+    }
+    return 0;
+}
@@ -0,0 +1,205 @@
+#ifndef GAIA_CATALOG_H
+#define GAIA_CATALOG_H
+
+#include <stdint.h>
+
+#define CATALOG_MAGIC "GAIACAT"
+#define CATALOG_VERSION 1
+#define CATALOG_MAX_COLUMNS 64
+#define CATALOG_NAME_LEN 48
+#define CATALOG_HEADER_SIZE 4096
+#define CATALOG_DEFAULT_ORDER 8
+
+// Header flags
+#define CATALOG_FLAG_FLUX_ORDER 0x1
+#define CATALOG_FLAG_FLUX_RANK 0x2
+
+// Result orderings for catalog_cone_search_limit
+#define CATALOG_ORDER_NONE 0
+#define CATALOG_ORDER_BRIGHTEST 1
+#define CATALOG_ORDER_NEAREST 2
+
+// Absent divisor column of a catalog_filter_rows term
+#define CATALOG_NO_COLUMN UINT32_MAX
+
+// On-disk layout:
+//   [header, CATALOG_HEADER_SIZE bytes]
+//   [pixel index: npix(order) + 1 uint64 row offsets]
+//   [column 0: source_id as int64, num_rows entries]
+//   [column 1..n: float64, num_rows entries each, NaN for null]
+//   [flux order: uint32 per row, when CATALOG_FLAG_FLUX_ORDER is set]
+//   [flux rank: uint64 per row, when CATALOG_FLAG_FLUX_RANK is set]
+// Rows are sorted by source_id, which puts them in nested HEALPix order,
+// so every pixel at `order` maps to one contiguous row range. The writer
+// appends derived ux, uy, uz unit-vector columns computed from ra/dec.
+// When phot_g_mean_flux is stored, the flux order lists each pixel's rows
+// as offsets from the pixel's first row, brightest first (NaN last), and
+// the flux rank lists every row of the catalog in that order.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t order;
+    uint64_t num_rows;
+    uint32_t num_columns;
+    uint32_t flags;
+    uint64_t index_offset;
+    uint64_t data_offset;
+    char columns[CATALOG_MAX_COLUMNS][CATALOG_NAME_LEN];
+    uint64_t flux_order_offset;
+    uint64_t flux_rank_offset;
+} catalog_header;
+
+typedef struct {
+    int fd;
+    uint8_t* map;
+    uint64_t map_size;
+    const catalog_header* header;
+    const uint64_t* index;
+    const int64_t* source_ids;
+    const double* columns[CATALOG_MAX_COLUMNS];
+    const uint32_t* flux_order;
+    const uint64_t* flux_rank;
+    int ra_col;
+    int dec_col;
+    int flux_col;
+    int ux_col;
+    int uy_col;
+    int uz_col;
+    int pmra_col;
+    int pmdec_col;
+} gaia_catalog;
+
+typedef struct {
+    uint64_t* rows;
+    uint64_t count;
+    uint64_t capacity;
+} gaia_rowset;
+
+// Results of a batched cone search: rows for target i are
+// rowset->rows[offsets[i]] .. rowset->rows[offsets[i + 1]]
+typedef struct {
+    gaia_rowset* rowset;
+    uint64_t* offsets;
+    uint64_t num_targets;
+} gaia_batch;
+
+typedef struct gaia_catalog_writer gaia_catalog_writer;
+typedef struct gaia_kdtree gaia_kdtree;
+
+const char* catalog_last_error(void);
+
+gaia_catalog_writer* catalog_writer_open(const char* path, const char* columns_json, uint32_t order, uint64_t num_rows);
+int catalog_writer_append(gaia_catalog_writer* writer, const int64_t* source_ids, const double* values, uint64_t count);
+int catalog_writer_close(gaia_catalog_writer* writer);
+
+gaia_catalog* catalog_open(const char* path);
+void catalog_close(gaia_catalog* catalog);
+uint64_t catalog_num_rows(const gaia_catalog* catalog);
+uint32_t catalog_num_columns(const gaia_catalog* catalog);
+const char* catalog_column_name(const gaia_catalog* catalog, uint32_t column);
+int32_t catalog_column_index(const gaia_catalog* catalog, const char* name);
+
+gaia_rowset* catalog_cone_search(const gaia_catalog* catalog, double ra, double dec, double radius, double flux_min, double flux_max);
+// Number of rows catalog_cone_search would return, counted without
+// building them. Returns -1 on error.
+int64_t catalog_cone_count(const gaia_catalog* catalog, double ra, double dec, double radius, double flux_min, double flux_max);
+// At most `limit` rows of a cone search (0 for all) in a CATALOG_ORDER_*
+// order. Brightest-first walks each pixel's flux order and stops once the
+// rest of the pixel is fainter than every kept row; nearest-first is a
+// best-first pixel walk bounded by the cone; unordered stops at `limit`.
+gaia_rowset* catalog_cone_search_limit(const gaia_catalog* catalog, double ra, double dec, double radius, double flux_min, double flux_max, uint64_t limit, int order);
+// Cone search on positions propagated `years` from the catalog epoch by
+// pmra/pmdec; the pixel coverage is widened by the fastest plausible
+// motion so stars moving into the cone are found
+gaia_rowset* catalog_cone_search_epoch(const gaia_catalog* catalog, double ra, double dec, double radius, double flux_min, double flux_max, double years);
+// Write the ra/dec (degrees) of each row propagated by `years`
+int catalog_propagate_rows(const gaia_catalog* catalog, const gaia_rowset* rowset, double years, double* out_ra, double* out_dec);
+// The k rows closest to (ra, dec) within the flux bounds, nearest first
+gaia_rowset* catalog_nearest(const gaia_catalog* catalog, double ra, double dec, uint32_t k, double flux_min, double flux_max);
+// Every row within the flux bounds, brightest first, at most `limit` (0
+// for all). The flux rank makes this two binary searches and a copy;
+// catalogs without it fall back to a scan and sort.
+gaia_rowset* catalog_brightness_search(const gaia_catalog* catalog, double flux_min, double flux_max, uint64_t limit);
+// Convex polygon from `count` (ra, dec) degree pairs, either winding
+gaia_rowset* catalog_polygon_search(const gaia_catalog* catalog, const double* vertices, uint32_t count, double flux_min, double flux_max);
+// RA/Dec box in degrees; ra_min > ra_max wraps through RA 0
+gaia_rowset* catalog_box_search(const gaia_catalog* catalog, double ra_min, double ra_max, double dec_min, double dec_max, double flux_min, double flux_max);
+
+// Pixels at `order` that may intersect a cone (degrees), with out_inside
+// set for pixels entirely inside it. Returns the pixel count, which may
+// exceed `capacity` (only that many are written), or -1 on error.
+int64_t catalog_cone_pixels(int order, double ra, double dec, double radius, int64_t* out_pixels, uint8_t* out_inside, uint64_t capacity);
+// Nested pixel ranges [lo, hi) at `order` covering a convex polygon of
+// `count` (ra, dec) vertices, as lo/hi pairs in out_ranges, with
+// out_inside set for ranges entirely inside it. Returns the total range
+// count (only `capacity` are written) or -1 on error.
+int64_t catalog_polygon_ranges(int order, const double* vertices, uint32_t count, int64_t* out_ranges, uint8_t* out_inside, uint64_t capacity);
+// Rows of one nested pixel at `order` (at most 12), found from the
+// source_id order of the rows, within an exclusive G flux range
+gaia_rowset* catalog_pixel_search(const gaia_catalog* catalog, int order, int64_t pixel, double flux_min, double flux_max);
+
+// Cone searches for many targets, sorted by HEALPix pixel so neighbouring
+// cones touch the same pages, split across `threads` worker threads
+gaia_batch* catalog_cone_search_batch(const gaia_catalog* catalog, const double* ra, const double* dec, const double* radius, uint64_t count, double flux_min, double flux_max, uint32_t threads);
+// Best match within `radius` degrees for each position, written to
+// out_rows (-1 when nothing matches) and out_separation (degrees).
+// With a non-zero `years`, catalog positions are first propagated by that
+// many years using pmra/pmdec. Returns the number of matched positions,
+// or -1 on error.
+int64_t catalog_xmatch(const gaia_catalog* catalog, const double* ra, const double* dec, uint64_t count, double radius, double years, uint32_t threads, int64_t* out_rows, double* out_separation);
+gaia_rowset* batch_rowset(const gaia_batch* batch);
+int batch_read_offsets(const gaia_batch* batch, uint64_t* out);
+void batch_free(gaia_batch* batch);
+
+// Row holding `source_id`, or -1
+int64_t catalog_find_source(const gaia_catalog* catalog, int64_t source_id);
+
+// In-memory k-d tree over heliocentric Cartesian positions in parsecs
+// (1000 / parallax along the unit vector), holding rows with a positive
+// parallax and, when min_parallax_over_error > 0, at least that S/N.
+// Building reads the whole catalog and sorts it by median splits:
+// O(n log n) time and 32 bytes per row held, paid once per tree; build
+// one with no cut and pass cuts to the queries instead of building more.
+gaia_kdtree* catalog_kdtree_build(const gaia_catalog* catalog, double min_parallax_over_error);
+uint64_t kdtree_count(const gaia_kdtree* tree);
+void kdtree_free(gaia_kdtree* tree);
+// Rows within `radius` parsecs of (x, y, z), in no particular order, with
+// at least min_parallax_over_error S/N when it is positive
+gaia_rowset* kdtree_sphere(const gaia_kdtree* tree, double x, double y, double z, double radius, double min_parallax_over_error, double flux_min, double flux_max);
+// The k rows closest to (x, y, z), nearest first, with the same S/N cut
+gaia_rowset* kdtree_nearest(const gaia_kdtree* tree, double x, double y, double z, uint32_t k, double min_parallax_over_error, double flux_min, double flux_max);
+
+// Keep only the rows passing every term, in order. Term t reads
+// columns[2t] and columns[2t + 1] (a divisor column, or CATALOG_NO_COLUMN)
+// and passes when bounds[2t] <= value <= bounds[2t + 1], or with a divisor
+// when divisor > 0 and bounds[2t] <= value / divisor <= bounds[2t + 1].
+// NaN never passes. Returns the number of rows kept, or -1 on error.
+int64_t catalog_filter_rows(const gaia_catalog* catalog, gaia_rowset* rowset, uint32_t num_terms, const uint32_t* columns, const double* bounds);
+// catalog_filter_rows over each target of a batch, keeping the offsets
+int64_t batch_filter_rows(const gaia_catalog* catalog, gaia_batch* batch, uint32_t num_terms, const uint32_t* columns, const double* bounds);
+// The `count` rows of a cone with the smallest random_index that pass the
+// exclusive flux range and catalog_filter_rows terms, smallest random_index
+// first, found in a single scan. Needs random_index in the catalog.
+gaia_rowset* catalog_cone_sample(const gaia_catalog* catalog, double ra, double dec, double radius, double flux_min, double flux_max, uint32_t num_terms, const uint32_t* columns, const double* bounds, uint64_t count);
+
+// Summarize rows over up to 4 axes without reading them out. Axis a reads
+// columns[2a] (/ columns[2a + 1] unless CATALOG_NO_COLUMN), then becomes
+// axes[4a] - 2.5 log10(value) unless that zeropoint is NaN. Rows with a
+// finite value on every axis are counted, with their (min, max) per axis
+// in out_range (NaN when none). When every axis has axes[4a + 3] > 0 bins
+// over [axes[4a + 1], axes[4a + 2]], out_counts gets the row-major bin
+// counts, first axis slowest. Returns the rows counted, or -1 on error.
+int64_t catalog_aggregate_rows(const gaia_catalog* catalog, const gaia_rowset* rowset, uint32_t num_axes, const uint32_t* columns, const double* axes, double* out_range, uint64_t* out_counts);
+
+int catalog_read_source_ids(const gaia_catalog* catalog, const gaia_rowset* rowset, int64_t* out);
+int catalog_read_column(const gaia_catalog* catalog, const gaia_rowset* rowset, uint32_t column, double* out);
+
+gaia_rowset* rowset_create(const uint64_t* rows, uint64_t count);
+// Copy of rows [start, start + count) of a rowset, clamped to its end
+gaia_rowset* rowset_slice(const gaia_rowset* rowset, uint64_t start, uint64_t count);
+int rowset_push(gaia_rowset* rowset, uint64_t row);
+int rowset_reserve(gaia_rowset* rowset, uint64_t additional);
+uint64_t rowset_count(const gaia_rowset* rowset);
+void rowset_free(gaia_rowset* rowset);
+
+#endif
@@ -3,6 +3,9 @@
 #include <string.h>
 #include <zlib.h>
 #include <ctype.h>
+#include <math.h>
+
+#include "gaia_kernels.h"
 
 // Simple JSON array builder
 typedef struct {
@@ -46,8 +49,25 @@ void json_builder_append_escaped(JsonBuilder* builder, const char* str) {
     json_builder_append(builder, buffer);
 }
 
-// Parse a gzipped CSV file and return JSON array
-char* parse_gzipped_csv(const char* file_path, const char* columns_json, size_t chunk_size) {
+// Gaia flux columns and the magnitudes derived from them
+static const char* flux_columns[3] = {"phot_g_mean_flux", "phot_bp_mean_flux", "phot_rp_mean_flux"};
+static const char* mag_columns[3] = {"phot_g_mean_mag", "phot_bp_mean_mag", "phot_rp_mean_mag"};
+
+// Append ",\"name\":value" for a magnitude, or null when not finite
+static void append_magnitude(JsonBuilder* json, const char* name, double mag) {
+    char field[64];
+    if (isfinite(mag)) {
+        snprintf(field, sizeof(field), ",\"%s\":%.17g", name, mag);
+    } else {
+        snprintf(field, sizeof(field), ",\"%s\":null", name);
+    }
+    json_builder_append(json, field);
+}
+
+// Parse a gzipped CSV file and return JSON array. With zeropoints for
+// G, BP and RP, each record also gets the three magnitudes and bp_rp,
+// computed from the flux columns (null where a flux is not above 0)
+char* parse_gzipped_csv_photometry(const char* file_path, const char* columns_json, size_t chunk_size, const double* zeropoints) {
     // Open gzipped file
     gzFile file = gzopen(file_path, "rb");
     if (!file) {
@@ -115,7 +135,10 @@ char* parse_gzipped_csv(const char* file_path, const char* columns_json, size_t
     char** headers = NULL;
     int record_count = 0;
     int line_num = 0;
-
+    int ra_header = -1;
+    int dec_header = -1;
+    // CSV column of each flux, read whether or not it is kept
+    int flux_col[3] = {-1, -1, -1};
 
     // Process each line
     char* line_start = decompressed;
@@ -148,11 +171,17 @@ char* parse_gzipped_csv(const char* file_path, const char* columns_json, size_t
             int col_idx = 0;
 
             while (token) {
+                for (int b = 0; b < 3; b++) {
+                    if (strcmp(token, flux_columns[b]) == 0) flux_col[b] = col_idx;
+                }
+
                 // Check if this column should be kept
                 for (int i = 0; i < num_columns_to_keep; i++) {
                     if (strcmp(token, columns_to_keep[i]) == 0) {
                         column_indices[num_indices] = col_idx;
                         headers[num_indices] = strdup(token);
+                        if (strcmp(token, "ra") == 0) ra_header = num_indices;
+                        if (strcmp(token, "dec") == 0) dec_header = num_indices;
                         num_indices++;
                         break;
                     }
@@ -175,8 +204,21 @@ char* parse_gzipped_csv(const char* file_path, const char* columns_json, size_t
             char* token = strtok(row_copy, ",");
             int col_idx = 0;
             int field_count = 0;
+            double ra = NAN;
+            double dec = NAN;
+            double flux[3] = {NAN, NAN, NAN};
 
             while (token) {
+                if (zeropoints) {
+                    for (int b = 0; b < 3; b++) {
+                        if (flux_col[b] == col_idx && strlen(token) > 0) {
+                            char* end;
+                            double value = strtod(token, &end);
+                            if (*end == '\0') flux[b] = value;
+                        }
+                    }
+                }
+
                 // Check if this column should be included
                 for (int i = 0; i < num_indices; i++) {
                     if (column_indices[i] == col_idx) {
@@ -194,6 +236,8 @@ char* parse_gzipped_csv(const char* file_path, const char* columns_json, size_t
                         } else if (strspn(token, "0123456789.-+eE") == strlen(token)) {
                             // Looks like a number
                             json_builder_append(&json, token);
+                            if (i == ra_header) ra = strtod(token, NULL);
+                            if (i == dec_header) dec = strtod(token, NULL);
                         } else {
                             // String value
                             json_builder_append_escaped(&json, token);
@@ -207,6 +251,24 @@ char* parse_gzipped_csv(const char* file_path, const char* columns_json, size_t
                 col_idx++;
             }
 
+            // Precomputed unit vector for dot-product cone tests
+            if (!isnan(ra) && !isnan(dec)) {
+                double x, y, z;
+                char vector[96];
+                radec_to_unit_vectors(&ra, &dec, 1, &x, &y, &z);
+                snprintf(vector, sizeof(vector), ",\"ux\":%.17g,\"uy\":%.17g,\"uz\":%.17g", x, y, z);
+                json_builder_append(&json, vector);
+            }
+
+            if (zeropoints) {
+                double mag[3];
+                for (int b = 0; b < 3; b++) {
+                    mag[b] = flux[b] > 0 ? zeropoints[b] - 2.5 * log10(flux[b]) : NAN;
+                    append_magnitude(&json, mag_columns[b], mag[b]);
+                }
+                append_magnitude(&json, "bp_rp", mag[1] - mag[2]);
+            }
+
             json_builder_append(&json, "}");
             free(row_copy);
             free(line);
@@ -232,6 +294,11 @@ char* parse_gzipped_csv(const char* file_path, const char* columns_json, size_t
     return json.data;
 }
 
+// Parse a gzipped CSV file and return JSON array
+char* parse_gzipped_csv(const char* file_path, const char* columns_json, size_t chunk_size) {
+    return parse_gzipped_csv_photometry(file_path, columns_json, chunk_size, NULL);
+}
+
 // Free a string allocated by this library
 void free_string(char* ptr) {
     if (ptr) {
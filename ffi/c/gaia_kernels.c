@@ -0,0 +1,441 @@
+#include "gaia_kernels.h"
+
+#include <math.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define GAIA_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static uint64_t cone_filter_scalar(
+    const double* x, const double* y, const double* z,
+    uint64_t start, uint64_t end, const double c[3], double cos_r, uint64_t* out
+) {
+    uint64_t n = 0;
+    for (uint64_t i = start; i < end; i++) {
+        double dot = x[i] * c[0] + y[i] * c[1] + z[i] * c[2];
+        // Branchless store: always write, only advance on a match
+        out[n] = i;
+        n += dot >= cos_r;
+    }
+    return n;
+}
+
+static void propagate_scalar(
+    const double* x, const double* y, const double* z,
+    const double* pmra, const double* pmdec, uint64_t start, uint64_t end,
+    double years, double* ox, double* oy, double* oz
+) {
+    for (uint64_t i = start; i < end; i++) {
+        double v[3] = {x[i], y[i], z[i]};
+        double w[3];
+        propagate_vec(v, pmra[i], pmdec[i], years, w);
+        ox[i - start] = w[0];
+        oy[i - start] = w[1];
+        oz[i - start] = w[2];
+    }
+}
+
+static void range_mask_scalar(
+    const double* values, const double* divisor, uint64_t start, uint64_t end,
+    double lo, double hi, uint8_t* mask
+) {
+    for (uint64_t i = start; i < end; i++) {
+        double v = values[i];
+        if (divisor) {
+            double d = divisor[i];
+            mask[i] &= d > 0 && v >= lo * d && v <= hi * d;
+        } else {
+            mask[i] &= v >= lo && v <= hi;
+        }
+    }
+}
+
+// Pogson's ratio for magnitude errors: 2.5 / ln(10)
+#define MAG_ERR_SCALE 1.0857362047581294
+
+static void flux_to_mag_scalar(
+    const double* flux, const double* flux_err, uint64_t start, uint64_t end,
+    double zeropoint, double* mag, double* mag_err
+) {
+    for (uint64_t i = start; i < end; i++) {
+        double f = flux[i];
+        int ok = f > 0 && f < INFINITY;
+        mag[i] = ok ? zeropoint - 2.5 * log10(f) : NAN;
+        if (mag_err) mag_err[i] = ok ? MAG_ERR_SCALE * flux_err[i] / f : NAN;
+    }
+}
+
+static void mag_to_flux_scalar(
+    const double* mag, uint64_t start, uint64_t end, double zeropoint, double* flux
+) {
+    for (uint64_t i = start; i < end; i++) {
+        flux[i] = pow(10.0, -0.4 * (mag[i] - zeropoint));
+    }
+}
+
+#ifdef GAIA_X86_DISPATCH
+
+static int cpu_level;
+
+// Detected once when the library loads, before any thread can call the
+// kernels, so the batch and cross-match workers only ever read it
+__attribute__((constructor))
+static void detect_cpu_level(void) {
+    __builtin_cpu_init();
+    cpu_level = __builtin_cpu_supports("avx512f") ? 2
+              : (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) ? 1
+              : 0;
+}
+
+static int dispatch_level(void) {
+    return cpu_level;
+}
+
+__attribute__((target("avx2,fma")))
+static uint64_t cone_filter_avx2(
+    const double* x, const double* y, const double* z,
+    uint64_t start, uint64_t end, const double c[3], double cos_r, uint64_t* out
+) {
+    const __m256d cx = _mm256_set1_pd(c[0]);
+    const __m256d cy = _mm256_set1_pd(c[1]);
+    const __m256d cz = _mm256_set1_pd(c[2]);
+    const __m256d threshold = _mm256_set1_pd(cos_r);
+
+    uint64_t n = 0;
+    uint64_t i = start;
+    for (; i + 4 <= end; i += 4) {
+        __m256d dot = _mm256_mul_pd(_mm256_loadu_pd(x + i), cx);
+        dot = _mm256_fmadd_pd(_mm256_loadu_pd(y + i), cy, dot);
+        dot = _mm256_fmadd_pd(_mm256_loadu_pd(z + i), cz, dot);
+        int mask = _mm256_movemask_pd(_mm256_cmp_pd(dot, threshold, _CMP_GE_OQ));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            out[n++] = i + (uint64_t)bit;
+            mask &= mask - 1;
+        }
+    }
+    return n + cone_filter_scalar(x, y, z, i, end, c, cos_r, out + n);
+}
+
+__attribute__((target("avx512f")))
+static uint64_t cone_filter_avx512(
+    const double* x, const double* y, const double* z,
+    uint64_t start, uint64_t end, const double c[3], double cos_r, uint64_t* out
+) {
+    const __m512d cx = _mm512_set1_pd(c[0]);
+    const __m512d cy = _mm512_set1_pd(c[1]);
+    const __m512d cz = _mm512_set1_pd(c[2]);
+    const __m512d threshold = _mm512_set1_pd(cos_r);
+    const __m512i lanes = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+
+    uint64_t n = 0;
+    uint64_t i = start;
+    for (; i + 8 <= end; i += 8) {
+        __m512d dot = _mm512_mul_pd(_mm512_loadu_pd(x + i), cx);
+        dot = _mm512_fmadd_pd(_mm512_loadu_pd(y + i), cy, dot);
+        dot = _mm512_fmadd_pd(_mm512_loadu_pd(z + i), cz, dot);
+        __mmask8 mask = _mm512_cmp_pd_mask(dot, threshold, _CMP_GE_OQ);
+        __m512i rows = _mm512_add_epi64(_mm512_set1_epi64((long long)i), lanes);
+        _mm512_mask_compressstoreu_epi64(out + n, mask, rows);
+        n += (uint64_t)__builtin_popcount(mask);
+    }
+    return n + cone_filter_scalar(x, y, z, i, end, c, cos_r, out + n);
+}
+
+// Same arithmetic as propagate_vec, four rows at a time. Rows at a pole
+// or with a NaN proper motion are blended back to their input vector.
+__attribute__((target("avx2,fma")))
+static void propagate_avx2(
+    const double* x, const double* y, const double* z,
+    const double* pmra, const double* pmdec, uint64_t start, uint64_t end,
+    double years, double* ox, double* oy, double* oz
+) {
+    const __m256d scale = _mm256_set1_pd(years * M_PI / (180.0 * 3600.0 * 1000.0));
+    const __m256d zero = _mm256_setzero_pd();
+
+    uint64_t i = start;
+    for (; i + 4 <= end; i += 4) {
+        __m256d vx = _mm256_loadu_pd(x + i);
+        __m256d vy = _mm256_loadu_pd(y + i);
+        __m256d vz = _mm256_loadu_pd(z + i);
+        __m256d east = _mm256_mul_pd(_mm256_loadu_pd(pmra + i), scale);
+        __m256d north = _mm256_mul_pd(_mm256_loadu_pd(pmdec + i), scale);
+
+        __m256d r2 = _mm256_fmadd_pd(vy, vy, _mm256_mul_pd(vx, vx));
+        __m256d r = _mm256_sqrt_pd(r2);
+        __m256d a = _mm256_div_pd(east, r);
+        __m256d b = _mm256_div_pd(_mm256_mul_pd(north, vz), r);
+
+        // w = v + east * (-y, x, 0) / r + north * (-z x, -z y, r^2) / r
+        __m256d wx = _mm256_fnmadd_pd(b, vx, _mm256_fnmadd_pd(a, vy, vx));
+        __m256d wy = _mm256_fnmadd_pd(b, vy, _mm256_fmadd_pd(a, vx, vy));
+        __m256d wz = _mm256_fmadd_pd(north, r, vz);
+        __m256d norm = _mm256_sqrt_pd(_mm256_fmadd_pd(wz, wz, _mm256_fmadd_pd(wy, wy, _mm256_mul_pd(wx, wx))));
+
+        __m256d keep = _mm256_and_pd(
+            _mm256_cmp_pd(r2, zero, _CMP_GT_OQ),
+            _mm256_cmp_pd(east, north, _CMP_ORD_Q));
+        _mm256_storeu_pd(ox + (i - start), _mm256_blendv_pd(vx, _mm256_div_pd(wx, norm), keep));
+        _mm256_storeu_pd(oy + (i - start), _mm256_blendv_pd(vy, _mm256_div_pd(wy, norm), keep));
+        _mm256_storeu_pd(oz + (i - start), _mm256_blendv_pd(vz, _mm256_div_pd(wz, norm), keep));
+    }
+    propagate_scalar(x, y, z, pmra, pmdec, i, end, years,
+        ox + (i - start), oy + (i - start), oz + (i - start));
+}
+
+__attribute__((target("avx2,fma")))
+static void range_mask_avx2(
+    const double* values, const double* divisor, uint64_t count,
+    double lo, double hi, uint8_t* mask
+) {
+    const __m256d vlo = _mm256_set1_pd(lo);
+    const __m256d vhi = _mm256_set1_pd(hi);
+    const __m256d zero = _mm256_setzero_pd();
+
+    uint64_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d v = _mm256_loadu_pd(values + i);
+        __m256d low = vlo, high = vhi;
+        __m256d ok = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        if (divisor) {
+            __m256d d = _mm256_loadu_pd(divisor + i);
+            low = _mm256_mul_pd(vlo, d);
+            high = _mm256_mul_pd(vhi, d);
+            ok = _mm256_cmp_pd(d, zero, _CMP_GT_OQ);
+        }
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(v, low, _CMP_GE_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(v, high, _CMP_LE_OQ));
+        int bits = _mm256_movemask_pd(ok);
+        mask[i] &= bits & 1;
+        mask[i + 1] &= (bits >> 1) & 1;
+        mask[i + 2] &= (bits >> 2) & 1;
+        mask[i + 3] &= (bits >> 3) & 1;
+    }
+    range_mask_scalar(values, divisor, i, count, lo, hi, mask);
+}
+
+// log10 of four positive normal doubles: x = 2^e * m with m in
+// [sqrt(1/2), sqrt(2)), and ln(m) = 2 atanh(s) for s = (m - 1) / (m + 1),
+// |s| < 0.172, summed to s^19 (within an ulp or two of libm)
+__attribute__((target("avx2,fma")))
+static __m256d log10_avx2(__m256d x) {
+    const __m256i mantissa_mask = _mm256_set1_epi64x(0x000fffffffffffffLL);
+    const __m256i one_bits = _mm256_set1_epi64x(0x3ff0000000000000LL);
+    const __m256d two52 = _mm256_set1_pd(4503599627370496.0);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    __m256i bits = _mm256_castpd_si256(x);
+    // Biased exponent as a double, via the 2^52 magic number
+    __m256i biased = _mm256_srli_epi64(bits, 52);
+    __m256d e = _mm256_sub_pd(
+        _mm256_castsi256_pd(_mm256_or_si256(biased, _mm256_castpd_si256(two52))),
+        two52);
+    e = _mm256_sub_pd(e, _mm256_set1_pd(1023.0));
+    __m256d m = _mm256_castsi256_pd(
+        _mm256_or_si256(_mm256_and_si256(bits, mantissa_mask), one_bits));
+
+    __m256d high = _mm256_cmp_pd(m, _mm256_set1_pd(1.4142135623730951), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), high);
+    e = _mm256_add_pd(e, _mm256_and_pd(high, one));
+
+    __m256d s = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+    __m256d s2 = _mm256_mul_pd(s, s);
+    __m256d p = _mm256_set1_pd(1.0 / 19);
+    p = _mm256_fmadd_pd(p, s2, _mm256_set1_pd(1.0 / 17));
+    p = _mm256_fmadd_pd(p, s2, _mm256_set1_pd(1.0 / 15));
+    p = _mm256_fmadd_pd(p, s2, _mm256_set1_pd(1.0 / 13));
+    p = _mm256_fmadd_pd(p, s2, _mm256_set1_pd(1.0 / 11));
+    p = _mm256_fmadd_pd(p, s2, _mm256_set1_pd(1.0 / 9));
+    p = _mm256_fmadd_pd(p, s2, _mm256_set1_pd(1.0 / 7));
+    p = _mm256_fmadd_pd(p, s2, _mm256_set1_pd(1.0 / 5));
+    p = _mm256_fmadd_pd(p, s2, _mm256_set1_pd(1.0 / 3));
+    p = _mm256_fmadd_pd(p, s2, one);
+    __m256d ln_m = _mm256_mul_pd(_mm256_add_pd(s, s), p);
+
+    // log10(x) = e log10(2) + ln(m) log10(e)
+    return _mm256_fmadd_pd(e, _mm256_set1_pd(0.30102999566398120),
+        _mm256_mul_pd(ln_m, _mm256_set1_pd(0.43429448190325182)));
+}
+
+// 10^y for four doubles: 2^t with t = y log2(10) split into an integer k
+// and f in [-1/2, 1/2], 2^f = exp(f ln 2) summed to degree 13. Beyond
+// the normal range the result is 0 or infinity.
+__attribute__((target("avx2,fma")))
+static __m256d exp10_avx2(__m256d y) {
+    const __m256d two52 = _mm256_set1_pd(4503599627370496.0);
+
+    const __m256d t_full = _mm256_mul_pd(y, _mm256_set1_pd(3.3219280948873623));
+    __m256d t = _mm256_min_pd(_mm256_max_pd(t_full, _mm256_set1_pd(-1020.0)), _mm256_set1_pd(1020.0));
+    __m256d k = _mm256_round_pd(t, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256d r = _mm256_mul_pd(_mm256_sub_pd(t, k), _mm256_set1_pd(0.69314718055994531));
+
+    static const double inverse_factorials[] = {
+        1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0,
+        1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0, 1.0 / 5040.0,
+        1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 1.0 / 2.0, 1.0, 1.0,
+    };
+    __m256d p = _mm256_set1_pd(inverse_factorials[0]);
+    for (int j = 1; j < 14; j++) {
+        p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(inverse_factorials[j]));
+    }
+
+    // 2^k from its biased exponent, via the 2^52 magic number
+    __m256i biased = _mm256_castpd_si256(
+        _mm256_add_pd(_mm256_add_pd(k, _mm256_set1_pd(1023.0)), two52));
+    biased = _mm256_sub_epi64(biased, _mm256_castpd_si256(two52));
+    __m256d scale = _mm256_castsi256_pd(_mm256_slli_epi64(biased, 52));
+    __m256d result = _mm256_mul_pd(p, scale);
+    result = _mm256_blendv_pd(result, _mm256_set1_pd(INFINITY),
+        _mm256_cmp_pd(t_full, _mm256_set1_pd(1020.0), _CMP_GT_OQ));
+    return _mm256_blendv_pd(result, _mm256_setzero_pd(),
+        _mm256_cmp_pd(t_full, _mm256_set1_pd(-1020.0), _CMP_LT_OQ));
+}
+
+__attribute__((target("avx2,fma")))
+static void flux_to_mag_avx2(
+    const double* flux, const double* flux_err, uint64_t count,
+    double zeropoint, double* mag, double* mag_err
+) {
+    const __m256d zp = _mm256_set1_pd(zeropoint);
+    const __m256d lowest = _mm256_set1_pd(2.2250738585072014e-308);
+    const __m256d highest = _mm256_set1_pd(INFINITY);
+    const __m256d nan = _mm256_set1_pd(NAN);
+
+    uint64_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d f = _mm256_loadu_pd(flux + i);
+        // Positive subnormals are left to libm
+        __m256d tiny = _mm256_and_pd(
+            _mm256_cmp_pd(f, _mm256_setzero_pd(), _CMP_GT_OQ),
+            _mm256_cmp_pd(f, lowest, _CMP_LT_OQ));
+        if (_mm256_movemask_pd(tiny)) {
+            flux_to_mag_scalar(flux, flux_err, i, i + 4, zeropoint, mag, mag_err);
+            continue;
+        }
+
+        __m256d ok = _mm256_and_pd(
+            _mm256_cmp_pd(f, lowest, _CMP_GE_OQ),
+            _mm256_cmp_pd(f, highest, _CMP_LT_OQ));
+        __m256d m = _mm256_fnmadd_pd(_mm256_set1_pd(2.5), log10_avx2(f), zp);
+        _mm256_storeu_pd(mag + i, _mm256_blendv_pd(nan, m, ok));
+        if (mag_err) {
+            __m256d err = _mm256_div_pd(
+                _mm256_mul_pd(_mm256_loadu_pd(flux_err + i), _mm256_set1_pd(MAG_ERR_SCALE)), f);
+            _mm256_storeu_pd(mag_err + i, _mm256_blendv_pd(nan, err, ok));
+        }
+    }
+    flux_to_mag_scalar(flux, flux_err, i, count, zeropoint, mag, mag_err);
+}
+
+__attribute__((target("avx2,fma")))
+static void mag_to_flux_avx2(const double* mag, uint64_t count, double zeropoint, double* flux) {
+    const __m256d zp = _mm256_set1_pd(zeropoint);
+    const __m256d nan = _mm256_set1_pd(NAN);
+
+    uint64_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d m = _mm256_loadu_pd(mag + i);
+        __m256d y = _mm256_mul_pd(_mm256_sub_pd(m, zp), _mm256_set1_pd(-0.4));
+        __m256d ok = _mm256_cmp_pd(m, m, _CMP_ORD_Q);
+        _mm256_storeu_pd(flux + i, _mm256_blendv_pd(nan, exp10_avx2(y), ok));
+    }
+    mag_to_flux_scalar(mag, i, count, zeropoint, flux);
+}
+
+#endif
+
+void flux_to_mag_block(const double* flux, const double* flux_err, uint64_t count, double zeropoint, double* mag, double* mag_err) {
+    if (!flux_err) mag_err = NULL;
+#ifdef GAIA_X86_DISPATCH
+    if (dispatch_level() >= 1) {
+        flux_to_mag_avx2(flux, flux_err, count, zeropoint, mag, mag_err);
+        return;
+    }
+#endif
+    flux_to_mag_scalar(flux, flux_err, 0, count, zeropoint, mag, mag_err);
+}
+
+void mag_to_flux_block(const double* mag, uint64_t count, double zeropoint, double* flux) {
+#ifdef GAIA_X86_DISPATCH
+    if (dispatch_level() >= 1) {
+        mag_to_flux_avx2(mag, count, zeropoint, flux);
+        return;
+    }
+#endif
+    mag_to_flux_scalar(mag, 0, count, zeropoint, flux);
+}
+
+uint64_t cone_filter_block(
+    const double* x, const double* y, const double* z,
+    uint64_t start, uint64_t end, const double center[3], double cos_r, uint64_t* out
+) {
+#ifdef GAIA_X86_DISPATCH
+    int level = dispatch_level();
+    if (level == 2) return cone_filter_avx512(x, y, z, start, end, center, cos_r, out);
+    if (level == 1) return cone_filter_avx2(x, y, z, start, end, center, cos_r, out);
+#endif
+    return cone_filter_scalar(x, y, z, start, end, center, cos_r, out);
+}
+
+void propagate_block(
+    const double* x, const double* y, const double* z,
+    const double* pmra, const double* pmdec, uint64_t start, uint64_t end,
+    double years, double* out_x, double* out_y, double* out_z
+) {
+#ifdef GAIA_X86_DISPATCH
+    if (dispatch_level() >= 1) {
+        propagate_avx2(x, y, z, pmra, pmdec, start, end, years, out_x, out_y, out_z);
+        return;
+    }
+#endif
+    propagate_scalar(x, y, z, pmra, pmdec, start, end, years, out_x, out_y, out_z);
+}
+
+void propagate_vec(const double v[3], double pmra, double pmdec, double years, double out[3]) {
+    double r = sqrt(v[0] * v[0] + v[1] * v[1]);
+    if (r == 0.0 || isnan(pmra) || isnan(pmdec)) {
+        out[0] = v[0];
+        out[1] = v[1];
+        out[2] = v[2];
+        return;
+    }
+
+    // Local east (increasing ra) and north (increasing dec) directions
+    const double mas2rad = M_PI / (180.0 * 3600.0 * 1000.0);
+    double east = pmra * years * mas2rad;
+    double north = pmdec * years * mas2rad;
+    double e[3] = {-v[1] / r, v[0] / r, 0.0};
+    double n[3] = {-v[2] * v[0] / r, -v[2] * v[1] / r, r};
+
+    double w[3];
+    for (int k = 0; k < 3; k++) w[k] = v[k] + east * e[k] + north * n[k];
+    double norm = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+    for (int k = 0; k < 3; k++) out[k] = w[k] / norm;
+}
+
+void radec_to_unit_vectors(const double* ra, const double* dec, uint64_t count, double* x, double* y, double* z) {
+    const double deg2rad = M_PI / 180.0;
+    for (uint64_t i = 0; i < count; i++) {
+        double r = ra[i] * deg2rad;
+        double d = dec[i] * deg2rad;
+        double cos_d = cos(d);
+        x[i] = cos_d * cos(r);
+        y[i] = cos_d * sin(r);
+        z[i] = sin(d);
+    }
+}
+
+void range_mask_block(const double* values, const double* divisor, uint64_t count, double lo, double hi, uint8_t* mask) {
+#ifdef GAIA_X86_DISPATCH
+    if (dispatch_level() >= 1) {
+        range_mask_avx2(values, divisor, count, lo, hi, mask);
+        return;
+    }
+#endif
+    range_mask_scalar(values, divisor, 0, count, lo, hi, mask);
+}
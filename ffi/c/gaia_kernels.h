@@ -0,0 +1,66 @@
+#ifndef GAIA_KERNELS_H
+#define GAIA_KERNELS_H
+
+#include <stdint.h>
+
+// Write the indices in [start, end) whose unit vector (x, y, z) satisfies
+// dot(v, center) >= cos_r to `out`, returning how many were written.
+// `out` must have room for end - start entries. Dispatches to AVX-512 or
+// AVX2 at runtime when the CPU supports them.
+uint64_t cone_filter_block(
+    const double* x,
+    const double* y,
+    const double* z,
+    uint64_t start,
+    uint64_t end,
+    const double center[3],
+    double cos_r,
+    uint64_t* out
+);
+
+// Fastest known Gaia DR3 proper motion (Barnard's star, ~10.4"/yr) plus
+// margin, for widening searches that propagate positions
+#define GAIA_MAX_PM_MAS_YR 10400.0
+
+// Move unit vector `v` along its proper motion over `years`: pmra (mas/yr,
+// already multiplied by cos dec) and pmdec (mas/yr). Linear motion in the
+// tangent plane, renormalized; positions exactly at a pole are unchanged.
+void propagate_vec(const double v[3], double pmra, double pmdec, double years, double out[3]);
+
+// propagate_vec over rows [start, end) of unit-vector and proper-motion
+// columns, writing row i to out_x/out_y/out_z[i - start]. Dispatches to
+// AVX2 at runtime like cone_filter_block.
+void propagate_block(
+    const double* x,
+    const double* y,
+    const double* z,
+    const double* pmra,
+    const double* pmdec,
+    uint64_t start,
+    uint64_t end,
+    double years,
+    double* out_x,
+    double* out_y,
+    double* out_z
+);
+
+// Clear mask[i] unless lo <= values[i] <= hi, or, with a non-NULL
+// `divisor`, unless divisor[i] > 0 and lo * divisor[i] <= values[i] <=
+// hi * divisor[i]. NaN never passes. Dispatches to AVX2 at runtime like
+// cone_filter_block.
+void range_mask_block(const double* values, const double* divisor, uint64_t count, double lo, double hi, uint8_t* mask);
+
+// Magnitudes zeropoint - 2.5 log10(flux) of `count` fluxes, NaN where the
+// flux is NaN or not positive, and with non-NULL `flux_err` and `mag_err`
+// the errors 2.5 / ln(10) * flux_err / flux. AVX2 when available, with a
+// vectorized log10 within a couple of ulps of libm.
+void flux_to_mag_block(const double* flux, const double* flux_err, uint64_t count, double zeropoint, double* mag, double* mag_err);
+
+// Fluxes 10^(-0.4 (mag - zeropoint)) of `count` magnitudes (NaN stays
+// NaN), e.g. 2MASS J/H/K with their Vega zeropoints. AVX2 when available.
+void mag_to_flux_block(const double* mag, uint64_t count, double zeropoint, double* flux);
+
+// Convert ra/dec (degrees) to unit vectors
+void radec_to_unit_vectors(const double* ra, const double* dec, uint64_t count, double* x, double* y, double* z);
+
+#endif
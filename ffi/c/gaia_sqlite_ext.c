@@ -0,0 +1,575 @@
+// SQLite loadable extension with native astrometry functions
+//
+//   ang_sep(ra1, dec1, ra2, dec2)          angular separation in degrees
+//   in_cone(ra, dec, ra0, dec0, cos_r)     1 if (ra, dec) is within the cone
+//   in_convex(ra, dec, vertices)           1 if (ra, dec) is within a convex
+//                                          polygon given as 'ra1 dec1 ra2 dec2 ...'
+//   healpix_nest(order, ra, dec)           nested HEALPix pixel
+//   gaia_healpix(source_id, order)         HEALPix pixel encoded in a Gaia source_id
+//
+// All angles are in degrees. Any NULL argument yields NULL.
+//
+// It also provides the eponymous virtual table `gaia_cone`, which exposes
+// the gaiadr3 columns for the stars inside a cone:
+//
+//   SELECT * FROM gaia_cone WHERE ra0 = ? AND dec0 = ? AND radius = ?
+//   SELECT * FROM gaia_cone(?, ?, ?)
+//
+// The cone is turned into HEALPix ranges over the indexed gaiadr3.hpx
+// column (level 12 pixel from source_id), and only pixels straddling the
+// cone edge get the exact cap test.
+//
+// Other tables with the same layout (such as the gaiadr3_g<N> magnitude
+// tiers) get their own cone table with a module argument:
+//
+//   CREATE VIRTUAL TABLE temp.gaiadr3_g10_cone USING gaia_cone(gaiadr3_g10)
+//
+// An upper bound on random_index (random_index < ? or <= ?) is pushed into
+// the per-range lookups, so with an (hpx, random_index) index a random
+// sample of a cone skips the table rows it doesn't keep.
+
+#include <math.h>
+#include <sqlite3ext.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "healpix.h"
+
+SQLITE_EXTENSION_INIT1
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#ifndef SQLITE_INNOCUOUS
+#define SQLITE_INNOCUOUS 0
+#endif
+
+#define DEG2RAD (M_PI / 180.0)
+#define RAD2DEG (180.0 / M_PI)
+
+// Cone center terms, cached on the ra0/dec0/cos_r arguments so they are
+// computed once per statement rather than once per row
+typedef struct {
+    double ra0;
+    double dec0;
+    double cos_r;
+    double sin_dec0;
+    double cos_dec0;
+    double radius_deg;
+} cone_terms;
+
+static int has_null(int argc, sqlite3_value** argv) {
+    for (int i = 0; i < argc; i++) {
+        if (sqlite3_value_type(argv[i]) == SQLITE_NULL) return 1;
+    }
+    return 0;
+}
+
+static void ang_sep_func(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+    if (has_null(argc, argv)) return;
+
+    double a[3], b[3];
+    radec_to_vec(sqlite3_value_double(argv[0]), sqlite3_value_double(argv[1]), a);
+    radec_to_vec(sqlite3_value_double(argv[2]), sqlite3_value_double(argv[3]), b);
+    sqlite3_result_double(ctx, vec_angle(a, b) * RAD2DEG);
+}
+
+static void in_cone_func(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+    if (has_null(argc, argv)) return;
+
+    double ra0 = sqlite3_value_double(argv[2]);
+    double dec0 = sqlite3_value_double(argv[3]);
+    double cos_r = sqlite3_value_double(argv[4]);
+
+    cone_terms* terms = sqlite3_get_auxdata(ctx, 4);
+    if (!terms || terms->ra0 != ra0 || terms->dec0 != dec0 || terms->cos_r != cos_r) {
+        terms = sqlite3_malloc(sizeof(cone_terms));
+        if (!terms) {
+            sqlite3_result_error_nomem(ctx);
+            return;
+        }
+        terms->ra0 = ra0;
+        terms->dec0 = dec0;
+        terms->cos_r = cos_r;
+        terms->sin_dec0 = sin(dec0 * DEG2RAD);
+        terms->cos_dec0 = cos(dec0 * DEG2RAD);
+        terms->radius_deg = acos(fmax(-1.0, fmin(1.0, cos_r))) * RAD2DEG;
+        sqlite3_set_auxdata(ctx, 4, terms, sqlite3_free);
+        // sqlite3_set_auxdata may free terms immediately on failure
+        terms = sqlite3_get_auxdata(ctx, 4);
+        if (!terms) {
+            sqlite3_result_error_nomem(ctx);
+            return;
+        }
+    }
+
+    double dec = sqlite3_value_double(argv[1]);
+
+    // Declination alone rules out most of the bounding box without trig
+    if (fabs(dec - terms->dec0) > terms->radius_deg) {
+        sqlite3_result_int(ctx, 0);
+        return;
+    }
+
+    double ra = sqlite3_value_double(argv[0]);
+    double dec_rad = dec * DEG2RAD;
+    double cos_sep = sin(dec_rad) * terms->sin_dec0 +
+                     cos(dec_rad) * terms->cos_dec0 * cos((ra - terms->ra0) * DEG2RAD);
+    sqlite3_result_int(ctx, cos_sep >= terms->cos_r);
+}
+
+// Read every number in the text as alternating ra, dec, so both
+// '10 20, 11 20, ...' and '[[10, 20], [11, 20], ...]' work
+static int parse_vertices(const char* text, double* radec, int max_values) {
+    int count = 0;
+    const char* p = text;
+    while (*p && count < max_values) {
+        if (strchr("+-.0123456789", *p)) {
+            char* end;
+            double value = strtod(p, &end);
+            if (end == p) {
+                p++;
+                continue;
+            }
+            radec[count++] = value;
+            p = end;
+        } else {
+            p++;
+        }
+    }
+    return *p ? -1 : count;
+}
+
+static void in_convex_func(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+    if (has_null(argc, argv)) return;
+
+    // Edge normals are built once per statement from the constant vertex list
+    hpx_polygon* polygon = sqlite3_get_auxdata(ctx, 2);
+    if (!polygon) {
+        double radec[2 * HPX_MAX_POLYGON_VERTICES];
+        int values = parse_vertices((const char*)sqlite3_value_text(argv[2]), radec, 2 * HPX_MAX_POLYGON_VERTICES);
+        polygon = sqlite3_malloc(sizeof(hpx_polygon));
+        if (!polygon) {
+            sqlite3_result_error_nomem(ctx);
+            return;
+        }
+        if (values < 0 || values % 2 != 0 || hpx_polygon_init(polygon, radec, values / 2) != 0) {
+            sqlite3_free(polygon);
+            sqlite3_result_error(ctx, "in_convex: vertices must be 3-64 ra dec pairs of a convex polygon", -1);
+            return;
+        }
+        sqlite3_set_auxdata(ctx, 2, polygon, sqlite3_free);
+        polygon = sqlite3_get_auxdata(ctx, 2);
+        if (!polygon) {
+            sqlite3_result_error_nomem(ctx);
+            return;
+        }
+    }
+
+    double v[3];
+    radec_to_vec(sqlite3_value_double(argv[0]), sqlite3_value_double(argv[1]), v);
+    sqlite3_result_int(ctx, hpx_polygon_contains(polygon, v));
+}
+
+static void healpix_nest_func(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+    if (has_null(argc, argv)) return;
+
+    int order = sqlite3_value_int(argv[0]);
+    if (order < 0 || order > 29) {
+        sqlite3_result_error(ctx, "healpix_nest: order must be between 0 and 29", -1);
+        return;
+    }
+    sqlite3_result_int64(ctx, healpix_ang2pix_nest(order, sqlite3_value_double(argv[1]), sqlite3_value_double(argv[2])));
+}
+
+static void gaia_healpix_func(sqlite3_context* ctx, int argc, sqlite3_value** argv) {
+    if (has_null(argc, argv)) return;
+
+    // source_id is stored as TEXT; value_int64 converts it exactly
+    sqlite3_int64 source_id = sqlite3_value_int64(argv[0]);
+    int order = sqlite3_value_int(argv[1]);
+    if (order < 0 || order > GAIA_HEALPIX_ORDER) {
+        sqlite3_result_error(ctx, "gaia_healpix: order must be between 0 and 12", -1);
+        return;
+    }
+    sqlite3_result_int64(ctx, gaia_source_healpix(source_id, order));
+}
+
+// gaia_cone virtual table
+
+#define CONE_MAX_RANGES_ORDER 10
+// Pixels per cone radius at the query order, so the interior of the cone
+// is covered by pixels classified inside and skips the cap test
+#define CONE_PIXELS_PER_RADIUS 4
+// Gaia DR3 source count, scaling the planner's row estimates by the
+// fraction of the sky a cone covers
+#define CONE_FULL_SKY_ROWS 1.8e9
+
+// Query plans (idxNum): every row in range, or only rows with
+// random_index below / at most a bound
+enum { CONE_PLAN_ALL, CONE_PLAN_RANDOM_LT, CONE_PLAN_RANDOM_LE, CONE_PLANS };
+
+typedef struct {
+    sqlite3_vtab base;
+    sqlite3* db;
+    int num_columns;
+    int ra_col;
+    int dec_col;
+    int ux_col; // statement column of ux, uy, uz or -1
+    int random_col; // declared column of random_index or -1
+    char* select_sql[CONE_PLANS];
+} cone_vtab;
+
+typedef struct {
+    sqlite3_vtab_cursor base;
+    sqlite3_stmt* stmt; // the plan's statement, from plans
+    sqlite3_stmt* plans[CONE_PLANS];
+    double random_bound;
+    int bounded;
+    hpx_ranges ranges;
+    size_t range;
+    int range_shift;
+    int eof;
+    double ra0;
+    double dec0;
+    double radius;
+    double center[3];
+    double cos_r;
+} cone_cursor;
+
+static int cone_connect(sqlite3* db, void* aux, int argc, const char* const* argv, sqlite3_vtab** out, char** err) {
+    (void)aux;
+
+    // argv[3] is the first module argument of CREATE VIRTUAL TABLE; the
+    // eponymous table reads gaiadr3
+    const char* table = argc > 3 ? argv[3] : "gaiadr3";
+
+    sqlite3_stmt* info;
+    char* info_sql = sqlite3_mprintf("SELECT name, type FROM pragma_table_info(%Q)", table);
+    if (!info_sql) return SQLITE_NOMEM;
+    int rc = sqlite3_prepare_v2(db, info_sql, -1, &info, NULL);
+    sqlite3_free(info_sql);
+    if (rc != SQLITE_OK) return rc;
+
+    sqlite3_str* schema = sqlite3_str_new(db);
+    sqlite3_str* select = sqlite3_str_new(db);
+    sqlite3_str_appendall(schema, "CREATE TABLE x(");
+    sqlite3_str_appendall(select, "SELECT rowid");
+
+    int num_columns = 0, ra_col = -1, dec_col = -1, random_col = -1, has_hpx = 0, unit_vectors = 0;
+    while (sqlite3_step(info) == SQLITE_ROW) {
+        const char* name = (const char*)sqlite3_column_text(info, 0);
+        const char* type = (const char*)sqlite3_column_text(info, 1);
+        if (strcmp(name, "hpx") == 0) {
+            has_hpx = 1;
+            continue;
+        }
+        if (strcmp(name, "ux") == 0 || strcmp(name, "uy") == 0 || strcmp(name, "uz") == 0) {
+            unit_vectors++;
+            continue;
+        }
+        if (strcmp(name, "ra") == 0) ra_col = num_columns;
+        if (strcmp(name, "dec") == 0) dec_col = num_columns;
+        if (strcmp(name, "random_index") == 0) random_col = num_columns;
+        sqlite3_str_appendf(schema, "%s\"%w\" %s", num_columns ? ", " : "", name, type ? type : "");
+        sqlite3_str_appendf(select, ", \"%w\"", name);
+        num_columns++;
+    }
+    sqlite3_finalize(info);
+
+    // Precomputed unit vectors follow the declared columns when present
+    if (unit_vectors == 3) sqlite3_str_appendall(select, ", ux, uy, uz");
+    sqlite3_str_appendall(schema, ", ra0 HIDDEN, dec0 HIDDEN, radius HIDDEN)");
+    sqlite3_str_appendf(select, " FROM \"%w\" WHERE hpx >= ?1 AND hpx < ?2", table);
+    char* schema_sql = sqlite3_str_finish(schema);
+    char* select_sql = sqlite3_str_finish(select);
+
+    if (!has_hpx || ra_col < 0 || dec_col < 0) {
+        *err = sqlite3_mprintf("gaia_cone needs %s with ra, dec and an indexed hpx column", table);
+        sqlite3_free(schema_sql);
+        sqlite3_free(select_sql);
+        return SQLITE_ERROR;
+    }
+
+    rc = sqlite3_declare_vtab(db, schema_sql);
+    sqlite3_free(schema_sql);
+    if (rc != SQLITE_OK) {
+        sqlite3_free(select_sql);
+        return rc;
+    }
+
+    cone_vtab* vtab = sqlite3_malloc(sizeof(cone_vtab));
+    if (!vtab) {
+        sqlite3_free(select_sql);
+        return SQLITE_NOMEM;
+    }
+    memset(vtab, 0, sizeof(cone_vtab));
+    vtab->db = db;
+    vtab->num_columns = num_columns;
+    vtab->ra_col = ra_col;
+    vtab->dec_col = dec_col;
+    vtab->ux_col = unit_vectors == 3 ? num_columns + 1 : -1;
+    vtab->random_col = random_col;
+    vtab->select_sql[CONE_PLAN_ALL] = select_sql;
+    if (random_col >= 0) {
+        vtab->select_sql[CONE_PLAN_RANDOM_LT] = sqlite3_mprintf("%s AND random_index < ?3", select_sql);
+        vtab->select_sql[CONE_PLAN_RANDOM_LE] = sqlite3_mprintf("%s AND random_index <= ?3", select_sql);
+    }
+    *out = &vtab->base;
+    return SQLITE_OK;
+}
+
+static int cone_disconnect(sqlite3_vtab* base) {
+    cone_vtab* vtab = (cone_vtab*)base;
+    for (int plan = 0; plan < CONE_PLANS; plan++) sqlite3_free(vtab->select_sql[plan]);
+    sqlite3_free(vtab);
+    return SQLITE_OK;
+}
+
+static int cone_best_index(sqlite3_vtab* base, sqlite3_index_info* info) {
+    cone_vtab* vtab = (cone_vtab*)base;
+    int args[3] = {-1, -1, -1};
+    int random_bound = -1;
+
+    for (int i = 0; i < info->nConstraint; i++) {
+        const struct sqlite3_index_constraint* c = &info->aConstraint[i];
+        if (!c->usable) continue;
+        if (c->iColumn == vtab->random_col && vtab->random_col >= 0 &&
+            (c->op == SQLITE_INDEX_CONSTRAINT_LT || c->op == SQLITE_INDEX_CONSTRAINT_LE)) {
+            random_bound = i;
+            continue;
+        }
+        int hidden = c->iColumn - vtab->num_columns;
+        if (hidden < 0 || hidden > 2) continue;
+        if (c->op != SQLITE_INDEX_CONSTRAINT_EQ) continue;
+        args[hidden] = i;
+    }
+
+    if (args[0] < 0 || args[1] < 0 || args[2] < 0) {
+        // Only a fully specified cone can be answered
+        return SQLITE_CONSTRAINT;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        info->aConstraintUsage[args[i]].argvIndex = i + 1;
+        info->aConstraintUsage[args[i]].omit = 1;
+    }
+    // Rows scale with the cone area when the radius is known at plan
+    // time (sqlite3_vtab_rhs_value needs SQLite 3.38)
+    double rows = 1000.0;
+    sqlite3_value* radius = NULL;
+    if (sqlite3_libversion_number() >= 3038000 &&
+        sqlite3_vtab_rhs_value(info, args[2], &radius) == SQLITE_OK && radius) {
+        double r = sqlite3_value_double(radius) * DEG2RAD;
+        if (r > M_PI) r = M_PI;
+        rows = r > 0 ? (1.0 - cos(r)) / 2.0 * CONE_FULL_SKY_ROWS : 1.0;
+        if (rows < 1.0) rows = 1.0;
+    }
+    info->idxNum = CONE_PLAN_ALL;
+    info->estimatedCost = rows;
+    info->estimatedRows = (sqlite3_int64)rows;
+
+    if (random_bound >= 0) {
+        info->aConstraintUsage[random_bound].argvIndex = 4;
+        info->aConstraintUsage[random_bound].omit = 1;
+        info->idxNum = info->aConstraint[random_bound].op == SQLITE_INDEX_CONSTRAINT_LT
+            ? CONE_PLAN_RANDOM_LT
+            : CONE_PLAN_RANDOM_LE;
+        info->estimatedCost = rows / 10.0;
+        info->estimatedRows = (sqlite3_int64)(rows / 10.0) + 1;
+    }
+    return SQLITE_OK;
+}
+
+static int cone_open(sqlite3_vtab* base, sqlite3_vtab_cursor** out) {
+    (void)base;
+    cone_cursor* cursor = sqlite3_malloc(sizeof(cone_cursor));
+    if (!cursor) return SQLITE_NOMEM;
+    memset(cursor, 0, sizeof(cone_cursor));
+    *out = &cursor->base;
+    return SQLITE_OK;
+}
+
+static int cone_close(sqlite3_vtab_cursor* base) {
+    cone_cursor* cursor = (cone_cursor*)base;
+    for (int plan = 0; plan < CONE_PLANS; plan++) sqlite3_finalize(cursor->plans[plan]);
+    hpx_ranges_free(&cursor->ranges);
+    sqlite3_free(cursor);
+    return SQLITE_OK;
+}
+
+// Bind the current pixel range, or flag EOF when none are left
+static int cone_start_range(cone_cursor* cursor) {
+    sqlite3_reset(cursor->stmt);
+    if (cursor->range >= cursor->ranges.count) {
+        cursor->eof = 1;
+        return SQLITE_OK;
+    }
+    const hpx_range* range = &cursor->ranges.items[cursor->range];
+    sqlite3_bind_int64(cursor->stmt, 1, range->lo << cursor->range_shift);
+    sqlite3_bind_int64(cursor->stmt, 2, range->hi << cursor->range_shift);
+    if (cursor->bounded) sqlite3_bind_double(cursor->stmt, 3, cursor->random_bound);
+    return SQLITE_OK;
+}
+
+static int cone_next(sqlite3_vtab_cursor* base) {
+    cone_cursor* cursor = (cone_cursor*)base;
+    cone_vtab* vtab = (cone_vtab*)base->pVtab;
+
+    while (!cursor->eof) {
+        int rc = sqlite3_step(cursor->stmt);
+        if (rc == SQLITE_ROW) {
+            if (cursor->ranges.items[cursor->range].inside) return SQLITE_OK;
+
+            double v[3];
+            sqlite3_stmt* stmt = cursor->stmt;
+            if (vtab->ux_col >= 0 && sqlite3_column_type(stmt, vtab->ux_col) != SQLITE_NULL) {
+                v[0] = sqlite3_column_double(stmt, vtab->ux_col);
+                v[1] = sqlite3_column_double(stmt, vtab->ux_col + 1);
+                v[2] = sqlite3_column_double(stmt, vtab->ux_col + 2);
+            } else {
+                radec_to_vec(sqlite3_column_double(stmt, vtab->ra_col + 1),
+                             sqlite3_column_double(stmt, vtab->dec_col + 1), v);
+            }
+            double dot = v[0] * cursor->center[0] + v[1] * cursor->center[1] + v[2] * cursor->center[2];
+            if (dot >= cursor->cos_r) return SQLITE_OK;
+            continue;
+        }
+        if (rc != SQLITE_DONE) return rc;
+
+        cursor->range++;
+        cone_start_range(cursor);
+    }
+    return SQLITE_OK;
+}
+
+// Coarsest order whose pixels are a fraction of the cone radius: the
+// pixels inside the cone are classified inside and read without the cap
+// test, and only a thin ring of edge pixels is read beyond the cone,
+// while the number of range lookups stays around a hundred
+static int cone_query_order(double radius_rad) {
+    int order = 0;
+    while (order < CONE_MAX_RANGES_ORDER &&
+           healpix_max_pixrad(order) * CONE_PIXELS_PER_RADIUS > radius_rad) {
+        order++;
+    }
+    return order;
+}
+
+static int cone_filter(sqlite3_vtab_cursor* base, int idx_num, const char* idx_str, int argc, sqlite3_value** argv) {
+    cone_cursor* cursor = (cone_cursor*)base;
+    cone_vtab* vtab = (cone_vtab*)base->pVtab;
+    (void)idx_str;
+
+    cursor->eof = 0;
+    cursor->range = 0;
+    cursor->ranges.count = 0;
+
+    if (argc < 3 || has_null(argc, argv)) {
+        cursor->eof = 1;
+        return SQLITE_OK;
+    }
+
+    // Each plan's statement is prepared on first use by this cursor
+    if (idx_num < 0 || idx_num >= CONE_PLANS || !vtab->select_sql[idx_num]) return SQLITE_ERROR;
+    if (!cursor->plans[idx_num]) {
+        int rc = sqlite3_prepare_v2(vtab->db, vtab->select_sql[idx_num], -1, &cursor->plans[idx_num], NULL);
+        if (rc != SQLITE_OK) return rc;
+    }
+    if (cursor->stmt && cursor->stmt != cursor->plans[idx_num]) sqlite3_reset(cursor->stmt);
+    cursor->stmt = cursor->plans[idx_num];
+    cursor->bounded = idx_num != CONE_PLAN_ALL && argc > 3;
+    if (cursor->bounded) cursor->random_bound = sqlite3_value_double(argv[3]);
+
+    cursor->ra0 = sqlite3_value_double(argv[0]);
+    cursor->dec0 = sqlite3_value_double(argv[1]);
+    cursor->radius = sqlite3_value_double(argv[2]);
+
+    hpx_cone cone;
+    radec_to_vec(cursor->ra0, cursor->dec0, cone.center);
+    cone.radius = cursor->radius * DEG2RAD;
+    memcpy(cursor->center, cone.center, sizeof(cone.center));
+    cursor->cos_r = cos(cone.radius);
+
+    int order = cone_query_order(cone.radius);
+    cursor->range_shift = 2 * (GAIA_HEALPIX_ORDER - order);
+    if (healpix_query_region(order, healpix_classify_cone, &cone, &cursor->ranges) != 0) {
+        return SQLITE_NOMEM;
+    }
+
+    cone_start_range(cursor);
+    return cone_next(base);
+}
+
+static int cone_eof(sqlite3_vtab_cursor* base) {
+    return ((cone_cursor*)base)->eof;
+}
+
+static int cone_column(sqlite3_vtab_cursor* base, sqlite3_context* ctx, int column) {
+    cone_cursor* cursor = (cone_cursor*)base;
+    cone_vtab* vtab = (cone_vtab*)base->pVtab;
+
+    switch (column - vtab->num_columns) {
+        case 0:
+            sqlite3_result_double(ctx, cursor->ra0);
+            break;
+        case 1:
+            sqlite3_result_double(ctx, cursor->dec0);
+            break;
+        case 2:
+            sqlite3_result_double(ctx, cursor->radius);
+            break;
+        default:
+            sqlite3_result_value(ctx, sqlite3_column_value(cursor->stmt, column + 1));
+    }
+    return SQLITE_OK;
+}
+
+static int cone_rowid(sqlite3_vtab_cursor* base, sqlite3_int64* rowid) {
+    *rowid = sqlite3_column_int64(((cone_cursor*)base)->stmt, 0);
+    return SQLITE_OK;
+}
+
+static sqlite3_module cone_module = {
+    .iVersion = 0,
+    .xCreate = cone_connect, // same as xConnect, so also eponymous
+    .xConnect = cone_connect,
+    .xBestIndex = cone_best_index,
+    .xDisconnect = cone_disconnect,
+    .xDestroy = cone_disconnect,
+    .xOpen = cone_open,
+    .xClose = cone_close,
+    .xFilter = cone_filter,
+    .xNext = cone_next,
+    .xEof = cone_eof,
+    .xColumn = cone_column,
+    .xRowid = cone_rowid,
+};
+
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+int sqlite3_gaiasqlite_init(sqlite3* db, char** pzErrMsg, const sqlite3_api_routines* pApi) {
+    SQLITE_EXTENSION_INIT2(pApi);
+    (void)pzErrMsg;
+
+    const int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS;
+    int rc = sqlite3_create_function(db, "ang_sep", 4, flags, NULL, ang_sep_func, NULL, NULL);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "in_cone", 5, flags, NULL, in_cone_func, NULL, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "in_convex", 3, flags, NULL, in_convex_func, NULL, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "healpix_nest", 3, flags, NULL, healpix_nest_func, NULL, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "gaia_healpix", 2, flags, NULL, gaia_healpix_func, NULL, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_module(db, "gaia_cone", &cone_module, NULL);
+    }
+    return rc;
+}
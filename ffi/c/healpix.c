@@ -0,0 +1,359 @@
+#include "healpix.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define HALF_PI (M_PI / 2.0)
+#define DEG2RAD (M_PI / 180.0)
+
+// Padding added to pixel radii so rounding never drops a border star
+#define PIXRAD_EPSILON 1e-9
+
+static const int jrll[12] = {2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4};
+static const int jpll[12] = {1, 3, 5, 7, 0, 2, 4, 6, 1, 3, 5, 7};
+
+// Interleave the lower 32 bits of v with zeros
+static int64_t spread_bits(int64_t v) {
+    uint64_t x = (uint64_t)v & 0xffffffffULL;
+    x = (x | (x << 16)) & 0x0000ffff0000ffffULL;
+    x = (x | (x << 8)) & 0x00ff00ff00ff00ffULL;
+    x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    x = (x | (x << 2)) & 0x3333333333333333ULL;
+    x = (x | (x << 1)) & 0x5555555555555555ULL;
+    return (int64_t)x;
+}
+
+// Inverse of spread_bits: gather every other bit
+static int64_t compress_bits(int64_t v) {
+    uint64_t x = (uint64_t)v & 0x5555555555555555ULL;
+    x = (x | (x >> 1)) & 0x3333333333333333ULL;
+    x = (x | (x >> 2)) & 0x0f0f0f0f0f0f0f0fULL;
+    x = (x | (x >> 4)) & 0x00ff00ff00ff00ffULL;
+    x = (x | (x >> 8)) & 0x0000ffff0000ffffULL;
+    x = (x | (x >> 16)) & 0x00000000ffffffffULL;
+    return (int64_t)x;
+}
+
+int64_t healpix_npix(int order) {
+    return 12LL << (2 * order);
+}
+
+int64_t gaia_source_healpix(int64_t source_id, int order) {
+    if (order < 0 || order > GAIA_HEALPIX_ORDER) {
+        return -1;
+    }
+    return (source_id >> GAIA_HEALPIX_SHIFT) >> (2 * (GAIA_HEALPIX_ORDER - order));
+}
+
+void radec_to_vec(double ra_deg, double dec_deg, double vec[3]) {
+    double ra = ra_deg * DEG2RAD;
+    double dec = dec_deg * DEG2RAD;
+    double cos_dec = cos(dec);
+    vec[0] = cos_dec * cos(ra);
+    vec[1] = cos_dec * sin(ra);
+    vec[2] = sin(dec);
+}
+
+double vec_angle(const double a[3], const double b[3]) {
+    // atan2 of cross and dot stays accurate for tiny and near-antipodal angles
+    double cx = a[1] * b[2] - a[2] * b[1];
+    double cy = a[2] * b[0] - a[0] * b[2];
+    double cz = a[0] * b[1] - a[1] * b[0];
+    double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    return atan2(sqrt(cx * cx + cy * cy + cz * cz), dot);
+}
+
+int64_t healpix_ang2pix_nest(int order, double ra_deg, double dec_deg) {
+    int64_t nside = 1LL << order;
+    double z = sin(dec_deg * DEG2RAD);
+    double za = fabs(z);
+    double phi = fmod(ra_deg * DEG2RAD, 2.0 * M_PI);
+    if (phi < 0) phi += 2.0 * M_PI;
+    double tt = phi / HALF_PI; // in [0, 4)
+    if (tt >= 4.0) tt = 0.0;
+
+    int face;
+    int64_t ix, iy;
+
+    if (za <= 2.0 / 3.0) {
+        // Equatorial region
+        double temp1 = nside * (0.5 + tt);
+        double temp2 = nside * (z * 0.75);
+        int64_t jp = (int64_t)(temp1 - temp2);
+        int64_t jm = (int64_t)(temp1 + temp2);
+        int64_t ifp = jp >> order;
+        int64_t ifm = jm >> order;
+        face = (ifp == ifm) ? (int)(ifp | 4) : ((ifp < ifm) ? (int)ifp : (int)(ifm + 8));
+        ix = jm & (nside - 1);
+        iy = nside - (jp & (nside - 1)) - 1;
+    } else {
+        // Polar caps
+        int ntt = (int)tt;
+        if (ntt >= 4) ntt = 3;
+        double tp = tt - ntt;
+        double tmp = nside * sqrt(3.0 * (1.0 - za));
+        int64_t jp = (int64_t)(tp * tmp);
+        int64_t jm = (int64_t)((1.0 - tp) * tmp);
+        if (jp >= nside) jp = nside - 1;
+        if (jm >= nside) jm = nside - 1;
+        if (z >= 0) {
+            face = ntt;
+            ix = nside - jm - 1;
+            iy = nside - jp - 1;
+        } else {
+            face = ntt + 8;
+            ix = jp;
+            iy = jm;
+        }
+    }
+
+    return ((int64_t)face << (2 * order)) + spread_bits(ix) + (spread_bits(iy) << 1);
+}
+
+void healpix_pix2vec_nest(int order, int64_t pix, double vec[3]) {
+    int64_t nside = 1LL << order;
+    int64_t npface = nside * nside;
+    double fact2 = 4.0 / (double)healpix_npix(order);
+    double fact1 = (double)(nside << 1) * fact2;
+
+    int face = (int)(pix >> (2 * order));
+    int64_t ipf = pix & (npface - 1);
+    int64_t ix = compress_bits(ipf);
+    int64_t iy = compress_bits(ipf >> 1);
+
+    int64_t jr = ((int64_t)jrll[face] << order) - ix - iy - 1;
+    int64_t nr;
+    double z;
+
+    if (jr < nside) {
+        nr = jr;
+        z = 1.0 - (double)(nr * nr) * fact2;
+    } else if (jr > 3 * nside) {
+        nr = nside * 4 - jr;
+        z = (double)(nr * nr) * fact2 - 1.0;
+    } else {
+        nr = nside;
+        z = (double)(2 * nside - jr) * fact1;
+    }
+
+    int64_t tmp = (int64_t)jpll[face] * nr + ix - iy;
+    if (tmp < 0) tmp += 8 * nr;
+    double phi = (nr == nside)
+        ? 0.75 * HALF_PI * (double)tmp * fact1
+        : (0.5 * HALF_PI * (double)tmp) / (double)nr;
+
+    double sin_theta = sqrt((1.0 - z) * (1.0 + z));
+    vec[0] = sin_theta * cos(phi);
+    vec[1] = sin_theta * sin(phi);
+    vec[2] = z;
+}
+
+double healpix_max_pixrad(int order) {
+    // Largest center-to-corner distance of any pixel at this order
+    // (same construction as Healpix_Base::max_pixrad)
+    double nside = (double)(1LL << order);
+    double va[3], vb[3];
+    double z = 2.0 / 3.0;
+    double phi = M_PI / (4.0 * nside);
+    double st = sqrt((1.0 - z) * (1.0 + z));
+    va[0] = st * cos(phi);
+    va[1] = st * sin(phi);
+    va[2] = z;
+
+    double t1 = 1.0 - 1.0 / nside;
+    t1 *= t1;
+    z = 1.0 - t1 / 3.0;
+    st = sqrt((1.0 - z) * (1.0 + z));
+    vb[0] = st;
+    vb[1] = 0.0;
+    vb[2] = z;
+
+    return vec_angle(va, vb) + PIXRAD_EPSILON;
+}
+
+int healpix_classify_cone(const void* region, const double center[3], double pixrad) {
+    const hpx_cone* cone = (const hpx_cone*)region;
+    double d = vec_angle(cone->center, center);
+    if (d > cone->radius + pixrad) return HPX_OUTSIDE;
+    if (d + pixrad <= cone->radius) return HPX_INSIDE;
+    return HPX_PARTIAL;
+}
+
+// Polygons
+
+#define POLYGON_EPSILON 1e-12
+
+int hpx_polygon_init(hpx_polygon* polygon, const double* radec, int count) {
+    if (count < 3 || count > HPX_MAX_POLYGON_VERTICES) return -1;
+
+    double vertices[HPX_MAX_POLYGON_VERTICES][3];
+    for (int i = 0; i < count; i++) {
+        radec_to_vec(radec[2 * i], radec[2 * i + 1], vertices[i]);
+    }
+
+    for (int i = 0; i < count; i++) {
+        const double* a = vertices[i];
+        const double* b = vertices[(i + 1) % count];
+        double* n = polygon->normals[i];
+        n[0] = a[1] * b[2] - a[2] * b[1];
+        n[1] = a[2] * b[0] - a[0] * b[2];
+        n[2] = a[0] * b[1] - a[1] * b[0];
+        double norm = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (norm < POLYGON_EPSILON) return -1;
+        for (int k = 0; k < 3; k++) n[k] /= norm;
+    }
+    polygon->count = count;
+
+    // Clockwise input: flip so the interior is on the positive side
+    const double* n0 = polygon->normals[0];
+    const double* v2 = vertices[2 % count];
+    if (n0[0] * v2[0] + n0[1] * v2[1] + n0[2] * v2[2] < 0) {
+        for (int i = 0; i < count; i++) {
+            for (int k = 0; k < 3; k++) polygon->normals[i][k] = -polygon->normals[i][k];
+        }
+    }
+
+    // Convex: every vertex is on the inner side of every edge
+    for (int i = 0; i < count; i++) {
+        const double* n = polygon->normals[i];
+        for (int j = 0; j < count; j++) {
+            const double* v = vertices[j];
+            if (n[0] * v[0] + n[1] * v[1] + n[2] * v[2] < -POLYGON_EPSILON) return -1;
+        }
+    }
+    return 0;
+}
+
+int hpx_polygon_contains(const hpx_polygon* polygon, const double v[3]) {
+    for (int i = 0; i < polygon->count; i++) {
+        const double* n = polygon->normals[i];
+        if (n[0] * v[0] + n[1] * v[1] + n[2] * v[2] < 0) return 0;
+    }
+    return 1;
+}
+
+int healpix_classify_polygon(const void* region, const double center[3], double pixrad) {
+    const hpx_polygon* polygon = (const hpx_polygon*)region;
+    double sin_pixrad = sin(pixrad);
+    int inside = 1;
+    for (int i = 0; i < polygon->count; i++) {
+        const double* n = polygon->normals[i];
+        // Sine of the center's angular distance above this edge's great circle
+        double height = n[0] * center[0] + n[1] * center[1] + n[2] * center[2];
+        if (height < -sin_pixrad) return HPX_OUTSIDE;
+        if (height < sin_pixrad) inside = 0;
+    }
+    return inside ? HPX_INSIDE : HPX_PARTIAL;
+}
+
+// Boxes
+
+static double box_ra_width(const hpx_box* box) {
+    double width = box->ra_max - box->ra_min;
+    return width < 0 ? width + 360.0 : width;
+}
+
+int hpx_box_contains(const hpx_box* box, double ra_deg, double dec_deg) {
+    if (!(dec_deg >= box->dec_min && dec_deg <= box->dec_max)) return 0;
+    double offset = fmod(ra_deg - box->ra_min + 360.0, 360.0);
+    return offset <= box_ra_width(box) || box->ra_max - box->ra_min >= 360.0;
+}
+
+int healpix_classify_box(const void* region, const double center[3], double pixrad) {
+    const hpx_box* box = (const hpx_box*)region;
+    double dec = asin(center[2]) / DEG2RAD;
+    double ra = atan2(center[1], center[0]) / DEG2RAD;
+    double radius = pixrad / DEG2RAD;
+
+    if (dec - radius > box->dec_max || dec + radius < box->dec_min) return HPX_OUTSIDE;
+    int dec_inside = dec - radius >= box->dec_min && dec + radius <= box->dec_max;
+
+    if (box->ra_max - box->ra_min >= 360.0) return dec_inside ? HPX_INSIDE : HPX_PARTIAL;
+
+    // RA half-width of the pixel's bounding cap; a cap over a pole spans all RA
+    double cos_dec = sqrt(center[0] * center[0] + center[1] * center[1]);
+    if (cos_dec <= sin(pixrad)) return HPX_PARTIAL;
+    double half_width = asin(sin(pixrad) / cos_dec) / DEG2RAD;
+
+    double width = box_ra_width(box);
+    double offset = fmod(ra - box->ra_min + 720.0, 360.0);
+    if (offset > width + half_width && offset + half_width < 360.0) return HPX_OUTSIDE;
+    if (dec_inside && offset - half_width >= 0 && offset + half_width <= width) return HPX_INSIDE;
+    return HPX_PARTIAL;
+}
+
+static int append_range(hpx_ranges* out, int64_t lo, int64_t hi, int inside) {
+    if (out->count > 0) {
+        hpx_range* last = &out->items[out->count - 1];
+        if (last->hi == lo && last->inside == inside) {
+            last->hi = hi;
+            return 0;
+        }
+    }
+    if (out->count == out->capacity) {
+        size_t capacity = out->capacity ? out->capacity * 2 : 64;
+        hpx_range* items = realloc(out->items, capacity * sizeof(hpx_range));
+        if (!items) return -1;
+        out->items = items;
+        out->capacity = capacity;
+    }
+    out->items[out->count].lo = lo;
+    out->items[out->count].hi = hi;
+    out->items[out->count].inside = inside;
+    out->count++;
+    return 0;
+}
+
+static int query_pixel(
+    int order,
+    int pix_order,
+    int64_t pix,
+    const double* pixrads,
+    hpx_classify_fn classify,
+    const void* region,
+    hpx_ranges* out
+) {
+    double center[3];
+    healpix_pix2vec_nest(pix_order, pix, center);
+
+    int state = classify(region, center, pixrads[pix_order]);
+    if (state == HPX_OUTSIDE) return 0;
+
+    int shift = 2 * (order - pix_order);
+    if (state == HPX_INSIDE || pix_order == order) {
+        return append_range(out, pix << shift, (pix + 1) << shift, state == HPX_INSIDE);
+    }
+
+    for (int child = 0; child < 4; child++) {
+        if (query_pixel(order, pix_order + 1, (pix << 2) + child, pixrads, classify, region, out) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int healpix_query_region(int order, hpx_classify_fn classify, const void* region, hpx_ranges* out) {
+    double pixrads[30];
+    for (int o = 0; o <= order; o++) {
+        pixrads[o] = healpix_max_pixrad(o);
+    }
+
+    out->count = 0;
+    for (int64_t face = 0; face < 12; face++) {
+        if (query_pixel(order, 0, face, pixrads, classify, region, out) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void hpx_ranges_free(hpx_ranges* ranges) {
+    free(ranges->items);
+    ranges->items = NULL;
+    ranges->count = 0;
+    ranges->capacity = 0;
+}
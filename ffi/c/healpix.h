@@ -0,0 +1,81 @@
+#ifndef GAIA_HEALPIX_H
+#define GAIA_HEALPIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Gaia DR3 source_ids carry the level 12 nested HEALPix pixel in their
+// upper bits: healpix12 = source_id / 2^35
+#define GAIA_HEALPIX_ORDER 12
+#define GAIA_HEALPIX_SHIFT 35
+
+#define HPX_OUTSIDE 0
+#define HPX_PARTIAL 1
+#define HPX_INSIDE 2
+
+// A run of nested pixels [lo, hi) at the query order. `inside` is set when
+// every pixel in the run lies entirely within the region.
+typedef struct {
+    int64_t lo;
+    int64_t hi;
+    int inside;
+} hpx_range;
+
+typedef struct {
+    hpx_range* items;
+    size_t count;
+    size_t capacity;
+} hpx_ranges;
+
+// Classify a pixel (center unit vector + bounding radius in radians)
+// against a region: HPX_OUTSIDE, HPX_PARTIAL or HPX_INSIDE
+typedef int (*hpx_classify_fn)(const void* region, const double center[3], double pixrad);
+
+typedef struct {
+    double center[3];
+    double radius; // radians
+} hpx_cone;
+
+// Convex spherical polygon as the inward normals of its edges: a point is
+// inside when it lies on the positive side of every edge's great circle
+#define HPX_MAX_POLYGON_VERTICES 64
+
+typedef struct {
+    double normals[HPX_MAX_POLYGON_VERTICES][3];
+    int count;
+} hpx_polygon;
+
+// RA/Dec box in degrees; ra_min > ra_max wraps through RA 0
+typedef struct {
+    double ra_min;
+    double ra_max;
+    double dec_min;
+    double dec_max;
+} hpx_box;
+
+int64_t healpix_npix(int order);
+int64_t healpix_ang2pix_nest(int order, double ra_deg, double dec_deg);
+void healpix_pix2vec_nest(int order, int64_t pix, double vec[3]);
+double healpix_max_pixrad(int order);
+int64_t gaia_source_healpix(int64_t source_id, int order);
+
+void radec_to_vec(double ra_deg, double dec_deg, double vec[3]);
+double vec_angle(const double a[3], const double b[3]);
+
+// Collect the pixel ranges at `order` that may intersect a region, walking
+// the nested hierarchy from the 12 base pixels down. Ranges come out sorted
+// and merged. Returns 0 on success, -1 on allocation failure.
+int healpix_query_region(int order, hpx_classify_fn classify, const void* region, hpx_ranges* out);
+int healpix_classify_cone(const void* cone, const double center[3], double pixrad);
+
+// Build a polygon from `count` (ra, dec) degree pairs in either winding.
+// Returns -1 if it is degenerate, not convex or has too many vertices.
+int hpx_polygon_init(hpx_polygon* polygon, const double* radec, int count);
+int hpx_polygon_contains(const hpx_polygon* polygon, const double v[3]);
+int healpix_classify_polygon(const void* polygon, const double center[3], double pixrad);
+
+int hpx_box_contains(const hpx_box* box, double ra_deg, double dec_deg);
+int healpix_classify_box(const void* box, const double center[3], double pixrad);
+void hpx_ranges_free(hpx_ranges* ranges);
+
+#endif
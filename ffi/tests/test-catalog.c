@@ -0,0 +1,1032 @@
+// How to run:
+// gcc -O2 -DSQLITE_CORE -I../c -o test-catalog test-catalog.c ../c/gaia_catalog.c ../c/healpix.c ../c/gaia_kernels.c ../c/gaia_sqlite_ext.c -lsqlite3 -lm -lpthread && ./test-catalog
+//
+// Checks the vectorized kernels against scalar references, and every
+// catalog search, filter and aggregate against brute force over a random
+// catalog written to ./test-catalog.cat. The gaia_cone virtual table is
+// checked over the same stars in an in-memory SQLite database.
+
+#include <math.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gaia_catalog.h"
+#include "gaia_kernels.h"
+#include "healpix.h"
+
+#define NUM_STARS 100000
+#define NUM_QUERIES 40
+#define KERNEL_COUNT 1003 // not a multiple of any vector width
+#define CATALOG_PATH "./test-catalog.cat"
+
+static const double DEG = M_PI / 180.0;
+
+static int failures = 0;
+
+static void check(int ok, const char *name, const char *detail)
+{
+    if (ok)
+    {
+        printf("PASS %s\n", name);
+    }
+    else
+    {
+        printf("FAIL %s: %s\n", name, detail);
+        failures++;
+    }
+}
+
+// Deterministic uniform doubles in [0, 1)
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+static double uniform(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void unit_vector(double ra, double dec, double v[3])
+{
+    v[0] = cos(dec * DEG) * cos(ra * DEG);
+    v[1] = cos(dec * DEG) * sin(ra * DEG);
+    v[2] = sin(dec * DEG);
+}
+
+static double dot(const double a[3], const double b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Kernels
+
+static void test_kernels(void)
+{
+    int n = KERNEL_COUNT;
+    double *ra = malloc(n * sizeof(double)), *dec = malloc(n * sizeof(double));
+    double *x = malloc(n * sizeof(double)), *y = malloc(n * sizeof(double)), *z = malloc(n * sizeof(double));
+    double *pmra = malloc(n * sizeof(double)), *pmdec = malloc(n * sizeof(double));
+    for (int i = 0; i < n; i++)
+    {
+        ra[i] = uniform() * 360.0;
+        dec[i] = asin(2.0 * uniform() - 1.0) / DEG;
+        pmra[i] = (uniform() - 0.5) * 2000.0;
+        pmdec[i] = (uniform() - 0.5) * 2000.0;
+    }
+
+    // radec_to_unit_vectors
+    radec_to_unit_vectors(ra, dec, n, x, y, z);
+    double worst = 0;
+    for (int i = 0; i < n; i++)
+    {
+        double v[3];
+        unit_vector(ra[i], dec[i], v);
+        worst = fmax(worst, fmax(fabs(x[i] - v[0]), fmax(fabs(y[i] - v[1]), fabs(z[i] - v[2]))));
+    }
+    check(worst < 1e-12, "radec_to_unit_vectors", "differs from cos/sin");
+
+    // cone_filter_block: only rows within rounding of the edge may differ
+    {
+        double center[3];
+        unit_vector(uniform() * 360.0, uniform() * 180.0 - 90.0, center);
+        double cos_r = cos(60.0 * DEG);
+        uint64_t *out = malloc(n * sizeof(uint64_t));
+        uint64_t start = 7, found = cone_filter_block(x, y, z, start, n, center, cos_r, out);
+        uint64_t j = 0;
+        int ok = 1;
+        for (uint64_t i = start; i < (uint64_t)n && ok; i++)
+        {
+            double v[3] = {x[i], y[i], z[i]};
+            int inside = dot(v, center) >= cos_r;
+            int listed = j < found && out[j] == i;
+            if (listed) j++;
+            if (inside != listed && fabs(dot(v, center) - cos_r) > 1e-12) ok = 0;
+        }
+        check(ok && j == found, "cone_filter_block", "rows differ from the scalar dot test");
+        free(out);
+    }
+
+    // range_mask_block, with and without a divisor, NaN never passing
+    {
+        double *values = malloc(n * sizeof(double)), *divisor = malloc(n * sizeof(double));
+        uint8_t *mask = malloc(n), *ratio_mask = malloc(n);
+        for (int i = 0; i < n; i++)
+        {
+            values[i] = i % 37 == 0 ? NAN : uniform() * 10.0 - 2.0;
+            divisor[i] = i % 41 == 0 ? 0.0 : uniform() * 3.0;
+        }
+        memset(mask, 1, n);
+        memset(ratio_mask, 1, n);
+        range_mask_block(values, NULL, n, 0.5, 4.0, mask);
+        range_mask_block(values, divisor, n, 0.5, 4.0, ratio_mask);
+        int ok = 1;
+        for (int i = 0; i < n; i++)
+        {
+            int plain = values[i] >= 0.5 && values[i] <= 4.0;
+            int ratio = divisor[i] > 0 && values[i] >= 0.5 * divisor[i] && values[i] <= 4.0 * divisor[i];
+            if (mask[i] != plain || ratio_mask[i] != ratio) ok = 0;
+        }
+        check(ok, "range_mask_block", "mask differs from scalar bounds");
+        free(values);
+        free(divisor);
+        free(mask);
+        free(ratio_mask);
+    }
+
+    // flux_to_mag_block and mag_to_flux_block
+    {
+        double *flux = malloc(n * sizeof(double)), *flux_err = malloc(n * sizeof(double));
+        double *mag = malloc(n * sizeof(double)), *mag_err = malloc(n * sizeof(double));
+        double *back = malloc(n * sizeof(double));
+        double zeropoint = 25.6873668671;
+        for (int i = 0; i < n; i++)
+        {
+            flux[i] = i % 29 == 0 ? NAN : i % 31 == 0 ? -1.0 : pow(10.0, uniform() * 8.0);
+            flux_err[i] = flux[i] * uniform() * 0.1;
+        }
+        flux_to_mag_block(flux, flux_err, n, zeropoint, mag, mag_err);
+        mag_to_flux_block(mag, n, zeropoint, back);
+        double worst_mag = 0, worst_err = 0, worst_flux = 0;
+        int nan_ok = 1;
+        for (int i = 0; i < n; i++)
+        {
+            if (!(flux[i] > 0))
+            {
+                nan_ok &= isnan(mag[i]) && isnan(back[i]);
+                continue;
+            }
+            worst_mag = fmax(worst_mag, fabs(mag[i] - (zeropoint - 2.5 * log10(flux[i]))));
+            worst_err = fmax(worst_err, fabs(mag_err[i] - 2.5 / log(10.0) * flux_err[i] / flux[i]));
+            worst_flux = fmax(worst_flux, fabs(back[i] / flux[i] - 1.0));
+        }
+        check(worst_mag < 1e-12 && worst_err < 1e-12 && nan_ok, "flux_to_mag_block", "differs from zp - 2.5 log10(flux)");
+        check(worst_flux < 1e-12, "mag_to_flux_block", "does not invert flux_to_mag_block");
+        free(flux);
+        free(flux_err);
+        free(mag);
+        free(mag_err);
+        free(back);
+    }
+
+    // propagate_block against propagate_vec
+    {
+        double *px = malloc(n * sizeof(double)), *py = malloc(n * sizeof(double)), *pz = malloc(n * sizeof(double));
+        propagate_block(x, y, z, pmra, pmdec, 0, n, 250.0, px, py, pz);
+        double worst_vec = 0;
+        for (int i = 0; i < n; i++)
+        {
+            double v[3] = {x[i], y[i], z[i]}, moved[3];
+            propagate_vec(v, pmra[i], pmdec[i], 250.0, moved);
+            worst_vec = fmax(worst_vec, fmax(fabs(px[i] - moved[0]), fmax(fabs(py[i] - moved[1]), fabs(pz[i] - moved[2]))));
+        }
+        check(worst_vec < 1e-12, "propagate_block", "differs from propagate_vec");
+        free(px);
+        free(py);
+        free(pz);
+    }
+
+    free(ra);
+    free(dec);
+    free(x);
+    free(y);
+    free(z);
+    free(pmra);
+    free(pmdec);
+}
+
+// Catalog searches
+
+enum { COL_RA, COL_DEC, COL_UX, COL_UY, COL_UZ, COL_PMRA, COL_PMDEC, COL_PARALLAX, COL_PARALLAX_ERROR, COL_FLUX, COL_RANDOM, NUM_COLS };
+
+typedef struct
+{
+    int64_t source_id;
+    double values[NUM_COLS];
+} star;
+
+static star *stars; // in catalog row order
+
+static int by_source_id(const void *a, const void *b)
+{
+    int64_t x = ((const star *)a)->source_id, y = ((const star *)b)->source_id;
+    return x < y ? -1 : x > y;
+}
+
+static int by_row(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static gaia_catalog *write_catalog(void)
+{
+    stars = malloc(NUM_STARS * sizeof(star));
+    int64_t *permutation = malloc(NUM_STARS * sizeof(int64_t));
+    for (int i = 0; i < NUM_STARS; i++) permutation[i] = i;
+    for (int i = NUM_STARS - 1; i > 0; i--)
+    {
+        int j = (int)(uniform() * (i + 1));
+        int64_t swap = permutation[i];
+        permutation[i] = permutation[j];
+        permutation[j] = swap;
+    }
+
+    for (int i = 0; i < NUM_STARS; i++)
+    {
+        double *v = stars[i].values;
+        v[COL_RA] = uniform() * 360.0;
+        v[COL_DEC] = asin(2.0 * uniform() - 1.0) / DEG;
+        unit_vector(v[COL_RA], v[COL_DEC], &v[COL_UX]);
+        v[COL_PMRA] = (uniform() - 0.5) * 4000.0;
+        v[COL_PMDEC] = (uniform() - 0.5) * 4000.0;
+        v[COL_PARALLAX] = i % 47 == 0 ? NAN : uniform() * 11.0 - 1.0;
+        v[COL_PARALLAX_ERROR] = 0.05 + uniform();
+        v[COL_FLUX] = i % 53 == 0 ? NAN : pow(10.0, uniform() * 6.0);
+        v[COL_RANDOM] = (double)permutation[i];
+        // Gaia source_ids carry the level 12 nested pixel above bit 35
+        stars[i].source_id = (healpix_ang2pix_nest(12, v[COL_RA], v[COL_DEC]) << 35) + i;
+    }
+    qsort(stars, NUM_STARS, sizeof(star), by_source_id);
+
+    const char *columns = "[\"ra\",\"dec\",\"ux\",\"uy\",\"uz\",\"pmra\",\"pmdec\",\"parallax\",\"parallax_error\",\"phot_g_mean_flux\",\"random_index\"]";
+    gaia_catalog_writer *writer = catalog_writer_open(CATALOG_PATH, columns, CATALOG_DEFAULT_ORDER, NUM_STARS);
+    int64_t *ids = malloc(NUM_STARS * sizeof(int64_t));
+    double *values = malloc((size_t)NUM_STARS * NUM_COLS * sizeof(double));
+    for (int i = 0; i < NUM_STARS; i++)
+    {
+        ids[i] = stars[i].source_id;
+        memcpy(values + (size_t)i * NUM_COLS, stars[i].values, sizeof(stars[i].values));
+    }
+    if (!writer || catalog_writer_append(writer, ids, values, NUM_STARS) != 0 || catalog_writer_close(writer) != 0)
+    {
+        fprintf(stderr, "Failed to write %s: %s\n", CATALOG_PATH, catalog_last_error());
+        exit(1);
+    }
+    free(ids);
+    free(values);
+    free(permutation);
+
+    gaia_catalog *catalog = catalog_open(CATALOG_PATH);
+    if (!catalog)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", CATALOG_PATH, catalog_last_error());
+        exit(1);
+    }
+    return catalog;
+}
+
+// Whether a rowset holds exactly the `expected` rows, in any order
+static int same_rows(gaia_rowset *rowset, uint64_t *expected, uint64_t count)
+{
+    if (!rowset || rowset->count != count) return 0;
+    qsort(rowset->rows, rowset->count, sizeof(uint64_t), by_row);
+    return memcmp(rowset->rows, expected, count * sizeof(uint64_t)) == 0;
+}
+
+static int passes_flux(double flux, double flux_min, double flux_max)
+{
+    return (isnan(flux_min) || flux > flux_min) && (isnan(flux_max) || flux < flux_max);
+}
+
+static void test_cones(gaia_catalog *catalog, uint64_t *expected)
+{
+    int cones = 1, counts = 1, epochs = 1, samples = 1;
+    for (int q = 0; q < NUM_QUERIES; q++)
+    {
+        double ra = uniform() * 360.0, dec = uniform() * 180.0 - 90.0, radius = uniform() * 12.0;
+        double flux_min = q % 2 ? 100.0 : NAN, flux_max = q % 3 ? NAN : 1e5;
+        double center[3];
+        unit_vector(ra, dec, center);
+        double cos_r = cos(radius * DEG);
+
+        uint64_t count = 0;
+        for (uint64_t i = 0; i < NUM_STARS; i++)
+        {
+            const double *v = stars[i].values;
+            if (dot(&v[COL_UX], center) >= cos_r && passes_flux(v[COL_FLUX], flux_min, flux_max)) expected[count++] = i;
+        }
+        gaia_rowset *rows = catalog_cone_search(catalog, ra, dec, radius, flux_min, flux_max);
+        cones &= same_rows(rows, expected, count);
+        rowset_free(rows);
+        counts &= catalog_cone_count(catalog, ra, dec, radius, flux_min, flux_max) == (int64_t)count;
+
+        // The smallest random_index rows, in random_index order
+        uint64_t k = 1 + (uint64_t)(uniform() * 200);
+        gaia_rowset *sample = catalog_cone_sample(catalog, ra, dec, radius, flux_min, flux_max, 0, NULL, NULL, k);
+        uint64_t want = count < k ? count : k;
+        int ok = sample && sample->count == want;
+        double last = -1;
+        for (uint64_t i = 0; ok && i < want; i++)
+        {
+            double key = stars[sample->rows[i]].values[COL_RANDOM];
+            uint64_t smaller = 0;
+            for (uint64_t j = 0; j < count; j++) smaller += stars[expected[j]].values[COL_RANDOM] < key;
+            ok = key > last && smaller == i;
+            last = key;
+        }
+        samples &= ok;
+        rowset_free(sample);
+
+        // Positions propagated by proper motion
+        double years = (uniform() - 0.5) * 200.0;
+        count = 0;
+        for (uint64_t i = 0; i < NUM_STARS; i++)
+        {
+            const double *v = stars[i].values;
+            double moved[3];
+            propagate_vec(&v[COL_UX], v[COL_PMRA], v[COL_PMDEC], years, moved);
+            if (dot(moved, center) >= cos_r && passes_flux(v[COL_FLUX], flux_min, flux_max)) expected[count++] = i;
+        }
+        rows = catalog_cone_search_epoch(catalog, ra, dec, radius, flux_min, flux_max, years);
+        epochs &= same_rows(rows, expected, count);
+        rowset_free(rows);
+    }
+    check(cones, "catalog_cone_search", "rows differ from brute force");
+    check(counts, "catalog_cone_count", "count differs from brute force");
+    check(samples, "catalog_cone_sample", "not the smallest random_index rows in order");
+    check(epochs, "catalog_cone_search_epoch", "rows differ from brute force with propagate_vec");
+}
+
+static void test_boxes(gaia_catalog *catalog, uint64_t *expected)
+{
+    int ok = 1;
+    for (int q = 0; q < NUM_QUERIES; q++)
+    {
+        // Every fourth box wraps through RA 0
+        double ra_min = uniform() * 360.0, width = uniform() * 40.0;
+        double ra_max = q % 4 == 0 ? fmod(ra_min + width + 300.0, 360.0) : fmod(ra_min + width, 360.0);
+        double dec_min = uniform() * 160.0 - 90.0, dec_max = fmin(dec_min + uniform() * 30.0, 90.0);
+
+        uint64_t count = 0;
+        for (uint64_t i = 0; i < NUM_STARS; i++)
+        {
+            double ra = stars[i].values[COL_RA], dec = stars[i].values[COL_DEC];
+            double span = ra_max >= ra_min ? ra_max - ra_min : ra_max - ra_min + 360.0;
+            double offset = ra >= ra_min ? ra - ra_min : ra - ra_min + 360.0;
+            if (dec >= dec_min && dec <= dec_max && offset <= span) expected[count++] = i;
+        }
+        gaia_rowset *rows = catalog_box_search(catalog, ra_min, ra_max, dec_min, dec_max, NAN, NAN);
+        ok &= same_rows(rows, expected, count);
+        rowset_free(rows);
+    }
+    check(ok, "catalog_box_search", "rows differ from brute force");
+}
+
+static void test_polygons(gaia_catalog *catalog, uint64_t *expected)
+{
+    int ok = 1;
+    for (int q = 0; q < NUM_QUERIES; q++)
+    {
+        // A convex polygon: points on a small circle at increasing angles,
+        // every other one listed clockwise
+        int count = 3 + q % 6;
+        double ra0 = uniform() * 360.0, dec0 = uniform() * 140.0 - 70.0, size = 1.0 + uniform() * 15.0;
+        double vertices[2 * 8], normals[8][3], center[3], east[3], north[3];
+        unit_vector(ra0, dec0, center);
+        east[0] = -sin(ra0 * DEG), east[1] = cos(ra0 * DEG), east[2] = 0;
+        north[0] = -sin(dec0 * DEG) * cos(ra0 * DEG), north[1] = -sin(dec0 * DEG) * sin(ra0 * DEG), north[2] = cos(dec0 * DEG);
+        double corner[8][3];
+        for (int i = 0; i < count; i++)
+        {
+            double angle = (q % 2 ? -1 : 1) * 2 * M_PI * (i + uniform() * 0.5) / count;
+            for (int k = 0; k < 3; k++)
+            {
+                corner[i][k] = cos(size * DEG) * center[k] + sin(size * DEG) * (cos(angle) * east[k] + sin(angle) * north[k]);
+            }
+            vertices[2 * i] = fmod(atan2(corner[i][1], corner[i][0]) / DEG + 360.0, 360.0);
+            vertices[2 * i + 1] = asin(corner[i][2]) / DEG;
+        }
+        // Edge normals pointing at the centre, independent of orientation
+        for (int i = 0; i < count; i++)
+        {
+            const double *a = corner[i], *b = corner[(i + 1) % count];
+            double *n = normals[i];
+            n[0] = a[1] * b[2] - a[2] * b[1];
+            n[1] = a[2] * b[0] - a[0] * b[2];
+            n[2] = a[0] * b[1] - a[1] * b[0];
+            if (dot(n, center) < 0)
+            {
+                for (int k = 0; k < 3; k++) n[k] = -n[k];
+            }
+        }
+
+        uint64_t found = 0;
+        for (uint64_t i = 0; i < NUM_STARS; i++)
+        {
+            int inside = 1;
+            for (int e = 0; e < count && inside; e++) inside = dot(normals[e], &stars[i].values[COL_UX]) >= 0;
+            if (inside) expected[found++] = i;
+        }
+        gaia_rowset *rows = catalog_polygon_search(catalog, vertices, count, NAN, NAN);
+        ok &= same_rows(rows, expected, found);
+        rowset_free(rows);
+    }
+    check(ok, "catalog_polygon_search", "rows differ from brute force");
+}
+
+// Flux keys as the catalog orders them: NaN fluxes last
+static double flux_key(uint64_t row)
+{
+    double flux = stars[row].values[COL_FLUX];
+    return isnan(flux) ? -INFINITY : flux;
+}
+
+static int by_key_desc(const void *a, const void *b)
+{
+    double x = flux_key(*(const uint64_t *)a), y = flux_key(*(const uint64_t *)b);
+    return (x < y) - (x > y);
+}
+
+static double *sort_keys;
+
+static int by_sort_key(const void *a, const void *b)
+{
+    double x = sort_keys[*(const uint64_t *)a], y = sort_keys[*(const uint64_t *)b];
+    return (x > y) - (x < y);
+}
+
+// Whether every row of a rowset is distinct and among the `expected` rows
+// (sorted), without reordering the rowset
+static int rows_within(const gaia_rowset *rowset, const uint64_t *expected, uint64_t count)
+{
+    uint64_t *rows = malloc((rowset->count ? rowset->count : 1) * sizeof(uint64_t));
+    memcpy(rows, rowset->rows, rowset->count * sizeof(uint64_t));
+    qsort(rows, rowset->count, sizeof(uint64_t), by_row);
+    int ok = 1;
+    for (uint64_t i = 0; i < rowset->count && ok; i++)
+    {
+        ok = (i == 0 || rows[i] != rows[i - 1]) && bsearch(&rows[i], expected, count, sizeof(uint64_t), by_row);
+    }
+    free(rows);
+    return ok;
+}
+
+// Rows of a cone (no flux bounds when both are NaN), in row order
+static uint64_t cone_rows(double ra, double dec, double radius, double flux_min, double flux_max, uint64_t *expected)
+{
+    double center[3];
+    unit_vector(ra, dec, center);
+    double cos_r = cos(radius * DEG);
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < NUM_STARS; i++)
+    {
+        const double *v = stars[i].values;
+        if (dot(&v[COL_UX], center) >= cos_r && passes_flux(v[COL_FLUX], flux_min, flux_max)) expected[count++] = i;
+    }
+    return count;
+}
+
+static void test_limits(gaia_catalog *catalog, uint64_t *expected)
+{
+    int unordered = 1, brightest = 1, nearest = 1;
+    double *separations = malloc(NUM_STARS * sizeof(double));
+    for (int q = 0; q < NUM_QUERIES; q++)
+    {
+        double ra = uniform() * 360.0, dec = uniform() * 180.0 - 90.0, radius = uniform() * 12.0;
+        double flux_min = q % 2 ? 100.0 : NAN, flux_max = q % 3 ? NAN : 1e5;
+        uint64_t limit = q % 5 == 0 ? 0 : 1 + (uint64_t)(uniform() * 300);
+        uint64_t count = cone_rows(ra, dec, radius, flux_min, flux_max, expected);
+        uint64_t want = limit && limit < count ? limit : count;
+
+        gaia_rowset *rows = catalog_cone_search_limit(catalog, ra, dec, radius, flux_min, flux_max, limit, CATALOG_ORDER_NONE);
+        unordered &= rows && rows->count == want && rows_within(rows, expected, count);
+        rowset_free(rows);
+
+        // The brightest `want` fluxes of the cone, brightest first
+        rows = catalog_cone_search_limit(catalog, ra, dec, radius, flux_min, flux_max, limit, CATALOG_ORDER_BRIGHTEST);
+        int ok = rows && rows->count == want && rows_within(rows, expected, count);
+        uint64_t *by_flux = malloc((count ? count : 1) * sizeof(uint64_t));
+        memcpy(by_flux, expected, count * sizeof(uint64_t));
+        qsort(by_flux, count, sizeof(uint64_t), by_key_desc);
+        for (uint64_t i = 0; ok && i < want; i++) ok = flux_key(rows->rows[i]) == flux_key(by_flux[i]);
+        brightest &= ok;
+        free(by_flux);
+        rowset_free(rows);
+
+        // The nearest `want` rows of the cone, nearest first
+        double center[3];
+        unit_vector(ra, dec, center);
+        for (uint64_t i = 0; i < count; i++) separations[expected[i]] = vec_angle(center, &stars[expected[i]].values[COL_UX]);
+        rows = catalog_cone_search_limit(catalog, ra, dec, radius, flux_min, flux_max, limit, CATALOG_ORDER_NEAREST);
+        ok = rows && rows->count == want && rows_within(rows, expected, count);
+        sort_keys = separations;
+        qsort(expected, count, sizeof(uint64_t), by_sort_key);
+        for (uint64_t i = 0; ok && i < want; i++) ok = separations[rows->rows[i]] == separations[expected[i]];
+        nearest &= ok;
+        rowset_free(rows);
+    }
+    free(separations);
+    check(unordered, "catalog_cone_search_limit unordered", "not `limit` distinct rows of the cone");
+    check(brightest, "catalog_cone_search_limit brightest", "not the brightest rows of the cone in order");
+    check(nearest, "catalog_cone_search_limit nearest", "not the nearest rows of the cone in order");
+}
+
+static void test_nearest(gaia_catalog *catalog, uint64_t *expected)
+{
+    int ok = 1;
+    double *separations = malloc(NUM_STARS * sizeof(double));
+    sort_keys = separations;
+    for (int q = 0; q < NUM_QUERIES; q++)
+    {
+        double ra = uniform() * 360.0, dec = uniform() * 180.0 - 90.0;
+        double flux_min = q % 2 ? 100.0 : NAN, flux_max = q % 3 ? NAN : 1e5;
+        uint32_t k = 1 + (uint32_t)(uniform() * 50);
+        double center[3];
+        unit_vector(ra, dec, center);
+
+        uint64_t count = 0;
+        for (uint64_t i = 0; i < NUM_STARS; i++)
+        {
+            if (!passes_flux(stars[i].values[COL_FLUX], flux_min, flux_max)) continue;
+            separations[i] = vec_angle(center, &stars[i].values[COL_UX]);
+            expected[count++] = i;
+        }
+        qsort(expected, count, sizeof(uint64_t), by_sort_key);
+
+        gaia_rowset *rows = catalog_nearest(catalog, ra, dec, k, flux_min, flux_max);
+        int same = rows && rows->count == (k < count ? k : count);
+        for (uint64_t i = 0; same && i < rows->count; i++) same = rows->rows[i] == expected[i];
+        ok &= same;
+        rowset_free(rows);
+    }
+    free(separations);
+    check(ok, "catalog_nearest", "not the k nearest rows in order");
+}
+
+// The filter terms of test_batches: -500 <= pmra <= 1000, parallax / parallax_error >= 2
+static const uint32_t filter_columns[] = {COL_PMRA + 1, CATALOG_NO_COLUMN, COL_PARALLAX + 1, COL_PARALLAX_ERROR + 1};
+static const double filter_bounds[] = {-500.0, 1000.0, 2.0, INFINITY};
+
+static int passes_terms(uint64_t row)
+{
+    const double *v = stars[row].values;
+    return v[COL_PMRA] >= -500.0 && v[COL_PMRA] <= 1000.0 && v[COL_PARALLAX_ERROR] > 0 &&
+           v[COL_PARALLAX] >= 2.0 * v[COL_PARALLAX_ERROR] && v[COL_PARALLAX] <= INFINITY * v[COL_PARALLAX_ERROR];
+}
+
+static void test_batches(gaia_catalog *catalog, uint64_t *expected)
+{
+    enum { TARGETS = 200 };
+    double ra[TARGETS], dec[TARGETS], radius[TARGETS];
+    for (int t = 0; t < TARGETS; t++)
+    {
+        ra[t] = uniform() * 360.0;
+        dec[t] = asin(2.0 * uniform() - 1.0) / DEG;
+        radius[t] = uniform() * 6.0;
+    }
+    double flux_min = 100.0, flux_max = NAN;
+
+    gaia_batch *batch = catalog_cone_search_batch(catalog, ra, dec, radius, TARGETS, flux_min, flux_max, 4);
+    int cones = batch != NULL && batch->num_targets == TARGETS;
+    for (int t = 0; cones && t < TARGETS; t++)
+    {
+        uint64_t count = cone_rows(ra[t], dec[t], radius[t], flux_min, flux_max, expected);
+        gaia_rowset target = {batch->rowset->rows + batch->offsets[t], batch->offsets[t + 1] - batch->offsets[t], 0};
+        cones = same_rows(&target, expected, count);
+    }
+
+    int filtered = cones && batch_filter_rows(catalog, batch, 2, filter_columns, filter_bounds) == (int64_t)batch->rowset->count;
+    for (int t = 0; filtered && t < TARGETS; t++)
+    {
+        uint64_t count = cone_rows(ra[t], dec[t], radius[t], flux_min, flux_max, expected), kept = 0;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (passes_terms(expected[i])) expected[kept++] = expected[i];
+        }
+        gaia_rowset target = {batch->rowset->rows + batch->offsets[t], batch->offsets[t + 1] - batch->offsets[t], 0};
+        filtered = same_rows(&target, expected, kept);
+    }
+    batch_free(batch);
+    check(cones, "catalog_cone_search_batch", "rows of a target differ from brute force");
+    check(filtered, "batch_filter_rows", "rows or offsets of a target differ from brute force");
+}
+
+static void test_xmatch(gaia_catalog *catalog)
+{
+    enum { TARGETS = 2000 };
+    double *ra = malloc(TARGETS * sizeof(double)), *dec = malloc(TARGETS * sizeof(double));
+    int64_t *rows = malloc(TARGETS * sizeof(int64_t));
+    double *separation = malloc(TARGETS * sizeof(double));
+    double (*moved)[3] = malloc(NUM_STARS * sizeof(*moved));
+    int ok = 1;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        double radius = 0.3, years = pass ? 80.0 : 0.0;
+        for (uint64_t i = 0; i < NUM_STARS; i++)
+        {
+            const double *v = stars[i].values;
+            propagate_vec(&v[COL_UX], v[COL_PMRA], v[COL_PMDEC], years, moved[i]);
+        }
+        // Half the targets sit near a star, the rest anywhere
+        for (int t = 0; t < TARGETS; t++)
+        {
+            if (t % 2)
+            {
+                const double *v = moved[(uint64_t)(uniform() * NUM_STARS)];
+                ra[t] = fmod(atan2(v[1], v[0]) / DEG + 360.0 + (uniform() - 0.5) * 0.2, 360.0);
+                dec[t] = fmax(-90.0, fmin(90.0, asin(v[2]) / DEG + (uniform() - 0.5) * 0.2));
+            }
+            else
+            {
+                ra[t] = uniform() * 360.0;
+                dec[t] = asin(2.0 * uniform() - 1.0) / DEG;
+            }
+        }
+
+        int64_t matched = catalog_xmatch(catalog, ra, dec, TARGETS, radius, years, 4, rows, separation);
+        int64_t expected_matched = 0;
+        for (int t = 0; t < TARGETS && ok; t++)
+        {
+            double center[3];
+            unit_vector(ra[t], dec[t], center);
+            int64_t best = -1;
+            double best_separation = radius * DEG, cos_r = cos(best_separation) - 1e-9;
+            for (uint64_t i = 0; i < NUM_STARS; i++)
+            {
+                if (dot(center, moved[i]) < cos_r) continue;
+                double s = vec_angle(center, moved[i]);
+                if (s < best_separation) best = (int64_t)i, best_separation = s;
+            }
+            expected_matched += best >= 0;
+            ok = rows[t] == best && (best < 0 ? isnan(separation[t]) : fabs(separation[t] - best_separation / DEG) < 1e-12);
+        }
+        ok &= matched == expected_matched;
+    }
+    free(ra);
+    free(dec);
+    free(rows);
+    free(separation);
+    free(moved);
+    check(ok, "catalog_xmatch", "best matches differ from brute force");
+}
+
+static void test_sources(gaia_catalog *catalog)
+{
+    int ok = 1;
+    for (uint64_t i = 0; i < NUM_STARS && ok; i++)
+    {
+        ok = catalog_find_source(catalog, stars[i].source_id) == (int64_t)i &&
+             catalog_find_source(catalog, stars[i].source_id + NUM_STARS) == -1;
+    }
+    check(ok, "catalog_find_source", "rows of source_ids differ");
+}
+
+// Heliocentric position of a row in parsecs, as the k-d tree builds it
+static int star_position(uint64_t row, double min_snr, double p[3])
+{
+    const double *v = stars[row].values;
+    double parallax = v[COL_PARALLAX];
+    if (!(parallax > 0)) return 0;
+    if (min_snr > 0 && !(parallax / v[COL_PARALLAX_ERROR] >= min_snr)) return 0;
+    double distance = 1000.0 / parallax;
+    for (int k = 0; k < 3; k++) p[k] = v[COL_UX + k] * distance;
+    return 1;
+}
+
+static double distance2(const double a[3], const double b[3])
+{
+    double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+    return dx * dx + dy * dy + dz * dz;
+}
+
+static void test_kdtree(gaia_catalog *catalog, uint64_t *expected)
+{
+    int spheres = 1, nearest = 1;
+    double *distances = malloc(NUM_STARS * sizeof(double));
+    sort_keys = distances;
+
+    // A tree with no cut, queried with cuts, and one built with a cut
+    for (int built = 0; built < 2; built++)
+    {
+        double build_snr = built ? 3.0 : 0.0;
+        gaia_kdtree *tree = catalog_kdtree_build(catalog, build_snr);
+        uint64_t held = 0;
+        double p[3];
+        for (uint64_t i = 0; i < NUM_STARS; i++) held += star_position(i, build_snr, p);
+        spheres &= tree && kdtree_count(tree) == held;
+        if (!tree) break;
+
+        for (int q = 0; q < NUM_QUERIES; q++)
+        {
+            double query_snr = q % 2 ? 5.0 : 0.0, snr = fmax(query_snr, build_snr);
+            double flux_min = q % 3 ? NAN : 100.0, flux_max = NAN;
+            double center[3], radius = 50.0 + uniform() * 400.0, distance = uniform() * 600.0;
+            unit_vector(uniform() * 360.0, asin(2.0 * uniform() - 1.0) / DEG, center);
+            for (int k = 0; k < 3; k++) center[k] *= distance;
+
+            uint64_t count = 0, inside = 0;
+            for (uint64_t i = 0; i < NUM_STARS; i++)
+            {
+                if (!star_position(i, snr, p) || !passes_flux(stars[i].values[COL_FLUX], flux_min, flux_max)) continue;
+                distances[i] = distance2(p, center);
+                expected[count++] = i;
+                inside += distances[i] <= radius * radius;
+            }
+            qsort(expected, count, sizeof(uint64_t), by_sort_key);
+
+            gaia_rowset *rows = kdtree_sphere(tree, center[0], center[1], center[2], radius, query_snr, flux_min, flux_max);
+            int ok = rows && rows->count == inside;
+            for (uint64_t i = 0; ok && i < rows->count; i++) ok = distances[rows->rows[i]] <= radius * radius;
+            // Distinct rows among those passing the cuts
+            uint64_t *sorted = malloc((count ? count : 1) * sizeof(uint64_t));
+            memcpy(sorted, expected, count * sizeof(uint64_t));
+            qsort(sorted, count, sizeof(uint64_t), by_row);
+            ok = ok && rows_within(rows, sorted, count);
+            free(sorted);
+            spheres &= ok;
+            rowset_free(rows);
+
+            uint32_t k = 1 + (uint32_t)(uniform() * 40);
+            rows = kdtree_nearest(tree, center[0], center[1], center[2], k, query_snr, flux_min, flux_max);
+            ok = rows && rows->count == (k < count ? k : count);
+            for (uint64_t i = 0; ok && i < rows->count; i++) ok = distances[rows->rows[i]] == distances[expected[i]];
+            nearest &= ok;
+            rowset_free(rows);
+        }
+        kdtree_free(tree);
+    }
+    free(distances);
+    check(spheres, "kdtree_sphere", "rows differ from brute force");
+    check(nearest, "kdtree_nearest", "not the k nearest rows in order");
+}
+
+static void test_brightness(gaia_catalog *catalog, uint64_t *expected)
+{
+    int ok = 1;
+    for (int q = 0; q < NUM_QUERIES; q++)
+    {
+        // Some bounds are fluxes in the catalog, to check they're exclusive
+        double catalog_flux = stars[(uint64_t)(uniform() * NUM_STARS)].values[COL_FLUX];
+        double flux_min = q % 2 ? (q % 4 == 1 ? pow(10.0, uniform() * 5.0) : catalog_flux) : NAN;
+        double flux_max = q % 3 ? NAN : (q % 2 ? pow(10.0, 1.0 + uniform() * 5.0) : catalog_flux);
+        uint64_t limit = q % 4 ? (uint64_t)(uniform() * 5000) : 0;
+        uint64_t count = 0;
+        for (uint64_t i = 0; i < NUM_STARS; i++)
+        {
+            if (passes_flux(stars[i].values[COL_FLUX], flux_min, flux_max)) expected[count++] = i;
+        }
+        qsort(expected, count, sizeof(uint64_t), by_key_desc);
+        uint64_t want = limit && limit < count ? limit : count;
+
+        gaia_rowset *rows = catalog_brightness_search(catalog, flux_min, flux_max, limit);
+        int same = rows && rows->count == want;
+        for (uint64_t i = 0; same && i < want; i++)
+        {
+            same = flux_key(rows->rows[i]) == flux_key(expected[i]) &&
+                   passes_flux(stars[rows->rows[i]].values[COL_FLUX], flux_min, flux_max);
+        }
+        ok &= same;
+        rowset_free(rows);
+    }
+    check(ok, "catalog_brightness_search", "not the brightest rows in the flux range in order");
+}
+
+static void test_aggregates(gaia_catalog *catalog, uint64_t *expected)
+{
+    // G magnitude over [10, 25] and pmra / pmdec over [-3, 3]
+    enum { BINS_G = 10, BINS_RATIO = 8 };
+    const uint32_t columns[] = {COL_FLUX + 1, CATALOG_NO_COLUMN, COL_PMRA + 1, COL_PMDEC + 1};
+    const double axes[] = {25.6873668671, 10.0, 25.0, BINS_G, NAN, -3.0, 3.0, BINS_RATIO};
+    int ok = 1;
+    for (int q = 0; q < NUM_QUERIES; q++)
+    {
+        double ra = uniform() * 360.0, dec = uniform() * 180.0 - 90.0, radius = uniform() * 20.0;
+        uint64_t count = cone_rows(ra, dec, radius, NAN, NAN, expected);
+
+        uint64_t counts[BINS_G * BINS_RATIO] = {0}, want_counts[BINS_G * BINS_RATIO] = {0};
+        double range[4], want_range[4] = {INFINITY, -INFINITY, INFINITY, -INFINITY};
+        int64_t want = 0;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            const double *v = stars[expected[i]].values;
+            double values[2] = {v[COL_FLUX] > 0 ? axes[0] - 2.5 * log10(v[COL_FLUX]) : NAN, v[COL_PMRA] / v[COL_PMDEC]};
+            if (!isfinite(values[0]) || !isfinite(values[1])) continue;
+            want++;
+            int inside = 1;
+            uint64_t bin = 0;
+            for (int a = 0; a < 2; a++)
+            {
+                const double *axis = axes + 4 * a;
+                uint64_t bins = (uint64_t)axis[3];
+                want_range[2 * a] = fmin(want_range[2 * a], values[a]);
+                want_range[2 * a + 1] = fmax(want_range[2 * a + 1], values[a]);
+                if (values[a] < axis[1] || values[a] > axis[2])
+                {
+                    inside = 0;
+                    continue;
+                }
+                // The top edge belongs to the last bin
+                uint64_t b = (uint64_t)((values[a] - axis[1]) * ((double)bins / (axis[2] - axis[1])));
+                bin = bin * bins + (b < bins ? b : bins - 1);
+            }
+            if (inside) want_counts[bin]++;
+        }
+
+        gaia_rowset *rows = catalog_cone_search(catalog, ra, dec, radius, NAN, NAN);
+        int64_t counted = rows ? catalog_aggregate_rows(catalog, rows, 2, columns, axes, range, counts) : -1;
+        ok &= counted == want && memcmp(counts, want_counts, sizeof(counts)) == 0;
+        for (int i = 0; i < 4 && want; i++) ok &= range[i] == want_range[i];
+        rowset_free(rows);
+    }
+    check(ok, "catalog_aggregate_rows", "counts, ranges or bins differ from brute force");
+}
+
+// Writing rows out of source_id order, or opening a damaged file, fails
+// with an error rather than a bad catalog or a fault
+static void test_catalog_files(void)
+{
+    const char *path = "./test-catalog-damaged.cat";
+    int64_t ids[3] = {(5LL << 35) + 1, (5LL << 35) + 1, (4LL << 35)};
+    double values[6] = {10.0, 20.0, 10.0, 20.0, 10.0, 20.0};
+    int ok = 1;
+    for (int bad = 1; bad < 3; bad++)
+    {
+        gaia_catalog_writer *writer = catalog_writer_open(path, "[\"ra\",\"dec\"]", CATALOG_DEFAULT_ORDER, 2);
+        int64_t rows[2] = {ids[0], ids[bad]};
+        ok &= writer && catalog_writer_append(writer, rows, values, 2) != 0;
+        catalog_writer_close(writer);
+    }
+    check(ok, "catalog_writer_append", "accepted a repeated or decreasing source_id");
+
+    gaia_catalog_writer *writer = catalog_writer_open(path, "[\"ra\",\"dec\"]", CATALOG_DEFAULT_ORDER, 2);
+    int64_t good[2] = {ids[2], ids[0]};
+    catalog_writer_append(writer, good, values, 2);
+    catalog_writer_close(writer);
+
+    FILE *file = fopen(path, "rb");
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    uint8_t *bytes = malloc(size);
+    ok = fread(bytes, 1, size, file) == (size_t)size;
+    fclose(file);
+    const catalog_header *header = (const catalog_header *)bytes;
+    uint64_t last_entry = header->index_offset + healpix_npix(CATALOG_DEFAULT_ORDER) * sizeof(uint64_t);
+
+    // Truncated inside the index, a bad order, and an index past the rows
+    for (int damage = 0; damage < 3 && ok; damage++)
+    {
+        uint8_t *copy = malloc(size);
+        memcpy(copy, bytes, size);
+        long copy_size = damage == 0 ? (long)header->index_offset + 64 : size;
+        if (damage == 1) ((catalog_header *)copy)->order = 13;
+        if (damage == 2) *(uint64_t *)(copy + last_entry) = 3;
+        file = fopen(path, "wb");
+        fwrite(copy, 1, copy_size, file);
+        fclose(file);
+        free(copy);
+
+        gaia_catalog *catalog = catalog_open(path);
+        ok = catalog == NULL && strlen(catalog_last_error()) > 0;
+        catalog_close(catalog);
+    }
+    free(bytes);
+    remove(path);
+    check(ok, "catalog_open", "opened a truncated or inconsistent file");
+}
+
+// gaia_cone
+
+int sqlite3_gaiasqlite_init(sqlite3 *db, char **err, const sqlite3_api_routines *api);
+
+static int sqlite_ok(sqlite3 *db, int rc)
+{
+    if (rc != SQLITE_OK && rc != SQLITE_DONE)
+    {
+        fprintf(stderr, "SQLite error: %s\n", sqlite3_errmsg(db));
+        return 0;
+    }
+    return 1;
+}
+
+// Rows of one gaia_cone query, in row order, or -1 on error
+static int64_t sqlite_cone(sqlite3 *db, const char *sql, double ra, double dec, double radius, double bound, uint64_t *out)
+{
+    sqlite3_stmt *stmt;
+    if (!sqlite_ok(db, sqlite3_prepare_v2(db, sql, -1, &stmt, NULL))) return -1;
+    sqlite3_bind_double(stmt, 1, ra);
+    sqlite3_bind_double(stmt, 2, dec);
+    sqlite3_bind_double(stmt, 3, radius);
+    if (sqlite3_bind_parameter_count(stmt) > 3) sqlite3_bind_double(stmt, 4, bound);
+    int64_t count = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW) out[count++] = (uint64_t)sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    qsort(out, count, sizeof(uint64_t), by_row);
+    return count;
+}
+
+// Whether the index chosen for a query is `plan`, from EXPLAIN QUERY PLAN
+static int uses_plan(sqlite3 *db, const char *sql, int plan)
+{
+    char *explain = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", sql), want[32];
+    snprintf(want, sizeof(want), "INDEX %d:", plan);
+    sqlite3_stmt *stmt;
+    int found = 0;
+    if (sqlite_ok(db, sqlite3_prepare_v2(db, explain, -1, &stmt, NULL)))
+    {
+        while (sqlite3_step(stmt) == SQLITE_ROW) found |= strstr((const char *)sqlite3_column_text(stmt, 3), want) != NULL;
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_free(explain);
+    return found;
+}
+
+static void test_sqlite_cone(uint64_t *found)
+{
+    sqlite3 *db;
+    sqlite3_open(":memory:", &db);
+    int ok = sqlite_ok(db, sqlite3_gaiasqlite_init(db, NULL, NULL)) &&
+             sqlite_ok(db, sqlite3_exec(db,
+                 "CREATE TABLE gaiadr3 (row INTEGER PRIMARY KEY, ra REAL, dec REAL, phot_g_mean_flux REAL, random_index INTEGER, hpx INTEGER);"
+                 "CREATE INDEX idx_hpx_random_index ON gaiadr3(hpx, random_index);"
+                 "BEGIN", NULL, NULL, NULL));
+
+    // The row number stands in for source_id, so results map to stars
+    sqlite3_stmt *insert;
+    ok = ok && sqlite_ok(db, sqlite3_prepare_v2(db, "INSERT INTO gaiadr3 VALUES (?, ?, ?, ?, ?, ?)", -1, &insert, NULL));
+    for (uint64_t i = 0; ok && i < NUM_STARS; i++)
+    {
+        const double *v = stars[i].values;
+        sqlite3_bind_int64(insert, 1, (sqlite3_int64)i);
+        sqlite3_bind_double(insert, 2, v[COL_RA]);
+        sqlite3_bind_double(insert, 3, v[COL_DEC]);
+        sqlite3_bind_double(insert, 4, v[COL_FLUX]);
+        sqlite3_bind_int64(insert, 5, (sqlite3_int64)v[COL_RANDOM]);
+        sqlite3_bind_int64(insert, 6, stars[i].source_id >> 35);
+        ok = sqlite_ok(db, sqlite3_step(insert));
+        sqlite3_reset(insert);
+    }
+    sqlite3_finalize(insert);
+    ok = ok && sqlite_ok(db, sqlite3_exec(db, "COMMIT", NULL, NULL, NULL));
+
+    const char *all = "SELECT row FROM gaia_cone(?, ?, ?)";
+    const char *below = "SELECT row FROM gaia_cone WHERE ra0 = ? AND dec0 = ? AND radius = ? AND random_index < ?";
+    const char *at_most = "SELECT row FROM gaia_cone WHERE ra0 = ? AND dec0 = ? AND radius = ? AND random_index <= ?";
+    int pushed = ok && uses_plan(db, below, 1) && uses_plan(db, at_most, 2);
+
+    for (int q = 0; ok && q < NUM_QUERIES; q++)
+    {
+        double ra = uniform() * 360.0, dec = uniform() * 180.0 - 90.0, radius = uniform() * 12.0;
+        double bound = 0;
+        double center[3];
+        unit_vector(ra, dec, center);
+        double cos_r = cos(radius * DEG);
+
+        for (int form = 0; form < 3 && ok; form++)
+        {
+            const char *sql = form == 0 ? all : form == 1 ? below : at_most;
+            int64_t count = sqlite_cone(db, sql, ra, dec, radius, bound, found);
+            ok = count >= 0;
+            // Bound the samples at a star of the cone, to check < against <=
+            if (form == 0 && count > 0) bound = stars[found[count / 2]].values[COL_RANDOM];
+
+            // The exact test may round differently right at the cone edge
+            int64_t j = 0;
+            for (uint64_t i = 0; ok && i < NUM_STARS; i++)
+            {
+                const double *v = stars[i].values;
+                double d = dot(&v[COL_UX], center);
+                int wanted = d >= cos_r && (form == 0 || (form == 1 ? v[COL_RANDOM] < bound : v[COL_RANDOM] <= bound));
+                int listed = j < count && found[j] == i;
+                if (listed) j++;
+                if (wanted != listed && fabs(d - cos_r) > 1e-12) ok = 0;
+            }
+            ok = ok && j == count;
+        }
+    }
+    sqlite3_close(db);
+    check(ok, "gaia_cone", "rows differ from brute force");
+    check(pushed, "gaia_cone random_index", "random_index bounds are not pushed into the lookups");
+}
+
+int main()
+{
+    test_kernels();
+    test_catalog_files();
+
+    gaia_catalog *catalog = write_catalog();
+    uint64_t *expected = malloc(NUM_STARS * sizeof(uint64_t));
+    test_cones(catalog, expected);
+    test_boxes(catalog, expected);
+    test_polygons(catalog, expected);
+    test_limits(catalog, expected);
+    test_nearest(catalog, expected);
+    test_batches(catalog, expected);
+    test_xmatch(catalog);
+    test_sources(catalog);
+    test_kdtree(catalog, expected);
+    test_brightness(catalog, expected);
+    test_aggregates(catalog, expected);
+    test_sqlite_cone(expected);
+
+    free(expected);
+    free(stars);
+    catalog_close(catalog);
+    remove(CATALOG_PATH);
+
+    printf("\n%d failed\n", failures);
+    return failures ? 1 : 0;
+}
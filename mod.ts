@@ -25,15 +25,33 @@
 // Core classes
 export { createGaia, Gaia } from "./src/gaia.ts";
 export { GaiaDatabase } from "./src/database.ts";
+export { ColumnarResult } from "./src/columnar.ts";
+export { GaiaPool } from "./src/pool.ts";
+export { GaiaClient } from "./src/client.ts";
 
 // Configuration
 export { DEFAULT_CONFIG } from "./src/config.ts";
 export type { CLIConfig as Config } from "./src/config.ts";
 
 // Types
+export type { CacheStats } from "./src/cache.ts";
 export type {
   GaiaRecord,
   TmassRecord,
   TmassXmatchRecord,
 } from "./src/database.ts";
 export type { GaiaOptions, PhotometryOutput } from "./src/gaia.ts";
+export type { GaiaPoolOptions, PoolMethod } from "./src/pool.ts";
+export type {
+  ServeQuery,
+  ServeRequest,
+  ServeResponse,
+} from "./src/server.ts";
+export type {
+  AggregateResult,
+  ConeTarget,
+  HistogramAxis,
+  QueryFilter,
+  ResultOrder,
+  SpaceCenter,
+} from "./src/types.ts";
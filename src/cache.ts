@@ -0,0 +1,107 @@
+import type { GaiaRecord } from "./database.ts";
+
+/**
+ * Hit, miss and eviction counters of a PixelCache, with its current size
+ */
+export interface CacheStats {
+  hits: number;
+  misses: number;
+  evictions: number;
+  entries: number;
+  bytes: number;
+  maxBytes: number;
+}
+
+type CacheEntry = { records: GaiaRecord[]; bytes: number };
+
+/**
+ * Least-recently-used cache of per-pixel candidate records, bounded by an
+ * estimate of their memory use. A Map keeps insertion order, so moving an
+ * entry to the end on every hit leaves the least recently used first.
+ */
+export class PixelCache {
+  private entries = new Map<string, CacheEntry>();
+  private bytes = 0;
+  private hits = 0;
+  private misses = 0;
+  private evictions = 0;
+  private maxBytes: number;
+
+  constructor(maxBytes: number) {
+    if (!(maxBytes > 0)) {
+      throw new Error(`Invalid cache size: ${maxBytes}. Must be above 0.`);
+    }
+    this.maxBytes = maxBytes;
+  }
+
+  /**
+   * Cached records for `key`, marking them most recently used
+   */
+  get(key: string): GaiaRecord[] | undefined {
+    const entry = this.entries.get(key);
+    if (!entry) {
+      this.misses++;
+      return undefined;
+    }
+
+    this.hits++;
+    this.entries.delete(key);
+    this.entries.set(key, entry);
+    return entry.records;
+  }
+
+  /**
+   * Cache records for `key`, evicting the least recently used entries
+   * until they fit. Entries larger than the whole budget are not kept.
+   */
+  set(key: string, records: GaiaRecord[]): void {
+    const bytes = estimateBytes(records);
+    const previous = this.entries.get(key);
+    if (previous) {
+      this.entries.delete(key);
+      this.bytes -= previous.bytes;
+    }
+    if (bytes > this.maxBytes) return;
+
+    for (const [oldest, entry] of this.entries) {
+      if (this.bytes + bytes <= this.maxBytes) break;
+      this.entries.delete(oldest);
+      this.bytes -= entry.bytes;
+      this.evictions++;
+    }
+
+    this.entries.set(key, { records, bytes });
+    this.bytes += bytes;
+  }
+
+  /**
+   * Drop every entry, keeping the counters
+   */
+  clear(): void {
+    this.entries.clear();
+    this.bytes = 0;
+  }
+
+  /**
+   * Counters since creation, and the current entries and size
+   */
+  stats(): CacheStats {
+    return {
+      hits: this.hits,
+      misses: this.misses,
+      evictions: this.evictions,
+      entries: this.entries.size,
+      bytes: this.bytes,
+      maxBytes: this.maxBytes,
+    };
+  }
+}
+
+/**
+ * Rough heap size of records: an object header plus a tagged value (and
+ * its boxed double or string) per property
+ */
+function estimateBytes(records: GaiaRecord[]): number {
+  if (!records.length) return 64;
+  return 64 + records.length * (64 + 24 * Object.keys(records[0]).length);
+}
@@ -2,8 +2,11 @@
 
 import { parseConfig, printUsage } from "./config.ts";
 import { populateCommand } from "./commands/populate.ts";
-import { queryCommand } from "./commands/query.ts";
+import { queryBrightCommand, queryCommand } from "./commands/query.ts";
+import { serveCommand } from "./commands/serve.ts";
 import { statsCommand } from "./commands/stats.ts";
+import { catalogCommand } from "./commands/catalog.ts";
+import { xmatchCommand } from "./commands/xmatch.ts";
 
 async function main(): Promise<void> {
   const args = Deno.args;
@@ -38,10 +41,26 @@ async function main(): Promise<void> {
         queryCommand(config, args.slice(1));
         break;
 
+      case "query:bright":
+        queryBrightCommand(config, args.slice(1));
+        break;
+
       case "stats":
         statsCommand(config);
         break;
 
+      case "serve":
+        await serveCommand(config, args.slice(1));
+        break;
+
+      case "catalog":
+        catalogCommand(config, args.slice(1));
+        break;
+
+      case "xmatch":
+        await xmatchCommand(config, args.slice(1));
+        break;
+
       default:
         console.error(`Unknown command: ${command}\n`);
         printUsage();
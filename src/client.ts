@@ -0,0 +1,125 @@
+import type { GaiaRecord } from "./database.ts";
+import type { ConeTarget } from "./types.ts";
+import {
+  readLines,
+  type ServeQuery,
+  type ServeRequest,
+  type ServeResponse,
+} from "./server.ts";
+
+type PendingRequest = {
+  resolve: (results: unknown) => void;
+  reject: (error: Error) => void;
+};
+
+const encoder = new TextEncoder();
+
+/**
+ * Client of a `serve` daemon on a Unix domain socket. Requests share one
+ * connection and may overlap; each resolves with its own response, so a
+ * query costs a round trip instead of process startup and a cold cache.
+ */
+export class GaiaClient {
+  private conn: Deno.UnixConn;
+  private writer: WritableStreamDefaultWriter<Uint8Array>;
+  private pending = new Map<number, PendingRequest>();
+  private nextId = 1;
+  private reading: Promise<void>;
+
+  private constructor(conn: Deno.UnixConn) {
+    this.conn = conn;
+    this.writer = conn.writable.getWriter();
+    this.reading = this.readResponses();
+  }
+
+  /**
+   * Connect to the daemon listening on the socket at `path`
+   */
+  static async connect(path: string): Promise<GaiaClient> {
+    return new GaiaClient(await Deno.connect({ transport: "unix", path }));
+  }
+
+  /**
+   * Send a query and wait for its results
+   */
+  async request<T = unknown>(query: ServeQuery): Promise<T> {
+    const id = this.nextId++;
+    const results = new Promise<T>((resolve, reject) => {
+      this.pending.set(id, {
+        resolve: resolve as (results: unknown) => void,
+        reject,
+      });
+    });
+    const request: ServeRequest = { ...query, id };
+    try {
+      await this.writer.write(encoder.encode(JSON.stringify(request) + "\n"));
+    } catch (error) {
+      this.pending.delete(id);
+      throw error;
+    }
+    return results;
+  }
+
+  /**
+   * Stars within `radius` degrees of ra, dec
+   */
+  coneSearch(ra: number, dec: number, radius: number): Promise<GaiaRecord[]> {
+    return this.request<GaiaRecord[]>({ op: "cone", ra, dec, radius });
+  }
+
+  /**
+   * Cone searches of many targets, one result list per target
+   */
+  coneSearchBatch(targets: ConeTarget[]): Promise<GaiaRecord[][]> {
+    return this.request<GaiaRecord[][]>({ op: "batch", targets });
+  }
+
+  /**
+   * The k stars nearest to ra, dec, nearest first
+   */
+  nearest(ra: number, dec: number, k: number): Promise<GaiaRecord[]> {
+    return this.request<GaiaRecord[]>({ op: "nearest", ra, dec, k });
+  }
+
+  /**
+   * Number of stars within `radius` degrees of ra, dec
+   */
+  coneCount(ra: number, dec: number, radius: number): Promise<number> {
+    return this.request<number>({ op: "count", ra, dec, radius });
+  }
+
+  /**
+   * Close the connection, rejecting requests still waiting
+   */
+  async close(): Promise<void> {
+    this.conn.close();
+    await this.reading;
+  }
+
+  /**
+   * Settle pending requests from response lines until the connection ends
+   */
+  private async readResponses(): Promise<void> {
+    try {
+      for await (const line of readLines(this.conn.readable)) {
+        const response = JSON.parse(line) as ServeResponse;
+        const request = this.pending.get(response.id as number);
+        if (!request) continue;
+        this.pending.delete(response.id as number);
+
+        if ("error" in response) {
+          request.reject(new Error(response.error));
+        } else {
+          request.resolve(response.results);
+        }
+      }
+    } catch {
+      // Connection closed
+    }
+
+    for (const request of this.pending.values()) {
+      request.reject(new Error("Connection to the Gaia server closed"));
+    }
+    this.pending.clear();
+  }
+}
@@ -0,0 +1,378 @@
+import type { GaiaRecord } from "./database.ts";
+
+/** Row number held by a lazy row view */
+const ROW = Symbol("row");
+
+type RowView = GaiaRecord & { [ROW]: number };
+
+type ColumnPart = {
+  offset: number;
+  values: BigInt64Array | Float64Array | (string | null)[];
+};
+
+/** Columns that hold text rather than numbers */
+const textColumns = new Set(["tmass_source_id"]);
+
+type ColumnKind = "id" | "number" | "text";
+
+/**
+ * How a column is held, from its name and one non-null value
+ */
+function columnKind(name: string, sample: unknown): ColumnKind {
+  if (name === "source_id") return "id";
+  return textColumns.has(name) || typeof sample === "string"
+    ? "text"
+    : "number";
+}
+
+/**
+ * Arrays of `length` rows for each column, NaN or null until filled.
+ * Columns with no kind (null in every row) are numeric.
+ */
+function emptyColumns(
+  names: string[],
+  kinds: Map<string, ColumnKind>,
+  length: number,
+): {
+  sourceIds: BigInt64Array | null;
+  numeric: Map<string, Float64Array>;
+  text: Map<string, (string | null)[]>;
+} {
+  let sourceIds: BigInt64Array | null = null;
+  const numeric = new Map<string, Float64Array>();
+  const text = new Map<string, (string | null)[]>();
+  for (const name of names) {
+    const kind = kinds.get(name) ?? (name === "source_id" ? "id" : "number");
+    if (kind === "id") {
+      sourceIds = new BigInt64Array(length);
+    } else if (kind === "text") {
+      text.set(name, new Array<string | null>(length).fill(null));
+    } else {
+      numeric.set(name, new Float64Array(length).fill(NaN));
+    }
+  }
+  return { sourceIds, numeric, text };
+}
+
+/**
+ * Query results held column by column: source_id as a BigInt64Array,
+ * numeric columns as Float64Arrays with NaN for null (see nullMask), and
+ * text columns such as tmass_source_id as plain arrays. Row objects are
+ * only built when asked for, as read-only views over the columns.
+ */
+export class ColumnarResult {
+  readonly length: number;
+  private ids: BigInt64Array | null;
+  private numeric: Map<string, Float64Array>;
+  private text: Map<string, (string | null)[]>;
+  private masks = new Map<string, Uint8Array | null>();
+  private prototype: object | null = null;
+
+  constructor(
+    length: number,
+    sourceIds: BigInt64Array | null,
+    numeric: Map<string, Float64Array>,
+    text: Map<string, (string | null)[]> = new Map(),
+  ) {
+    this.length = length;
+    this.ids = sourceIds;
+    this.numeric = numeric;
+    this.text = text;
+  }
+
+  /**
+   * Build a result from batches of records, copying each batch into
+   * typed arrays so the records can be collected as it goes. A column's
+   * kind comes from its first non-null value in any batch; batches where
+   * it is all null leave the NaN or null the arrays start with.
+   */
+  static fromRecords(batches: Iterable<GaiaRecord[]>): ColumnarResult {
+    const names: string[] = [];
+    const parts = new Map<string, ColumnPart[]>();
+    const kinds = new Map<string, ColumnKind>();
+    let length = 0;
+
+    for (const batch of batches) {
+      if (!batch.length) continue;
+
+      for (const name of Object.keys(batch[0])) {
+        if (!parts.has(name)) {
+          names.push(name);
+          parts.set(name, []);
+        }
+        let kind = kinds.get(name);
+        if (!kind) {
+          const sample = batch.find((record) => record[name] != null)?.[name];
+          if (sample === undefined) continue;
+          kind = columnKind(name, sample);
+          kinds.set(name, kind);
+        }
+
+        let values: ColumnPart["values"];
+        if (kind === "id") {
+          values = BigInt64Array.from(
+            batch,
+            (record) => BigInt(record[name] as string),
+          );
+        } else if (kind === "text") {
+          values = batch.map((record) =>
+            record[name] == null ? null : String(record[name])
+          );
+        } else {
+          values = Float64Array.from(
+            batch,
+            (record) => record[name] == null ? NaN : Number(record[name]),
+          );
+        }
+        parts.get(name)!.push({ offset: length, values });
+      }
+      length += batch.length;
+    }
+
+    const columns = emptyColumns(names, kinds, length);
+    for (const [name, kind] of kinds) {
+      for (const part of parts.get(name)!) {
+        if (kind === "id") {
+          columns.sourceIds!.set(part.values as BigInt64Array, part.offset);
+        } else if (kind === "text") {
+          const values = columns.text.get(name)!;
+          (part.values as (string | null)[]).forEach((value, i) => {
+            values[part.offset + i] = value;
+          });
+        } else {
+          columns.numeric.get(name)!.set(
+            part.values as Float64Array,
+            part.offset,
+          );
+        }
+      }
+    }
+
+    return new ColumnarResult(
+      length,
+      columns.sourceIds,
+      columns.numeric,
+      columns.text,
+    );
+  }
+
+  /**
+   * Build a result from rows of values in `names` order, as
+   * Statement.values returns them, filling each column's array directly
+   */
+  static fromValues(names: string[], rows: unknown[][]): ColumnarResult {
+    const kinds = new Map<string, ColumnKind>();
+    names.forEach((name, c) => {
+      const sample = rows.find((row) => row[c] != null)?.[c];
+      if (sample !== undefined) kinds.set(name, columnKind(name, sample));
+    });
+
+    const columns = emptyColumns(names, kinds, rows.length);
+    names.forEach((name, c) => {
+      const kind = kinds.get(name);
+      if (kind === "id") {
+        const values = columns.sourceIds!;
+        rows.forEach((row, i) => {
+          values[i] = BigInt(row[c] as string | number | bigint);
+        });
+      } else if (kind === "text") {
+        const values = columns.text.get(name)!;
+        rows.forEach((row, i) => {
+          if (row[c] != null) values[i] = String(row[c]);
+        });
+      } else if (kind === "number") {
+        const values = columns.numeric.get(name)!;
+        rows.forEach((row, i) => {
+          if (row[c] != null) values[i] = Number(row[c]);
+        });
+      }
+    });
+
+    return new ColumnarResult(
+      rows.length,
+      columns.sourceIds,
+      columns.numeric,
+      columns.text,
+    );
+  }
+
+  /**
+   * source_id of every row as int64, or null when not selected
+   */
+  get sourceIds(): BigInt64Array | null {
+    return this.ids;
+  }
+
+  /**
+   * Column names, source_id first
+   */
+  get names(): string[] {
+    return [
+      ...(this.sourceIds ? ["source_id"] : []),
+      ...this.numeric.keys(),
+      ...this.text.keys(),
+    ];
+  }
+
+  /**
+   * Whether the result has a column
+   */
+  has(name: string): boolean {
+    return (name === "source_id" && !!this.sourceIds) ||
+      this.numeric.has(name) || this.text.has(name);
+  }
+
+  /**
+   * Values of a numeric column, NaN where null
+   */
+  column(name: string): Float64Array {
+    const values = this.numeric.get(name);
+    if (!values) {
+      throw new Error(`No numeric column ${name} in the result`);
+    }
+    return values;
+  }
+
+  /**
+   * Values of a text column such as tmass_source_id
+   */
+  textColumn(name: string): (string | null)[] {
+    const values = this.text.get(name);
+    if (!values) {
+      throw new Error(`No text column ${name} in the result`);
+    }
+    return values;
+  }
+
+  /**
+   * 1 for each row where a numeric column is null, or null when none is.
+   * Built on first use.
+   */
+  nullMask(name: string): Uint8Array | null {
+    if (!this.masks.has(name)) {
+      const values = this.column(name);
+      let mask: Uint8Array | null = null;
+      for (let i = 0; i < values.length; i++) {
+        if (Number.isNaN(values[i])) {
+          mask ??= new Uint8Array(values.length);
+          mask[i] = 1;
+        }
+      }
+      this.masks.set(name, mask);
+    }
+    return this.masks.get(name)!;
+  }
+
+  /**
+   * Add or replace a numeric column, which must have one value per row
+   */
+  setColumn(name: string, values: Float64Array): void {
+    if (values.length !== this.length) {
+      throw new Error(
+        `Column ${name} has ${values.length} values for ${this.length} rows`,
+      );
+    }
+    this.text.delete(name);
+    this.numeric.set(name, values);
+    this.masks.delete(name);
+    this.prototype = null;
+  }
+
+  /**
+   * Drop a column if present
+   */
+  deleteColumn(name: string): void {
+    if (name === "source_id") {
+      this.ids = null;
+    }
+    this.numeric.delete(name);
+    this.text.delete(name);
+    this.masks.delete(name);
+    this.prototype = null;
+  }
+
+  /**
+   * Value of one cell as a record would hold it: source_id as a string,
+   * null for missing values
+   */
+  value(name: string, index: number): string | number | null {
+    if (name === "source_id" && this.sourceIds) {
+      return this.sourceIds[index].toString();
+    }
+    const values = this.numeric.get(name);
+    if (values) {
+      const value = values[index];
+      return Number.isNaN(value) ? null : value;
+    }
+    return this.text.get(name)?.[index] ?? null;
+  }
+
+  /**
+   * Lazy read-only view of row `index`: each column is read from its
+   * array when accessed, and JSON.stringify writes the full row
+   */
+  row(index: number): GaiaRecord {
+    if (!(index >= 0 && index < this.length)) {
+      throw new Error(`Row ${index} is out of range (${this.length} rows)`);
+    }
+    const view = Object.create(this.rowPrototype()) as RowView;
+    view[ROW] = index;
+    return view;
+  }
+
+  /**
+   * Lazy views of every row in order
+   */
+  *rows(): Generator<GaiaRecord> {
+    for (let i = 0; i < this.length; i++) {
+      yield this.row(i);
+    }
+  }
+
+  [Symbol.iterator](): Generator<GaiaRecord> {
+    return this.rows();
+  }
+
+  /**
+   * Row `index` copied into a plain record
+   */
+  record(index: number): GaiaRecord {
+    const record = {} as GaiaRecord;
+    for (const name of this.names) {
+      record[name] = this.value(name, index);
+    }
+    return record;
+  }
+
+  /**
+   * Every row copied into plain records
+   */
+  toRecords(): GaiaRecord[] {
+    return Array.from({ length: this.length }, (_, i) => this.record(i));
+  }
+
+  /**
+   * Shared prototype of the row views, with a getter per column
+   */
+  private rowPrototype(): object {
+    if (!this.prototype) {
+      const result = this;
+      const prototype = {};
+      for (const name of this.names) {
+        Object.defineProperty(prototype, name, {
+          get(this: RowView) {
+            return result.value(name, this[ROW]);
+          },
+          enumerable: true,
+        });
+      }
+      Object.defineProperty(prototype, "toJSON", {
+        value(this: RowView) {
+          return result.record(this[ROW]);
+        },
+      });
+      this.prototype = prototype;
+    }
+    return this.prototype;
+  }
+}
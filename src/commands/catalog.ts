@@ -0,0 +1,43 @@
+import type { CLIConfig } from "../config.ts";
+import { GaiaDatabase } from "../database.ts";
+import { parseArgs } from "@std/cli/parse-args";
+import { formatDuration } from "../utils.ts";
+
+const DEFAULT_CATALOG_ORDER = 8;
+
+/**
+ * Build the native memory-mapped catalog from the populated database
+ * @param config - The configuration for the database
+ * @param args - The arguments for the command
+ * @returns void
+ */
+export function catalogCommand(config: CLIConfig, args: string[]) {
+  const parsed = parseArgs(args, {
+    string: ["order"],
+  });
+
+  const order = parsed.order ? parseInt(parsed.order) : DEFAULT_CATALOG_ORDER;
+
+  if (isNaN(order) || order < 0 || order > 12) {
+    throw new Error(`Invalid HEALPix order: ${parsed.order}. Must be 0-12.`);
+  }
+
+  console.log("🗺️  Gaia Offline - Native Catalog Build\n");
+  console.log(`  Database path:  ${config.databasePath}`);
+  console.log(`  Catalog path:   ${config.catalogPath}`);
+  console.log(`  HEALPix order:  ${order}\n`);
+
+  const startTime = Date.now();
+  const db = new GaiaDatabase(config);
+
+  try {
+    const count = db.exportCatalog(config.catalogPath, order);
+    console.log(
+      `✅ Wrote ${count.toLocaleString()} records in ${
+        formatDuration(Date.now() - startTime)
+      }`,
+    );
+  } finally {
+    db.close();
+  }
+}
@@ -20,6 +20,9 @@ export async function populateCommand(
   console.log(`  Database path:       ${config.databasePath}`);
   console.log(`  Parallel downloads:  ${config.maxParallelDownloads}`);
   console.log(`  Magnitude limit:     ${config.magnitudeLimit}`);
+  if (config.magnitudeTiers.length > 0) {
+    console.log(`  Magnitude tiers:     ${config.magnitudeTiers.join(", ")}`);
+  }
   console.log(
     `  Stored columns:      ${config.storedColumns.length} columns (${
       config.storedColumns.join(", ")
@@ -1,7 +1,15 @@
 import type { CLIConfig } from "../config.ts";
 import { createGaia } from "../gaia.ts";
 import { parseArgs } from "@std/cli/parse-args";
-import { PhotometryOutput } from "../types.ts";
+import {
+  ConeTarget,
+  HistogramAxis,
+  isGaiaColumn,
+  PhotometryOutput,
+  QueryBackend,
+  QueryFilter,
+  ResultOrder,
+} from "../types.ts";
 
 /**
  * Query the database with the Gaia DR3 data
@@ -18,12 +26,28 @@ export function queryCommand(config: CLIConfig, args: string[]) {
       "magnitude-limit",
       "limit",
       "photometry",
+      "backend",
+      "targets",
+      "threads",
+      "epoch",
+      "order",
+      "columns",
+      "filter",
+      "histogram",
+      "sample",
+      "batch-size",
     ],
     boolean: [
       "xmatch",
+      "count",
+      "ndjson",
     ],
   });
 
+  if (parsed.targets) {
+    return batchQuery(config, parsed);
+  }
+
   if (!parsed.ra) {
     throw new Error("--ra is required");
   }
@@ -42,22 +66,178 @@ export function queryCommand(config: CLIConfig, args: string[]) {
 
   const radius = parseFloat(parsed.radius);
 
+  const epoch = parsed.epoch ? parseFloat(parsed.epoch) : undefined;
+  if (epoch !== undefined && isNaN(epoch)) {
+    throw new Error(`Invalid epoch: ${parsed.epoch}`);
+  }
+
   const instance = createGaia({
     ...config,
+    epoch,
+    order: getOrder(parsed.order),
+    columns: getColumns(parsed.columns),
+    filter: getFilter(parsed.filter),
+    sample: getSample(parsed.sample),
     limit: Number(parsed.limit) ?? 0,
     photometryOutput: getPhotometryOutput(parsed.photometry),
     magnitudeLimit: getMagnitudeLimit(parsed["magnitude-limit"]) ?? [-3, 20],
     tmassCrossmatch: parsed["xmatch"],
+    backend: getBackend(parsed.backend),
   });
 
+  if (parsed.ndjson) {
+    const batchSize = parsed["batch-size"]
+      ? parseInt(parsed["batch-size"])
+      : undefined;
+    // One JSON record per line, written as each batch arrives
+    instance.run((gaia) => {
+      for (const batch of gaia.coneSearchIter(ra, dec, radius, batchSize)) {
+        console.log(batch.map((record) => JSON.stringify(record)).join("\n"));
+      }
+    });
+    return;
+  }
+
+  const histogram = getHistogram(parsed.histogram);
   const results = instance.run((gaia) => {
+    if (parsed.count) {
+      return gaia.coneCount(ra, dec, radius);
+    }
+    if (histogram?.length === 1) {
+      return gaia.coneHistogram(ra, dec, radius, histogram[0]);
+    }
+    if (histogram) {
+      const [x, y] = histogram;
+      return gaia.coneHistogram2D(ra, dec, radius, x, y);
+    }
     return gaia.coneSearch(ra, dec, radius);
   });
 
   console.log(results);
 }
 
-function getPhotometryOutput(
+/**
+ * Every star in a magnitude range across the whole sky, brightest first,
+ * read through a flux-ordered index instead of a sky scan
+ * @param config - The configuration for the database
+ * @param args - The arguments for the command
+ */
+export function queryBrightCommand(config: CLIConfig, args: string[]) {
+  const parsed = parseArgs(args, {
+    string: [
+      "magnitude-limit",
+      "limit",
+      "photometry",
+      "backend",
+      "columns",
+      "filter",
+      "sample",
+    ],
+    boolean: [
+      "xmatch",
+    ],
+  });
+
+  const magnitudeLimit = getMagnitudeLimit(parsed["magnitude-limit"]);
+  if (!magnitudeLimit) {
+    throw new Error("--magnitude-limit is required");
+  }
+
+  const instance = createGaia({
+    ...config,
+    columns: getColumns(parsed.columns),
+    filter: getFilter(parsed.filter),
+    sample: getSample(parsed.sample),
+    limit: Number(parsed.limit) ?? 0,
+    photometryOutput: getPhotometryOutput(parsed.photometry),
+    tmassCrossmatch: parsed["xmatch"],
+    backend: getBackend(parsed.backend),
+  });
+
+  const results = instance.run((gaia) => {
+    return gaia.brightnessLimitSearch(magnitudeLimit);
+  });
+
+  console.log(results);
+}
+
+/**
+ * Cone search every target in a `ra,dec[,radius]` file, falling back to
+ * --radius for lines without one
+ */
+function batchQuery(
+  config: CLIConfig,
+  parsed: {
+    targets?: string;
+    radius?: string;
+    limit?: string;
+    photometry?: string;
+    backend?: string;
+    threads?: string;
+    columns?: string;
+    filter?: string;
+    sample?: string;
+    xmatch: boolean;
+    "magnitude-limit"?: string;
+  },
+) {
+  const defaultRadius = parsed.radius ? parseFloat(parsed.radius) : undefined;
+  const targets = readTargets(parsed.targets!, defaultRadius);
+  const threads = parsed.threads
+    ? parseInt(parsed.threads)
+    : navigator.hardwareConcurrency;
+
+  if (isNaN(threads) || threads < 1) {
+    throw new Error(`Invalid thread count: ${parsed.threads}`);
+  }
+
+  const instance = createGaia({
+    ...config,
+    columns: getColumns(parsed.columns),
+    filter: getFilter(parsed.filter),
+    sample: getSample(parsed.sample),
+    limit: Number(parsed.limit) ?? 0,
+    photometryOutput: getPhotometryOutput(parsed.photometry),
+    magnitudeLimit: getMagnitudeLimit(parsed["magnitude-limit"]) ?? [-3, 20],
+    tmassCrossmatch: parsed["xmatch"],
+    backend: getBackend(parsed.backend),
+  });
+
+  const results = instance.run((gaia) => {
+    return gaia.coneSearchBatch(targets, threads);
+  });
+
+  console.log(
+    targets.map((target, i) => ({ ...target, results: results[i] })),
+  );
+}
+
+function readTargets(path: string, defaultRadius?: number): ConeTarget[] {
+  const targets: ConeTarget[] = [];
+  const lines = Deno.readTextFileSync(path).split("\n");
+
+  for (const [index, line] of lines.entries()) {
+    const trimmed = line.trim();
+    if (!trimmed || trimmed.startsWith("#")) continue;
+
+    const [ra, dec, radius] = trimmed.split(/[,\s]+/).map(Number);
+    // Skip a header row
+    if (index === 0 && isNaN(ra)) continue;
+
+    const target = { ra, dec, radius: radius ?? defaultRadius };
+    if (isNaN(target.ra) || isNaN(target.dec) || !(target.radius! > 0)) {
+      throw new Error(
+        `Invalid target on line ${index + 1} of ${path}: "${trimmed}". ` +
+          "Expected ra,dec[,radius] (or pass --radius).",
+      );
+    }
+    targets.push(target as ConeTarget);
+  }
+
+  return targets;
+}
+
+export function getPhotometryOutput(
   photometry?: string,
 ): PhotometryOutput | undefined {
   if (!photometry) {
@@ -77,7 +257,120 @@ function getPhotometryOutput(
   );
 }
 
-function getMagnitudeLimit(magLimit?: string): [number, number] | undefined {
+export function getBackend(backend?: string): QueryBackend | undefined {
+  if (!backend) {
+    return undefined;
+  }
+
+  if (backend === "sql" || backend === "native") {
+    return backend;
+  }
+
+  throw new Error(`Invalid backend: ${backend}. Must be "sql" or "native".`);
+}
+
+export function getOrder(order?: string): ResultOrder | undefined {
+  if (!order) {
+    return undefined;
+  }
+
+  if (order === "none" || order === "brightest" || order === "nearest") {
+    return order;
+  }
+
+  throw new Error(
+    `Invalid order: ${order}. Must be "none", "brightest" or "nearest".`,
+  );
+}
+
+/**
+ * Output columns for --columns. The global parser also reads the flag as
+ * the stored columns, which only matter when populating.
+ */
+export function getColumns(columns?: string): string[] | undefined {
+  if (!columns) {
+    return undefined;
+  }
+
+  return columns.split(",").map((column) => column.trim()).filter(Boolean);
+}
+
+/**
+ * Column cuts from --filter, e.g. `bp_rp=0.5:1.5,ruwe=:1.4`; an empty
+ * bound leaves that side open
+ */
+export function getFilter(filter?: string): QueryFilter | undefined {
+  if (!filter) {
+    return undefined;
+  }
+
+  const cuts: QueryFilter = {};
+  for (const cut of filter.split(",")) {
+    const match = cut.trim().match(/^(\w+)=([^:]*):([^:]*)$/);
+    if (!match || !isGaiaColumn(match[1])) {
+      throw new Error(
+        `Invalid filter: ${cut}. Must be column=min:max with a Gaia column.`,
+      );
+    }
+
+    const min = match[2] === "" ? -Infinity : Number(match[2]);
+    const max = match[3] === "" ? Infinity : Number(match[3]);
+    if (isNaN(min) || isNaN(max)) {
+      throw new Error(`Invalid filter bounds: ${cut}`);
+    }
+    cuts[match[1]] = [min, max];
+  }
+
+  return cuts;
+}
+
+/**
+ * Histogram axes from --histogram, e.g. `bp_rp=-0.5:3:35` or, for a 2D
+ * histogram, `bp_rp=-0.5:3:35,phot_g_mean_mag=4:16:48`
+ */
+function getHistogram(histogram?: string): HistogramAxis[] | undefined {
+  if (!histogram) {
+    return undefined;
+  }
+
+  const axes = histogram.split(",").map((axis) => {
+    const match = axis.trim().match(/^(\w+)=([^:]+):([^:]+):(\d+)$/);
+    if (!match || !isGaiaColumn(match[1])) {
+      throw new Error(
+        `Invalid histogram axis: ${axis}. Must be column=min:max:bins with a Gaia column.`,
+      );
+    }
+    return {
+      column: match[1],
+      min: Number(match[2]),
+      max: Number(match[3]),
+      bins: Number(match[4]),
+    };
+  });
+
+  if (axes.length > 2) {
+    throw new Error("--histogram takes one or two axes");
+  }
+  return axes;
+}
+
+export function getSample(sample?: string): number | undefined {
+  if (!sample) {
+    return undefined;
+  }
+
+  const value = Number(sample);
+  if (!(value > 0)) {
+    throw new Error(
+      `Invalid sample: ${sample}. Must be a fraction below 1 or a star count.`,
+    );
+  }
+  return value;
+}
+
+export function getMagnitudeLimit(
+  magLimit?: string,
+): [number, number] | undefined {
   if (!magLimit) {
     return undefined;
   }
@@ -0,0 +1,98 @@
+import type { CLIConfig } from "../config.ts";
+import { parseArgs } from "@std/cli/parse-args";
+import { GaiaPool } from "../pool.ts";
+import { serveHttp, serveUnix } from "../server.ts";
+import {
+  getBackend,
+  getColumns,
+  getFilter,
+  getMagnitudeLimit,
+  getOrder,
+  getPhotometryOutput,
+  getSample,
+} from "./query.ts";
+
+const DEFAULT_SOCKET = "./gaiaoffline.sock";
+
+/**
+ * Keep the database open and warm in a pool of read-only workers, and
+ * answer NDJSON queries on a Unix socket or localhost HTTP until
+ * interrupted
+ * @param config - The configuration for the database
+ * @param args - The arguments for the command
+ */
+export async function serveCommand(config: CLIConfig, args: string[]) {
+  const parsed = parseArgs(args, {
+    string: [
+      "socket",
+      "port",
+      "workers",
+      "magnitude-limit",
+      "limit",
+      "photometry",
+      "backend",
+      "epoch",
+      "order",
+      "columns",
+      "filter",
+      "sample",
+    ],
+    boolean: [
+      "xmatch",
+      "immutable",
+    ],
+  });
+
+  const port = parsed.port ? parseInt(parsed.port) : undefined;
+  if (port !== undefined && !(port >= 0 && port <= 65535)) {
+    throw new Error(`Invalid port: ${parsed.port}`);
+  }
+  const socket = parsed.socket ?? DEFAULT_SOCKET;
+
+  const workers = parsed.workers
+    ? parseInt(parsed.workers)
+    : navigator.hardwareConcurrency;
+  if (isNaN(workers) || workers < 1) {
+    throw new Error(`Invalid worker count: ${parsed.workers}`);
+  }
+
+  const epoch = parsed.epoch ? parseFloat(parsed.epoch) : undefined;
+  if (epoch !== undefined && isNaN(epoch)) {
+    throw new Error(`Invalid epoch: ${parsed.epoch}`);
+  }
+
+  const pool = new GaiaPool({
+    ...config,
+    workers,
+    immutable: parsed.immutable,
+    epoch,
+    order: getOrder(parsed.order),
+    columns: getColumns(parsed.columns),
+    filter: getFilter(parsed.filter),
+    sample: getSample(parsed.sample),
+    limit: Number(parsed.limit) || 0,
+    photometryOutput: getPhotometryOutput(parsed.photometry),
+    magnitudeLimit: getMagnitudeLimit(parsed["magnitude-limit"]) ?? [-3, 20],
+    tmassCrossmatch: parsed["xmatch"],
+    backend: getBackend(parsed.backend),
+  });
+
+  // Open every worker's connection before accepting queries
+  await pool.ready();
+
+  const controller = new AbortController();
+  Deno.addSignalListener("SIGINT", () => controller.abort());
+
+  if (port !== undefined) {
+    const server = serveHttp(pool, port, controller.signal);
+    console.log(
+      `Serving Gaia queries on http://127.0.0.1:${server.addr.port}/ with ${workers} workers`,
+    );
+    await server.finished;
+  } else {
+    console.log(`Serving Gaia queries on ${socket} with ${workers} workers`);
+    await serveUnix(pool, socket, controller.signal);
+  }
+
+  await pool.close();
+}
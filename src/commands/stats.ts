@@ -18,7 +18,13 @@ export function statsCommand(config: CLIConfig) {
     const stats = gaia.getStats();
 
     console.log(`Database: ${config.databasePath}`);
-    console.log(`Total records: ${stats.totalRecords.toLocaleString()}\n`);
+    console.log(`Total records: ${stats.totalRecords.toLocaleString()}`);
+    for (const tier of stats.tiers) {
+      console.log(
+        `  G < ${tier.limit} tier: ${tier.count.toLocaleString()} records`,
+      );
+    }
+    console.log();
 
     console.log("Tracking Progress:");
     console.log("─".repeat(30));
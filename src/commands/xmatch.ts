@@ -0,0 +1,233 @@
+import { type CLIConfig, GAIA_DR3_EPOCH } from "../config.ts";
+import { parseArgs } from "@std/cli/parse-args";
+import { CsvParseStream } from "@std/csv/parse-stream";
+import type { GaiaRecord } from "../database.ts";
+import { NativeCatalog, RowSet } from "../ffi/catalog.ts";
+import { formatDuration } from "../utils.ts";
+
+const DEFAULT_XMATCH_RADIUS = 1; // arcsec
+const DEFAULT_XMATCH_CHUNK = 100000;
+
+/**
+ * Cross-match a CSV of positions against the native catalog, streaming
+ * the best Gaia match for each position to an output CSV
+ * @param config - The configuration for the database
+ * @param args - The arguments for the command
+ * @returns void
+ */
+export async function xmatchCommand(config: CLIConfig, args: string[]) {
+  const parsed = parseArgs(args, {
+    string: [
+      "input",
+      "output",
+      "radius",
+      "epoch",
+      "ra-column",
+      "dec-column",
+      "threads",
+      "chunk-size",
+    ],
+    boolean: ["unmatched"],
+    default: {
+      "ra-column": "ra",
+      "dec-column": "dec",
+    },
+  });
+
+  if (!parsed.input) {
+    throw new Error("--input is required");
+  }
+
+  if (!parsed.output) {
+    throw new Error("--output is required");
+  }
+
+  const radius = parsed.radius
+    ? parseFloat(parsed.radius)
+    : DEFAULT_XMATCH_RADIUS;
+  if (isNaN(radius) || radius <= 0) {
+    throw new Error(`Invalid radius: ${parsed.radius}. Must be > 0 arcsec.`);
+  }
+
+  const epoch = parsed.epoch ? parseFloat(parsed.epoch) : GAIA_DR3_EPOCH;
+  if (isNaN(epoch)) {
+    throw new Error(`Invalid epoch: ${parsed.epoch}`);
+  }
+
+  const threads = parsed.threads
+    ? parseInt(parsed.threads)
+    : navigator.hardwareConcurrency;
+  if (isNaN(threads) || threads < 1) {
+    throw new Error(`Invalid thread count: ${parsed.threads}`);
+  }
+
+  const chunkSize = parsed["chunk-size"]
+    ? parseInt(parsed["chunk-size"])
+    : DEFAULT_XMATCH_CHUNK;
+  if (isNaN(chunkSize) || chunkSize < 1) {
+    throw new Error(`Invalid chunk size: ${parsed["chunk-size"]}`);
+  }
+
+  console.log("🎯 Gaia Offline - Cross-match\n");
+  console.log(`  Catalog path:   ${config.catalogPath}`);
+  console.log(`  Input:          ${parsed.input}`);
+  console.log(`  Output:         ${parsed.output}`);
+  console.log(`  Radius:         ${radius}″`);
+  console.log(`  Epoch:          ${epoch}`);
+  console.log(`  Threads:        ${threads}\n`);
+
+  const startTime = Date.now();
+  const catalog = NativeCatalog.open(config.catalogPath);
+  const input = await Deno.open(parsed.input, { read: true });
+  const output = await Deno.open(parsed.output, {
+    write: true,
+    create: true,
+    truncate: true,
+  });
+  const writer = output.writable.getWriter();
+  const encoder = new TextEncoder();
+
+  let total = 0;
+  let matched = 0;
+
+  try {
+    const rows = input.readable
+      .pipeThrough(new TextDecoderStream())
+      .pipeThrough(new CsvParseStream({ comment: "#" }));
+
+    let headers: string[] | null = null;
+    let raIndex = -1;
+    let decIndex = -1;
+    let chunk: string[][] = [];
+
+    const flush = async () => {
+      const result = matchChunk(chunk, {
+        catalog,
+        raIndex,
+        decIndex,
+        radius: radius / 3600,
+        years: epoch - GAIA_DR3_EPOCH,
+        threads,
+        includeUnmatched: parsed.unmatched,
+      });
+      total += chunk.length;
+      matched += result.matched;
+      await writer.write(encoder.encode(result.text));
+      chunk = [];
+    };
+
+    for await (const row of rows) {
+      if (!headers) {
+        headers = row;
+        raIndex = headers.indexOf(parsed["ra-column"]);
+        decIndex = headers.indexOf(parsed["dec-column"]);
+        if (raIndex < 0 || decIndex < 0) {
+          throw new Error(
+            `Input must have "${parsed["ra-column"]}" and "${
+              parsed["dec-column"]
+            }" columns (see --ra-column/--dec-column)`,
+          );
+        }
+
+        const outputHeaders = [
+          ...headers,
+          ...catalog.columns.map((col) => `gaia_${col}`),
+          "separation_arcsec",
+        ];
+        await writer.write(
+          encoder.encode(outputHeaders.map(csvField).join(",") + "\n"),
+        );
+        continue;
+      }
+
+      chunk.push(row);
+      if (chunk.length === chunkSize) {
+        await flush();
+      }
+    }
+
+    if (chunk.length > 0) {
+      await flush();
+    }
+  } finally {
+    await writer.close();
+    catalog.close();
+  }
+
+  console.log(
+    `✅ Matched ${matched.toLocaleString()} of ${total.toLocaleString()} positions in ${
+      formatDuration(Date.now() - startTime)
+    }`,
+  );
+}
+
+/**
+ * Match one chunk of input rows and render the output CSV lines
+ */
+function matchChunk(
+  chunk: string[][],
+  options: {
+    catalog: NativeCatalog;
+    raIndex: number;
+    decIndex: number;
+    radius: number;
+    years: number;
+    threads: number;
+    includeUnmatched: boolean;
+  },
+): { text: string; matched: number } {
+  const { catalog } = options;
+  const ra = Float64Array.from(
+    chunk,
+    (row) => parseFloat(row[options.raIndex]),
+  );
+  const dec = Float64Array.from(
+    chunk,
+    (row) => parseFloat(row[options.decIndex]),
+  );
+
+  const result = catalog.crossMatch(
+    ra,
+    dec,
+    options.radius,
+    options.years,
+    options.threads,
+  );
+
+  // Gather the matched Gaia rows in one call
+  const matchedRows = new BigUint64Array(result.matched);
+  let next = 0;
+  for (const row of result.rows) {
+    if (row >= 0n) matchedRows[next++] = BigInt.asUintN(64, row);
+  }
+  const rowSet = RowSet.fromRows(matchedRows);
+  let records: GaiaRecord[];
+  try {
+    records = catalog.readRecords(rowSet);
+  } finally {
+    rowSet.free();
+  }
+
+  const empty = catalog.columns.map(() => "");
+  let text = "";
+  next = 0;
+
+  for (let i = 0; i < chunk.length; i++) {
+    let gaia = empty;
+    let separation = "";
+    if (result.rows[i] >= 0n) {
+      const record = records[next++];
+      gaia = catalog.columns.map((col) => `${record[col] ?? ""}`);
+      separation = `${result.separation[i] * 3600}`;
+    } else if (!options.includeUnmatched) {
+      continue;
+    }
+    text += [...chunk[i], ...gaia, separation].map(csvField).join(",") + "\n";
+  }
+
+  return { text, matched: result.matched };
+}
+
+function csvField(value: string): string {
+  return /[",\n\r]/.test(value) ? `"${value.replaceAll('"', '""')}"` : value;
+}
@@ -7,6 +7,11 @@ export interface CLIConfig {
    * @default ./gaiaoffline.db
    */
   databasePath: string;
+  /**
+   * Path to the native memory-mapped catalog built from the database
+   * @default ./gaiaoffline.cat
+   */
+  catalogPath: string;
   /**
    * Number of max parallel downloads
    * @default 10
@@ -44,6 +49,13 @@ export interface CLIConfig {
    * @default 16
    */
   magnitudeLimit: number;
+  /**
+   * G magnitude limits of bright-star tiers written alongside gaiadr3
+   * while populating, each as a gaiadr3_g<N> table with its own spatial
+   * index. Queries read the smallest tier covering their magnitude limit.
+   * @default []
+   */
+  magnitudeTiers: number[];
   /**
    * The log level
    * @default "INFO"
@@ -69,10 +81,45 @@ export interface CLIConfig {
    * @default false
    */
   useCParser: boolean;
+  /**
+   * Whether to store G, BP and RP magnitudes and bp_rp next to the
+   * fluxes, computed while parsing with the zeropoints, so magnitude
+   * ranges run on an index and output needs no conversion
+   * @default false
+   */
+  storeMagnitudes: boolean;
 }
 
+/**
+ * Reference epoch of Gaia DR3 positions (Julian year)
+ */
+export const GAIA_DR3_EPOCH = 2016.0;
+
+/**
+ * Fastest known Gaia DR3 proper motion plus margin (mas/yr), matching
+ * GAIA_MAX_PM_MAS_YR in the native library
+ */
+export const GAIA_MAX_PM_MAS_YR = 10400;
+
+/**
+ * Number of Gaia DR3 sources; random_index is a random permutation of
+ * 0 .. GAIA_DR3_SOURCES - 1
+ */
+export const GAIA_DR3_SOURCES = 1811709771;
+
+/**
+ * Columns derived from the fluxes when storeMagnitudes is set
+ */
+export const MAGNITUDE_COLUMNS: GaiaColumn[] = [
+  "phot_g_mean_mag",
+  "phot_bp_mean_mag",
+  "phot_rp_mean_mag",
+  "bp_rp",
+];
+
 export const DEFAULT_CONFIG: CLIConfig = {
   databasePath: "./gaiaoffline.db",
+  catalogPath: "./gaiaoffline.cat",
   maxParallelDownloads: 10,
   csvChunkSize: 100000,
   storedColumns: [
@@ -94,34 +141,40 @@ export const DEFAULT_CONFIG: CLIConfig = {
   cleanUpDownloadedFiles: true,
   zeropoints: [25.6873668671, 25.3385422158, 24.7478955012],
   magnitudeLimit: 16,
+  magnitudeTiers: [],
   logLevel: "INFO",
   useStreaming: false,
   useRustParser: false,
   useCParser: false,
+  storeMagnitudes: false,
 };
 
 export function parseConfig(args: string[]): CLIConfig {
   const parsed = parseArgs(args, {
     string: [
       "db-path",
+      "catalog-path",
       "log-level",
       "columns",
       "parallel",
       "mag-limit",
       "download-dir",
       "csv-chunks",
+      "tiers",
     ],
     boolean: [
       "clean",
       "stream",
       "rust-ffi",
       "c-ffi",
+      "store-magnitudes",
     ],
     negatable: [
       "clean",
     ],
     default: {
       "db-path": DEFAULT_CONFIG.databasePath,
+      "catalog-path": DEFAULT_CONFIG.catalogPath,
       // parallel: DEFAULT_CONFIG.maxParallelDownloads,
       "download-dir": DEFAULT_CONFIG.downloadDir,
       "clean": DEFAULT_CONFIG.cleanUpDownloadedFiles,
@@ -131,6 +184,7 @@ export function parseConfig(args: string[]): CLIConfig {
       "stream": DEFAULT_CONFIG.useStreaming,
       "rust-ffi": DEFAULT_CONFIG.useRustParser,
       "c-ffi": DEFAULT_CONFIG.useCParser,
+      "store-magnitudes": DEFAULT_CONFIG.storeMagnitudes,
     },
     alias: {
       p: "parallel",
@@ -148,6 +202,12 @@ export function parseConfig(args: string[]): CLIConfig {
     parsed["mag-limit"],
     DEFAULT_CONFIG.magnitudeLimit,
   );
+  const magnitudeTiers = parsed.tiers
+    ? parsed.tiers.split(",").map(Number)
+    : DEFAULT_CONFIG.magnitudeTiers;
+  if (magnitudeTiers.some((tier) => !(tier > 0))) {
+    throw new Error(`Invalid magnitude tiers: ${parsed.tiers}`);
+  }
   const csvChunkSize = parseInt(
     `${parsed["csv-chunks"]}`,
     DEFAULT_CONFIG.csvChunkSize,
@@ -169,6 +229,13 @@ export function parseConfig(args: string[]): CLIConfig {
     throw new Error(`Invalid columns: ${invalid.join(", ")}`);
   }
 
+  const storeMagnitudes = parsed["store-magnitudes"];
+  if (storeMagnitudes) {
+    for (const column of MAGNITUDE_COLUMNS) {
+      if (!valid.includes(column)) valid.push(column);
+    }
+  }
+
   const logLevel = parsed["log-level"].toUpperCase();
   if (!isLogLevel(logLevel)) {
     throw new Error(`Invalid log level: ${logLevel}`);
@@ -197,10 +264,12 @@ export function parseConfig(args: string[]): CLIConfig {
 
   const config: CLIConfig = {
     databasePath: parsed["db-path"],
+    catalogPath: parsed["catalog-path"],
     maxParallelDownloads,
     downloadDir: parsed["download-dir"],
     cleanUpDownloadedFiles: parsed["clean"],
     magnitudeLimit,
+    magnitudeTiers,
     csvChunkSize,
     logLevel,
     storedColumns: valid,
@@ -208,6 +277,7 @@ export function parseConfig(args: string[]): CLIConfig {
     useStreaming,
     useRustParser: parsed["rust-ffi"],
     useCParser: parsed["c-ffi"],
+    storeMagnitudes,
   };
 
   return config;
@@ -223,11 +293,16 @@ Commands:
   populate:tmass-xmatch   Download and populate 2MASS crossmatch data (links Gaia to 2MASS)
   populate:tmass          Download and populate 2MASS photometry data (J, H, K magnitudes)
   query                   Run interactive queries (WIP)
+  query:bright            List every star in a magnitude range, brightest first
   stats                   Show database statistics
+  serve                   Keep the database warm and answer NDJSON queries on a Unix socket (--socket) or localhost HTTP (--port)
+  catalog                 Build the native memory-mapped catalog from the database
+  xmatch                  Cross-match a CSV of positions against the native catalog
 
 Options:
+  --catalog-path    Path to the native catalog file (default: ./gaiaoffline.cat)
   --clean           Clean up downloaded files after processing (default: true)
-  --columns         Comma-separated list of columns to store (default: source_id,ra,dec,parallax,pmra,pmdec,radial_velocity,phot_g_mean_flux,phot_bp_mean_flux,phot_rp_mean_flux,teff_gspphot,logg_gspphot,mh_gspphot)
+  --columns         Comma-separated list of columns to store, or for query the columns to return (default: source_id,ra,dec,parallax,pmra,pmdec,radial_velocity,phot_g_mean_flux,phot_bp_mean_flux,phot_rp_mean_flux,teff_gspphot,logg_gspphot,mh_gspphot)
   --csv-chunks      The amount of rows to process at a time from the CSV file. (default: 100000)
   --db-path         Path to SQLite database (default: ./gaiaoffline.db)
   --file-limit      Limit number of files to download (for testing)
@@ -237,7 +312,9 @@ Options:
   -p, --parallel    Number of parallel downloads (default: 10, max: 50)
   --rust            Use Rust FFI for CSV parsing (2-4x faster, requires --allow-ffi)
   --c               Use C FFI for CSV parsing (4-5x faster, fastest option, requires --allow-ffi)
+  --store-magnitudes  Also store G, BP and RP magnitudes and bp_rp, computed while parsing
   --stream          Process files while downloading (faster but uses more RAM)
+  --tiers           Comma-separated G magnitude limits of bright-star tier tables written while populating, e.g. 10,12
 
 Examples:
   # Populate Gaia DR3 with default settings
@@ -252,8 +329,53 @@ Examples:
   # Populate 2MASS photometry (run after populating crossmatch)
   gaiaoffline populate:tmass
 
+  # Also write G<10 and G<12 tier tables, read by queries with a bright enough --magnitude-limit
+  gaiaoffline populate --tiers 10,12
+
+  # Store magnitudes so magnitude-range queries read an index on phot_g_mean_mag
+  gaiaoffline populate --store-magnitudes --c
+
   # Test with only 2 files using C FFI parser
   gaiaoffline populate --file-limit 2 --c
+
+  # Answer queries from 4 warm read-only workers on a Unix socket
+  gaiaoffline serve --socket ./gaiaoffline.sock --workers 4
+  echo '{"id":1,"op":"cone","ra":56.75,"dec":24.12,"radius":0.5}' | nc -U ./gaiaoffline.sock
+
+  # Build the native catalog and query it
+  gaiaoffline catalog --order 8
+  gaiaoffline query --backend native --ra 56.75 --dec 24.12 --radius 0.5
+
+  # Cone search at epoch 2030, with stars moved by their proper motion
+  gaiaoffline query --ra 269.45 --dec 4.69 --radius 0.1 --epoch 2030
+
+  # The 10 brightest stars in a wide field, without reading the rest
+  gaiaoffline query --backend native --ra 266.4 --dec -29 --radius 5 --limit 10 --order brightest
+
+  # Red, well-behaved stars only, cut inside the query
+  gaiaoffline query --ra 56.75 --dec 24.12 --radius 1 --filter bp_rp=1:,ruwe=:1.4
+
+  # Return only positions and G magnitudes
+  gaiaoffline query --ra 56.75 --dec 24.12 --radius 1 --columns ra,dec,phot_g_mean_mag --photometry magnitude
+
+  # A uniform random 1% of a wide field (random_index must be stored)
+  gaiaoffline query --ra 56.75 --dec 24.12 --radius 10 --sample 0.01
+
+  # Stream a wide field as newline-delimited JSON, 10000 records per batch
+  gaiaoffline query --ra 56.75 --dec 24.12 --radius 15 --ndjson --batch-size 10000
+
+  # Star count and a colour-magnitude diagram of a field, without fetching the stars
+  gaiaoffline query --ra 56.75 --dec 24.12 --radius 2 --count
+  gaiaoffline query --ra 56.75 --dec 24.12 --radius 2 --histogram bp_rp=-0.5:3:35,phot_g_mean_mag=4:16:48
+
+  # Every star brighter than G=6 on the sky, via the flux index
+  gaiaoffline query:bright --magnitude-limit -3,6
+
+  # Cone search every ra,dec[,radius] line of a targets file on 8 threads
+  gaiaoffline query --backend native --targets targets.csv --radius 0.2 --threads 8
+
+  # Best Gaia match within 2" for each row of a J2000 source list
+  gaiaoffline xmatch --input sources.csv --output matches.csv --radius 2 --epoch 2000
   `);
 }
 
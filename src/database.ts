@@ -1,7 +1,57 @@
-import { Database } from "@db/sqlite";
-import type { CLIConfig } from "./config.ts";
-import type { Logger } from "./types.ts";
-import { createLogger, formatDuration } from "./utils.ts";
+import { Database, type Statement } from "@db/sqlite";
+import {
+  type CLIConfig,
+  GAIA_MAX_PM_MAS_YR,
+  MAGNITUDE_COLUMNS,
+} from "./config.ts";
+import type {
+  AggregateResult,
+  AggregateTerm,
+  ConeTarget,
+  FilterTerm,
+  Logger,
+  ResultOrder,
+} from "./types.ts";
+import {
+  angularSeparation,
+  convexPolygonNormals,
+  createLogger,
+  formatDuration,
+  magnitudeToFluxRange,
+  orderRecords,
+  parallaxToCartesian,
+  propagatePosition,
+  radecToVector,
+} from "./utils.ts";
+import {
+  CatalogWriter,
+  hasCatalogLib,
+  polygonRanges,
+} from "./ffi/catalog.ts";
+import {
+  sqliteExtensionEntryPoint,
+  sqliteExtensionPath,
+} from "./ffi/sqlite.ts";
+
+/**
+ * SQL condition on the `g` alias for compiled filter terms, with bound
+ * parameters so the text only varies with the filter shape
+ */
+function filterCondition(
+  terms: FilterTerm[],
+): { condition: string; params: Record<string, number> } {
+  const params: Record<string, number> = {};
+  const condition = terms.map((term, i) => {
+    params[`filter${i}Min`] = term.min;
+    params[`filter${i}Max`] = term.max;
+    if (!term.divisor) {
+      return `g.${term.column} BETWEEN :filter${i}Min AND :filter${i}Max`;
+    }
+    const divisor = `g.${term.divisor}`;
+    return `${divisor} > 0 AND g.${term.column} BETWEEN :filter${i}Min * ${divisor} AND :filter${i}Max * ${divisor}`;
+  }).join(" AND ");
+  return { condition, params };
+}
 
 export interface FileTrackingRecord {
   url: string;
@@ -34,20 +84,145 @@ export interface TrackingProgress {
   pending: number;
 }
 
-export type GaiaDatabaseOptions = Pick<
-  CLIConfig,
-  "databasePath" | "logLevel" | "storedColumns" | "zeropoints"
->;
+/**
+ * Columns derived at insert time rather than read from the Gaia CSVs.
+ * `hpx` is the level 12 nested HEALPix pixel Gaia encodes in source_id;
+ * `ux`, `uy`, `uz` are the unit vector of (ra, dec), so the cone test is
+ * a dot product instead of per-row trigonometry.
+ */
+const unitVectorColumns = ["ux", "uy", "uz"];
+const derivedColumns = new Set(["hpx", ...unitVectorColumns]);
+const hpxFromSourceId = (sourceId: string) =>
+  `CAST(${sourceId} AS INTEGER) >> 35`;
+const magnitudeFromFlux = (flux: string, zeropoint: number) =>
+  `CASE WHEN ${flux} > 0 THEN ${zeropoint} - 2.5 * log10(${flux}) END`;
+
+/**
+ * Bright-star tier tables hold the gaiadr3 rows brighter than a G
+ * magnitude limit, e.g. gaiadr3_g10 or gaiadr3_g12_5
+ */
+interface MagnitudeTier {
+  limit: number;
+  table: string;
+  /**
+   * G flux the rows exceed, rounded like magnitudeToFluxRange, as recorded
+   * when the tier was created
+   */
+  minFlux: number;
+}
+
+const tierPrefix = "gaiadr3_g";
+const tierTable = (limit: number) =>
+  `${tierPrefix}${String(limit).replace(".", "_")}`;
+
+/**
+ * Unit vector of a record, preferring the one computed by the native parser
+ */
+function unitVector(record: GaiaRecord): [number, number, number] | null {
+  if (typeof record.ux === "number") {
+    return [record.ux, record.uy as number, record.uz as number];
+  }
+  if (typeof record.ra !== "number" || typeof record.dec !== "number") {
+    return null;
+  }
+  const ra = (record.ra * Math.PI) / 180;
+  const dec = (record.dec * Math.PI) / 180;
+  const cosDec = Math.cos(dec);
+  return [cosDec * Math.cos(ra), cosDec * Math.sin(ra), Math.sin(dec)];
+}
+
+// Unit vector of the `g` row, from ra/dec for rows not yet backfilled
+const UNIT_X = "coalesce(g.ux, cos(radians(g.dec)) * cos(radians(g.ra)))";
+const UNIT_Y = "coalesce(g.uy, cos(radians(g.dec)) * sin(radians(g.ra)))";
+const UNIT_Z = "coalesce(g.uz, sin(radians(g.dec)))";
+
+export type GaiaDatabaseOptions =
+  & Pick<
+    CLIConfig,
+    "databasePath" | "logLevel" | "storedColumns" | "zeropoints"
+  >
+  & Partial<Pick<CLIConfig, "magnitudeTiers">>
+  & {
+    /** Open the database read-only, tuned for concurrent reads */
+    readOnly?: boolean;
+    /**
+     * With readOnly, open it as immutable: SQLite takes no locks and
+     * never checks for changes, so nothing may write to it meanwhile
+     */
+    immutable?: boolean;
+  };
+
+/** SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, for immutable connections */
+const openReadOnlyUri = 0x01 | 0x40;
+
+/** Memory-mapped window of read-only connections (bytes) */
+const readMmapSize = 1 << 30;
+
+/** Page cache of read-only connections (KiB, as a negative cache_size) */
+const readCacheKiB = 65536;
 
 export class GaiaDatabase {
   private db: Database;
   private config: GaiaDatabaseOptions;
   private logger: Logger;
+  private hasExtension: boolean;
+  private gaiaColumns: string[] | null = null;
+  private spatialIndex = new Map<string, boolean>();
+  private tiers: MagnitudeTier[] | null = null;
+  private staleColumns: Map<string, number> | null = null;
+  /** Connection-local gaia_cone tables created over tiers */
+  private coneTables = new Set<string>();
+  /** Prepared statements by SQL text, finalized on close() */
+  private statements = new Map<string, Statement>();
 
   constructor(config: GaiaDatabaseOptions) {
-    this.db = new Database(config.databasePath);
+    if (config.readOnly && config.immutable) {
+      this.db = new Database(
+        `file:${
+          encodeURI(config.databasePath).replace(/[?#]/g, encodeURIComponent)
+        }?immutable=1`,
+        { flags: openReadOnlyUri, enableLoadExtension: true },
+      );
+    } else {
+      this.db = new Database(config.databasePath, {
+        readonly: config.readOnly ?? false,
+        enableLoadExtension: true,
+      });
+    }
     this.config = config;
     this.logger = createLogger(config.logLevel, "Database");
+    this.hasExtension = this.loadExtension();
+
+    if (config.readOnly) {
+      // Readers page through the file with mmap, sharing the OS page
+      // cache across connections, and keep temporary b-trees in memory
+      this.db.exec(`PRAGMA mmap_size = ${readMmapSize}`);
+      this.db.exec(`PRAGMA cache_size = -${readCacheKiB}`);
+      this.db.exec("PRAGMA temp_store = MEMORY");
+    }
+  }
+
+  /**
+   * Load the native astrometry functions (ang_sep, in_cone, healpix_nest,
+   * gaia_healpix). Queries fall back to built-in SQL math without them.
+   */
+  private loadExtension(): boolean {
+    try {
+      this.db.loadExtension(sqliteExtensionPath, sqliteExtensionEntryPoint);
+      return true;
+    } catch (error) {
+      this.logger.debug(
+        `Native SQLite extension not loaded, using SQL math: ${error}`,
+      );
+      return false;
+    }
+  }
+
+  /**
+   * Whether the native SQLite extension is available on this connection
+   */
+  hasNativeExtension(): boolean {
+    return this.hasExtension;
   }
 
   /**
@@ -66,9 +241,45 @@ export class GaiaDatabase {
 
     this.db.exec(`
       CREATE TABLE IF NOT EXISTS gaiadr3 (
-        ${columnDefs}
+        ${columnDefs},
+        hpx INTEGER,
+        ux REAL,
+        uy REAL,
+        uz REAL
+      );
+    `);
+
+    // Databases populated before the derived columns existed
+    const existing = this.getTableColumns("gaiadr3");
+    if (!existing.includes("hpx")) {
+      this.db.exec(`ALTER TABLE gaiadr3 ADD COLUMN hpx INTEGER`);
+    }
+    for (const col of unitVectorColumns) {
+      if (!existing.includes(col)) {
+        this.db.exec(`ALTER TABLE gaiadr3 ADD COLUMN ${col} REAL`);
+      }
+    }
+    // Magnitudes stored after populating without them, filled from the
+    // fluxes by createIndices
+    for (const table of ["gaiadr3", ...this.getTiers().map((t) => t.table)]) {
+      const columns = this.getTableColumns(table);
+      for (const col of MAGNITUDE_COLUMNS) {
+        if (this.config.storedColumns.includes(col) && !columns.includes(col)) {
+          this.db.exec(`ALTER TABLE ${table} ADD COLUMN ${col} REAL`);
+        }
+      }
+    }
+    this.gaiaColumns = null;
+    this.db.exec(`
+      CREATE TABLE IF NOT EXISTS metadata (
+        key TEXT PRIMARY KEY,
+        value TEXT NOT NULL
       );
     `);
+    this.recordMagnitudeZeropoints();
+
+    this.initializeTiers(columnDefs);
+    this.recordTierFluxes();
 
     // Create 2MASS crossmatch table
     this.db.exec(`
@@ -95,6 +306,312 @@ export class GaiaDatabase {
     this.createTrackingTable("file_tracking_tmass");
   }
 
+  /**
+   * Create the configured magnitude tier tables. A tier added to an
+   * already populated database is filled from gaiadr3 once; later
+   * inserts write to it in the same pass as gaiadr3.
+   */
+  private initializeTiers(columnDefs: string): void {
+    const limits = this.config.magnitudeTiers ?? [];
+    if (limits.length === 0) return;
+
+    if (!this.config.storedColumns.includes("phot_g_mean_flux")) {
+      throw new Error("Magnitude tiers require phot_g_mean_flux");
+    }
+
+    const existing = new Set(this.getTiers().map((tier) => tier.table));
+    for (const limit of limits) {
+      const table = tierTable(limit);
+      if (existing.has(table)) continue;
+
+      this.db.exec(`
+        CREATE TABLE ${table} (
+          ${columnDefs},
+          hpx INTEGER,
+          ux REAL,
+          uy REAL,
+          uz REAL
+        );
+      `);
+
+      const columns = this.getTableColumns(table).join(", ");
+      const filled = this.storesMagnitudes()
+        ? this.db.prepare(
+          `INSERT OR IGNORE INTO ${table} (${columns}) SELECT ${columns} FROM gaiadr3 WHERE phot_g_mean_mag < ?`,
+        ).run(limit)
+        : this.db.prepare(
+          `INSERT OR IGNORE INTO ${table} (${columns}) SELECT ${columns} FROM gaiadr3 WHERE phot_g_mean_flux > ?`,
+        ).run(this.tierFlux(limit));
+      this.logger.debug(
+        `Created tier ${table} from ${filled.toLocaleString()} stored records`,
+      );
+    }
+    this.tiers = null;
+  }
+
+  /**
+   * Record the zeropoints stored magnitudes are computed with, the first
+   * time they are stored, and refuse to add magnitudes computed with
+   * different ones. Databases that stored magnitudes before this record
+   * existed are assumed to have used the current zeropoints.
+   */
+  private recordMagnitudeZeropoints(): void {
+    if (!this.storesMagnitudes()) return;
+
+    const zeropoints = this.config.zeropoints;
+    const recorded = this.magnitudeZeropoints();
+    if (!recorded) {
+      this.writeMetadata("magnitude_zeropoints", JSON.stringify(zeropoints));
+    } else if (recorded.some((zp, i) => zp !== zeropoints[i])) {
+      throw new Error(
+        `Stored magnitudes use zeropoints ${recorded.join(", ")}; populate with the same zeropoints`,
+      );
+    }
+    this.staleColumns = null;
+  }
+
+  /**
+   * G, BP and RP zeropoints the stored magnitudes were computed with at
+   * ingest, or null when none are recorded
+   */
+  magnitudeZeropoints(): number[] | null {
+    const value = this.readMetadata("magnitude_zeropoints");
+    return value ? JSON.parse(value) as number[] : null;
+  }
+
+  /**
+   * Record the G flux cut of each tier the first time it is seen: the cut
+   * its rows were selected with, so tier inserts and routing stay on it
+   * when later runs use other zeropoints. Tiers created before this record
+   * existed are assumed to have used the current zeropoints.
+   */
+  private recordTierFluxes(): void {
+    for (const { limit, table } of this.getTiers()) {
+      const key = `tier_flux:${table}`;
+      if (this.readMetadata(key) === null) {
+        this.writeMetadata(key, String(this.tierFlux(limit)));
+      }
+    }
+    this.tiers = null;
+  }
+
+  /**
+   * Value recorded under `key` in the metadata table, or null
+   */
+  private readMetadata(key: string): string | null {
+    try {
+      const row = this.db.prepare(
+        "SELECT value FROM metadata WHERE key = ?",
+      ).get<{ value: string }>(key);
+      return row?.value ?? null;
+    } catch {
+      // No metadata table: nothing recorded
+      return null;
+    }
+  }
+
+  /**
+   * Record `value` under `key` in the metadata table
+   */
+  private writeMetadata(key: string, value: string): void {
+    this.db.prepare(
+      "INSERT OR REPLACE INTO metadata (key, value) VALUES (?, ?)",
+    ).run(key, value);
+  }
+
+  /**
+   * Stored magnitude columns computed at ingest with zeropoints other
+   * than the configured ones, each with the offset that converts its
+   * values to the configured zeropoints. Queries cut and rank on the
+   * fluxes instead of these columns.
+   */
+  staleMagnitudes(): Map<string, number> {
+    if (!this.staleColumns) {
+      this.staleColumns = new Map();
+      const ingest = this.magnitudeZeropoints();
+      const stored = this.getGaiaColumns();
+      if (ingest) {
+        const [g, bp, rp] = this.config.zeropoints;
+        const offsets: [string, number][] = [
+          ["phot_g_mean_mag", g - ingest[0]],
+          ["phot_bp_mean_mag", bp - ingest[1]],
+          ["phot_rp_mean_mag", rp - ingest[2]],
+          ["bp_rp", bp - rp - (ingest[1] - ingest[2])],
+        ];
+        for (const [column, offset] of offsets) {
+          if (offset !== 0 && stored.includes(column)) {
+            this.staleColumns.set(column, offset);
+          }
+        }
+      }
+    }
+    return this.staleColumns;
+  }
+
+  /**
+   * Whether G magnitudes are stored, so magnitude ranges and tiers use
+   * phot_g_mean_mag and its index instead of the flux
+   */
+  private storesMagnitudes(): boolean {
+    return this.getGaiaColumns().includes("phot_g_mean_mag");
+  }
+
+  /**
+   * SQL condition on the `g` alias for a [min, max] G magnitude range,
+   * on phot_g_mean_mag when stored, otherwise on the matching fluxes
+   */
+  private magnitudeCondition(
+    magnitudeLimit: [number, number],
+  ): { condition: string; params: Record<string, number> } {
+    if (
+      this.storesMagnitudes() &&
+      !this.staleMagnitudes().has("phot_g_mean_mag")
+    ) {
+      const [minMag, maxMag] = magnitudeLimit;
+      return {
+        condition:
+          "g.phot_g_mean_mag > :minMag AND g.phot_g_mean_mag < :maxMag",
+        params: { minMag, maxMag },
+      };
+    }
+
+    const [minFlux, maxFlux] = magnitudeToFluxRange(
+      magnitudeLimit,
+      this.config.zeropoints[0],
+    );
+    return {
+      condition:
+        "g.phot_g_mean_flux < :maxFlux AND g.phot_g_mean_flux > :minFlux",
+      params: { minFlux, maxFlux },
+    };
+  }
+
+  /**
+   * ORDER BY term putting the brightest G first, and rows without G last
+   * unless the query already excludes them (so the index gives the order)
+   */
+  private brightestFirst(withNulls = true): string {
+    if (!this.storesMagnitudes()) return "g.phot_g_mean_flux DESC";
+    return withNulls
+      ? "g.phot_g_mean_mag ASC NULLS LAST"
+      : "g.phot_g_mean_mag ASC";
+  }
+
+  /**
+   * Compute stored magnitudes missing from gaiadr3 and tier rows, such as
+   * rows inserted before storeMagnitudes was set, from their fluxes
+   */
+  private backfillMagnitudes(): void {
+    const [zpG, zpBP, zpRP] = this.magnitudeZeropoints() ??
+      this.config.zeropoints;
+    const bp = magnitudeFromFlux("phot_bp_mean_flux", zpBP);
+    const rp = magnitudeFromFlux("phot_rp_mean_flux", zpRP);
+
+    for (const table of ["gaiadr3", ...this.getTiers().map((t) => t.table)]) {
+      const columns = this.getTableColumns(table);
+      const stored = [
+        ...MAGNITUDE_COLUMNS,
+        "phot_g_mean_flux",
+        "phot_bp_mean_flux",
+        "phot_rp_mean_flux",
+      ].every((col) => columns.includes(col));
+      if (!stored) continue;
+
+      try {
+        this.db.exec(`
+          UPDATE ${table} SET
+            phot_g_mean_mag = ${magnitudeFromFlux("phot_g_mean_flux", zpG)},
+            phot_bp_mean_mag = ${bp},
+            phot_rp_mean_mag = ${rp},
+            bp_rp = (${bp}) - (${rp})
+          WHERE phot_g_mean_mag IS NULL AND phot_g_mean_flux > 0
+            OR phot_bp_mean_mag IS NULL AND phot_bp_mean_flux > 0
+            OR phot_rp_mean_mag IS NULL AND phot_rp_mean_flux > 0
+        `);
+      } catch (error) {
+        this.logger.error(
+          `Failed to backfill magnitudes of ${table}: ${error}`,
+        );
+      }
+    }
+  }
+
+  /**
+   * G flux bound of a new tier, matching the lower flux bound of a
+   * magnitudeLimit query that ends at the same magnitude
+   */
+  private tierFlux(limit: number): number {
+    return magnitudeToFluxRange([limit, limit], this.config.zeropoints[0])[0];
+  }
+
+  /**
+   * Magnitude tier tables present in the database, faintest limit last
+   */
+  private getTiers(): MagnitudeTier[] {
+    if (!this.tiers) {
+      this.tiers = this.db.prepare(
+        `SELECT name FROM sqlite_master WHERE type = 'table' AND name GLOB '${tierPrefix}[0-9]*'`,
+      ).all<{ name: string }>().map(({ name }) => {
+        const limit = Number(name.slice(tierPrefix.length).replace("_", "."));
+        const recorded = this.readMetadata(`tier_flux:${name}`);
+        const minFlux = recorded === null
+          ? this.tierFlux(limit)
+          : Number(recorded);
+        return { limit, table: name, minFlux };
+      }).filter((tier) => !isNaN(tier.limit))
+        .sort((a, b) => a.limit - b.limit);
+    }
+    return this.tiers;
+  }
+
+  /**
+   * Table to read for a magnitude limit: the smallest tier holding every
+   * star brighter than its faint end, or gaiadr3
+   */
+  private tableFor(magnitudeLimit?: [number, number]): string {
+    if (!magnitudeLimit) return "gaiadr3";
+    const tiers = this.getTiers();
+    if (this.storesMagnitudes()) {
+      // Tier limits are on the ingest zeropoint's magnitude scale
+      const shift = this.staleMagnitudes().get("phot_g_mean_mag") ?? 0;
+      const tier = tiers.find((tier) =>
+        tier.limit >= magnitudeLimit[1] - shift
+      );
+      return tier?.table ?? "gaiadr3";
+    }
+
+    // Flux-cut tiers hold every star the query's flux range admits when
+    // their recorded cut is at or below its lower bound
+    const [minFlux] = magnitudeToFluxRange(
+      magnitudeLimit,
+      this.config.zeropoints[0],
+    );
+    const tier = tiers.find((tier) => tier.minFlux <= minFlux);
+    return tier?.table ?? "gaiadr3";
+  }
+
+  /**
+   * Prepare `sql` once and reuse it on later calls. Query text must take
+   * its values as bound parameters so each query shape is compiled once.
+   */
+  private cachedStatement(sql: string): Statement {
+    let stmt = this.statements.get(sql);
+    if (!stmt) {
+      stmt = this.db.prepare(sql);
+      this.statements.set(sql, stmt);
+    }
+    return stmt;
+  }
+
+  /**
+   * Get the column names of a table
+   */
+  private getTableColumns(tableName: string): string[] {
+    return this.db.prepare(`PRAGMA table_info(${tableName})`)
+      .all<{ name: string }>()
+      .map((column) => column.name);
+  }
+
   /**
    * Create a tracking table for file processing
    */
@@ -136,7 +653,7 @@ export class GaiaDatabase {
    * Check if a file has already been processed
    */
   isFileProcessed(tableName: string, url: string): boolean {
-    const result = this.db.prepare(
+    const result = this.cachedStatement(
       `SELECT status FROM ${tableName} WHERE url = ?`,
     ).get<{ status: string }>(url);
 
@@ -147,18 +664,18 @@ export class GaiaDatabase {
    * Mark a file as completed
    */
   markFileCompleted(tableName: string, url: string): void {
-    this.db.prepare(
+    this.cachedStatement(
       `UPDATE ${tableName} SET status = 'completed' WHERE url = ?`,
-    )
-      .run(url);
+    ).run(url);
   }
 
   /**
    * Mark a file as failed
    */
   markFileFailed(tableName: string, url: string): void {
-    this.db.prepare(`UPDATE ${tableName} SET status = 'failed' WHERE url = ?`)
-      .run(url);
+    this.cachedStatement(
+      `UPDATE ${tableName} SET status = 'failed' WHERE url = ?`,
+    ).run(url);
   }
 
   /**
@@ -201,23 +718,47 @@ export class GaiaDatabase {
     // Build dynamic INSERT statement based on columns
     const columns = this.config.storedColumns.join(", ");
     const placeholders = this.config.storedColumns.map(() => "?").join(", ");
-
-    const stmt = this.db.prepare(
-      `INSERT OR IGNORE INTO gaiadr3 (${columns}) VALUES (${placeholders})`,
-    );
+    const sourceIdParam = this.config.storedColumns.indexOf("source_id") + 1;
+    const hpx = sourceIdParam > 0
+      ? hpxFromSourceId(`?${sourceIdParam}`)
+      : "NULL";
+
+    const insertInto = (table: string) =>
+      this.cachedStatement(
+        `INSERT OR IGNORE INTO ${table} (${columns}, hpx, ux, uy, uz) VALUES (${placeholders}, ${hpx}, ?, ?, ?)`,
+      );
+    const stmt = insertInto("gaiadr3");
+    // Tier rows are written in the same pass, so each record is read once
+    const tiers = this.getTiers().map((tier) => ({
+      limit: tier.limit,
+      minFlux: tier.minFlux,
+      stmt: insertInto(tier.table),
+    }));
+    const byMagnitude = this.storesMagnitudes();
 
     let insertedCount = 0;
 
     this.db.transaction(() => {
       for (const record of records) {
-        const values = this.config.storedColumns.map((col) => record[col]);
+        const values = [
+          ...this.config.storedColumns.map((col) => record[col]),
+          ...(unitVector(record) ?? [null, null, null]),
+        ];
         stmt.run(...values);
+        const flux = record.phot_g_mean_flux;
+        const mag = record.phot_g_mean_mag;
+        for (const tier of tiers) {
+          const inTier = byMagnitude
+            ? typeof mag === "number" && mag < tier.limit
+            : typeof flux === "number" && flux > tier.minFlux;
+          if (inTier) {
+            tier.stmt.run(...values);
+          }
+        }
         insertedCount++;
       }
     })();
 
-    stmt.finalize();
-
     const insertDuration = Date.now() - insertStartTime;
     this.logger.debug(
       `Database insert took ${formatDuration(insertDuration)}`,
@@ -231,7 +772,7 @@ export class GaiaDatabase {
   insertTmassXmatchRecords(records: TmassXmatchRecord[]): number {
     if (records.length === 0) return 0;
 
-    const stmt = this.db.prepare(
+    const stmt = this.cachedStatement(
       `INSERT OR IGNORE INTO tmass_xmatch (gaiadr3_source_id, tmass_source_id) VALUES (?, ?)`,
     );
 
@@ -244,7 +785,6 @@ export class GaiaDatabase {
       }
     })();
 
-    stmt.finalize();
     return insertedCount;
   }
 
@@ -254,7 +794,7 @@ export class GaiaDatabase {
   insertTmassRecords(records: TmassRecord[]): number {
     if (records.length === 0) return 0;
 
-    const stmt = this.db.prepare(
+    const stmt = this.cachedStatement(
       `INSERT OR IGNORE INTO tmass (gaiadr3_source_id, tmass_source_id, j_m, h_m, k_m) VALUES (?, ?, ?, ?, ?)`,
     );
 
@@ -273,7 +813,6 @@ export class GaiaDatabase {
       }
     })();
 
-    stmt.finalize();
     return insertedCount;
   }
 
@@ -309,8 +848,38 @@ export class GaiaDatabase {
     const startTime = Date.now();
     this.logger.debug("Creating database indices…");
 
+    // Backfill the spatial key for rows inserted before it existed
+    try {
+      this.db.exec(
+        `UPDATE gaiadr3 SET hpx = ${
+          hpxFromSourceId("source_id")
+        } WHERE hpx IS NULL`,
+      );
+    } catch (error) {
+      this.logger.error(`Failed to backfill HEALPix keys: ${error}`);
+    }
+
+    try {
+      this.db.exec(`
+        UPDATE gaiadr3 SET
+          ux = cos(radians(dec)) * cos(radians(ra)),
+          uy = cos(radians(dec)) * sin(radians(ra)),
+          uz = sin(radians(dec))
+        WHERE ux IS NULL
+      `);
+    } catch (error) {
+      this.logger.error(`Failed to backfill unit vectors: ${error}`);
+    }
+
+    // Fill magnitudes of rows stored before they were
+    const magnitudes = this.storesMagnitudes();
+    if (magnitudes) {
+      this.backfillMagnitudes();
+    }
+
     const indices = [
       "CREATE INDEX IF NOT EXISTS idx_source_id ON gaiadr3(source_id)",
+      "CREATE INDEX IF NOT EXISTS idx_hpx ON gaiadr3(hpx)",
       "CREATE INDEX IF NOT EXISTS idx_ra ON gaiadr3(ra)",
       "CREATE INDEX IF NOT EXISTS idx_dec ON gaiadr3(dec)",
       "CREATE INDEX IF NOT EXISTS idx_ra_dec ON gaiadr3(ra, dec)",
@@ -321,6 +890,53 @@ export class GaiaDatabase {
       "CREATE INDEX IF NOT EXISTS idx_tmass_tmass ON tmass(tmass_source_id)",
     ];
 
+    if (magnitudes) {
+      indices.push(
+        "CREATE INDEX IF NOT EXISTS idx_phot_g_mean_mag ON gaiadr3(phot_g_mean_mag)",
+      );
+    }
+
+    // Spheres around the Sun are a parallax range over the whole sky
+    const parallaxes = this.getGaiaColumns().includes("parallax");
+    if (parallaxes) {
+      indices.push(
+        "CREATE INDEX IF NOT EXISTS idx_parallax ON gaiadr3(parallax)",
+      );
+    }
+
+    // Random samples of a region read random_index from the index
+    const sampled = this.getGaiaColumns().includes("random_index");
+    if (sampled) {
+      indices.push(
+        "CREATE INDEX IF NOT EXISTS idx_hpx_random_index ON gaiadr3(hpx, random_index)",
+      );
+    }
+
+    // Each tier gets its own spatial, flux and source_id indices
+    for (const { table } of this.getTiers()) {
+      indices.push(
+        `CREATE INDEX IF NOT EXISTS idx_${table}_source_id ON ${table}(source_id)`,
+        `CREATE INDEX IF NOT EXISTS idx_${table}_hpx ON ${table}(hpx)`,
+        `CREATE INDEX IF NOT EXISTS idx_${table}_ra_dec ON ${table}(ra, dec)`,
+        `CREATE INDEX IF NOT EXISTS idx_${table}_phot_g_mean_flux ON ${table}(phot_g_mean_flux)`,
+      );
+      if (magnitudes) {
+        indices.push(
+          `CREATE INDEX IF NOT EXISTS idx_${table}_phot_g_mean_mag ON ${table}(phot_g_mean_mag)`,
+        );
+      }
+      if (parallaxes) {
+        indices.push(
+          `CREATE INDEX IF NOT EXISTS idx_${table}_parallax ON ${table}(parallax)`,
+        );
+      }
+      if (sampled) {
+        indices.push(
+          `CREATE INDEX IF NOT EXISTS idx_${table}_hpx_random_index ON ${table}(hpx, random_index)`,
+        );
+      }
+    }
+
     for (const indexSql of indices) {
       try {
         this.db.exec(indexSql);
@@ -329,12 +945,54 @@ export class GaiaDatabase {
       }
     }
 
+    this.spatialIndex.clear();
+
     const duration = Date.now() - startTime;
     this.logger.debug(
       `Indices created successfully in ${formatDuration(duration)}`,
     );
   }
 
+  /**
+   * Whether `table` (gaiadr3 or a tier) has the indexed HEALPix key used
+   * by `gaia_cone`
+   */
+  hasSpatialIndex(table = "gaiadr3"): boolean {
+    let indexed = this.spatialIndex.get(table);
+    if (indexed === undefined) {
+      const name = table === "gaiadr3" ? "idx_hpx" : `idx_${table}_hpx`;
+      indexed = this.db.prepare(
+        `SELECT name FROM sqlite_master WHERE type='index' AND name=?`,
+      ).get(name) !== undefined;
+      this.spatialIndex.set(table, indexed);
+    }
+    return indexed;
+  }
+
+  /**
+   * Whether pixelSearch under `magnitudeLimit` reads its pixel as a range
+   * of the hpx index of the table (gaiadr3 or a tier) it queries
+   */
+  hasPixelIndex(magnitudeLimit?: [number, number]): boolean {
+    return this.hasSpatialIndex(this.tableFor(magnitudeLimit));
+  }
+
+  /**
+   * Cone virtual table over `table`: the eponymous gaia_cone for gaiadr3,
+   * or a connection-local gaia_cone over a tier
+   */
+  private coneTable(table: string): string {
+    if (table === "gaiadr3") return "gaia_cone";
+    const name = `${table}_cone`;
+    if (!this.coneTables.has(name)) {
+      this.db.exec(
+        `CREATE VIRTUAL TABLE IF NOT EXISTS temp.${name} USING gaia_cone(${table})`,
+      );
+      this.coneTables.add(name);
+    }
+    return name;
+  }
+
   /**
    * Vacuum and optimize the database
    */
@@ -350,7 +1008,11 @@ export class GaiaDatabase {
   }
 
   /**
-   * Execute a cone search query
+   * Execute a cone search query. A non-zero `years` propagates positions
+   * that far from the Gaia epoch before the cone test and returns the
+   * propagated ra/dec. A non-zero `limit` is applied in SQL, after
+   * ordering by `order`. `columns` narrows the selected Gaia columns and
+   * `filter` adds compiled column cuts to the WHERE clause.
    */
   coneSearch(
     ra: number,
@@ -358,64 +1020,107 @@ export class GaiaDatabase {
     radius: number,
     magnitudeLimit?: [number, number],
     tmassCrossmatch = false,
+    years = 0,
+    limit = 0,
+    order: ResultOrder = "none",
+    columns?: string[],
+    filter: FilterTerm[] = [],
   ): GaiaRecord[] {
-    const startTime = Date.now();
-    const radiusRad = (radius * Math.PI) / 180;
-    const raRad = (ra * Math.PI) / 180;
-    const decRad = (dec * Math.PI) / 180;
-
-    const sinDec = Math.sin(decRad);
-    const cosDec = Math.cos(decRad);
-    const cosRadius = Math.cos(radiusRad);
-
-    // Calculate bounding box
-    const deltaRa = (radius * 180) / (Math.PI * Math.cos(decRad));
-    const deltaDec = radius;
-
-    const decMin = Math.max(dec - deltaDec, -90);
-    const decMax = Math.min(dec + deltaDec, 90);
-    const raMin = (ra - deltaRa + 360) % 360;
-    const raMax = (ra + deltaRa) % 360;
-
-    // Build SELECT clause with 2MASS join if needed
-    let selectClause = "g.*";
-    let fromClause = "gaiadr3 g";
-
-    if (tmassCrossmatch) {
-      selectClause += ", t.tmass_source_id, t.j_m, t.h_m, t.k_m";
-      fromClause += " LEFT JOIN tmass t ON g.source_id = t.gaiadr3_source_id";
+    if (years === 0) {
+      return this.coneQuery(
+        ra,
+        dec,
+        radius,
+        magnitudeLimit,
+        tmassCrossmatch,
+        undefined,
+        limit,
+        order,
+        columns,
+        filter,
+      );
     }
 
-    // Build query with magnitude filter if provided
-    let whereClause = `g.dec BETWEEN ${decMin} AND ${decMax}`;
-
-    if (raMin > raMax) {
-      whereClause +=
-        ` AND (g.ra BETWEEN ${raMin} AND 360 OR g.ra BETWEEN 0 AND ${raMax})`;
-    } else {
-      whereClause += ` AND g.ra BETWEEN ${raMin} AND ${raMax}`;
+    const stored = this.getGaiaColumns();
+    if (!stored.includes("pmra") || !stored.includes("pmdec")) {
+      throw new Error("Epoch propagation requires pmra and pmdec columns");
     }
 
-    if (magnitudeLimit) {
-      const [minMag, maxMag] = magnitudeLimit;
-      const zp = this.config.zeropoints[0];
-      const maxFlux = Math.round(10 ** ((zp - minMag) / 2.5));
-      const minFlux = Math.round(10 ** ((zp - maxMag) / 2.5));
+    // Anything that can move into the cone starts within the widened one
+    const widened = Math.min(
+      radius + Math.abs(years) * GAIA_MAX_PM_MAS_YR / 3.6e6,
+      180,
+    );
+    const candidates = this.coneQuery(
+      ra,
+      dec,
+      widened,
+      magnitudeLimit,
+      tmassCrossmatch,
+      undefined,
+      0,
+      "none",
+      columns,
+      filter,
+    );
 
-      whereClause +=
-        ` AND g.phot_g_mean_flux < ${maxFlux} AND g.phot_g_mean_flux > ${minFlux}`;
-    }
+    const results = candidates.filter((record) => {
+      [record.ra, record.dec] = propagatePosition(
+        record.ra,
+        record.dec,
+        record.pmra as number,
+        record.pmdec as number,
+        years,
+      );
+      return angularSeparation(ra, dec, record.ra, record.dec) <= radius;
+    });
 
-    // Add spherical cap check
-    whereClause += ` AND (
-      sin(radians(g.dec)) * ${sinDec} +
-      cos(radians(g.dec)) * ${cosDec} * cos(radians(g.ra) - ${raRad})
-    ) >= ${cosRadius}`;
+    // Propagated positions decide membership, so order and limit here
+    return orderRecords(results, order, ra, dec, limit);
+  }
 
-    const query =
-      `SELECT ${selectClause} FROM ${fromClause} WHERE ${whereClause}`;
+  /**
+   * Cone query with an optional extra SQL condition on the `g` alias,
+   * column cuts, ordering, limit and column projection
+   */
+  private coneQuery(
+    ra: number,
+    dec: number,
+    radius: number,
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    condition?: string,
+    limit = 0,
+    order: ResultOrder = "none",
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): GaiaRecord[] {
+    const startTime = Date.now();
+    const { query, params } = this.coneSql(
+      ra,
+      dec,
+      radius,
+      magnitudeLimit,
+      tmassCrossmatch,
+      condition,
+      limit,
+      order,
+      columns,
+      filter,
+    );
 
-    const results = this.db.prepare(query).all<GaiaRecord>();
+    // Extra conditions carry their own literals, so don't cache those
+    let results: GaiaRecord[];
+    if (condition) {
+      const stmt = this.db.prepare(query);
+      try {
+        results = stmt.all<GaiaRecord>(params);
+      } finally {
+        stmt.finalize();
+      }
+    } else {
+      results = this.cachedStatement(query).all<GaiaRecord>(params);
+    }
     const duration = Date.now() - startTime;
     this.logger.debug(
       `Cone search completed in ${formatDuration(duration)}`,
@@ -424,18 +1129,1173 @@ export class GaiaDatabase {
   }
 
   /**
-   * Get total record count
+   * Cone search at the catalog epoch as rows of column values in `names`
+   * order, read with Statement.values so no record objects are built
    */
-  getRecordCount(table = "gaiadr3"): number {
-    const result = this.db.prepare(`SELECT COUNT(*) as count FROM ${table}`)
-      .get<{ count: number }>();
-    return result?.count ?? 0;
+  coneSearchValues(
+    ra: number,
+    dec: number,
+    radius: number,
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    limit = 0,
+    order: ResultOrder = "none",
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): { names: string[]; rows: unknown[][] } {
+    const startTime = Date.now();
+    const { query, params } = this.coneSql(
+      ra,
+      dec,
+      radius,
+      magnitudeLimit,
+      tmassCrossmatch,
+      undefined,
+      limit,
+      order,
+      columns,
+      filter,
+    );
+    const stmt = this.cachedStatement(query);
+    const rows = stmt.values<unknown[]>(params);
+    this.logger.debug(
+      `Cone search completed in ${formatDuration(Date.now() - startTime)}`,
+    );
+    return { names: stmt.columnNames(), rows };
   }
 
   /**
-   * Close database connection
+   * Cone search yielding batches of up to `batchSize` records as SQLite
+   * steps through them, so only one batch is held at a time. With
+   * `years`, each batch is propagated and cut to the cone; ordering
+   * propagated positions needs them all, so that collects the result.
    */
-  close(): void {
+  *coneSearchIter(
+    ra: number,
+    dec: number,
+    radius: number,
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    years = 0,
+    limit = 0,
+    order: ResultOrder = "none",
+    columns?: string[],
+    filter: FilterTerm[] = [],
+    batchSize = 10000,
+  ): Generator<GaiaRecord[]> {
+    if (years !== 0 && order !== "none") {
+      const results = this.coneSearch(
+        ra,
+        dec,
+        radius,
+        magnitudeLimit,
+        tmassCrossmatch,
+        years,
+        limit,
+        order,
+        columns,
+        filter,
+      );
+      for (let i = 0; i < results.length; i += batchSize) {
+        yield results.slice(i, i + batchSize);
+      }
+      return;
+    }
+
+    if (years !== 0) {
+      const stored = this.getGaiaColumns();
+      if (!stored.includes("pmra") || !stored.includes("pmdec")) {
+        throw new Error("Epoch propagation requires pmra and pmdec columns");
+      }
+    }
+    const searchRadius = years === 0
+      ? radius
+      : Math.min(radius + Math.abs(years) * GAIA_MAX_PM_MAS_YR / 3.6e6, 180);
+    const { query, params } = this.coneSql(
+      ra,
+      dec,
+      searchRadius,
+      magnitudeLimit,
+      tmassCrossmatch,
+      undefined,
+      years === 0 ? limit : 0,
+      order,
+      columns,
+      filter,
+    );
+
+    // A statement of its own, as the cached one may be reused while the
+    // caller holds this iterator
+    const stmt = this.db.prepare(query);
+    try {
+      let batch: GaiaRecord[] = [];
+      for (
+        const record of stmt.iter(params) as IterableIterator<GaiaRecord>
+      ) {
+        if (years !== 0) {
+          [record.ra, record.dec] = propagatePosition(
+            record.ra,
+            record.dec,
+            record.pmra as number,
+            record.pmdec as number,
+            years,
+          );
+          if (angularSeparation(ra, dec, record.ra, record.dec) > radius) {
+            continue;
+          }
+        }
+
+        batch.push(record);
+        if (batch.length === batchSize) {
+          yield batch;
+          batch = [];
+        }
+      }
+      if (batch.length) {
+        yield batch;
+      }
+    } finally {
+      stmt.finalize();
+    }
+  }
+
+  /**
+   * SQL text and parameters of a cone query with an optional extra
+   * condition, ordering and limit
+   */
+  private coneSql(
+    ra: number,
+    dec: number,
+    radius: number,
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    condition?: string,
+    limit = 0,
+    order: ResultOrder = "none",
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): { query: string; params: Record<string, number> } {
+    const cone = this.coneWhere(ra, dec, radius, magnitudeLimit, filter);
+    const { selectClause, fromClause } = this.coneSelect(
+      cone.useConeTable,
+      tmassCrossmatch,
+      columns,
+      cone.table,
+    );
+    let whereClause = cone.whereClause;
+    const params = cone.params;
+
+    if (condition) {
+      whereClause += ` AND ${condition}`;
+    }
+
+    let query =
+      `SELECT ${selectClause} FROM ${fromClause} WHERE ${whereClause}`;
+
+    if (order === "brightest") {
+      if (
+        !this.storesMagnitudes() &&
+        !this.getGaiaColumns().includes("phot_g_mean_flux")
+      ) {
+        throw new Error("Brightest-first ordering requires phot_g_mean_flux");
+      }
+      query += ` ORDER BY ${this.brightestFirst()}`;
+    } else if (order === "nearest") {
+      query += ` ORDER BY coalesce(
+        g.ux * :x0 + g.uy * :y0 + g.uz * :sinDec,
+        sin(radians(g.dec)) * :sinDec +
+          cos(radians(g.dec)) * :cosDec * cos(radians(g.ra) - :raRad)
+      ) DESC`;
+      Object.assign(params, cone.center);
+    }
+
+    if (limit > 0) {
+      query += " LIMIT :limit";
+      params.limit = limit;
+    }
+
+    return { query, params };
+  }
+
+  /**
+   * Table and WHERE clause (on the `g` alias) selecting the stars of a
+   * cone, with the magnitude limit and column cuts. Values are bound
+   * parameters, so the SQL text only varies with the query shape.
+   */
+  private coneWhere(
+    ra: number,
+    dec: number,
+    radius: number,
+    magnitudeLimit?: [number, number],
+    filter: FilterTerm[] = [],
+  ): {
+    table: string;
+    useConeTable: boolean;
+    whereClause: string;
+    params: Record<string, number>;
+    center: Record<string, number>;
+  } {
+    const radiusRad = (radius * Math.PI) / 180;
+    const raRad = (ra * Math.PI) / 180;
+    const decRad = (dec * Math.PI) / 180;
+
+    const sinDec = Math.sin(decRad);
+    const cosDec = Math.cos(decRad);
+    const cosRadius = Math.cos(radiusRad);
+    const x0 = cosDec * Math.cos(raRad);
+    const y0 = cosDec * Math.sin(raRad);
+
+    // Calculate bounding box
+    const deltaRa = (radius * 180) / (Math.PI * Math.cos(decRad));
+    const deltaDec = radius;
+
+    const decMin = Math.max(dec - deltaDec, -90);
+    const decMax = Math.min(dec + deltaDec, 90);
+    const raMin = (ra - deltaRa + 360) % 360;
+    const raMax = (ra + deltaRa) % 360;
+
+    // The gaia_cone virtual table walks HEALPix ranges of the hpx index
+    // and applies the exact cap test itself
+    const table = this.tableFor(magnitudeLimit);
+    const useConeTable = this.hasExtension && this.hasSpatialIndex(table);
+
+    let whereClause: string;
+    const params: Record<string, number> = {};
+
+    if (useConeTable) {
+      whereClause = "g.ra0 = :ra AND g.dec0 = :dec AND g.radius = :radius";
+      Object.assign(params, { ra, dec, radius });
+    } else {
+      whereClause = "g.dec BETWEEN :decMin AND :decMax";
+
+      if (raMin > raMax) {
+        whereClause +=
+          " AND (g.ra BETWEEN :raMin AND 360 OR g.ra BETWEEN 0 AND :raMax)";
+      } else {
+        whereClause += " AND g.ra BETWEEN :raMin AND :raMax";
+      }
+      Object.assign(params, { decMin, decMax, raMin, raMax });
+    }
+
+    if (magnitudeLimit) {
+      const magnitude = this.magnitudeCondition(magnitudeLimit);
+      whereClause += ` AND ${magnitude.condition}`;
+      Object.assign(params, magnitude.params);
+    }
+
+    // Add spherical cap check: a dot product against the stored unit
+    // vector, falling back to ra/dec for rows not yet backfilled
+    if (useConeTable) {
+      // Already applied by gaia_cone
+    } else {
+      let fallback: string;
+      if (this.hasExtension) {
+        fallback = "in_cone(g.ra, g.dec, :ra, :dec, :cosRadius)";
+        Object.assign(params, { ra, dec });
+      } else {
+        fallback = `(
+        sin(radians(g.dec)) * :sinDec +
+        cos(radians(g.dec)) * :cosDec * cos(radians(g.ra) - :raRad)
+      ) >= :cosRadius`;
+        Object.assign(params, { cosDec, raRad });
+      }
+      whereClause += ` AND coalesce(
+        g.ux * :x0 + g.uy * :y0 + g.uz * :sinDec >= :cosRadius,
+        ${fallback}
+      )`;
+      Object.assign(params, { x0, y0, sinDec, cosRadius });
+    }
+
+    if (filter.length) {
+      const cuts = filterCondition(filter);
+      whereClause += ` AND ${cuts.condition}`;
+      Object.assign(params, cuts.params);
+    }
+
+    return {
+      table,
+      useConeTable,
+      whereClause,
+      params,
+      center: { x0, y0, sinDec, cosDec, raRad },
+    };
+  }
+
+  /**
+   * Count, value range and bin counts of the stars in a cone over
+   * aggregate axes, computed by SQLite so no rows reach JS
+   */
+  coneAggregate(
+    ra: number,
+    dec: number,
+    radius: number,
+    terms: AggregateTerm[],
+    magnitudeLimit?: [number, number],
+    filter: FilterTerm[] = [],
+  ): AggregateResult {
+    const startTime = Date.now();
+    const cone = this.coneWhere(ra, dec, radius, magnitudeLimit, filter);
+    const from = cone.useConeTable
+      ? this.coneTable(cone.table)
+      : cone.table;
+    const params = cone.params;
+
+    const values = terms.map((term, t) => {
+      let value = term.divisor
+        ? `g.${term.column} / g.${term.divisor}`
+        : `g.${term.column}`;
+      if (term.zeropoint !== undefined) {
+        // log10 is NULL for non-positive fluxes, which drops the row
+        value = `:axis${t}Zeropoint - 2.5 * log10(${value})`;
+        params[`axis${t}Zeropoint`] = term.zeropoint;
+      }
+      return `${value} AS v${t}`;
+    });
+    const rows = `SELECT ${
+      ["1", ...values].join(", ")
+    } FROM ${from} g WHERE ${cone.whereClause}`;
+    const defined = terms.length
+      ? ` WHERE ${terms.map((_, t) => `v${t} IS NOT NULL`).join(" AND ")}`
+      : "";
+    const ranges = terms.map((_, t) => `, min(v${t}), max(v${t})`).join("");
+
+    // Bin indices, NULL outside the histogram; values on the max edge
+    // go to the last bin
+    const binned = terms.length > 0 && terms.every((term) => term.bins > 0);
+    let query: string;
+    if (binned) {
+      const bins = terms.map((term, t) => {
+        Object.assign(params, {
+          [`axis${t}Min`]: term.min,
+          [`axis${t}Max`]: term.max,
+          [`axis${t}Scale`]: term.bins / (term.max - term.min),
+          [`axis${t}Last`]: term.bins - 1,
+        });
+        return `CASE WHEN v${t} BETWEEN :axis${t}Min AND :axis${t}Max THEN min(CAST((v${t} - :axis${t}Min) * :axis${t}Scale AS INTEGER), :axis${t}Last) END AS b${t}`;
+      });
+      const groups = terms.map((_, t) => `b${t}`).join(", ");
+      query = `SELECT ${groups}, count(*)${ranges} FROM (SELECT ${
+        bins.join(", ")
+      }, * FROM (${rows})${defined}) GROUP BY ${groups}`;
+    } else {
+      query = `SELECT count(*)${ranges} FROM (${rows})${defined}`;
+    }
+
+    const numBins = binned
+      ? terms.reduce((product, term) => product * term.bins, 1)
+      : 0;
+    const result: AggregateResult = {
+      count: 0,
+      min: terms.map(() => Infinity),
+      max: terms.map(() => -Infinity),
+      counts: new Array(numBins).fill(0),
+    };
+
+    // One row per bin cell (NULL cells hold rows outside the histogram)
+    const offset = binned ? terms.length : 0;
+    const cells = this.cachedStatement(query).values<(number | null)[]>(
+      params,
+    );
+    for (const row of cells) {
+      const count = row[offset] as number;
+      result.count += count;
+      terms.forEach((_, t) => {
+        const min = row[offset + 1 + 2 * t];
+        const max = row[offset + 2 + 2 * t];
+        if (min !== null) result.min[t] = Math.min(result.min[t], min);
+        if (max !== null) result.max[t] = Math.max(result.max[t], max);
+      });
+
+      const cell = row.slice(0, offset);
+      if (binned && cell.every((b) => b !== null)) {
+        const bin = terms.reduce(
+          (flat, term, t) => flat * term.bins + (cell[t] as number),
+          0,
+        );
+        result.counts[bin] += count;
+      }
+    }
+    if (result.count === 0) {
+      result.min.fill(NaN);
+      result.max.fill(NaN);
+    }
+
+    this.logger.debug(
+      `Cone aggregate completed in ${formatDuration(Date.now() - startTime)}`,
+    );
+    return result;
+  }
+
+  /**
+   * Select every star inside an RA/Dec box (degrees). `raMin > raMax`
+   * wraps through RA 0.
+   */
+  boxSearch(
+    raMin: number,
+    raMax: number,
+    decMin: number,
+    decMax: number,
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): GaiaRecord[] {
+    if (!(decMin <= decMax)) {
+      throw new Error(
+        `Invalid box: decMin ${decMin} must not exceed decMax ${decMax}`,
+      );
+    }
+    const startTime = Date.now();
+    const { selectClause, fromClause } = this.coneSelect(
+      false,
+      tmassCrossmatch,
+      columns,
+      this.tableFor(magnitudeLimit),
+    );
+
+    // The box is exact in ra/dec, so idx_ra_dec answers it directly
+    let whereClause = "g.dec BETWEEN :decMin AND :decMax";
+    if (raMin > raMax) {
+      whereClause += " AND (g.ra >= :raMin OR g.ra <= :raMax)";
+    } else {
+      whereClause += " AND g.ra BETWEEN :raMin AND :raMax";
+    }
+    const params: Record<string, number> = { raMin, raMax, decMin, decMax };
+
+    if (magnitudeLimit) {
+      const magnitude = this.magnitudeCondition(magnitudeLimit);
+      whereClause += ` AND ${magnitude.condition}`;
+      Object.assign(params, magnitude.params);
+    }
+
+    if (filter.length) {
+      const cuts = filterCondition(filter);
+      whereClause += ` AND ${cuts.condition}`;
+      Object.assign(params, cuts.params);
+    }
+
+    const results = this.cachedStatement(
+      `SELECT ${selectClause} FROM ${fromClause} WHERE ${whereClause}`,
+    ).all<GaiaRecord>(params);
+    this.logger.debug(
+      `Box search completed in ${formatDuration(Date.now() - startTime)}`,
+    );
+    return results;
+  }
+
+  /**
+   * Every star in one nested HEALPix pixel at `order` (at most 12), read
+   * as a range of the level 12 `hpx` index
+   */
+  pixelSearch(
+    order: number,
+    pixel: number,
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): GaiaRecord[] {
+    if (!Number.isInteger(order) || order < 0 || order > 12) {
+      throw new Error(`Invalid pixel order: ${order}. Must be 0 to 12.`);
+    }
+
+    const { selectClause, fromClause } = this.coneSelect(
+      false,
+      tmassCrossmatch,
+      columns,
+      this.tableFor(magnitudeLimit),
+    );
+    const span = 4 ** (12 - order);
+    let whereClause = "g.hpx >= :hpxMin AND g.hpx < :hpxMax";
+    const params: Record<string, number> = {
+      hpxMin: pixel * span,
+      hpxMax: (pixel + 1) * span,
+    };
+
+    if (magnitudeLimit) {
+      const magnitude = this.magnitudeCondition(magnitudeLimit);
+      whereClause += ` AND ${magnitude.condition}`;
+      Object.assign(params, magnitude.params);
+    }
+
+    if (filter.length) {
+      const cuts = filterCondition(filter);
+      whereClause += ` AND ${cuts.condition}`;
+      Object.assign(params, cuts.params);
+    }
+
+    return this.cachedStatement(
+      `SELECT ${selectClause} FROM ${fromClause} WHERE ${whereClause}`,
+    ).all<GaiaRecord>(params);
+  }
+
+  /**
+   * Every star in a G magnitude range across the whole sky, brightest
+   * first. The range and order both run on idx_phot_g_mean_mag when
+   * magnitudes are stored, otherwise idx_phot_g_mean_flux, so only the
+   * matching rows are read.
+   */
+  brightnessSearch(
+    magnitudeLimit: [number, number],
+    tmassCrossmatch = false,
+    limit = 0,
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): GaiaRecord[] {
+    const startTime = Date.now();
+    if (
+      !this.storesMagnitudes() &&
+      !this.getGaiaColumns().includes("phot_g_mean_flux")
+    ) {
+      throw new Error("Brightness search requires phot_g_mean_flux");
+    }
+
+    const { selectClause, fromClause } = this.coneSelect(
+      false,
+      tmassCrossmatch,
+      columns,
+      this.tableFor(magnitudeLimit),
+    );
+    const magnitude = this.magnitudeCondition(magnitudeLimit);
+    let whereClause = magnitude.condition;
+    const params: Record<string, number> = { ...magnitude.params };
+
+    if (filter.length) {
+      const cuts = filterCondition(filter);
+      whereClause += ` AND ${cuts.condition}`;
+      Object.assign(params, cuts.params);
+    }
+
+    let query =
+      `SELECT ${selectClause} FROM ${fromClause} WHERE ${whereClause} ORDER BY ${this.brightestFirst(false)}`;
+    if (limit > 0) {
+      query += " LIMIT :limit";
+      params.limit = limit;
+    }
+
+    const results = this.cachedStatement(query).all<GaiaRecord>(params);
+    this.logger.debug(
+      `Brightness search completed in ${
+        formatDuration(Date.now() - startTime)
+      }`,
+    );
+    return results;
+  }
+
+  /**
+   * Select every star inside a convex polygon of [ra, dec] vertices
+   * (degrees). With the native library and the hpx index, the polygon's
+   * own HEALPix coverage drives the query and only rows of edge pixels
+   * get the exact test; otherwise the smallest cone through the vertices
+   * selects the candidates. Concave polygons are rejected.
+   */
+  polygonSearch(
+    vertices: [number, number][],
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): GaiaRecord[] {
+    const normals = convexPolygonNormals(vertices);
+
+    // Normalized vertex centroid and the farthest vertex from it
+    const sum = [0, 0, 0];
+    for (const [ra, dec] of vertices) {
+      radecToVector(ra, dec).forEach((value, k) => sum[k] += value);
+    }
+    const norm = Math.hypot(sum[0], sum[1], sum[2]);
+    const centerRa = (Math.atan2(sum[1], sum[0]) * 180 / Math.PI + 360) % 360;
+    const centerDec = Math.asin(sum[2] / norm) * 180 / Math.PI;
+    const radius = Math.max(
+      ...vertices.map(([ra, dec]) =>
+        angularSeparation(centerRa, centerDec, ra, dec)
+      ),
+    );
+
+    const table = this.tableFor(magnitudeLimit);
+    if (this.hasSpatialIndex(table) && hasCatalogLib()) {
+      const results = this.polygonRangeQuery(
+        vertices,
+        normals,
+        radius,
+        table,
+        magnitudeLimit,
+        tmassCrossmatch,
+        columns,
+        filter,
+      );
+      if (results) return results;
+    }
+
+    let condition: string;
+    if (this.hasExtension) {
+      const list = vertices.map(([ra, dec]) => `${ra} ${dec}`).join(", ");
+      condition = `in_convex(g.ra, g.dec, '${list}')`;
+    } else {
+      condition = normals.map(([x, y, z]) =>
+        `${UNIT_X} * ${x} + ${UNIT_Y} * ${y} + ${UNIT_Z} * ${z} >= 0`
+      ).join(" AND ");
+    }
+
+    return this.coneQuery(
+      centerRa,
+      centerDec,
+      radius,
+      magnitudeLimit,
+      tmassCrossmatch,
+      condition,
+      0,
+      "none",
+      columns,
+      filter,
+    );
+  }
+
+  /**
+   * Polygon search over the hpx ranges of its HEALPix coverage, at an
+   * order with pixels about a quarter of the polygon's radius. Rows of
+   * inside ranges skip the edge test. Null when the coverage needs too
+   * many ranges, for the caller to fall back to the enclosing cone.
+   */
+  private polygonRangeQuery(
+    vertices: [number, number][],
+    normals: [number, number, number][],
+    radius: number,
+    table: string,
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): GaiaRecord[] | null {
+    const startTime = Date.now();
+    // Order 0 pixels are about 58.6° across
+    const order = Math.min(
+      10,
+      Math.max(0, Math.ceil(Math.log2(4 * 58.6 / Math.max(radius, 1e-6)))),
+    );
+    const coverage = polygonRanges(order, vertices, 4096);
+    if (!coverage) return null;
+
+    const span = 4 ** (12 - order);
+    const ranges = coverage.ranges.map(([lo, hi], r) => [
+      lo * span,
+      hi * span,
+      coverage.inside[r] ? 1 : 0,
+    ]);
+    const params: Record<string, number | string> = {
+      ranges: JSON.stringify(ranges),
+    };
+
+    let edge: string;
+    if (this.hasExtension) {
+      edge = "in_convex(g.ra, g.dec, :vertices)";
+      params.vertices = vertices.map(([ra, dec]) => `${ra} ${dec}`).join(
+        ", ",
+      );
+    } else {
+      edge = normals.map(([x, y, z], i) => {
+        Object.assign(params, {
+          [`normal${i}x`]: x,
+          [`normal${i}y`]: y,
+          [`normal${i}z`]: z,
+        });
+        return `${UNIT_X} * :normal${i}x + ${UNIT_Y} * :normal${i}y + ${UNIT_Z} * :normal${i}z >= 0`;
+      }).join(" AND ");
+    }
+
+    const { selectClause, fromClause } = this.coneSelect(
+      false,
+      tmassCrossmatch,
+      columns,
+      table,
+    );
+    // json_each stays the outer loop, so each range is one hpx index seek
+    let whereClause =
+      `g.hpx >= json_extract(r.value, '$[0]') AND g.hpx < json_extract(r.value, '$[1]') AND (json_extract(r.value, '$[2]') OR ${edge})`;
+
+    if (magnitudeLimit) {
+      const magnitude = this.magnitudeCondition(magnitudeLimit);
+      whereClause += ` AND ${magnitude.condition}`;
+      Object.assign(params, magnitude.params);
+    }
+
+    if (filter.length) {
+      const cuts = filterCondition(filter);
+      whereClause += ` AND ${cuts.condition}`;
+      Object.assign(params, cuts.params);
+    }
+
+    const results = this.cachedStatement(
+      `SELECT ${selectClause} FROM json_each(:ranges) r CROSS JOIN ${fromClause} WHERE ${whereClause}`,
+    ).all<GaiaRecord>(params);
+    this.logger.debug(
+      `Polygon search over ${ranges.length} pixel ranges completed in ${
+        formatDuration(Date.now() - startTime)
+      }`,
+    );
+    return results;
+  }
+
+  /**
+   * SELECT and FROM clauses for a cone query, with the 2MASS join if needed.
+   * `columns` narrows the projection to a subset of the stored columns and
+   * `table` is gaiadr3 or one of its magnitude tiers.
+   */
+  private coneSelect(
+    useConeTable: boolean,
+    tmassCrossmatch: boolean,
+    columns?: string[],
+    table = "gaiadr3",
+  ): { selectClause: string; fromClause: string } {
+    const stored = this.getGaiaColumns();
+    for (const col of columns ?? []) {
+      if (!stored.includes(col)) {
+        throw new Error(`Column ${col} is not stored in the database`);
+      }
+    }
+
+    let selectClause = (columns ?? stored).map((col) => `g.${col}`).join(
+      ", ",
+    );
+    let fromClause = `${useConeTable ? this.coneTable(table) : table} g`;
+
+    if (tmassCrossmatch) {
+      selectClause += ", t.tmass_source_id, t.j_m, t.h_m, t.k_m";
+      fromClause += " LEFT JOIN tmass t ON g.source_id = t.gaiadr3_source_id";
+    }
+
+    return { selectClause, fromClause };
+  }
+
+  /**
+   * Cone search many targets, returning one result list per target in
+   * input order. With gaia_cone available the targets are visited in
+   * HEALPix order through a single prepared statement; otherwise each
+   * target runs as a regular cone search.
+   */
+  coneSearchBatch(
+    targets: ConeTarget[],
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): GaiaRecord[][] {
+    const table = this.tableFor(magnitudeLimit);
+    if (!this.hasExtension || !this.hasSpatialIndex(table)) {
+      return targets.map((target) =>
+        this.coneSearch(
+          target.ra,
+          target.dec,
+          target.radius,
+          magnitudeLimit,
+          tmassCrossmatch,
+          0,
+          0,
+          "none",
+          columns,
+          filter,
+        )
+      );
+    }
+
+    const startTime = Date.now();
+    const { selectClause, fromClause } = this.coneSelect(
+      true,
+      tmassCrossmatch,
+      columns,
+      table,
+    );
+    let whereClause = "g.ra0 = :ra AND g.dec0 = :dec AND g.radius = :radius";
+    let filterParams = {};
+
+    if (magnitudeLimit) {
+      const magnitude = this.magnitudeCondition(magnitudeLimit);
+      whereClause += ` AND ${magnitude.condition}`;
+      filterParams = magnitude.params;
+    }
+
+    if (filter.length) {
+      const cuts = filterCondition(filter);
+      whereClause += ` AND ${cuts.condition}`;
+      filterParams = { ...filterParams, ...cuts.params };
+    }
+
+    // Neighbouring targets share index and table pages: one statement
+    // sorts every target by its HEALPix pixel
+    const visitOrder = this.cachedStatement(
+      "SELECT key FROM json_each(?) ORDER BY healpix_nest(8, json_extract(value, '$[0]'), json_extract(value, '$[1]'))",
+    ).values<[number]>(
+      JSON.stringify(targets.map(({ ra, dec }) => [ra, dec])),
+    ).map(([i]) => i);
+
+    const results: GaiaRecord[][] = new Array(targets.length);
+    const stmt = this.cachedStatement(
+      `SELECT ${selectClause} FROM ${fromClause} WHERE ${whereClause}`,
+    );
+    for (const i of visitOrder) {
+      const { ra, dec, radius } = targets[i];
+      results[i] = stmt.all<GaiaRecord>({ ra, dec, radius, ...filterParams });
+    }
+
+    const duration = Date.now() - startTime;
+    this.logger.debug(
+      `Batched cone search of ${targets.length} targets completed in ${
+        formatDuration(duration)
+      }`,
+    );
+    return results;
+  }
+
+  /**
+   * Find the `k` stars closest to (ra, dec), nearest first.
+   * Counts the stars of a probe cone, then widens it to the radius that
+   * the density seen so far says holds `k` stars, until it does. Only
+   * the final cone returns rows, ordered by distance with LIMIT `k` in
+   * SQL; anything outside it is farther than all of them.
+   */
+  nearest(
+    ra: number,
+    dec: number,
+    k: number,
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): GaiaRecord[] {
+    if (k <= 0) return [];
+
+    let radius = 0.05;
+    while (radius < 180) {
+      const { count } = this.coneAggregate(
+        ra,
+        dec,
+        radius,
+        [],
+        magnitudeLimit,
+        filter,
+      );
+      if (count >= k) break;
+      // Cap area grows as the squared radius; aim 50% past the estimate
+      // so one more probe usually suffices, and at least double
+      const estimate = count > 0
+        ? radius * Math.sqrt(k / count) * 1.5
+        : radius * 4;
+      radius = Math.min(Math.max(estimate, radius * 2), 180);
+    }
+
+    return this.coneSearch(
+      ra,
+      dec,
+      radius,
+      magnitudeLimit,
+      tmassCrossmatch,
+      0,
+      k,
+      "nearest",
+      columns,
+      filter,
+    );
+  }
+
+  /**
+   * Position and parallax of a single source, or null if it is not stored
+   */
+  getSourcePosition(
+    sourceId: string | bigint,
+  ): { ra: number; dec: number; parallax: number | null } | null {
+    return this.db.prepare(
+      "SELECT ra, dec, parallax FROM gaiadr3 WHERE source_id = ?",
+    ).get<{ ra: number; dec: number; parallax: number | null }>(
+      sourceId.toString(),
+    ) ?? null;
+  }
+
+  /**
+   * Find stars within `radius` parsecs of a heliocentric Cartesian point
+   * in parsecs, using their parallax distances. A sphere away from the
+   * Sun is turned into a cone and a parallax range; one around the Sun
+   * covers the whole sky, so it is only a parallax range, read through
+   * idx_parallax. Candidates get the exact 3D test.
+   */
+  sphereSearch(
+    center: [number, number, number],
+    radius: number,
+    minParallaxOverError = 0,
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): GaiaRecord[] {
+    if (!(radius > 0)) return [];
+
+    const [x, y, z] = center;
+    const distance = Math.hypot(x, y, z);
+    const inside = (record: GaiaRecord) => {
+      const p = parallaxToCartesian(
+        record.ra,
+        record.dec,
+        record.parallax as number,
+      );
+      return Math.hypot(p[0] - x, p[1] - y, p[2] - z) <= radius;
+    };
+
+    if (distance <= radius) {
+      return this.parallaxQuery(
+        1000 / (distance + radius),
+        minParallaxOverError,
+        magnitudeLimit,
+        tmassCrossmatch,
+        columns,
+        filter,
+      ).filter(inside);
+    }
+
+    let condition = `g.parallax >= ${1000 / (distance + radius)}`;
+    condition += ` AND g.parallax <= ${1000 / (distance - radius)}`;
+    if (minParallaxOverError > 0) {
+      condition +=
+        ` AND ${this.parallaxOverError()} >= ${minParallaxOverError}`;
+    }
+
+    const ra = (Math.atan2(y, x) * 180 / Math.PI + 360) % 360;
+    const dec = Math.asin(z / distance) * 180 / Math.PI;
+    const coneRadius = Math.asin(radius / distance) * 180 / Math.PI;
+
+    return this.coneQuery(
+      ra,
+      dec,
+      coneRadius,
+      magnitudeLimit,
+      tmassCrossmatch,
+      condition,
+      0,
+      "none",
+      columns,
+      filter,
+    ).filter(inside);
+  }
+
+  /**
+   * Every star with a parallax of at least `minParallax` mas (closer than
+   * 1000 / minParallax parsecs) across the whole sky, read as a range of
+   * the parallax index
+   */
+  private parallaxQuery(
+    minParallax: number,
+    minParallaxOverError = 0,
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): GaiaRecord[] {
+    const { selectClause, fromClause } = this.coneSelect(
+      false,
+      tmassCrossmatch,
+      columns,
+      this.tableFor(magnitudeLimit),
+    );
+    let whereClause = "g.parallax >= :minParallax";
+    const params: Record<string, number> = { minParallax };
+
+    if (minParallaxOverError > 0) {
+      whereClause += ` AND ${this.parallaxOverError()} >= :minSnr`;
+      params.minSnr = minParallaxOverError;
+    }
+
+    if (magnitudeLimit) {
+      const magnitude = this.magnitudeCondition(magnitudeLimit);
+      whereClause += ` AND ${magnitude.condition}`;
+      Object.assign(params, magnitude.params);
+    }
+
+    if (filter.length) {
+      const cuts = filterCondition(filter);
+      whereClause += ` AND ${cuts.condition}`;
+      Object.assign(params, cuts.params);
+    }
+
+    return this.cachedStatement(
+      `SELECT ${selectClause} FROM ${fromClause} WHERE ${whereClause}`,
+    ).all<GaiaRecord>(params);
+  }
+
+  /**
+   * Find the `k` stars closest in space to a heliocentric Cartesian point
+   * in parsecs, nearest first, by sphere searches grown by the star
+   * density seen in the previous one
+   */
+  nearestInSpace(
+    center: [number, number, number],
+    k: number,
+    minParallaxOverError = 0,
+    magnitudeLimit?: [number, number],
+    tmassCrossmatch = false,
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): GaiaRecord[] {
+    if (k <= 0) return [];
+
+    const [x, y, z] = center;
+    const separation = (record: GaiaRecord) => {
+      const p = parallaxToCartesian(
+        record.ra,
+        record.dec,
+        record.parallax as number,
+      );
+      return Math.hypot(p[0] - x, p[1] - y, p[2] - z);
+    };
+
+    // Beyond 1 Mpc there are no meaningful Gaia parallaxes
+    let radius = 10;
+    let results: GaiaRecord[] = [];
+    while (true) {
+      results = this.sphereSearch(
+        center,
+        radius,
+        minParallaxOverError,
+        magnitudeLimit,
+        tmassCrossmatch,
+        columns,
+        filter,
+      );
+      if (results.length >= k || radius >= 1e6) break;
+      // Volume grows as the cubed radius; aim 30% past the estimate and
+      // at least double
+      const estimate = results.length > 0
+        ? radius * Math.cbrt(k / results.length) * 1.3
+        : radius * 4;
+      radius = Math.min(Math.max(estimate, radius * 2), 1e6);
+    }
+
+    return results
+      .map((record) => ({ record, separation: separation(record) }))
+      .sort((a, b) => a.separation - b.separation)
+      .slice(0, k)
+      .map(({ record }) => record);
+  }
+
+  /**
+   * SQL expression for the parallax S/N from whichever columns are stored
+   */
+  private parallaxOverError(): string {
+    const columns = this.getGaiaColumns();
+    if (columns.includes("parallax_over_error")) {
+      return "g.parallax_over_error";
+    }
+    if (columns.includes("parallax_error")) {
+      return "g.parallax / g.parallax_error";
+    }
+    throw new Error(
+      "A parallax S/N cut requires parallax_error or parallax_over_error in the database",
+    );
+  }
+
+  /**
+   * Get the Gaia columns actually present in the gaiadr3 table
+   * (excluding derived index columns)
+   */
+  getGaiaColumns(): string[] {
+    if (!this.gaiaColumns) {
+      this.gaiaColumns = this.getTableColumns("gaiadr3").filter((col) =>
+        !derivedColumns.has(col)
+      );
+    }
+    return this.gaiaColumns;
+  }
+
+  /**
+   * Export the gaiadr3 table to a native catalog file, streaming rows in
+   * source_id (and therefore HEALPix) order
+   */
+  exportCatalog(path: string, order: number): number {
+    const startTime = Date.now();
+    const columns = this.getGaiaColumns().filter((col) =>
+      col !== "source_id"
+    );
+    const total = this.getRecordCount();
+    this.logger.debug(
+      `Exporting ${total.toLocaleString()} records to ${path}…`,
+    );
+
+    const batchSize = 100000;
+    const sourceIds = new BigInt64Array(batchSize);
+    const values = new Float64Array(batchSize * columns.length);
+    const writer = CatalogWriter.create(path, columns, order, total);
+
+    // The hpx index yields rows in pixel order, but not in source_id order
+    // within a pixel, which the catalog's source lookup relies on
+    const orderBy = this.hasSpatialIndex()
+      ? "hpx, CAST(source_id AS INTEGER)"
+      : "CAST(source_id AS INTEGER)";
+    const stmt = this.db.prepare(
+      `SELECT source_id, ${
+        columns.join(", ")
+      } FROM gaiadr3 ORDER BY ${orderBy}`,
+    );
+
+    let count = 0;
+    let written = 0;
+
+    try {
+      for (const row of stmt.iter() as IterableIterator<GaiaRecord>) {
+        sourceIds[count] = BigInt(row.source_id);
+        for (let c = 0; c < columns.length; c++) {
+          const value = row[columns[c]];
+          values[count * columns.length + c] = value === null
+            ? NaN
+            : Number(value);
+        }
+
+        if (++count === batchSize) {
+          writer.append(sourceIds, values, count);
+          written += count;
+          count = 0;
+        }
+      }
+
+      if (count > 0) {
+        writer.append(sourceIds, values, count);
+        written += count;
+      }
+    } finally {
+      stmt.finalize();
+      writer.close();
+    }
+
+    const duration = Date.now() - startTime;
+    this.logger.debug(
+      `Catalog export completed in ${formatDuration(duration)}`,
+    );
+    return written;
+  }
+
+  /**
+   * Record count of each magnitude tier, brightest tier first
+   */
+  getTierCounts(): { limit: number; count: number }[] {
+    return this.getTiers().map(({ limit, table }) => ({
+      limit,
+      count: this.getRecordCount(table),
+    }));
+  }
+
+  /**
+   * Get total record count
+   */
+  getRecordCount(table = "gaiadr3"): number {
+    const result = this.db.prepare(`SELECT COUNT(*) as count FROM ${table}`)
+      .get<{ count: number }>();
+    return result?.count ?? 0;
+  }
+
+  /**
+   * Close database connection
+   */
+  close(): void {
+    for (const stmt of this.statements.values()) {
+      stmt.finalize();
+    }
+    this.statements.clear();
     this.db.close();
   }
 }
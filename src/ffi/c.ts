@@ -17,6 +17,10 @@ let lib:
       parameters: ["pointer", "pointer", "usize"];
       result: "pointer";
     };
+    parse_gzipped_csv_photometry: {
+      parameters: ["pointer", "pointer", "usize", "buffer"];
+      result: "pointer";
+    };
     free_string: {
       parameters: ["pointer"];
       result: "void";
@@ -35,6 +39,10 @@ function getCLib() {
         parameters: ["pointer", "pointer", "usize"],
         result: "pointer",
       },
+      parse_gzipped_csv_photometry: {
+        parameters: ["pointer", "pointer", "usize", "buffer"],
+        result: "pointer",
+      },
       free_string: {
         parameters: ["pointer"],
         result: "void",
@@ -47,12 +55,14 @@ function getCLib() {
 const encoder = new TextEncoder();
 
 /**
- * Parse a gzipped CSV file using C
+ * Parse a gzipped CSV file using C. With G, BP and RP `zeropoints`, each
+ * record also gets phot_{g,bp,rp}_mean_mag and bp_rp from the fluxes.
  */
 export async function parseGzippedCsvC(
   filePath: string,
   columnsToKeep: string[],
   chunkSize = 100000,
+  zeropoints?: number[],
 ): Promise<Array<Record<string, unknown>>> {
   // Convert strings to C strings (null-terminated)
   const filePathBytes = encoder.encode(filePath + "\0");
@@ -67,11 +77,14 @@ export async function parseGzippedCsvC(
   const cLib = getCLib();
 
   // Call C function
-  const resultPtr = cLib.symbols.parse_gzipped_csv(
-    filePathPtr,
-    columnsJsonPtr,
-    chunkSize,
-  );
+  const resultPtr = zeropoints
+    ? cLib.symbols.parse_gzipped_csv_photometry(
+      filePathPtr,
+      columnsJsonPtr,
+      chunkSize,
+      new Float64Array(zeropoints.slice(0, 3)),
+    )
+    : cLib.symbols.parse_gzipped_csv(filePathPtr, columnsJsonPtr, chunkSize);
 
   if (resultPtr === null) {
     throw new Error("Failed to parse CSV file in C");
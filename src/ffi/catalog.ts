@@ -0,0 +1,1185 @@
+/**
+ * Deno FFI bindings for the native memory-mapped catalog engine
+ * Lazy-loaded to avoid requiring --allow-ffi unless actually used
+ */
+
+import { fromFileUrl } from "@std/path";
+import type { GaiaRecord } from "../database.ts";
+import type {
+  AggregateResult,
+  AggregateTerm,
+  ConeTarget,
+  FilterTerm,
+  ResultOrder,
+} from "../types.ts";
+
+const libName = Deno.build.os === "darwin"
+  ? "libgaia_csv_parser.dylib"
+  : Deno.build.os === "windows"
+  ? "gaia_csv_parser.dll"
+  : "libgaia_csv_parser.so";
+
+const libPath = fromFileUrl(
+  new URL(`../../ffi/c/${libName}`, import.meta.url),
+);
+
+/** CATALOG_ORDER_* values in gaia_catalog.h */
+const resultOrders: Record<ResultOrder, number> = {
+  none: 0,
+  brightest: 1,
+  nearest: 2,
+};
+
+/** CATALOG_NO_COLUMN in gaia_catalog.h */
+const NO_COLUMN = 0xffffffff;
+
+/** Unit-vector columns the writer derives from ra/dec */
+const derivedColumns = new Set(["ux", "uy", "uz"]);
+
+const symbols = {
+  catalog_last_error: { parameters: [], result: "pointer" },
+  flux_to_mag_block: {
+    parameters: ["buffer", "buffer", "u64", "f64", "buffer", "buffer"],
+    result: "void",
+  },
+  mag_to_flux_block: {
+    parameters: ["buffer", "u64", "f64", "buffer"],
+    result: "void",
+  },
+  catalog_writer_open: {
+    parameters: ["buffer", "buffer", "u32", "u64"],
+    result: "pointer",
+  },
+  catalog_writer_append: {
+    parameters: ["pointer", "buffer", "buffer", "u64"],
+    result: "i32",
+  },
+  catalog_writer_close: { parameters: ["pointer"], result: "i32" },
+  catalog_open: { parameters: ["buffer"], result: "pointer" },
+  catalog_close: { parameters: ["pointer"], result: "void" },
+  catalog_num_rows: { parameters: ["pointer"], result: "u64" },
+  catalog_num_columns: { parameters: ["pointer"], result: "u32" },
+  catalog_column_name: { parameters: ["pointer", "u32"], result: "pointer" },
+  catalog_cone_search: {
+    parameters: ["pointer", "f64", "f64", "f64", "f64", "f64"],
+    result: "pointer",
+  },
+  catalog_cone_count: {
+    parameters: ["pointer", "f64", "f64", "f64", "f64", "f64"],
+    result: "i64",
+  },
+  catalog_cone_search_limit: {
+    parameters: ["pointer", "f64", "f64", "f64", "f64", "f64", "u64", "i32"],
+    result: "pointer",
+  },
+  catalog_cone_search_epoch: {
+    parameters: ["pointer", "f64", "f64", "f64", "f64", "f64", "f64"],
+    result: "pointer",
+  },
+  catalog_propagate_rows: {
+    parameters: ["pointer", "pointer", "f64", "buffer", "buffer"],
+    result: "i32",
+  },
+  catalog_cone_search_batch: {
+    parameters: [
+      "pointer",
+      "buffer",
+      "buffer",
+      "buffer",
+      "u64",
+      "f64",
+      "f64",
+      "u32",
+    ],
+    result: "pointer",
+  },
+  batch_rowset: { parameters: ["pointer"], result: "pointer" },
+  batch_read_offsets: { parameters: ["pointer", "buffer"], result: "i32" },
+  batch_free: { parameters: ["pointer"], result: "void" },
+  catalog_nearest: {
+    parameters: ["pointer", "f64", "f64", "u32", "f64", "f64"],
+    result: "pointer",
+  },
+  catalog_box_search: {
+    parameters: ["pointer", "f64", "f64", "f64", "f64", "f64", "f64"],
+    result: "pointer",
+  },
+  catalog_cone_pixels: {
+    parameters: ["i32", "f64", "f64", "f64", "buffer", "buffer", "u64"],
+    result: "i64",
+  },
+  catalog_polygon_ranges: {
+    parameters: ["i32", "buffer", "u32", "buffer", "buffer", "u64"],
+    result: "i64",
+  },
+  catalog_pixel_search: {
+    parameters: ["pointer", "i32", "i64", "f64", "f64"],
+    result: "pointer",
+  },
+  catalog_polygon_search: {
+    parameters: ["pointer", "buffer", "u32", "f64", "f64"],
+    result: "pointer",
+  },
+  catalog_brightness_search: {
+    parameters: ["pointer", "f64", "f64", "u64"],
+    result: "pointer",
+  },
+  catalog_read_source_ids: {
+    parameters: ["pointer", "pointer", "buffer"],
+    result: "i32",
+  },
+  catalog_read_column: {
+    parameters: ["pointer", "pointer", "u32", "buffer"],
+    result: "i32",
+  },
+  catalog_xmatch: {
+    parameters: [
+      "pointer",
+      "buffer",
+      "buffer",
+      "u64",
+      "f64",
+      "f64",
+      "u32",
+      "buffer",
+      "buffer",
+    ],
+    result: "i64",
+  },
+  catalog_filter_rows: {
+    parameters: ["pointer", "pointer", "u32", "buffer", "buffer"],
+    result: "i64",
+  },
+  catalog_cone_sample: {
+    parameters: [
+      "pointer",
+      "f64",
+      "f64",
+      "f64",
+      "f64",
+      "f64",
+      "u32",
+      "buffer",
+      "buffer",
+      "u64",
+    ],
+    result: "pointer",
+  },
+  batch_filter_rows: {
+    parameters: ["pointer", "pointer", "u32", "buffer", "buffer"],
+    result: "i64",
+  },
+  catalog_aggregate_rows: {
+    parameters: [
+      "pointer",
+      "pointer",
+      "u32",
+      "buffer",
+      "buffer",
+      "buffer",
+      "buffer",
+    ],
+    result: "i64",
+  },
+  catalog_find_source: { parameters: ["pointer", "i64"], result: "i64" },
+  catalog_kdtree_build: { parameters: ["pointer", "f64"], result: "pointer" },
+  kdtree_free: { parameters: ["pointer"], result: "void" },
+  kdtree_sphere: {
+    parameters: ["pointer", "f64", "f64", "f64", "f64", "f64", "f64", "f64"],
+    result: "pointer",
+  },
+  kdtree_nearest: {
+    parameters: ["pointer", "f64", "f64", "f64", "u32", "f64", "f64", "f64"],
+    result: "pointer",
+  },
+  rowset_create: { parameters: ["buffer", "u64"], result: "pointer" },
+  rowset_count: { parameters: ["pointer"], result: "u64" },
+  rowset_slice: { parameters: ["pointer", "u64", "u64"], result: "pointer" },
+  rowset_free: { parameters: ["pointer"], result: "void" },
+} as const;
+
+let lib: Deno.DynamicLibrary<typeof symbols> | null = null;
+let libUnavailable = false;
+
+/**
+ * Lazy-load the native library (only loads once)
+ */
+function getCatalogLib() {
+  if (!lib) {
+    lib = Deno.dlopen(libPath, symbols);
+  }
+  return lib;
+}
+
+/**
+ * Whether the native library loads (it needs a build of ffi/c and
+ * --allow-ffi), for code with a JS fallback. A failure is remembered.
+ */
+export function hasCatalogLib(): boolean {
+  if (lib) return true;
+  if (libUnavailable) return false;
+  try {
+    getCatalogLib();
+    return true;
+  } catch {
+    libUnavailable = true;
+    return false;
+  }
+}
+
+const encoder = new TextEncoder();
+
+function toCString(value: string): Uint8Array {
+  return encoder.encode(value + "\0");
+}
+
+function lastError(fallback: string): Error {
+  const ptr = getCatalogLib().symbols.catalog_last_error();
+  const message = ptr ? new Deno.UnsafePointerView(ptr).getCString() : "";
+  return new Error(message || fallback);
+}
+
+/**
+ * Set of matching catalog rows owned by the native library
+ */
+export class RowSet {
+  readonly pointer: Deno.PointerObject;
+
+  constructor(pointer: Deno.PointerObject) {
+    this.pointer = pointer;
+  }
+
+  /**
+   * Number of rows, read from the native set so in-place filters show
+   */
+  get count(): number {
+    return Number(getCatalogLib().symbols.rowset_count(this.pointer));
+  }
+
+  /**
+   * Build a row set from explicit row numbers
+   */
+  static fromRows(rows: BigUint64Array): RowSet {
+    const ptr = getCatalogLib().symbols.rowset_create(
+      rows,
+      BigInt(rows.length),
+    );
+    if (ptr === null) {
+      throw new Error("Failed to allocate row set");
+    }
+    return new RowSet(ptr);
+  }
+
+  /**
+   * Copy of up to `count` rows starting at `start`, e.g. to read a large
+   * row set a batch at a time
+   */
+  slice(start: number, count: number): RowSet {
+    const ptr = getCatalogLib().symbols.rowset_slice(
+      this.pointer,
+      BigInt(start),
+      BigInt(count),
+    );
+    if (ptr === null) {
+      throw lastError("Failed to slice row set");
+    }
+    return new RowSet(ptr);
+  }
+
+  /**
+   * Release the native row buffer
+   */
+  free(): void {
+    getCatalogLib().symbols.rowset_free(this.pointer);
+  }
+}
+
+/**
+ * Best catalog match per input position: `rows[i]` is -1 when position
+ * `i` has no match, `separation[i]` is in degrees
+ */
+export interface CrossMatchResult {
+  rows: BigInt64Array;
+  separation: Float64Array;
+  matched: number;
+}
+
+/**
+ * Rows for many cones, concatenated in target order. Rows for target `i`
+ * are `offsets[i]` to `offsets[i + 1]` of `rows`.
+ */
+export class BatchResult {
+  readonly pointer: Deno.PointerObject;
+  readonly rows: RowSet;
+  offsets: number[];
+
+  constructor(pointer: Deno.PointerObject, targetCount: number) {
+    this.pointer = pointer;
+    // Owned by the batch: released by free() below, not RowSet.free()
+    this.rows = new RowSet(getCatalogLib().symbols.batch_rowset(pointer)!);
+    this.offsets = new Array(targetCount + 1);
+    this.readOffsets();
+  }
+
+  /**
+   * Re-read the per-target offsets, e.g. after filtering in place
+   */
+  readOffsets(): void {
+    const offsets = new BigUint64Array(this.offsets.length);
+    getCatalogLib().symbols.batch_read_offsets(this.pointer, offsets);
+    this.offsets = Array.from(offsets, Number);
+  }
+
+  /**
+   * Release the native rows and offsets
+   */
+  free(): void {
+    getCatalogLib().symbols.batch_free(this.pointer);
+  }
+}
+
+/**
+ * Streaming writer for the spatially ordered catalog file.
+ * Rows must be appended in strictly increasing source_id order.
+ */
+export class CatalogWriter {
+  private handle: Deno.PointerObject;
+  private columns: string[];
+
+  private constructor(handle: Deno.PointerObject, columns: string[]) {
+    this.handle = handle;
+    this.columns = columns;
+  }
+
+  /**
+   * Create a catalog file sized for `rowCount` rows of `columns`
+   * (source_id is always stored first and must not be listed)
+   */
+  static create(
+    path: string,
+    columns: string[],
+    order: number,
+    rowCount: number,
+  ): CatalogWriter {
+    const handle = getCatalogLib().symbols.catalog_writer_open(
+      toCString(path),
+      toCString(JSON.stringify(columns)),
+      order,
+      BigInt(rowCount),
+    );
+    if (handle === null) {
+      throw lastError(`Failed to create catalog ${path}`);
+    }
+    return new CatalogWriter(handle, columns);
+  }
+
+  /**
+   * Append `count` rows; `values` is row-major with one entry per column
+   */
+  append(sourceIds: BigInt64Array, values: Float64Array, count: number): void {
+    if (values.length < count * this.columns.length) {
+      throw new Error("Value buffer is smaller than count × columns");
+    }
+    const status = getCatalogLib().symbols.catalog_writer_append(
+      this.handle,
+      sourceIds,
+      values,
+      BigInt(count),
+    );
+    if (status !== 0) {
+      throw lastError("Failed to append catalog rows");
+    }
+  }
+
+  /**
+   * Write the pixel index and flush the file
+   */
+  close(): void {
+    const status = getCatalogLib().symbols.catalog_writer_close(this.handle);
+    if (status !== 0) {
+      throw lastError("Failed to finalize catalog");
+    }
+  }
+}
+
+/**
+ * Read-only handle on a memory-mapped catalog file
+ */
+export class NativeCatalog {
+  private handle: Deno.PointerObject;
+  /** Every stored column, in file order */
+  private storedColumns: string[];
+  /** Gaia columns, excluding the derived unit vectors */
+  readonly columns: string[];
+  readonly rowCount: number;
+  /** 3D indices, built on first use for each parallax S/N cut */
+  private spaceTree: Deno.PointerObject | null = null;
+
+  private constructor(handle: Deno.PointerObject) {
+    const symbols = getCatalogLib().symbols;
+    this.handle = handle;
+    this.rowCount = Number(symbols.catalog_num_rows(handle));
+
+    const numColumns = symbols.catalog_num_columns(handle);
+    this.storedColumns = [];
+    for (let i = 0; i < numColumns; i++) {
+      const ptr = symbols.catalog_column_name(handle, i);
+      this.storedColumns.push(
+        ptr ? new Deno.UnsafePointerView(ptr).getCString() : "",
+      );
+    }
+    this.columns = this.storedColumns.filter((col) =>
+      !derivedColumns.has(col)
+    );
+  }
+
+  /**
+   * Map a catalog file built with `deno task catalog`
+   */
+  static open(path: string): NativeCatalog {
+    const handle = getCatalogLib().symbols.catalog_open(toCString(path));
+    if (handle === null) {
+      throw lastError(`Failed to open catalog ${path}`);
+    }
+    return new NativeCatalog(handle);
+  }
+
+  /**
+   * Find rows within `radius` degrees of (ra, dec), optionally restricted
+   * to an exclusive G flux range. A non-zero `years` tests positions
+   * propagated that far from the catalog epoch by proper motion.
+   */
+  coneSearch(
+    ra: number,
+    dec: number,
+    radius: number,
+    fluxRange?: [number, number],
+    years = 0,
+  ): RowSet {
+    const [fluxMin, fluxMax] = fluxRange ?? [NaN, NaN];
+    const ptr = getCatalogLib().symbols.catalog_cone_search_epoch(
+      this.handle,
+      ra,
+      dec,
+      radius,
+      fluxMin,
+      fluxMax,
+      years,
+    );
+    if (ptr === null) {
+      throw lastError("Native cone search failed");
+    }
+    return new RowSet(ptr);
+  }
+
+  /**
+   * Number of rows coneSearch would find at the catalog epoch, counted
+   * without building them: pixels inside the cone count from the pixel
+   * index, and only edge pixels are tested
+   */
+  coneCount(
+    ra: number,
+    dec: number,
+    radius: number,
+    fluxRange?: [number, number],
+  ): number {
+    const [fluxMin, fluxMax] = fluxRange ?? [NaN, NaN];
+    const count = getCatalogLib().symbols.catalog_cone_count(
+      this.handle,
+      ra,
+      dec,
+      radius,
+      fluxMin,
+      fluxMax,
+    );
+    if (Number(count) < 0) {
+      throw lastError("Native cone count failed");
+    }
+    return Number(count);
+  }
+
+  /**
+   * At most `limit` rows (0 for all) within `radius` degrees of
+   * (ra, dec) in the given order, stopping early where the order allows
+   */
+  coneSearchLimit(
+    ra: number,
+    dec: number,
+    radius: number,
+    limit: number,
+    order: ResultOrder = "none",
+    fluxRange?: [number, number],
+  ): RowSet {
+    const [fluxMin, fluxMax] = fluxRange ?? [NaN, NaN];
+    const ptr = getCatalogLib().symbols.catalog_cone_search_limit(
+      this.handle,
+      ra,
+      dec,
+      radius,
+      fluxMin,
+      fluxMax,
+      BigInt(limit),
+      resultOrders[order],
+    );
+    if (ptr === null) {
+      throw lastError("Native cone search failed");
+    }
+    return new RowSet(ptr);
+  }
+
+  /**
+   * Positions of a row set propagated `years` from the catalog epoch
+   */
+  propagatePositions(
+    rows: RowSet,
+    years: number,
+  ): { ra: Float64Array; dec: Float64Array } {
+    const ra = new Float64Array(rows.count);
+    const dec = new Float64Array(rows.count);
+    const status = getCatalogLib().symbols.catalog_propagate_rows(
+      this.handle,
+      rows.pointer,
+      years,
+      ra,
+      dec,
+    );
+    if (status !== 0) {
+      throw lastError("Native epoch propagation failed");
+    }
+    return { ra, dec };
+  }
+
+  /**
+   * Cone search many targets in one native call, spread over `threads`
+   * threads, optionally restricted to an exclusive G flux range
+   */
+  coneSearchBatch(
+    targets: ConeTarget[],
+    fluxRange?: [number, number],
+    threads = navigator.hardwareConcurrency,
+  ): BatchResult {
+    const [fluxMin, fluxMax] = fluxRange ?? [NaN, NaN];
+    const ra = Float64Array.from(targets, (target) => target.ra);
+    const dec = Float64Array.from(targets, (target) => target.dec);
+    const radius = Float64Array.from(targets, (target) => target.radius);
+
+    const ptr = getCatalogLib().symbols.catalog_cone_search_batch(
+      this.handle,
+      ra,
+      dec,
+      radius,
+      BigInt(targets.length),
+      fluxMin,
+      fluxMax,
+      threads,
+    );
+    if (ptr === null) {
+      throw lastError("Native batched cone search failed");
+    }
+    return new BatchResult(ptr, targets.length);
+  }
+
+  /**
+   * Match each position to its nearest catalog row within `radius`
+   * degrees. A non-zero `years` propagates catalog positions by proper
+   * motion first (input epoch minus the catalog epoch).
+   */
+  crossMatch(
+    ra: Float64Array,
+    dec: Float64Array,
+    radius: number,
+    years = 0,
+    threads = navigator.hardwareConcurrency,
+  ): CrossMatchResult {
+    const rows = new BigInt64Array(ra.length);
+    const separation = new Float64Array(ra.length);
+    const matched = getCatalogLib().symbols.catalog_xmatch(
+      this.handle,
+      ra,
+      dec,
+      BigInt(ra.length),
+      radius,
+      years,
+      threads,
+      rows,
+      separation,
+    );
+    if (Number(matched) < 0) {
+      throw lastError("Native cross-match failed");
+    }
+    return { rows, separation, matched: Number(matched) };
+  }
+
+  /**
+   * Find the `k` rows closest to (ra, dec), nearest first, optionally
+   * restricted to an exclusive G flux range
+   */
+  nearest(
+    ra: number,
+    dec: number,
+    k: number,
+    fluxRange?: [number, number],
+  ): RowSet {
+    const [fluxMin, fluxMax] = fluxRange ?? [NaN, NaN];
+    const ptr = getCatalogLib().symbols.catalog_nearest(
+      this.handle,
+      ra,
+      dec,
+      k,
+      fluxMin,
+      fluxMax,
+    );
+    if (ptr === null) {
+      throw lastError("Native nearest neighbour search failed");
+    }
+    return new RowSet(ptr);
+  }
+
+  /**
+   * Find rows inside an RA/Dec box in degrees (`raMin > raMax` wraps
+   * through RA 0), optionally restricted to an exclusive G flux range
+   */
+  boxSearch(
+    raMin: number,
+    raMax: number,
+    decMin: number,
+    decMax: number,
+    fluxRange?: [number, number],
+  ): RowSet {
+    const [fluxMin, fluxMax] = fluxRange ?? [NaN, NaN];
+    const ptr = getCatalogLib().symbols.catalog_box_search(
+      this.handle,
+      raMin,
+      raMax,
+      decMin,
+      decMax,
+      fluxMin,
+      fluxMax,
+    );
+    if (ptr === null) {
+      throw lastError("Native box search failed");
+    }
+    return new RowSet(ptr);
+  }
+
+  /**
+   * Rows of one nested HEALPix pixel at `order` (at most 12), optionally
+   * restricted to an exclusive G flux range
+   */
+  pixelSearch(
+    order: number,
+    pixel: number,
+    fluxRange?: [number, number],
+  ): RowSet {
+    const [fluxMin, fluxMax] = fluxRange ?? [NaN, NaN];
+    const ptr = getCatalogLib().symbols.catalog_pixel_search(
+      this.handle,
+      order,
+      BigInt(pixel),
+      fluxMin,
+      fluxMax,
+    );
+    if (ptr === null) {
+      throw lastError("Native pixel search failed");
+    }
+    return new RowSet(ptr);
+  }
+
+  /**
+   * Every row in an exclusive G flux range across the whole sky,
+   * brightest first, at most `limit` (0 for all). Served by the catalog's
+   * flux rank, so only the matching rows are touched.
+   */
+  brightnessSearch(fluxRange: [number, number], limit = 0): RowSet {
+    const ptr = getCatalogLib().symbols.catalog_brightness_search(
+      this.handle,
+      fluxRange[0],
+      fluxRange[1],
+      BigInt(limit),
+    );
+    if (ptr === null) {
+      throw lastError("Native brightness search failed");
+    }
+    return new RowSet(ptr);
+  }
+
+  /**
+   * Find rows inside a convex polygon of [ra, dec] vertices in degrees,
+   * optionally restricted to an exclusive G flux range
+   */
+  polygonSearch(
+    vertices: [number, number][],
+    fluxRange?: [number, number],
+  ): RowSet {
+    const [fluxMin, fluxMax] = fluxRange ?? [NaN, NaN];
+    const ptr = getCatalogLib().symbols.catalog_polygon_search(
+      this.handle,
+      Float64Array.from(vertices.flat()),
+      vertices.length,
+      fluxMin,
+      fluxMax,
+    );
+    if (ptr === null) {
+      throw lastError("Native polygon search failed");
+    }
+    return new RowSet(ptr);
+  }
+
+  /**
+   * Narrow `rows` in place to those passing every filter term, with the
+   * predicates evaluated natively a block of rows at a time. Returns the
+   * number of rows kept.
+   */
+  filterRows(rows: RowSet, terms: FilterTerm[]): number {
+    if (!terms.length) return rows.count;
+
+    const { columns, bounds } = this.filterArrays(terms);
+    const kept = getCatalogLib().symbols.catalog_filter_rows(
+      this.handle,
+      rows.pointer,
+      terms.length,
+      columns,
+      bounds,
+    );
+    if (Number(kept) < 0) {
+      throw lastError("Native row filter failed");
+    }
+    return Number(kept);
+  }
+
+  /**
+   * filterRows for every target of a batch in place, updating its
+   * per-target offsets. Returns the number of rows kept.
+   */
+  filterBatch(batch: BatchResult, terms: FilterTerm[]): number {
+    if (!terms.length) return batch.rows.count;
+
+    const { columns, bounds } = this.filterArrays(terms);
+    const kept = getCatalogLib().symbols.batch_filter_rows(
+      this.handle,
+      batch.pointer,
+      terms.length,
+      columns,
+      bounds,
+    );
+    if (Number(kept) < 0) {
+      throw lastError("Native batch filter failed");
+    }
+    batch.readOffsets();
+    return Number(kept);
+  }
+
+  /**
+   * The `count` rows of a cone with the smallest random_index that pass
+   * the flux range and filter terms, smallest random_index first. One
+   * scan: the sample so far sets the random_index cut of later pixels.
+   */
+  coneSample(
+    ra: number,
+    dec: number,
+    radius: number,
+    fluxRange: [number, number] | undefined,
+    terms: FilterTerm[],
+    count: number,
+  ): RowSet {
+    const [fluxMin, fluxMax] = fluxRange ?? [NaN, NaN];
+    const { columns, bounds } = this.filterArrays(terms);
+    const ptr = getCatalogLib().symbols.catalog_cone_sample(
+      this.handle,
+      ra,
+      dec,
+      radius,
+      fluxMin,
+      fluxMax,
+      terms.length,
+      columns,
+      bounds,
+      BigInt(count),
+    );
+    if (ptr === null) {
+      throw lastError("Native cone sample failed");
+    }
+    return new RowSet(ptr);
+  }
+
+  /**
+   * Count, value range and bin counts of `rows` over aggregate axes,
+   * computed natively without reading the rows out
+   */
+  aggregate(rows: RowSet, terms: AggregateTerm[]): AggregateResult {
+    const axes = new Float64Array(terms.length * 4);
+    terms.forEach((term, t) => {
+      axes.set([term.zeropoint ?? NaN, term.min, term.max, term.bins], 4 * t);
+    });
+    const numBins = terms.length && terms.every((term) => term.bins > 0)
+      ? terms.reduce((product, term) => product * term.bins, 1)
+      : 0;
+    const range = new Float64Array(terms.length * 2);
+    const counts = new BigUint64Array(numBins);
+
+    const count = getCatalogLib().symbols.catalog_aggregate_rows(
+      this.handle,
+      rows.pointer,
+      terms.length,
+      this.columnPairs(terms),
+      axes,
+      range,
+      counts,
+    );
+    if (Number(count) < 0) {
+      throw lastError("Native aggregate failed");
+    }
+    return {
+      count: Number(count),
+      min: terms.map((_, t) => range[2 * t]),
+      max: terms.map((_, t) => range[2 * t + 1]),
+      counts: Array.from(counts, Number),
+    };
+  }
+
+  /**
+   * (column, divisor) index pairs and (min, max) bound pairs of filter
+   * terms, as catalog_filter_rows takes them
+   */
+  private filterArrays(
+    terms: FilterTerm[],
+  ): { columns: Uint32Array; bounds: Float64Array } {
+    const bounds = new Float64Array(terms.length * 2);
+    terms.forEach((term, t) => {
+      bounds[2 * t] = term.min;
+      bounds[2 * t + 1] = term.max;
+    });
+    return { columns: this.columnPairs(terms), bounds };
+  }
+
+  /**
+   * (column, divisor) index pairs of filter or aggregate terms, with
+   * NO_COLUMN for a missing divisor
+   */
+  private columnPairs(
+    terms: { column: string; divisor?: string }[],
+  ): Uint32Array {
+    const columns = new Uint32Array(terms.length * 2);
+    terms.forEach((term, t) => {
+      for (const [k, name] of [term.column, term.divisor].entries()) {
+        if (name === undefined) {
+          columns[2 * t + k] = NO_COLUMN;
+          continue;
+        }
+        const index = this.storedColumns.indexOf(name);
+        if (index < 0) {
+          throw new Error(`Column ${name} is not stored in the catalog`);
+        }
+        columns[2 * t + k] = index;
+      }
+    });
+    return columns;
+  }
+
+  /**
+   * Row number of a source, or null when it is not in the catalog
+   */
+  findSource(sourceId: bigint): number | null {
+    const row = getCatalogLib().symbols.catalog_find_source(
+      this.handle,
+      sourceId,
+    );
+    return row < 0 ? null : Number(row);
+  }
+
+  /**
+   * k-d tree over heliocentric positions in parsecs of the rows with a
+   * positive parallax, built on the first 3D query and kept until close.
+   * The build reads every row and costs O(n log n) time and 32 bytes per
+   * row; S/N cuts are applied while querying, so one tree serves them all.
+   */
+  private spaceIndex(): Deno.PointerObject {
+    if (!this.spaceTree) {
+      const ptr = getCatalogLib().symbols.catalog_kdtree_build(this.handle, 0);
+      if (ptr === null) {
+        throw lastError("Failed to build 3D index");
+      }
+      this.spaceTree = ptr;
+    }
+    return this.spaceTree;
+  }
+
+  /**
+   * Find rows within `radius` parsecs of a heliocentric Cartesian point
+   * in parsecs, optionally restricted to an exclusive G flux range
+   */
+  sphereSearch(
+    center: [number, number, number],
+    radius: number,
+    minParallaxOverError = 0,
+    fluxRange?: [number, number],
+  ): RowSet {
+    const [fluxMin, fluxMax] = fluxRange ?? [NaN, NaN];
+    const ptr = getCatalogLib().symbols.kdtree_sphere(
+      this.spaceIndex(),
+      center[0],
+      center[1],
+      center[2],
+      radius,
+      minParallaxOverError,
+      fluxMin,
+      fluxMax,
+    );
+    if (ptr === null) {
+      throw lastError("Native sphere search failed");
+    }
+    return new RowSet(ptr);
+  }
+
+  /**
+   * Find the `k` rows closest in space to a heliocentric Cartesian point
+   * in parsecs, nearest first
+   */
+  nearestInSpace(
+    center: [number, number, number],
+    k: number,
+    minParallaxOverError = 0,
+    fluxRange?: [number, number],
+  ): RowSet {
+    const [fluxMin, fluxMax] = fluxRange ?? [NaN, NaN];
+    const ptr = getCatalogLib().symbols.kdtree_nearest(
+      this.spaceIndex(),
+      center[0],
+      center[1],
+      center[2],
+      k,
+      minParallaxOverError,
+      fluxMin,
+      fluxMax,
+    );
+    if (ptr === null) {
+      throw lastError("Native 3D nearest neighbour search failed");
+    }
+    return new RowSet(ptr);
+  }
+
+  /**
+   * Gather the requested columns for a row set into records
+   */
+  readRecords(rows: RowSet, columns: string[] = this.columns): GaiaRecord[] {
+    const symbols = getCatalogLib().symbols;
+    const count = rows.count;
+    const records: GaiaRecord[] = new Array(count);
+
+    for (let i = 0; i < count; i++) {
+      records[i] = {} as GaiaRecord;
+    }
+
+    for (const column of columns) {
+      const index = this.storedColumns.indexOf(column);
+      if (index < 0) {
+        throw new Error(`Column ${column} is not stored in the catalog`);
+      }
+
+      if (index === 0) {
+        const ids = new BigInt64Array(count);
+        symbols.catalog_read_source_ids(this.handle, rows.pointer, ids);
+        for (let i = 0; i < count; i++) {
+          records[i].source_id = ids[i].toString();
+        }
+        continue;
+      }
+
+      const values = new Float64Array(count);
+      symbols.catalog_read_column(this.handle, rows.pointer, index, values);
+      for (let i = 0; i < count; i++) {
+        const value = values[i];
+        records[i][column] = Number.isNaN(value) ? null : value;
+      }
+    }
+
+    return records;
+  }
+
+  /**
+   * Gather the requested columns for a row set into typed arrays, without
+   * building records: source_id as int64, the rest as float64 with NaN
+   * for null
+   */
+  readColumns(
+    rows: RowSet,
+    columns: string[] = this.columns,
+  ): { sourceIds: BigInt64Array | null; values: Map<string, Float64Array> } {
+    const symbols = getCatalogLib().symbols;
+    let sourceIds: BigInt64Array | null = null;
+    const values = new Map<string, Float64Array>();
+
+    for (const column of columns) {
+      const index = this.storedColumns.indexOf(column);
+      if (index < 0) {
+        throw new Error(`Column ${column} is not stored in the catalog`);
+      }
+
+      if (index === 0) {
+        sourceIds = new BigInt64Array(rows.count);
+        symbols.catalog_read_source_ids(this.handle, rows.pointer, sourceIds);
+      } else {
+        const array = new Float64Array(rows.count);
+        symbols.catalog_read_column(this.handle, rows.pointer, index, array);
+        values.set(column, array);
+      }
+    }
+
+    return { sourceIds, values };
+  }
+
+  /**
+   * Unmap the catalog file
+   */
+  close(): void {
+    const symbols = getCatalogLib().symbols;
+    if (this.spaceTree) {
+      symbols.kdtree_free(this.spaceTree);
+      this.spaceTree = null;
+    }
+    symbols.catalog_close(this.handle);
+  }
+}
+
+/**
+ * Nested HEALPix pixels at `order` that may intersect a cone (degrees),
+ * with `inside` set for those entirely inside it. Returns null when the
+ * cone needs more than `maxPixels` pixels.
+ */
+export function conePixels(
+  order: number,
+  ra: number,
+  dec: number,
+  radius: number,
+  maxPixels: number,
+): { pixels: number[]; inside: boolean[] } | null {
+  const pixels = new BigInt64Array(maxPixels);
+  const inside = new Uint8Array(maxPixels);
+  const count = Number(
+    getCatalogLib().symbols.catalog_cone_pixels(
+      order,
+      ra,
+      dec,
+      radius,
+      pixels,
+      inside,
+      BigInt(maxPixels),
+    ),
+  );
+  if (count < 0) {
+    throw lastError("Cone pixel coverage failed");
+  }
+  if (count > maxPixels) {
+    return null;
+  }
+  return {
+    pixels: Array.from(pixels.subarray(0, count), Number),
+    inside: Array.from(inside.subarray(0, count), Boolean),
+  };
+}
+
+/**
+ * Nested HEALPix pixel ranges [lo, hi) at `order` covering a convex
+ * polygon of [ra, dec] vertices (degrees), with `inside` set for ranges
+ * entirely inside it. Returns null when it needs more than `maxRanges`.
+ */
+export function polygonRanges(
+  order: number,
+  vertices: [number, number][],
+  maxRanges: number,
+): { ranges: [number, number][]; inside: boolean[] } | null {
+  const bounds = new BigInt64Array(2 * maxRanges);
+  const inside = new Uint8Array(maxRanges);
+  const count = Number(
+    getCatalogLib().symbols.catalog_polygon_ranges(
+      order,
+      new Float64Array(vertices.flat()),
+      vertices.length,
+      bounds,
+      inside,
+      BigInt(maxRanges),
+    ),
+  );
+  if (count < 0) {
+    throw lastError("Polygon pixel coverage failed");
+  }
+  if (count > maxRanges) {
+    return null;
+  }
+  const ranges: [number, number][] = [];
+  for (let r = 0; r < count; r++) {
+    ranges.push([Number(bounds[2 * r]), Number(bounds[2 * r + 1])]);
+  }
+  return { ranges, inside: Array.from(inside.subarray(0, count), Boolean) };
+}
+
+/**
+ * Magnitudes `zeropoint - 2.5 log10(flux)` of a flux column, and with
+ * `fluxError` the magnitude errors, NaN where the flux is missing or not
+ * positive. Runs the native vectorized kernel, or a JS loop without it.
+ */
+export function fluxToMagnitude(
+  flux: Float64Array,
+  zeropoint: number,
+  fluxError?: Float64Array,
+): { mag: Float64Array; magError: Float64Array | null } {
+  const mag = new Float64Array(flux.length);
+  const magError = fluxError ? new Float64Array(flux.length) : null;
+
+  if (hasCatalogLib()) {
+    getCatalogLib().symbols.flux_to_mag_block(
+      flux,
+      fluxError ?? null,
+      BigInt(flux.length),
+      zeropoint,
+      mag,
+      magError,
+    );
+    return { mag, magError };
+  }
+
+  for (let i = 0; i < flux.length; i++) {
+    const value = flux[i];
+    const ok = value > 0 && value < Infinity;
+    mag[i] = ok ? zeropoint - 2.5 * Math.log10(value) : NaN;
+    if (magError) {
+      magError[i] = ok ? (2.5 / Math.LN10) * (fluxError![i] / value) : NaN;
+    }
+  }
+  return { mag, magError };
+}
+
+/**
+ * Fluxes `10^(-0.4 (mag - zeropoint))` of a magnitude column (NaN stays
+ * NaN), natively or with a JS loop as in fluxToMagnitude
+ */
+export function magnitudeToFlux(
+  mag: Float64Array,
+  zeropoint: number,
+): Float64Array {
+  const flux = new Float64Array(mag.length);
+  if (hasCatalogLib()) {
+    getCatalogLib().symbols.mag_to_flux_block(
+      mag,
+      BigInt(mag.length),
+      zeropoint,
+      flux,
+    );
+    return flux;
+  }
+
+  for (let i = 0; i < mag.length; i++) {
+    flux[i] = 10 ** (-0.4 * (mag[i] - zeropoint));
+  }
+  return flux;
+}
+
+/**
+ * Close the library (cleanup)
+ */
+export function closeCatalogLib() {
+  if (lib) {
+    lib.close();
+    lib = null;
+  }
+}
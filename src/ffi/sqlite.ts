@@ -0,0 +1,18 @@
+/**
+ * Location of the native SQLite extension built by `make -C ffi/c`
+ * (astrometry SQL functions, loaded by GaiaDatabase on open)
+ */
+
+import { fromFileUrl } from "@std/path";
+
+const extensionName = Deno.build.os === "darwin"
+  ? "libgaia_sqlite.dylib"
+  : Deno.build.os === "windows"
+  ? "gaia_sqlite.dll"
+  : "libgaia_sqlite.so";
+
+export const sqliteExtensionPath = fromFileUrl(
+  new URL(`../../ffi/c/${extensionName}`, import.meta.url),
+);
+
+export const sqliteExtensionEntryPoint = "sqlite3_gaiasqlite_init";
@@ -3,8 +3,43 @@ import {
   type GaiaRecord,
   type TrackingProgress,
 } from "./database.ts";
-import { type CLIConfig, DEFAULT_CONFIG } from "./config.ts";
-import type { GaiaColumn, PhotometryOutput } from "./types.ts";
+import {
+  type CLIConfig,
+  DEFAULT_CONFIG,
+  GAIA_DR3_EPOCH,
+  GAIA_DR3_SOURCES,
+} from "./config.ts";
+import type {
+  AggregateResult,
+  ConeTarget,
+  FilterTerm,
+  GaiaColumn,
+  HistogramAxis,
+  PhotometryOutput,
+  QueryBackend,
+  QueryFilter,
+  ResultOrder,
+  SpaceCenter,
+} from "./types.ts";
+import {
+  conePixels,
+  fluxToMagnitude,
+  magnitudeToFlux,
+  NativeCatalog,
+  RowSet,
+} from "./ffi/catalog.ts";
+import { type CacheStats, PixelCache } from "./cache.ts";
+import { ColumnarResult } from "./columnar.ts";
+import {
+  aggregateTerms,
+  angularSeparation,
+  binEdges,
+  filterTerms,
+  magnitudeToFluxRange,
+  orderRecords,
+  parallaxToCartesian,
+  radecToVector,
+} from "./utils.ts";
 
 export type GaiaOptions = {
   /**
@@ -12,6 +47,16 @@ export type GaiaOptions = {
    * @default ./gaiaoffline.db
    */
   databasePath?: CLIConfig["databasePath"];
+  /**
+   * Path to the native catalog (used by the "native" backend)
+   * @default ./gaiaoffline.cat
+   */
+  catalogPath?: CLIConfig["catalogPath"];
+  /**
+   * Query engine: SQLite, or the native memory-mapped catalog
+   * @default "sql"
+   */
+  backend?: QueryBackend;
   /**
    * The select columns to store in the database
    * @default ["source_id", "ra", "dec", "parallax", "pmra", "pmdec", "radial_velocity", "phot_g_mean_flux", "phot_bp_mean_flux", "phot_rp_mean_flux", "teff_gspphot", "logg_gspphot", "mh_gspphot"]
@@ -47,8 +92,74 @@ export type GaiaOptions = {
    * @default false
    */
   tmassCrossmatch?: boolean;
+  /**
+   * Minimum parallax S/N for 3D queries (needs parallax_error or
+   * parallax_over_error stored when above 0)
+   * @default 0
+   */
+  minParallaxOverError?: number;
+  /**
+   * Epoch (Julian year) of cone search positions. Stars are propagated
+   * by proper motion before the cone test and returned at this epoch.
+   * coneSearch and coneSearchBatch honour it; other queries throw.
+   * @default 2016.0
+   */
+  epoch?: number;
+  /**
+   * Order of cone search results, applied before `limit` so a limited
+   * query returns the brightest or nearest matches
+   * @default "none"
+   */
+  order?: ResultOrder;
+  /**
+   * Output columns of query results; empty returns every stored column.
+   * Magnitude columns are derived from their flux when only that is
+   * stored. Only these columns are read from the database or catalog.
+   * @default []
+   */
+  columns?: string[];
+  /**
+   * Column cuts such as `{ bp_rp: [0.5, 1.5], ruwe: [0, 1.4] }`, applied
+   * in the SQL WHERE clause or by native predicates over the candidates
+   * @default {}
+   */
+  filter?: QueryFilter;
+  /**
+   * Random subset of the results, read through Gaia's random_index (which
+   * must be stored): a fraction below 1 of every query, or for cone
+   * searches a count of stars. 0 disables sampling.
+   * @default 0
+   */
+  sample?: number;
+  /**
+   * Memory budget in bytes of an LRU cache of per-pixel cone search
+   * candidates, so overlapping cones reuse pixels already read. Needs the
+   * native library for pixel coverage, and the hpx index with SQLite.
+   * Records that need no cleaning are returned frozen, as the cache
+   * shares them. 0 disables the cache.
+   * @default 0
+   */
+  cacheSize?: number;
+  /**
+   * Open the database read-only, with a large mmap window and page cache
+   * tuned for reads, as GaiaPool workers do
+   * @default false
+   */
+  readOnly?: boolean;
+  /**
+   * With readOnly, open the database as immutable so SQLite takes no
+   * locks. Only for databases nothing writes to while open.
+   * @default false
+   */
+  immutable?: boolean;
 };
 
+/** HEALPix order of cached pixels (about 0.23° across) */
+const CACHE_ORDER = 8;
+
+/** Cones covering more cached pixels than this (about 4° radius) skip it */
+const CACHE_MAX_PIXELS = 1024;
+
 // 2MASS zeropoints (Vega system)
 const tmassZeropoints = {
   j: 20.86650085,
@@ -56,13 +167,60 @@ const tmassZeropoints = {
   k: 20.04360008,
 };
 
+// Gaia bands, with the index of their zeropoint
+const gaiaBands = [
+  { flux: "phot_g_mean_flux", mag: "phot_g_mean_mag", zp: 0 },
+  { flux: "phot_bp_mean_flux", mag: "phot_bp_mean_mag", zp: 1 },
+  { flux: "phot_rp_mean_flux", mag: "phot_rp_mean_mag", zp: 2 },
+];
+
+/**
+ * One column of a batch of records as float64, NaN for null
+ */
+function numericColumn(records: GaiaRecord[], column: string): Float64Array {
+  return Float64Array.from(
+    records,
+    (record) => record[column] == null ? NaN : Number(record[column]),
+  );
+}
+
+/**
+ * Slices of up to `size` records
+ */
+function* chunks(records: GaiaRecord[], size: number): Generator<GaiaRecord[]> {
+  for (let i = 0; i < records.length; i += size) {
+    yield records.slice(i, i + size);
+  }
+}
+
+/**
+ * Batches cut off after `limit` records in total (0 for all), closing
+ * the source as soon as the limit is reached
+ */
+function* limitBatches(
+  batches: Iterable<GaiaRecord[]>,
+  limit: number,
+): Generator<GaiaRecord[]> {
+  let remaining = limit > 0 ? limit : Infinity;
+  for (const batch of batches) {
+    const records = batch.length > remaining
+      ? batch.slice(0, remaining)
+      : batch;
+    remaining -= records.length;
+    yield records;
+    if (remaining <= 0) return;
+  }
+}
+
 /**
  * Gaia offline query interface
  * Port of the Python Gaia class
  */
 export class Gaia {
   private db: GaiaDatabase;
+  private catalog: NativeCatalog | null = null;
   private options: Required<GaiaOptions>;
+  private cache: PixelCache | null = null;
 
   constructor(options: GaiaOptions = {}) {
     this.options = {
@@ -70,11 +228,29 @@ export class Gaia {
       limit: options.limit || 0,
       photometryOutput: options.photometryOutput || "flux",
       tmassCrossmatch: options.tmassCrossmatch || false,
+      minParallaxOverError: options.minParallaxOverError || 0,
+      epoch: options.epoch ?? GAIA_DR3_EPOCH,
+      order: options.order || "none",
+      columns: options.columns || [],
+      filter: options.filter || {},
+      sample: options.sample || 0,
+      cacheSize: options.cacheSize || 0,
+      readOnly: options.readOnly || false,
+      immutable: options.immutable || false,
       databasePath: options.databasePath || DEFAULT_CONFIG.databasePath,
+      catalogPath: options.catalogPath || DEFAULT_CONFIG.catalogPath,
+      backend: options.backend || "sql",
       storedColumns: options.storedColumns || DEFAULT_CONFIG.storedColumns,
       zeropoints: options.zeropoints || DEFAULT_CONFIG.zeropoints,
       logLevel: options.logLevel || DEFAULT_CONFIG.logLevel,
     };
+    const sample = this.options.sample;
+    if (!(sample >= 0) || (sample >= 1 && !Number.isInteger(sample))) {
+      throw new Error(
+        `Invalid sample: ${sample}. Must be a fraction below 1 or a count.`,
+      );
+    }
+
     this.db = new GaiaDatabase(this.options);
 
     // Check if 2MASS table exists if crossmatch is requested
@@ -83,125 +259,1389 @@ export class Gaia {
         "2MASS Crossmatch is not present in the database. Run populate:tmass first.",
       );
     }
+
+    if (this.options.backend === "native") {
+      if (this.options.tmassCrossmatch) {
+        this.db.close();
+        throw new Error(
+          "2MASS Crossmatch is not available with the native backend.",
+        );
+      }
+      this.catalog = NativeCatalog.open(this.options.catalogPath);
+    }
+
+    if (this.options.cacheSize > 0) {
+      this.cache = new PixelCache(this.options.cacheSize);
+    }
   }
 
   /**
    * Perform a cone search around RA, Dec
    */
   coneSearch(ra: number, dec: number, radius: number): GaiaRecord[] {
-    let results = this.db.coneSearch(
+    const { records, extras } = this.coneResult(ra, dec, radius);
+
+    // Convert photometry if needed
+    return this.cleanDataFrame(records, extras);
+  }
+
+  /**
+   * Cone search yielding results in batches of up to `batchSize` records
+   * as SQLite or the native engine produces them, with photometry
+   * converted per batch, so memory stays bounded by the batch size rather
+   * than the result. A sample count, and brightest or nearest ordering
+   * combined with an epoch or native filter, collect the result first.
+   */
+  *coneSearchIter(
+    ra: number,
+    dec: number,
+    radius: number,
+    batchSize = 10000,
+  ): Generator<GaiaRecord[]> {
+    const { batches, extras } = this.coneBatches(ra, dec, radius, batchSize);
+    for (const batch of batches) {
+      yield this.cleanDataFrame(batch, extras);
+    }
+  }
+
+  /**
+   * Cone search results held column by column in typed arrays, with rows
+   * available as lazy views. The native backend reads the columns
+   * straight into arrays, as does SQLite from row values for a plain cone;
+   * otherwise records are copied over `batchSize` at a time. Photometry is
+   * converted over whole columns.
+   */
+  coneSearchColumns(
+    ra: number,
+    dec: number,
+    radius: number,
+    batchSize = 10000,
+  ): ColumnarResult {
+    const native = this.catalog
+      ? this.nativeConeColumns(this.catalog, ra, dec, radius)
+      : null;
+    if (native) {
+      return this.cleanColumns(native);
+    }
+
+    // A plain SQL cone fills the columns from row values, with no records
+    const filter = this.options.sample >= 1 ? [] : this.compiledFilter();
+    if (
+      !this.catalog && this.streams(filter) &&
+      this.options.epoch === GAIA_DR3_EPOCH
+    ) {
+      const { limit, order } = this.options;
+      const { columns } = this.projection();
+      const { names, rows } = this.db.coneSearchValues(
+        ra,
+        dec,
+        radius,
+        this.options.magnitudeLimit,
+        this.options.tmassCrossmatch,
+        limit,
+        order,
+        columns,
+        filter,
+      );
+      return this.cleanColumns(ColumnarResult.fromValues(names, rows));
+    }
+
+    const { batches, extras } = this.coneBatches(ra, dec, radius, batchSize);
+    return this.cleanColumns(ColumnarResult.fromRecords(batches), extras);
+  }
+
+  /**
+   * Cone search records before cleaning, honouring the sample, order and
+   * limit options
+   */
+  private coneResult(
+    ra: number,
+    dec: number,
+    radius: number,
+  ): { records: GaiaRecord[]; extras: string[] } {
+    const { limit, order, sample } = this.options;
+    if (sample >= 1) {
+      return this.sampledConeRecords(ra, dec, radius, sample);
+    }
+
+    return this.coneRecords(
       ra,
       dec,
       radius,
+      this.compiledFilter(),
+      limit,
+      order,
+    );
+  }
+
+  /**
+   * Cone search records before cleaning, in batches of up to `batchSize`
+   * as the query engine produces them where the options allow, or slices
+   * of the collected result otherwise
+   */
+  private coneBatches(
+    ra: number,
+    dec: number,
+    radius: number,
+    batchSize: number,
+  ): { batches: Iterable<GaiaRecord[]>; extras: string[] } {
+    if (!Number.isInteger(batchSize) || batchSize < 1) {
+      throw new Error(
+        `Invalid batch size: ${batchSize}. Must be a positive integer.`,
+      );
+    }
+
+    const { limit, order, sample } = this.options;
+    const years = this.options.epoch - GAIA_DR3_EPOCH;
+    const filter = sample >= 1 ? [] : this.compiledFilter();
+    if (!this.streams(filter)) {
+      const { records, extras } = this.coneResult(ra, dec, radius);
+      return { batches: chunks(records, batchSize), extras };
+    }
+
+    const { columns, extras } = this.projection(
+      years !== 0 ? ["ra", "dec", "pmra", "pmdec"] : [],
+    );
+    const batches = this.catalog
+      ? this.nativeConeBatches(
+        this.catalog,
+        ra,
+        dec,
+        radius,
+        columns,
+        filter,
+        batchSize,
+      )
+      : this.db.coneSearchIter(
+        ra,
+        dec,
+        radius,
+        this.options.magnitudeLimit,
+        this.options.tmassCrossmatch,
+        years,
+        limit,
+        order,
+        columns,
+        filter,
+        batchSize,
+      );
+
+    // Propagated cones can't take the limit in SQL, so count it here
+    return { batches: limitBatches(batches, limit), extras };
+  }
+
+  /**
+   * Whether a cone search can be read out as the engine produces rows:
+   * not for a sample count, nor when brightest or nearest ordering must
+   * see every propagated or natively filtered row first
+   */
+  private streams(filter: FilterTerm[]): boolean {
+    const { order, sample } = this.options;
+    const years = this.options.epoch - GAIA_DR3_EPOCH;
+    return sample < 1 &&
+      (order === "none" || (years === 0 && !(this.catalog && filter.length)));
+  }
+
+  /**
+   * Rows of a native cone search after the filter, ordered and limited.
+   * Order and limit run natively when there is no epoch or filter;
+   * otherwise `order` must be "none".
+   */
+  private nativeConeRows(
+    catalog: NativeCatalog,
+    ra: number,
+    dec: number,
+    radius: number,
+    filter: FilterTerm[],
+  ): RowSet {
+    const { limit, order } = this.options;
+    const years = this.options.epoch - GAIA_DR3_EPOCH;
+    const fluxRange = magnitudeToFluxRange(
       this.options.magnitudeLimit,
-      this.options.tmassCrossmatch,
+      this.options.zeropoints[0],
     );
 
-    // Apply limit if specified
+    const limited = years === 0 && !filter.length;
+    const rows = limited
+      ? catalog.coneSearchLimit(ra, dec, radius, limit, order, fluxRange)
+      : catalog.coneSearch(ra, dec, radius, fluxRange, years);
+    try {
+      catalog.filterRows(rows, filter);
+    } catch (error) {
+      rows.free();
+      throw error;
+    }
+    if (limited || !(limit > 0) || rows.count <= limit) {
+      return rows;
+    }
+
+    try {
+      return rows.slice(0, limit);
+    } finally {
+      rows.free();
+    }
+  }
+
+  /**
+   * Native cone search read out `batchSize` rows at a time. The row set
+   * holds only row numbers, so it stays small however many rows match.
+   */
+  private *nativeConeBatches(
+    catalog: NativeCatalog,
+    ra: number,
+    dec: number,
+    radius: number,
+    columns: string[] | undefined,
+    filter: FilterTerm[],
+    batchSize: number,
+  ): Generator<GaiaRecord[]> {
+    const years = this.options.epoch - GAIA_DR3_EPOCH;
+    const rows = this.nativeConeRows(catalog, ra, dec, radius, filter);
+    try {
+      for (let start = 0; start < rows.count; start += batchSize) {
+        const chunk = rows.slice(start, batchSize);
+        try {
+          const records = catalog.readRecords(chunk, columns);
+          if (years !== 0) {
+            const positions = catalog.propagatePositions(chunk, years);
+            records.forEach((record, i) => {
+              record.ra = positions.ra[i];
+              record.dec = positions.dec[i];
+            });
+          }
+          yield records;
+        } finally {
+          chunk.free();
+        }
+      }
+    } finally {
+      rows.free();
+    }
+  }
+
+  /**
+   * Native cone search read straight into column arrays, or null when the
+   * options need records to order or sample
+   */
+  private nativeConeColumns(
+    catalog: NativeCatalog,
+    ra: number,
+    dec: number,
+    radius: number,
+  ): ColumnarResult | null {
+    if (this.options.sample >= 1) return null;
+    const filter = this.compiledFilter();
+    if (!this.streams(filter)) return null;
+
+    const years = this.options.epoch - GAIA_DR3_EPOCH;
+    const { columns } = this.projection();
+    const rows = this.nativeConeRows(catalog, ra, dec, radius, filter);
+    try {
+      const { sourceIds, values } = catalog.readColumns(rows, columns);
+      if (years !== 0 && values.has("ra") && values.has("dec")) {
+        const positions = catalog.propagatePositions(rows, years);
+        values.set("ra", positions.ra);
+        values.set("dec", positions.dec);
+      }
+      return new ColumnarResult(rows.count, sourceIds, values);
+    } finally {
+      rows.free();
+    }
+  }
+
+  /**
+   * Cone search for a sample of `count` stars: those with the smallest
+   * random_index that pass. The native engine finds them in one scan;
+   * SQL widens a random_index cut, sized from the stars the last cut
+   * found, until enough pass. The order and limit options then apply to
+   * the sample.
+   */
+  private sampledConeRecords(
+    ra: number,
+    dec: number,
+    radius: number,
+    count: number,
+  ): { records: GaiaRecord[]; extras: string[] } {
+    const { limit, order } = this.options;
+    const required = ["random_index", "ra", "dec"];
+    if (order === "brightest") {
+      required.push("phot_g_mean_flux");
+    }
+
+    if (this.catalog && this.options.epoch === GAIA_DR3_EPOCH) {
+      const { columns, extras } = this.projection(required);
+      const rows = this.catalog.coneSample(
+        ra,
+        dec,
+        radius,
+        magnitudeToFluxRange(
+          this.options.magnitudeLimit,
+          this.options.zeropoints[0],
+        ),
+        this.compiledFilter(0),
+        count,
+      );
+      try {
+        const records = this.catalog.readRecords(rows, columns);
+        return {
+          records: orderRecords(records, order, ra, dec, limit),
+          extras,
+        };
+      } finally {
+        rows.free();
+      }
+    }
+
+    let fraction = 1 / 4096;
+    while (true) {
+      const { records, extras } = this.coneRecords(
+        ra,
+        dec,
+        radius,
+        this.compiledFilter(fraction < 1 ? fraction : 0),
+        0,
+        "none",
+        required,
+      );
+      if (records.length < count && fraction < 1) {
+        // Stars pass the cut in proportion to it, so size the next cut
+        // to find all of them at once, with some margin
+        const estimate = records.length
+          ? fraction * (count / records.length) * 1.5
+          : fraction * 8;
+        fraction = Math.min(Math.max(estimate, fraction * 2), 1);
+        continue;
+      }
+
+      const sample = records
+        .sort((a, b) =>
+          (a.random_index as number) - (b.random_index as number)
+        )
+        .slice(0, count);
+      return { records: orderRecords(sample, order, ra, dec, limit), extras };
+    }
+  }
+
+  /**
+   * Cone search records with the columns the query needs beyond the
+   * `columns` option (`required` plus any for propagation and ordering)
+   * reported as `extras`
+   */
+  private coneRecords(
+    ra: number,
+    dec: number,
+    radius: number,
+    filter: FilterTerm[],
+    limit: number,
+    order: ResultOrder,
+    required: string[] = [],
+  ): { records: GaiaRecord[]; extras: string[] } {
+    const years = this.options.epoch - GAIA_DR3_EPOCH;
+    const cached = years === 0 && this.usesCache();
+    // Propagation, cached pixels, and filtering in the native engine leave
+    // ordering to the records themselves
+    const ordersRecords = years !== 0 || cached ||
+      (!!this.catalog && !!filter.length);
+    required = [...required];
+    if (ordersRecords) {
+      required.push("ra", "dec");
+    }
+    if (years !== 0) {
+      required.push("pmra", "pmdec");
+    }
+    if (ordersRecords && order === "brightest") {
+      required.push("phot_g_mean_flux");
+    }
+    const { columns, extras } = this.projection([...new Set(required)]);
+
+    const candidates = cached
+      ? this.cachedCone(ra, dec, radius, filter, columns)
+      : null;
+    if (candidates) {
+      return {
+        records: orderRecords(candidates, order, ra, dec, limit),
+        extras,
+      };
+    }
+
+    const records = this.catalog
+      ? this.nativeConeSearch(
+        this.catalog,
+        ra,
+        dec,
+        radius,
+        limit,
+        order,
+        columns,
+        filter,
+      )
+      : this.db.coneSearch(
+        ra,
+        dec,
+        radius,
+        this.options.magnitudeLimit,
+        this.options.tmassCrossmatch,
+        years,
+        limit,
+        order,
+        columns,
+        filter,
+      );
+    return { records, extras };
+  }
+
+  /**
+   * Whether cone searches can go through the pixel cache: it is enabled
+   * and pixels can be read by range (always natively, or with the hpx
+   * index of the table the magnitude limit selects in SQLite)
+   */
+  private usesCache(): boolean {
+    return !!this.cache &&
+      (!!this.catalog ||
+        this.db.hasPixelIndex(this.options.magnitudeLimit));
+  }
+
+  /**
+   * Stars of a cone from cached per-pixel candidates, reading and caching
+   * the pixels not seen yet, or null when the cone covers too many pixels.
+   * Only stars of pixels on the cone edge get the cap test. Cached
+   * records are frozen and shared between results; cleanDataFrame copies
+   * them only when it has to change them.
+   */
+  private cachedCone(
+    ra: number,
+    dec: number,
+    radius: number,
+    filter: FilterTerm[],
+    columns?: string[],
+  ): GaiaRecord[] | null {
+    const cache = this.cache!;
+    const coverage = conePixels(
+      CACHE_ORDER,
+      ra,
+      dec,
+      radius,
+      CACHE_MAX_PIXELS,
+    );
+    if (!coverage) return null;
+
+    // Pixels are cached per magnitude limit, projection and filter
+    const shape = [...this.options.magnitudeLimit, columns ?? "*"].join(":") +
+      JSON.stringify(filter);
+    const [x0, y0, z0] = radecToVector(ra, dec);
+    const cosRadius = Math.cos((radius * Math.PI) / 180);
+    const results: GaiaRecord[] = [];
+
+    coverage.pixels.forEach((pixel, i) => {
+      const key = `${CACHE_ORDER}:${pixel}:${shape}`;
+      let records = cache.get(key);
+      if (!records) {
+        records = this.pixelRecords(pixel, filter, columns);
+        records.forEach((record) => Object.freeze(record));
+        cache.set(key, records);
+      }
+
+      for (const record of records) {
+        if (!coverage.inside[i]) {
+          const [x, y, z] = radecToVector(record.ra, record.dec);
+          if (x * x0 + y * y0 + z * z0 < cosRadius) continue;
+        }
+        results.push(record);
+      }
+    });
+    return results;
+  }
+
+  /**
+   * Every star of one cache pixel within the magnitude limit and filter
+   */
+  private pixelRecords(
+    pixel: number,
+    filter: FilterTerm[],
+    columns?: string[],
+  ): GaiaRecord[] {
+    if (!this.catalog) {
+      return this.db.pixelSearch(
+        CACHE_ORDER,
+        pixel,
+        this.options.magnitudeLimit,
+        this.options.tmassCrossmatch,
+        columns,
+        filter,
+      );
+    }
+
+    const rows = this.catalog.pixelSearch(
+      CACHE_ORDER,
+      pixel,
+      magnitudeToFluxRange(
+        this.options.magnitudeLimit,
+        this.options.zeropoints[0],
+      ),
+    );
+    try {
+      this.catalog.filterRows(rows, filter);
+      return this.catalog.readRecords(rows, columns);
+    } finally {
+      rows.free();
+    }
+  }
+
+  /**
+   * Cone search against the memory-mapped catalog
+   */
+  private nativeConeSearch(
+    catalog: NativeCatalog,
+    ra: number,
+    dec: number,
+    radius: number,
+    limit: number,
+    order: ResultOrder,
+    columns?: string[],
+    filter: FilterTerm[] = [],
+  ): GaiaRecord[] {
+    const years = this.options.epoch - GAIA_DR3_EPOCH;
+    const fluxRange = magnitudeToFluxRange(
+      this.options.magnitudeLimit,
+      this.options.zeropoints[0],
+    );
+
+    // Without propagation or filters the limit and order run natively
+    const limited = years === 0 && !filter.length;
+    const rows = limited
+      ? catalog.coneSearchLimit(ra, dec, radius, limit, order, fluxRange)
+      : catalog.coneSearch(ra, dec, radius, fluxRange, years);
+    try {
+      catalog.filterRows(rows, filter);
+      const records = catalog.readRecords(rows, columns);
+      if (limited) {
+        return records;
+      }
+
+      if (years !== 0) {
+        const positions = catalog.propagatePositions(rows, years);
+        records.forEach((record, i) => {
+          record.ra = positions.ra[i];
+          record.dec = positions.dec[i];
+        });
+      }
+      return orderRecords(records, order, ra, dec, limit);
+    } finally {
+      rows.free();
+    }
+  }
+
+  /**
+   * Cone search a list of targets, returning one result list per target
+   * in the same order. The native backend runs the targets on `threads`
+   * threads. With an epoch each target is propagated like coneSearch.
+   */
+  coneSearchBatch(
+    targets: ConeTarget[],
+    threads = navigator.hardwareConcurrency,
+  ): GaiaRecord[][] {
+    const { columns } = this.projection();
+    const filter = this.compiledFilter();
+    let results: GaiaRecord[][];
+
+    // Cached pixels serve each target like a single cone search, as does
+    // an epoch, which propagates each cone's candidates
+    if (this.usesCache() || this.options.epoch !== GAIA_DR3_EPOCH) {
+      return targets.map((target) => {
+        const { records, extras } = this.coneRecords(
+          target.ra,
+          target.dec,
+          target.radius,
+          filter,
+          this.options.limit,
+          "none",
+        );
+        return this.cleanDataFrame(records, extras);
+      });
+    }
+
+    if (this.catalog) {
+      const batch = this.catalog.coneSearchBatch(
+        targets,
+        magnitudeToFluxRange(
+          this.options.magnitudeLimit,
+          this.options.zeropoints[0],
+        ),
+        threads,
+      );
+      try {
+        this.catalog.filterBatch(batch, filter);
+        const records = this.catalog.readRecords(batch.rows, columns);
+        results = targets.map((_, i) =>
+          records.slice(batch.offsets[i], batch.offsets[i + 1])
+        );
+      } finally {
+        batch.free();
+      }
+    } else {
+      results = this.db.coneSearchBatch(
+        targets,
+        this.options.magnitudeLimit,
+        this.options.tmassCrossmatch,
+        columns,
+        filter,
+      );
+    }
+
+    return results.map((records) =>
+      this.cleanDataFrame(
+        this.options.limit > 0 ? records.slice(0, this.options.limit) : records,
+      )
+    );
+  }
+
+  /**
+   * Find the `k` stars closest to RA, Dec within a magnitude range,
+   * sorted by separation (degrees, added as `separation`)
+   */
+  nearest(
+    ra: number,
+    dec: number,
+    k: number,
+    magnitudeLimit: [number, number] = this.options.magnitudeLimit,
+  ): GaiaRecord[] {
+    this.requireCatalogEpoch("nearest");
+    const { columns, extras } = this.projection(["ra", "dec"]);
+    const filter = this.compiledFilter();
+    const fluxRange = magnitudeToFluxRange(
+      magnitudeLimit,
+      this.options.zeropoints[0],
+    );
+    let results: GaiaRecord[];
+
+    if (this.catalog && filter.length) {
+      results = this.filteredNearest(
+        this.catalog,
+        ra,
+        dec,
+        k,
+        fluxRange,
+        columns,
+        filter,
+      );
+    } else if (this.catalog) {
+      const rows = this.catalog.nearest(ra, dec, k, fluxRange);
+      try {
+        results = this.catalog.readRecords(rows, columns);
+      } finally {
+        rows.free();
+      }
+    } else {
+      results = this.db.nearest(
+        ra,
+        dec,
+        k,
+        magnitudeLimit,
+        this.options.tmassCrossmatch,
+        columns,
+        filter,
+      );
+    }
+
+    for (const record of results) {
+      record.separation = angularSeparation(ra, dec, record.ra, record.dec);
+    }
+
+    return this.cleanDataFrame(results, extras);
+  }
+
+  /**
+   * The `k` nearest stars passing a filter, which can't prune the native
+   * k-nearest walk: filtered cones with a doubling radius as in SQL
+   */
+  private filteredNearest(
+    catalog: NativeCatalog,
+    ra: number,
+    dec: number,
+    k: number,
+    fluxRange: [number, number],
+    columns: string[] | undefined,
+    filter: FilterTerm[],
+  ): GaiaRecord[] {
+    if (k <= 0) return [];
+
+    let radius = 0.05;
+    while (true) {
+      const rows = catalog.coneSearch(ra, dec, radius, fluxRange);
+      try {
+        catalog.filterRows(rows, filter);
+        if (rows.count >= k || radius >= 180) {
+          const records = catalog.readRecords(rows, columns);
+          return orderRecords(records, "nearest", ra, dec, k);
+        }
+      } finally {
+        rows.free();
+      }
+      radius = Math.min(radius * 2, 180);
+    }
+  }
+
+  /**
+   * Select every star inside an RA/Dec box in degrees. `raMin > raMax`
+   * wraps through RA 0.
+   */
+  boxSearch(
+    raMin: number,
+    raMax: number,
+    decMin: number,
+    decMax: number,
+  ): GaiaRecord[] {
+    this.requireCatalogEpoch("boxSearch");
+    const { columns } = this.projection();
+    const filter = this.compiledFilter();
+    let results: GaiaRecord[];
+
+    if (this.catalog) {
+      const rows = this.catalog.boxSearch(
+        raMin,
+        raMax,
+        decMin,
+        decMax,
+        magnitudeToFluxRange(
+          this.options.magnitudeLimit,
+          this.options.zeropoints[0],
+        ),
+      );
+      try {
+        this.catalog.filterRows(rows, filter);
+        results = this.catalog.readRecords(rows, columns);
+      } finally {
+        rows.free();
+      }
+    } else {
+      results = this.db.boxSearch(
+        raMin,
+        raMax,
+        decMin,
+        decMax,
+        this.options.magnitudeLimit,
+        this.options.tmassCrossmatch,
+        columns,
+        filter,
+      );
+    }
+
     if (this.options.limit > 0) {
       results = results.slice(0, this.options.limit);
     }
 
-    // Convert photometry if needed
     return this.cleanDataFrame(results);
   }
 
   /**
-   * Search for all targets within a brightness limit
+   * Select every star inside a convex polygon of [ra, dec] vertices in
+   * degrees, listed in either winding order
    */
-  brightnessLimitSearch(magnitudeLimit: [number, number]): GaiaRecord[] {
-    // This would require a full table scan, so we'll use the cone search
-    // with a very large radius as a proxy
-    const results = this.db.coneSearch(
-      0,
-      0,
-      180,
-      magnitudeLimit,
-      this.options.tmassCrossmatch,
-    );
+  polygonSearch(vertices: [number, number][]): GaiaRecord[] {
+    this.requireCatalogEpoch("polygonSearch");
+    const { columns } = this.projection();
+    const filter = this.compiledFilter();
+    let results: GaiaRecord[];
+
+    if (this.catalog) {
+      const rows = this.catalog.polygonSearch(
+        vertices,
+        magnitudeToFluxRange(
+          this.options.magnitudeLimit,
+          this.options.zeropoints[0],
+        ),
+      );
+      try {
+        this.catalog.filterRows(rows, filter);
+        results = this.catalog.readRecords(rows, columns);
+      } finally {
+        rows.free();
+      }
+    } else {
+      results = this.db.polygonSearch(
+        vertices,
+        this.options.magnitudeLimit,
+        this.options.tmassCrossmatch,
+        columns,
+        filter,
+      );
+    }
 
     if (this.options.limit > 0) {
-      return this.cleanDataFrame(results.slice(0, this.options.limit));
+      results = results.slice(0, this.options.limit);
     }
 
     return this.cleanDataFrame(results);
   }
 
   /**
-   * Convert flux to magnitude or vice versa based on user preferences
+   * Select every star within `radius` parsecs of a point in space, using
+   * parallax distances, nearest first. Records gain `distance_pc` (from
+   * the Sun) and `separation_pc` (from the center).
    */
-  private cleanDataFrame(records: GaiaRecord[]): GaiaRecord[] {
-    if (this.options.photometryOutput === "magnitude") {
-      return records.map((record) => {
-        const cleaned = { ...record };
-
-        // Handle Gaia photometry
-        const bands = [
-          { flux: "phot_g_mean_flux", mag: "phot_g_mean_mag", zp: 0 },
-          { flux: "phot_bp_mean_flux", mag: "phot_bp_mean_mag", zp: 1 },
-          { flux: "phot_rp_mean_flux", mag: "phot_rp_mean_mag", zp: 2 },
-        ];
-
-        for (const band of bands) {
-          const flux = record[band.flux] as number;
-          if (flux && flux > 0) {
-            const zeropoint = this.options.zeropoints[band.zp];
-            cleaned[band.mag] = zeropoint - 2.5 * Math.log10(flux);
-
-            // Calculate magnitude error if flux error exists
-            const fluxError = record[`${band.flux}_error`] as number;
-            if (fluxError) {
-              cleaned[`${band.mag}_error`] = (2.5 / Math.log(10)) *
-                (fluxError / flux);
-              delete cleaned[`${band.flux}_error`];
-            }
+  sphereSearch(center: SpaceCenter, radius: number): GaiaRecord[] {
+    this.requireCatalogEpoch("sphereSearch");
+    const point = this.spacePoint(center);
+    const { columns, extras } = this.projection(["ra", "dec", "parallax"]);
+    const filter = this.compiledFilter();
+    let results: GaiaRecord[];
 
-            delete cleaned[band.flux];
-          }
+    if (this.catalog) {
+      const rows = this.catalog.sphereSearch(
+        point,
+        radius,
+        this.options.minParallaxOverError,
+        magnitudeToFluxRange(
+          this.options.magnitudeLimit,
+          this.options.zeropoints[0],
+        ),
+      );
+      try {
+        this.catalog.filterRows(rows, filter);
+        results = this.catalog.readRecords(rows, columns);
+      } finally {
+        rows.free();
+      }
+    } else {
+      results = this.db.sphereSearch(
+        point,
+        radius,
+        this.options.minParallaxOverError,
+        this.options.magnitudeLimit,
+        this.options.tmassCrossmatch,
+        columns,
+        filter,
+      );
+    }
+
+    results = this.addSpaceSeparation(results, point).sort((a, b) =>
+      (a.separation_pc as number) - (b.separation_pc as number)
+    );
+
+    if (this.options.limit > 0) {
+      results = results.slice(0, this.options.limit);
+    }
+
+    return this.cleanDataFrame(results, extras);
+  }
+
+  /**
+   * Find the `k` stars closest in space to a point, nearest first, with
+   * `distance_pc` and `separation_pc` added as in sphereSearch
+   */
+  nearestInSpace(center: SpaceCenter, k: number): GaiaRecord[] {
+    this.requireCatalogEpoch("nearestInSpace");
+    const point = this.spacePoint(center);
+    const { columns, extras } = this.projection(["ra", "dec", "parallax"]);
+    const filter = this.compiledFilter();
+    const fluxRange = magnitudeToFluxRange(
+      this.options.magnitudeLimit,
+      this.options.zeropoints[0],
+    );
+    let results: GaiaRecord[];
+
+    if (this.catalog && filter.length) {
+      return this.cleanDataFrame(
+        this.filteredNearestInSpace(
+          this.catalog,
+          point,
+          k,
+          fluxRange,
+          columns,
+          filter,
+        ),
+        extras,
+      );
+    } else if (this.catalog) {
+      const rows = this.catalog.nearestInSpace(
+        point,
+        k,
+        this.options.minParallaxOverError,
+        fluxRange,
+      );
+      try {
+        results = this.catalog.readRecords(rows, columns);
+      } finally {
+        rows.free();
+      }
+    } else {
+      results = this.db.nearestInSpace(
+        point,
+        k,
+        this.options.minParallaxOverError,
+        this.options.magnitudeLimit,
+        this.options.tmassCrossmatch,
+        columns,
+        filter,
+      );
+    }
+
+    return this.cleanDataFrame(
+      this.addSpaceSeparation(results, point),
+      extras,
+    );
+  }
+
+  /**
+   * The `k` stars nearest in space passing a filter, with separations
+   * added: filtered spheres with a growing radius as in SQL
+   */
+  private filteredNearestInSpace(
+    catalog: NativeCatalog,
+    point: [number, number, number],
+    k: number,
+    fluxRange: [number, number],
+    columns: string[] | undefined,
+    filter: FilterTerm[],
+  ): GaiaRecord[] {
+    if (k <= 0) return [];
+
+    let radius = 10;
+    while (true) {
+      const rows = catalog.sphereSearch(
+        point,
+        radius,
+        this.options.minParallaxOverError,
+        fluxRange,
+      );
+      try {
+        catalog.filterRows(rows, filter);
+        if (rows.count >= k || radius >= 1e6) {
+          const records = catalog.readRecords(rows, columns);
+          return this.addSpaceSeparation(records, point)
+            .sort((a, b) =>
+              (a.separation_pc as number) - (b.separation_pc as number)
+            )
+            .slice(0, k);
         }
+      } finally {
+        rows.free();
+      }
+      radius *= 4;
+    }
+  }
 
-        // 2MASS magnitudes are already in magnitude format, just ensure they're numeric
-        if (this.options.tmassCrossmatch) {
-          if (cleaned.j_m !== null && cleaned.j_m !== undefined) {
-            cleaned.j_m = Number(cleaned.j_m);
-          }
-          if (cleaned.h_m !== null && cleaned.h_m !== undefined) {
-            cleaned.h_m = Number(cleaned.h_m);
-          }
-          if (cleaned.k_m !== null && cleaned.k_m !== undefined) {
-            cleaned.k_m = Number(cleaned.k_m);
-          }
+  /**
+   * Heliocentric Cartesian position in parsecs of a 3D query center
+   */
+  private spacePoint(center: SpaceCenter): [number, number, number] {
+    if (!("sourceId" in center)) {
+      const [x, y, z] = radecToVector(center.ra, center.dec);
+      return [x * center.distance, y * center.distance, z * center.distance];
+    }
+
+    let source: { ra: number; dec: number; parallax: number | null } | null;
+    if (this.catalog) {
+      const row = this.catalog.findSource(BigInt(center.sourceId));
+      source = null;
+      if (row !== null) {
+        const rows = RowSet.fromRows(BigUint64Array.of(BigInt(row)));
+        try {
+          const [record] = this.catalog.readRecords(rows, [
+            "ra",
+            "dec",
+            "parallax",
+          ]);
+          source = {
+            ra: record.ra,
+            dec: record.dec,
+            parallax: record.parallax as number | null,
+          };
+        } finally {
+          rows.free();
         }
+      }
+    } else {
+      source = this.db.getSourcePosition(center.sourceId);
+    }
+
+    if (!source) {
+      throw new Error(`Source ${center.sourceId} not found`);
+    }
+    if (source.parallax === null || !(source.parallax > 0)) {
+      throw new Error(`Source ${center.sourceId} has no positive parallax`);
+    }
+    return parallaxToCartesian(source.ra, source.dec, source.parallax);
+  }
+
+  /**
+   * Add `distance_pc` and `separation_pc` from `point` to each record
+   */
+  private addSpaceSeparation(
+    records: GaiaRecord[],
+    point: [number, number, number],
+  ): GaiaRecord[] {
+    for (const record of records) {
+      const [x, y, z] = parallaxToCartesian(
+        record.ra,
+        record.dec,
+        record.parallax as number,
+      );
+      record.distance_pc = 1000 / (record.parallax as number);
+      record.separation_pc = Math.hypot(
+        x - point[0],
+        y - point[1],
+        z - point[2],
+      );
+    }
+    return records;
+  }
 
-        return cleaned;
+  /**
+   * Search for all targets within a brightness limit across the whole
+   * sky, brightest first. Walks a flux-ordered index (the SQLite flux
+   * index or the catalog's flux rank), so only qualifying rows are read.
+   */
+  brightnessLimitSearch(magnitudeLimit: [number, number]): GaiaRecord[] {
+    this.requireCatalogEpoch("brightnessLimitSearch");
+    const { columns } = this.projection();
+    const filter = this.compiledFilter();
+    const limit = this.options.limit;
+    let results: GaiaRecord[];
+
+    if (this.catalog) {
+      // Filtered rows can't stop the rank walk early
+      const rows = this.catalog.brightnessSearch(
+        magnitudeToFluxRange(magnitudeLimit, this.options.zeropoints[0]),
+        filter.length ? 0 : limit,
+      );
+      try {
+        this.catalog.filterRows(rows, filter);
+        results = this.catalog.readRecords(rows, columns);
+      } finally {
+        rows.free();
+      }
+      if (limit > 0) {
+        results = results.slice(0, limit);
+      }
+    } else {
+      results = this.db.brightnessSearch(
+        magnitudeLimit,
+        this.options.tmassCrossmatch,
+        limit,
+        columns,
+        filter,
+      );
+    }
+
+    return this.cleanDataFrame(results);
+  }
+
+  /**
+   * Number of stars in a cone, after the magnitude limit and filter,
+   * counted without reading the stars out
+   */
+  coneCount(ra: number, dec: number, radius: number): number {
+    this.requireCatalogEpoch("Aggregates");
+    if (this.catalog && !this.compiledFilter().length) {
+      return this.catalog.coneCount(
+        ra,
+        dec,
+        radius,
+        magnitudeToFluxRange(
+          this.options.magnitudeLimit,
+          this.options.zeropoints[0],
+        ),
+      );
+    }
+    return this.coneAggregate(ra, dec, radius, []).count;
+  }
+
+  /**
+   * Smallest and largest value of a column (or derived magnitude, colour
+   * or parallax_over_error) over the stars in a cone that have one
+   */
+  coneRange(
+    ra: number,
+    dec: number,
+    radius: number,
+    column: GaiaColumn,
+  ): { count: number; min: number; max: number } {
+    const { count, min, max } = this.coneAggregate(ra, dec, radius, [
+      { column, min: NaN, max: NaN, bins: 0 },
+    ]);
+    return { count, min: min[0], max: max[0] };
+  }
+
+  /**
+   * Histogram of a column over the stars in a cone, e.g. G magnitude or
+   * bp_rp. `edges` has one more entry than `counts`.
+   */
+  coneHistogram(
+    ra: number,
+    dec: number,
+    radius: number,
+    axis: HistogramAxis,
+  ): { edges: number[]; counts: number[] } {
+    const edges = binEdges(axis);
+    const { counts } = this.coneAggregate(ra, dec, radius, [axis]);
+    return { edges, counts };
+  }
+
+  /**
+   * 2D histogram over the stars in a cone, e.g. a colour-magnitude
+   * diagram with x = bp_rp and y = phot_g_mean_mag. `counts[i][j]` is x
+   * bin i and y bin j.
+   */
+  coneHistogram2D(
+    ra: number,
+    dec: number,
+    radius: number,
+    x: HistogramAxis,
+    y: HistogramAxis,
+  ): { xEdges: number[]; yEdges: number[]; counts: number[][] } {
+    const xEdges = binEdges(x);
+    const yEdges = binEdges(y);
+    const { counts } = this.coneAggregate(ra, dec, radius, [x, y]);
+    return {
+      xEdges,
+      yEdges,
+      counts: Array.from(
+        { length: x.bins },
+        (_, i) => counts.slice(i * y.bins, (i + 1) * y.bins),
+      ),
+    };
+  }
+
+  /**
+   * Throw for an epoch option in queries that only run on catalog
+   * (2016.0) positions, rather than silently ignoring it
+   */
+  private requireCatalogEpoch(query: string): void {
+    if (this.options.epoch !== GAIA_DR3_EPOCH) {
+      throw new Error(
+        `${query} uses Gaia DR3 epoch ${GAIA_DR3_EPOCH} positions; unset epoch (only cone searches propagate to ${this.options.epoch})`,
+      );
+    }
+  }
+
+  /**
+   * Aggregate the stars of a cone over `axes`, natively over the row set
+   * or in SQL, so only the summary leaves the query engine. Membership
+   * uses catalog positions, so the epoch option must be unset.
+   */
+  private coneAggregate(
+    ra: number,
+    dec: number,
+    radius: number,
+    axes: HistogramAxis[],
+  ): AggregateResult {
+    this.requireCatalogEpoch("Aggregates");
+
+    const filter = this.compiledFilter();
+    const terms = aggregateTerms(
+      axes,
+      this.readableColumns(),
+      this.options.zeropoints,
+    );
+
+    if (!this.catalog) {
+      return this.db.coneAggregate(
+        ra,
+        dec,
+        radius,
+        terms,
+        this.options.magnitudeLimit,
+        filter,
+      );
+    }
+
+    const rows = this.catalog.coneSearch(
+      ra,
+      dec,
+      radius,
+      magnitudeToFluxRange(
+        this.options.magnitudeLimit,
+        this.options.zeropoints[0],
+      ),
+    );
+    try {
+      this.catalog.filterRows(rows, filter);
+      return this.catalog.aggregate(rows, terms);
+    } finally {
+      rows.free();
+    }
+  }
+
+  /**
+   * The `filter` option compiled against the stored columns, plus the
+   * random_index cut of a `sample` fraction
+   */
+  private compiledFilter(sample = this.options.sample): FilterTerm[] {
+    const stored = this.readableColumns();
+    const terms = filterTerms(
+      this.options.filter,
+      stored,
+      this.options.zeropoints,
+    );
+
+    if (sample >= 1) {
+      throw new Error(
+        "A sample count is only supported by coneSearch; use a fraction below 1",
+      );
+    }
+    if (sample > 0) {
+      if (!stored.includes("random_index")) {
+        throw new Error(
+          "Sampling requires random_index; populate with it in --columns",
+        );
+      }
+      // random_index permutes the DR3 sources, so a cut on it keeps a
+      // uniform random fraction of any region
+      terms.push({
+        column: "random_index",
+        min: 0,
+        max: Math.ceil(sample * GAIA_DR3_SOURCES) - 1,
       });
     }
+    return terms;
+  }
 
-    if (this.options.photometryOutput === "flux") {
-      // Convert 2MASS magnitudes to flux if needed
-      if (this.options.tmassCrossmatch) {
-        return records.map((record) => {
-          const cleaned = { ...record };
+  /**
+   * Stored columns queries use as they are: magnitudes stored with other
+   * zeropoints than the configured ones are left out, so cuts and
+   * aggregates derive them from the fluxes like unstored magnitudes
+   */
+  private readableColumns(): string[] {
+    const stale = this.db.staleMagnitudes();
+    const stored = this.catalog?.columns ?? this.db.getGaiaColumns();
+    return stale.size
+      ? stored.filter((column) => !stale.has(column))
+      : stored;
+  }
+
+  /**
+   * Stored columns to read for the `columns` option, plus `required` ones
+   * the query needs itself, which come back as `extras` to drop later.
+   * Without a `columns` option everything is read.
+   */
+  private projection(
+    required: string[] = [],
+  ): { columns?: string[]; extras: string[] } {
+    if (!this.options.columns.length) {
+      return { extras: [] };
+    }
 
-          if (cleaned.j_m !== null && cleaned.j_m !== undefined) {
-            const jMag = Number(cleaned.j_m);
-            cleaned.j_flux = 10 ** (-0.4 * (jMag - tmassZeropoints.j));
-            delete cleaned.j_m;
+    const stored = this.catalog?.columns ?? this.db.getGaiaColumns();
+    const columns = new Set<string>();
+    for (const column of this.options.columns) {
+      // Magnitudes are derived from the flux when only that is stored
+      const flux = column.replace(/_mag(_error)?$/, "_flux$1");
+      if (!stored.includes(column) && stored.includes(flux)) {
+        columns.add(flux);
+      } else {
+        columns.add(column);
+      }
+    }
+
+    const extras = required.filter((column) => !columns.has(column));
+    for (const column of extras) {
+      columns.add(column);
+    }
+    return { columns: [...columns], extras };
+  }
+
+  /**
+   * Convert flux to magnitude or vice versa based on user preferences,
+   * dropping `extras` read only for the query itself. Records fresh from
+   * the query are updated in place, and frozen ones shared with the pixel
+   * cache are copied first. Each band is converted
+   * for the whole batch at once by the native photometry kernel.
+   */
+  private cleanDataFrame(
+    records: GaiaRecord[],
+    extras: string[] = [],
+  ): GaiaRecord[] {
+    const magnitudes = this.options.photometryOutput === "magnitude";
+    const tmass = this.options.tmassCrossmatch;
+    const stale = [...this.db.staleMagnitudes()]
+      .filter(([column]) => column in (records[0] ?? {}));
+    if (
+      !records.length ||
+      (!extras.length && !magnitudes && !tmass && !stale.length)
+    ) {
+      return records;
+    }
+    // Records shared with the pixel cache are changed on copies
+    if (Object.isFrozen(records[0])) {
+      records = records.map((record) => ({ ...record }));
+    }
+
+    // Magnitudes stored with other zeropoints differ by a constant
+    for (const [column, offset] of stale) {
+      for (const record of records) {
+        if (record[column] !== null) {
+          record[column] = (record[column] as number) + offset;
+        }
+      }
+    }
+
+    for (const record of records) {
+      for (const column of extras) {
+        delete record[column];
+      }
+    }
+
+    if (magnitudes) {
+      // Handle Gaia photometry
+      for (const band of gaiaBands) {
+        if (!(band.flux in records[0])) continue;
+
+        // Magnitudes stored at ingest need no conversion
+        const errorColumn = `${band.flux}_error`;
+        if (band.mag in records[0] && !(errorColumn in records[0])) {
+          for (const record of records) {
+            if (record[band.mag] !== null) delete record[band.flux];
           }
+          continue;
+        }
 
-          if (cleaned.h_m !== null && cleaned.h_m !== undefined) {
-            const hMag = Number(cleaned.h_m);
-            cleaned.h_flux = 10 ** (-0.4 * (hMag - tmassZeropoints.h));
-            delete cleaned.h_m;
+        const flux = numericColumn(records, band.flux);
+        const { mag, magError } = fluxToMagnitude(
+          flux,
+          this.options.zeropoints[band.zp],
+          errorColumn in records[0]
+            ? numericColumn(records, errorColumn)
+            : undefined,
+        );
+
+        records.forEach((record, i) => {
+          if (!(flux[i] > 0)) return;
+          record[band.mag] = mag[i];
+
+          // Calculate magnitude error if flux error exists
+          if (magError && record[errorColumn]) {
+            record[`${band.mag}_error`] = magError[i];
+            delete record[errorColumn];
           }
 
-          if (cleaned.k_m !== null && cleaned.k_m !== undefined) {
-            const kMag = Number(cleaned.k_m);
-            cleaned.k_flux = 10 ** (-0.4 * (kMag - tmassZeropoints.k));
-            delete cleaned.k_m;
+          delete record[band.flux];
+        });
+      }
+
+      // 2MASS magnitudes are already in magnitude format, just ensure they're numeric
+      if (tmass) {
+        for (const record of records) {
+          for (const column of ["j_m", "h_m", "k_m"]) {
+            if (record[column] !== null && record[column] !== undefined) {
+              record[column] = Number(record[column]);
+            }
           }
+        }
+      }
+    } else if (tmass) {
+      // Convert 2MASS magnitudes to flux
+      for (const band of ["j", "h", "k"] as const) {
+        const column = `${band}_m`;
+        const flux = magnitudeToFlux(
+          numericColumn(records, column),
+          tmassZeropoints[band],
+        );
 
-          return cleaned;
+        records.forEach((record, i) => {
+          if (record[column] === null || record[column] === undefined) return;
+          record[`${band}_flux`] = flux[i];
+          delete record[column];
         });
       }
     }
@@ -209,14 +1649,75 @@ export class Gaia {
     return records;
   }
 
+  /**
+   * cleanDataFrame over whole columns: drops `extras` and converts flux to
+   * magnitude (or 2MASS magnitudes to flux) one column at a time. A
+   * magnitude is null where its flux is missing or not positive.
+   */
+  private cleanColumns(
+    result: ColumnarResult,
+    extras: string[] = [],
+  ): ColumnarResult {
+    for (const column of extras) {
+      result.deleteColumn(column);
+    }
+    for (const [column, offset] of this.db.staleMagnitudes()) {
+      if (result.has(column)) {
+        result.setColumn(
+          column,
+          result.column(column).map((value) => value + offset),
+        );
+      }
+    }
+
+    if (this.options.photometryOutput === "magnitude") {
+      for (const band of gaiaBands) {
+        if (!result.has(band.flux)) continue;
+
+        const errorColumn = `${band.flux}_error`;
+        if (result.has(band.mag) && !result.has(errorColumn)) {
+          result.deleteColumn(band.flux);
+          continue;
+        }
+
+        const { mag, magError } = fluxToMagnitude(
+          result.column(band.flux),
+          this.options.zeropoints[band.zp],
+          result.has(errorColumn) ? result.column(errorColumn) : undefined,
+        );
+        result.setColumn(band.mag, mag);
+        if (magError) {
+          result.setColumn(`${band.mag}_error`, magError);
+          result.deleteColumn(errorColumn);
+        }
+        result.deleteColumn(band.flux);
+      }
+    } else if (this.options.tmassCrossmatch) {
+      for (const band of ["j", "h", "k"] as const) {
+        if (!result.has(`${band}_m`)) continue;
+
+        result.setColumn(
+          `${band}_flux`,
+          magnitudeToFlux(result.column(`${band}_m`), tmassZeropoints[band]),
+        );
+        result.deleteColumn(`${band}_m`);
+      }
+    }
+
+    return result;
+  }
+
   /**
    * Get database statistics
    */
   getStats(): {
     totalRecords: number;
+    tiers: { limit: number; count: number }[];
+    cache: CacheStats | null;
     trackingProgress: { [key: string]: TrackingProgress | null };
   } {
     const totalRecords = this.db.getRecordCount();
+    const tiers = this.db.getTierCounts();
 
     const trackingTables = [
       "file_tracking_gaiadr3",
@@ -237,6 +1738,8 @@ export class Gaia {
 
     return {
       totalRecords,
+      tiers,
+      cache: this.cache?.stats() ?? null,
       trackingProgress,
     };
   }
@@ -266,6 +1769,7 @@ export class Gaia {
    * Close database connection
    */
   close(): void {
+    this.catalog?.close();
     this.db.close();
   }
 }
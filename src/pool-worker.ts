@@ -0,0 +1,58 @@
+/// <reference no-default-lib="true" />
+/// <reference lib="deno.worker" />
+
+/**
+ * GaiaPool worker: holds one read-only Gaia instance and answers query
+ * messages from the pool in order
+ */
+
+import { Gaia } from "./gaia.ts";
+import type { PoolRequest, PoolResponse } from "./pool.ts";
+
+let gaia: Gaia | null = null;
+
+self.onmessage = (event: MessageEvent<PoolRequest>) => {
+  const request = event.data;
+  let response: PoolResponse;
+
+  try {
+    if (request.type === "open") {
+      gaia = new Gaia({ ...request.options, readOnly: true });
+      response = { id: request.id, result: null };
+    } else if (request.type === "close") {
+      gaia?.close();
+      gaia = null;
+      response = { id: request.id, result: null };
+    } else {
+      if (!gaia) {
+        throw new Error("Pool worker has no open database");
+      }
+      const method = gaia[request.method] as unknown as (
+        ...args: unknown[]
+      ) => unknown;
+      response = {
+        id: request.id,
+        result: method.apply(gaia, request.args),
+      };
+    }
+  } catch (error) {
+    response = {
+      id: request.id,
+      error: error instanceof Error ? error.message : String(error),
+    };
+  }
+
+  try {
+    self.postMessage(response);
+  } catch (error) {
+    // A result structured clone can't copy must not kill the worker
+    self.postMessage({
+      id: request.id,
+      error: `Result of ${
+        request.type === "query" ? request.method : request.type
+      } could not be sent: ${
+        error instanceof Error ? error.message : String(error)
+      }`,
+    } satisfies PoolResponse);
+  }
+};
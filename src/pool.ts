@@ -0,0 +1,233 @@
+import type { ConeTarget } from "./types.ts";
+import type { GaiaRecord } from "./database.ts";
+import type { Gaia, GaiaOptions } from "./gaia.ts";
+
+/**
+ * Gaia query methods a GaiaPool can run. Their arguments and results are
+ * plain data, so they cross to and from the workers by structured clone.
+ */
+export type PoolMethod =
+  | "coneSearch"
+  | "coneSearchBatch"
+  | "nearest"
+  | "boxSearch"
+  | "polygonSearch"
+  | "sphereSearch"
+  | "nearestInSpace"
+  | "brightnessLimitSearch"
+  | "coneCount"
+  | "coneRange"
+  | "coneHistogram"
+  | "coneHistogram2D"
+  | "getStats";
+
+type PoolMessage =
+  | { type: "open"; options: GaiaOptions }
+  | { type: "close" }
+  | { type: "query"; method: PoolMethod; args: unknown[] };
+
+/** Message from a GaiaPool to a worker */
+export type PoolRequest = PoolMessage & { id: number };
+
+/** Reply of a worker to a PoolRequest with the same id */
+export type PoolResponse =
+  | { id: number; result: unknown }
+  | { id: number; error: string };
+
+export type GaiaPoolOptions = GaiaOptions & {
+  /**
+   * Number of worker threads, each with its own read-only connection
+   * (and native catalog handle with the native backend)
+   * @default navigator.hardwareConcurrency
+   */
+  workers?: number;
+};
+
+type PendingQuery = {
+  worker: number;
+  resolve: (result: unknown) => void;
+  reject: (error: Error) => void;
+};
+
+/**
+ * Pool of Deno Workers, each holding a read-only Gaia instance, so
+ * queries run concurrently across cores instead of serializing on one
+ * connection. Queries are dispatched round-robin and return Promises.
+ * Readers share the OS page cache through mmap; with `immutable` they
+ * also skip SQLite's file locks.
+ */
+export class GaiaPool {
+  readonly size: number;
+  private workers: Worker[] = [];
+  /** Workers that failed, skipped by query() */
+  private dead = new Set<number>();
+  private pending = new Map<number, PendingQuery>();
+  private opened: Promise<void>;
+  private nextWorker = 0;
+  private nextId = 1;
+  private closed = false;
+
+  constructor(options: GaiaPoolOptions = {}) {
+    const { workers = navigator.hardwareConcurrency, ...gaiaOptions } =
+      options;
+    if (!Number.isInteger(workers) || workers < 1) {
+      throw new Error(`Invalid worker count: ${workers}. Must be at least 1.`);
+    }
+    this.size = workers;
+
+    for (let i = 0; i < workers; i++) {
+      const worker = new Worker(
+        new URL("./pool-worker.ts", import.meta.url).href,
+        { type: "module" },
+      );
+      worker.onmessage = (event: MessageEvent<PoolResponse>) =>
+        this.settle(event.data);
+      worker.onerror = (event: ErrorEvent) => {
+        event.preventDefault();
+        this.failWorker(i, new Error(`Pool worker ${i}: ${event.message}`));
+      };
+      this.workers.push(worker);
+    }
+
+    this.opened = Promise.all(
+      this.workers.map((_, i) =>
+        this.send(i, { type: "open", options: gaiaOptions })
+      ),
+    ).then(() => undefined);
+    // Surfaced by the first query; close() must not throw on it
+    this.opened.catch(() => {});
+  }
+
+  /**
+   * Resolve once every worker has opened its database, or reject with the
+   * first worker's failure to
+   */
+  ready(): Promise<void> {
+    return this.opened;
+  }
+
+  /**
+   * Run a Gaia query method on the next live worker in turn
+   */
+  async query<M extends PoolMethod>(
+    method: M,
+    ...args: Parameters<Gaia[M]>
+  ): Promise<ReturnType<Gaia[M]>> {
+    if (this.closed) {
+      throw new Error("GaiaPool is closed");
+    }
+    await this.opened;
+
+    if (this.dead.size === this.size) {
+      throw new Error("Every GaiaPool worker has failed");
+    }
+    let worker = this.nextWorker;
+    while (this.dead.has(worker)) {
+      worker = (worker + 1) % this.size;
+    }
+    this.nextWorker = (worker + 1) % this.size;
+    return await this.send(worker, {
+      type: "query",
+      method,
+      args,
+    }) as ReturnType<Gaia[M]>;
+  }
+
+  /**
+   * Cone search on the next worker, as Gaia.coneSearch
+   */
+  coneSearch(ra: number, dec: number, radius: number): Promise<GaiaRecord[]> {
+    return this.query("coneSearch", ra, dec, radius);
+  }
+
+  /**
+   * Cone searches of many targets on the next worker, as
+   * Gaia.coneSearchBatch; spread targets over several calls to use
+   * several workers
+   */
+  coneSearchBatch(
+    targets: ConeTarget[],
+    threads?: number,
+  ): Promise<GaiaRecord[][]> {
+    return this.query("coneSearchBatch", targets, threads);
+  }
+
+  /**
+   * The k nearest stars to a position on the next worker, as Gaia.nearest
+   */
+  nearest(ra: number, dec: number, k: number): Promise<GaiaRecord[]> {
+    return this.query("nearest", ra, dec, k);
+  }
+
+  /**
+   * Number of queries sent to the workers and not yet answered
+   */
+  get inFlight(): number {
+    return this.pending.size;
+  }
+
+  /**
+   * Close every worker's connection and stop the workers. Queries still
+   * running are rejected.
+   */
+  async close(): Promise<void> {
+    if (this.closed) return;
+    this.closed = true;
+
+    await this.opened.catch(() => {});
+    // Failed workers are already stopped and would never answer
+    await Promise.allSettled(
+      this.workers.map((_, i) =>
+        this.dead.has(i) ? undefined : this.send(i, { type: "close" })
+      ),
+    );
+    for (const [id, query] of this.pending) {
+      query.reject(new Error("GaiaPool is closed"));
+      this.pending.delete(id);
+    }
+    for (const worker of this.workers) {
+      worker.terminate();
+    }
+  }
+
+  /**
+   * Post a request to a worker, resolving with its reply
+   */
+  private send(worker: number, message: PoolMessage): Promise<unknown> {
+    const id = this.nextId++;
+    return new Promise((resolve, reject) => {
+      this.pending.set(id, { worker, resolve, reject });
+      this.workers[worker].postMessage({ ...message, id } as PoolRequest);
+    });
+  }
+
+  /**
+   * Resolve or reject the query a worker replied to
+   */
+  private settle(response: PoolResponse): void {
+    const query = this.pending.get(response.id);
+    if (!query) return;
+    this.pending.delete(response.id);
+
+    if ("error" in response) {
+      query.reject(new Error(response.error));
+    } else {
+      query.resolve(response.result);
+    }
+  }
+
+  /**
+   * Take a failed worker out of the rotation, stopping it, and reject
+   * every query waiting on it
+   */
+  private failWorker(worker: number, error: Error): void {
+    this.dead.add(worker);
+    this.workers[worker].terminate();
+    for (const [id, query] of this.pending) {
+      if (query.worker === worker) {
+        query.reject(error);
+        this.pending.delete(id);
+      }
+    }
+  }
+}
@@ -0,0 +1,235 @@
+import type { ConeTarget, HistogramAxis } from "./types.ts";
+import type { GaiaPool } from "./pool.ts";
+
+/**
+ * A query to the `serve` daemon, one JSON object per line
+ */
+export type ServeQuery =
+  | { op: "cone"; ra: number; dec: number; radius: number }
+  | { op: "batch"; targets: ConeTarget[] }
+  | { op: "nearest"; ra: number; dec: number; k: number }
+  | { op: "count"; ra: number; dec: number; radius: number }
+  | {
+    op: "histogram";
+    ra: number;
+    dec: number;
+    radius: number;
+    axes: HistogramAxis[];
+  }
+  | { op: "stats" };
+
+/** A ServeQuery with an optional id, echoed back in its response */
+export type ServeRequest = ServeQuery & { id?: string | number };
+
+/**
+ * Answer to one request line: `results` as the matching Gaia method
+ * returns them, or the error message
+ */
+export type ServeResponse =
+  | { id?: string | number; results: unknown }
+  | { id?: string | number; error: string };
+
+const encoder = new TextEncoder();
+
+/**
+ * Run one request on the pool
+ */
+export function runQuery(
+  pool: GaiaPool,
+  request: ServeRequest,
+): Promise<unknown> {
+  switch (request.op) {
+    case "cone":
+      return pool.coneSearch(
+        number(request, "ra"),
+        number(request, "dec"),
+        number(request, "radius"),
+      );
+    case "batch":
+      if (!Array.isArray(request.targets)) {
+        throw new Error("batch needs a targets array of {ra, dec, radius}");
+      }
+      // One thread per batch: concurrent requests spread over the workers
+      return pool.coneSearchBatch(request.targets, 1);
+    case "nearest":
+      return pool.nearest(
+        number(request, "ra"),
+        number(request, "dec"),
+        number(request, "k"),
+      );
+    case "count":
+      return pool.query(
+        "coneCount",
+        number(request, "ra"),
+        number(request, "dec"),
+        number(request, "radius"),
+      );
+    case "histogram": {
+      const [x, y] = Array.isArray(request.axes) ? request.axes : [];
+      const cone = [
+        number(request, "ra"),
+        number(request, "dec"),
+        number(request, "radius"),
+      ] as const;
+      if (!x || request.axes.length > 2) {
+        throw new Error("histogram needs one or two axes");
+      }
+      return y
+        ? pool.query("coneHistogram2D", ...cone, x, y)
+        : pool.query("coneHistogram", ...cone, x);
+    }
+    case "stats":
+      return pool.query("getStats");
+    default:
+      throw new Error(
+        `Unknown op: ${(request as { op?: unknown }).op}. Must be cone, batch, nearest, count, histogram or stats.`,
+      );
+  }
+}
+
+/**
+ * Parse and run one request line, catching every error into the response
+ */
+async function respond(pool: GaiaPool, line: string): Promise<ServeResponse> {
+  let id: string | number | undefined;
+  try {
+    const request = JSON.parse(line) as ServeRequest;
+    id = request.id;
+    return { id, results: await runQuery(pool, request) };
+  } catch (error) {
+    const message = error instanceof Error ? error.message : String(error);
+    return { id, error: message };
+  }
+}
+
+/**
+ * Lines of a byte stream, without their line endings
+ */
+export async function* readLines(
+  readable: ReadableStream<Uint8Array>,
+): AsyncGenerator<string> {
+  let buffered = "";
+  for await (const text of readable.pipeThrough(new TextDecoderStream())) {
+    buffered += text;
+    let end;
+    while ((end = buffered.indexOf("\n")) >= 0) {
+      yield buffered.slice(0, end).replace(/\r$/, "");
+      buffered = buffered.slice(end + 1);
+    }
+  }
+  if (buffered) yield buffered;
+}
+
+/**
+ * Answer NDJSON requests on a Unix domain socket until `signal` aborts.
+ * A connection may send many requests without waiting; each response is
+ * written as soon as its query finishes, so clients match them by id.
+ */
+export async function serveUnix(
+  pool: GaiaPool,
+  path: string,
+  signal?: AbortSignal,
+): Promise<void> {
+  // Replace a socket left behind by a previous server, but nothing else
+  try {
+    if (!Deno.lstatSync(path).isSocket) {
+      throw new Error(`${path} exists and is not a socket`);
+    }
+    Deno.removeSync(path);
+  } catch (error) {
+    if (!(error instanceof Deno.errors.NotFound)) throw error;
+  }
+
+  const listener = Deno.listen({ transport: "unix", path });
+  signal?.addEventListener("abort", () => listener.close(), { once: true });
+
+  try {
+    for await (const conn of listener) {
+      serveConnection(pool, conn).catch(() => {
+        try {
+          conn.close();
+        } catch {
+          // Already closed
+        }
+      });
+    }
+  } catch (error) {
+    if (!signal?.aborted) throw error;
+  } finally {
+    try {
+      Deno.removeSync(path);
+    } catch {
+      // Already gone
+    }
+  }
+}
+
+/**
+ * Answer the request lines of one socket connection until it closes
+ */
+async function serveConnection(
+  pool: GaiaPool,
+  conn: Deno.Conn,
+): Promise<void> {
+  const writer = conn.writable.getWriter();
+  let written = Promise.resolve();
+  const answers: Promise<void>[] = [];
+
+  for await (const line of readLines(conn.readable)) {
+    if (!line.trim()) continue;
+    answers.push(
+      respond(pool, line).then((response) => {
+        written = written.then(() =>
+          writer.write(encoder.encode(JSON.stringify(response) + "\n"))
+        );
+        return written;
+      }),
+    );
+  }
+
+  await Promise.allSettled(answers);
+  conn.close();
+}
+
+/**
+ * Answer NDJSON requests POSTed to http://127.0.0.1:`port`/, one response
+ * line per request line in the same order
+ */
+export function serveHttp(
+  pool: GaiaPool,
+  port: number,
+  signal?: AbortSignal,
+): Deno.HttpServer<Deno.NetAddr> {
+  return Deno.serve(
+    { hostname: "127.0.0.1", port, signal, onListen: () => {} },
+    async (request) => {
+      if (request.method !== "POST") {
+        return new Response("POST NDJSON query lines\n", {
+          status: 405,
+          headers: { allow: "POST" },
+        });
+      }
+
+      const lines = (await request.text()).split("\n")
+        .filter((line) => line.trim());
+      const responses = await Promise.all(
+        lines.map((line) => respond(pool, line)),
+      );
+      return new Response(
+        responses.map((response) => JSON.stringify(response) + "\n").join(""),
+        { headers: { "content-type": "application/x-ndjson" } },
+      );
+    },
+  );
+}
+
+/**
+ * A finite number field of a request
+ */
+function number(request: object, field: string): number {
+  const value = (request as Record<string, unknown>)[field];
+  if (typeof value !== "number" || !Number.isFinite(value)) {
+    throw new Error(`${field} must be a number`);
+  }
+  return value;
+}
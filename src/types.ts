@@ -187,3 +187,86 @@ export type Logger = {
 };
 
 export type PhotometryOutput = "flux" | "magnitude";
+
+export type QueryBackend = "sql" | "native";
+
+/**
+ * Order of limited query results: unordered, brightest G first, or
+ * nearest to the search center first
+ */
+export type ResultOrder = "none" | "brightest" | "nearest";
+
+/**
+ * One cone of a batched search, in degrees
+ */
+export type ConeTarget = {
+  ra: number;
+  dec: number;
+  radius: number;
+};
+
+/**
+ * A point in space: a sky position at a distance in parsecs (0 for the
+ * Sun), or a catalog star placed by its parallax
+ */
+export type SpaceCenter =
+  | { ra: number; dec: number; distance: number }
+  | { sourceId: string | bigint };
+
+/**
+ * Inclusive [min, max] cuts on Gaia columns, applied inside the query.
+ * Use -Infinity or Infinity for a one-sided cut; missing values never
+ * pass. Magnitudes, colours and parallax_over_error also work from the
+ * stored fluxes and parallax_error.
+ */
+export type QueryFilter = Partial<Record<GaiaColumn, [number, number]>>;
+
+/**
+ * A compiled filter cut on stored columns: min <= column <= max, or with
+ * a divisor, divisor > 0 and min <= column / divisor <= max
+ */
+export type FilterTerm = {
+  column: string;
+  divisor?: string;
+  min: number;
+  max: number;
+};
+
+/**
+ * Equal-width bins over a Gaia column, or over a magnitude, colour or
+ * parallax_over_error derived from the stored columns. Values on the max
+ * edge fall in the last bin.
+ */
+export type HistogramAxis = {
+  column: GaiaColumn;
+  min: number;
+  max: number;
+  bins: number;
+};
+
+/**
+ * A compiled aggregate axis on stored columns: column (/ divisor), or
+ * zeropoint - 2.5 log10 of that when a zeropoint is set. `bins` of 0
+ * only tracks the value range.
+ */
+export type AggregateTerm = {
+  column: string;
+  divisor?: string;
+  zeropoint?: number;
+  min: number;
+  max: number;
+  bins: number;
+};
+
+/**
+ * Summary of the rows with a value on every aggregate axis
+ */
+export type AggregateResult = {
+  count: number;
+  /** Smallest value per axis, NaN without rows */
+  min: number[];
+  /** Largest value per axis, NaN without rows */
+  max: number[];
+  /** Row-major bin counts, first axis slowest; empty unless every axis has bins */
+  counts: number[];
+};
@@ -5,7 +5,7 @@
 import { parseGzippedCsvC } from "./ffi/c.ts";
 import type { CLIConfig } from "./config.ts";
 import type { GaiaRecord, TmassXmatchRecord } from "./database.ts";
-import { filterByMagnitude } from "./utils.ts";
+import { filterByMagnitude, parsedColumns } from "./utils.ts";
 
 /**
  * Stream and filter CSV from a file path using C parser
@@ -17,10 +17,12 @@ export async function streamAndFilterCSVC(
 ): Promise<GaiaRecord[]> {
   try {
     // Parse entire file with C
+    // Stored magnitudes are computed in C while parsing
     const allRecords = await parseGzippedCsvC(
       filePath,
-      config.storedColumns,
+      parsedColumns(config),
       config.csvChunkSize,
+      config.storeMagnitudes ? config.zeropoints : undefined,
     );
 
     // Filter by magnitude (still in TypeScript for now)
@@ -5,7 +5,7 @@
 import { parseGzippedCsvRust } from "./ffi/rust.ts";
 import type { CLIConfig } from "./config.ts";
 import type { GaiaRecord, TmassXmatchRecord } from "./database.ts";
-import { filterByMagnitude } from "./utils.ts";
+import { addMagnitudes, filterByMagnitude, parsedColumns } from "./utils.ts";
 
 /**
  * Stream and filter CSV from a file path using Rust parser
@@ -19,7 +19,7 @@ export async function streamAndFilterCSVRust(
     // Parse entire file with Rust
     const allRecords = await parseGzippedCsvRust(
       filePath,
-      config.storedColumns,
+      parsedColumns(config),
       config.csvChunkSize,
     );
 
@@ -30,7 +30,9 @@ export async function streamAndFilterCSVRust(
       config.zeropoints[0],
     );
 
-    return filteredRecords;
+    return config.storeMagnitudes
+      ? addMagnitudes(filteredRecords, config.zeropoints)
+      : filteredRecords;
   } catch (error) {
     const errorMessage = error instanceof Error ? error.message : String(error);
     throw new Error(`Rust CSV parsing failed: ${errorMessage}`);
@@ -5,8 +5,16 @@ import {
   type TmassRecord,
   type TmassXmatchRecord,
 } from "./database.ts";
-import type { CLIConfig } from "./config.ts";
-import { Logger, LogLevel } from "./types.ts";
+import { type CLIConfig, MAGNITUDE_COLUMNS } from "./config.ts";
+import { fluxToMagnitude } from "./ffi/catalog.ts";
+import {
+  AggregateTerm,
+  FilterTerm,
+  Logger,
+  LogLevel,
+  QueryFilter,
+  ResultOrder,
+} from "./types.ts";
 import { parse as parsePSV } from "@std/csv";
 
 /**
@@ -126,7 +134,7 @@ export async function streamAndFilterCSV(
   for await (
     const chunk of streamGzippedCSV(
       source,
-      config.storedColumns,
+      parsedColumns(config),
       config.csvChunkSize,
     )
   ) {
@@ -135,6 +143,9 @@ export async function streamAndFilterCSV(
       config.magnitudeLimit,
       config.zeropoints[0],
     );
+    if (config.storeMagnitudes) {
+      addMagnitudes(filteredRecords, config.zeropoints);
+    }
     allRecords.push(...filteredRecords);
   }
 
@@ -168,6 +179,365 @@ export function filterByMagnitude(
   });
 }
 
+/**
+ * CSV columns to parse for the stored columns: magnitudes stored with
+ * storeMagnitudes are not in the CSV, but need their fluxes
+ */
+export function parsedColumns(config: CLIConfig): string[] {
+  if (!config.storeMagnitudes) return config.storedColumns;
+
+  const columns: string[] = config.storedColumns.filter((column) =>
+    !MAGNITUDE_COLUMNS.includes(column)
+  );
+  for (const band of ["g", "bp", "rp"]) {
+    const flux = `phot_${band}_mean_flux`;
+    if (!columns.includes(flux)) columns.push(flux);
+  }
+  return columns;
+}
+
+/**
+ * Add phot_{g,bp,rp}_mean_mag and bp_rp computed from the fluxes with the
+ * G, BP and RP zeropoints, null where a flux is not above 0, as the C
+ * parser does while parsing
+ */
+export function addMagnitudes(
+  records: GaiaRecord[],
+  zeropoints: number[],
+): GaiaRecord[] {
+  const mags = ["g", "bp", "rp"].map((band, zp) =>
+    fluxToMagnitude(
+      Float64Array.from(
+        records,
+        (record) => Number(record[`phot_${band}_mean_flux`] ?? NaN),
+      ),
+      zeropoints[zp],
+    ).mag
+  );
+
+  records.forEach((record, i) => {
+    const [g, bp, rp] = mags.map((mag) => mag[i]);
+    record.phot_g_mean_mag = Number.isFinite(g) ? g : null;
+    record.phot_bp_mean_mag = Number.isFinite(bp) ? bp : null;
+    record.phot_rp_mean_mag = Number.isFinite(rp) ? rp : null;
+    record.bp_rp = Number.isFinite(bp - rp) ? bp - rp : null;
+  });
+  return records;
+}
+
+/**
+ * Convert a [min, max] G magnitude range to the matching [min, max] G flux
+ * range (brighter magnitudes map to larger fluxes)
+ */
+export function magnitudeToFluxRange(
+  magnitudeLimit: [number, number],
+  zeropoint: number,
+): [number, number] {
+  const [minMag, maxMag] = magnitudeLimit;
+  const maxFlux = Math.round(10 ** ((zeropoint - minMag) / 2.5));
+  const minFlux = Math.round(10 ** ((zeropoint - maxMag) / 2.5));
+  return [minFlux, maxFlux];
+}
+
+// Flux column and zeropoint index of each photometric band
+const bandFlux: Record<string, [string, number]> = {
+  g: ["phot_g_mean_flux", 0],
+  bp: ["phot_bp_mean_flux", 1],
+  rp: ["phot_rp_mean_flux", 2],
+};
+
+/**
+ * Lower flux bound of an open faint magnitude bound, which converts to 0:
+ * the smallest positive double, so the inclusive cut still rejects zero
+ * fluxes (which have no magnitude)
+ */
+function positiveBound(flux: number): number {
+  return Math.max(flux, Number.MIN_VALUE);
+}
+
+/**
+ * A query column in terms of stored columns: itself, or a flux (over a
+ * divisor) with the zeropoint of the magnitude or colour it gives
+ */
+type ResolvedColumn = { column: string; divisor?: string; zeropoint?: number };
+
+/**
+ * Resolve a filter or aggregate column against the `stored` columns.
+ * Magnitudes and colours that aren't stored come from their fluxes, and
+ * parallax_over_error from parallax and parallax_error.
+ */
+function resolveColumn(
+  column: string,
+  stored: string[],
+  zeropoints: number[],
+  use: "filter" | "aggregate",
+): ResolvedColumn {
+  const magnitude = column.match(/^phot_(g|bp|rp)_mean_mag$/);
+  const colour = column.match(/^(bp|g)_(g|rp)$/);
+  let resolved: ResolvedColumn;
+
+  if (stored.includes(column)) {
+    resolved = { column };
+  } else if (magnitude) {
+    const [flux, zp] = bandFlux[magnitude[1]];
+    resolved = { column: flux, zeropoint: zeropoints[zp] };
+  } else if (colour && colour[1] !== colour[2]) {
+    const [fluxA, zpA] = bandFlux[colour[1]];
+    const [fluxB, zpB] = bandFlux[colour[2]];
+    resolved = {
+      column: fluxA,
+      divisor: fluxB,
+      zeropoint: zeropoints[zpA] - zeropoints[zpB],
+    };
+  } else if (column === "parallax_over_error") {
+    resolved = { column: "parallax", divisor: "parallax_error" };
+  } else {
+    const verb = use === "filter" ? "filter on" : "aggregate";
+    throw new Error(`Cannot ${verb} ${column}: it is not stored`);
+  }
+
+  for (const needed of [resolved.column, resolved.divisor]) {
+    if (needed && !stored.includes(needed)) {
+      const verb = use === "filter" ? "Filtering on" : "Aggregating";
+      throw new Error(`${verb} ${column} requires ${needed}`);
+    }
+  }
+  return resolved;
+}
+
+/**
+ * Compile a query filter into cuts on the `stored` columns. Magnitudes,
+ * colours and parallax_over_error that aren't stored become flux and
+ * parallax ratios, so queries need no logarithms.
+ */
+export function filterTerms(
+  filter: QueryFilter,
+  stored: string[],
+  zeropoints: number[],
+): FilterTerm[] {
+  const terms: FilterTerm[] = [];
+
+  for (const [name, range] of Object.entries(filter)) {
+    if (!range) continue;
+    const [min, max] = range;
+    if (!(min <= max)) {
+      throw new Error(`Invalid filter range for ${name}: [${min}, ${max}]`);
+    }
+
+    const { column, divisor, zeropoint } = resolveColumn(
+      name,
+      stored,
+      zeropoints,
+      "filter",
+    );
+    if (zeropoint === undefined) {
+      terms.push({ column, divisor, min, max });
+    } else {
+      // m = zp - 2.5 log10(flux), so the bounds swap
+      terms.push({
+        column,
+        divisor,
+        min: positiveBound(10 ** ((zeropoint - max) / 2.5)),
+        max: 10 ** ((zeropoint - min) / 2.5),
+      });
+    }
+  }
+
+  return terms;
+}
+
+/**
+ * Compile aggregate axes into values of the `stored` columns, resolved
+ * as filterTerms resolves filter columns
+ */
+export function aggregateTerms(
+  axes: { column: string; min: number; max: number; bins: number }[],
+  stored: string[],
+  zeropoints: number[],
+): AggregateTerm[] {
+  return axes.map(({ column, min, max, bins }) => {
+    if (!(bins >= 0) || !Number.isInteger(bins)) {
+      throw new Error(`Invalid bin count for ${column}: ${bins}`);
+    }
+    return {
+      ...resolveColumn(column, stored, zeropoints, "aggregate"),
+      min,
+      max,
+      bins,
+    };
+  });
+}
+
+/**
+ * The bins + 1 edges of equal-width histogram bins
+ */
+export function binEdges(
+  axis: { column: string; min: number; max: number; bins: number },
+): number[] {
+  if (!(axis.bins >= 1) || !Number.isInteger(axis.bins)) {
+    throw new Error(`A histogram needs at least one bin, got ${axis.bins}`);
+  }
+  if (!(axis.min < axis.max)) {
+    throw new Error(
+      `Invalid histogram range for ${axis.column}: [${axis.min}, ${axis.max}]`,
+    );
+  }
+  const width = (axis.max - axis.min) / axis.bins;
+  return Array.from(
+    { length: axis.bins + 1 },
+    (_, i) => i === axis.bins ? axis.max : axis.min + i * width,
+  );
+}
+
+/**
+ * Angular separation in degrees between two positions (Vincenty formula,
+ * accurate at all separations)
+ */
+export function angularSeparation(
+  ra1: number,
+  dec1: number,
+  ra2: number,
+  dec2: number,
+): number {
+  const toRad = Math.PI / 180;
+  const deltaRa = (ra2 - ra1) * toRad;
+  const sin1 = Math.sin(dec1 * toRad);
+  const cos1 = Math.cos(dec1 * toRad);
+  const sin2 = Math.sin(dec2 * toRad);
+  const cos2 = Math.cos(dec2 * toRad);
+
+  const a = cos2 * Math.sin(deltaRa);
+  const b = cos1 * sin2 - sin1 * cos2 * Math.cos(deltaRa);
+  const c = sin1 * sin2 + cos1 * cos2 * Math.cos(deltaRa);
+  return Math.atan2(Math.hypot(a, b), c) / toRad;
+}
+
+/**
+ * Unit vector of a position in degrees
+ */
+export function radecToVector(
+  ra: number,
+  dec: number,
+): [number, number, number] {
+  const raRad = (ra * Math.PI) / 180;
+  const decRad = (dec * Math.PI) / 180;
+  const cosDec = Math.cos(decRad);
+  return [cosDec * Math.cos(raRad), cosDec * Math.sin(raRad), Math.sin(decRad)];
+}
+
+/**
+ * Sort records in place into `order` (brightest G flux first, or nearest
+ * to (ra, dec) first) and keep the first `limit` (0 for all)
+ */
+export function orderRecords(
+  records: GaiaRecord[],
+  order: ResultOrder,
+  ra: number,
+  dec: number,
+  limit = 0,
+): GaiaRecord[] {
+  if (order === "brightest") {
+    const flux = (record: GaiaRecord) =>
+      (record.phot_g_mean_flux as number | null) ?? -Infinity;
+    records.sort((a, b) => flux(b) - flux(a));
+  } else if (order === "nearest") {
+    const separation = (record: GaiaRecord) =>
+      angularSeparation(ra, dec, record.ra, record.dec);
+    records.sort((a, b) => separation(a) - separation(b));
+  }
+  return limit > 0 ? records.slice(0, limit) : records;
+}
+
+/**
+ * Move a position (degrees) by its proper motion over `years`: pmra in
+ * mas/yr already multiplied by cos dec, pmdec in mas/yr. Linear motion in
+ * the tangent plane, matching the native propagate_vec.
+ */
+export function propagatePosition(
+  ra: number,
+  dec: number,
+  pmra: number,
+  pmdec: number,
+  years: number,
+): [number, number] {
+  const [x, y, z] = radecToVector(ra, dec);
+  const r = Math.hypot(x, y);
+  if (r === 0 || !Number.isFinite(pmra) || !Number.isFinite(pmdec)) {
+    return [ra, dec];
+  }
+
+  const masToRad = Math.PI / (180 * 3600 * 1000);
+  const east = pmra * years * masToRad;
+  const north = pmdec * years * masToRad;
+  const wx = x - (east * y) / r - (north * z * x) / r;
+  const wy = y + (east * x) / r - (north * z * y) / r;
+  const wz = z + north * r;
+  const norm = Math.hypot(wx, wy, wz);
+
+  return [
+    (Math.atan2(wy, wx) * 180 / Math.PI + 360) % 360,
+    Math.asin(wz / norm) * 180 / Math.PI,
+  ];
+}
+
+/**
+ * Heliocentric Cartesian position in parsecs of a star at (ra, dec) in
+ * degrees with a parallax in mas
+ */
+export function parallaxToCartesian(
+  ra: number,
+  dec: number,
+  parallax: number,
+): [number, number, number] {
+  const distance = 1000 / parallax;
+  const [x, y, z] = radecToVector(ra, dec);
+  return [x * distance, y * distance, z * distance];
+}
+
+/**
+ * Inward unit normals of a convex spherical polygon's edges, given its
+ * [ra, dec] vertices in degrees in either winding. A point is inside when
+ * its unit vector has a non-negative dot product with every normal.
+ */
+export function convexPolygonNormals(
+  vertices: [number, number][],
+): [number, number, number][] {
+  if (vertices.length < 3 || vertices.length > 64) {
+    throw new Error("Polygon must have between 3 and 64 vertices");
+  }
+
+  const points = vertices.map(([ra, dec]) => radecToVector(ra, dec));
+  const dot = (a: number[], b: number[]) =>
+    a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+
+  let normals = points.map((a, i): [number, number, number] => {
+    const b = points[(i + 1) % points.length];
+    const n = [
+      a[1] * b[2] - a[2] * b[1],
+      a[2] * b[0] - a[0] * b[2],
+      a[0] * b[1] - a[1] * b[0],
+    ];
+    const norm = Math.hypot(n[0], n[1], n[2]);
+    if (norm < 1e-12) {
+      throw new Error("Polygon has repeated or antipodal vertices");
+    }
+    return [n[0] / norm, n[1] / norm, n[2] / norm];
+  });
+
+  // Clockwise input: flip so the interior is on the positive side
+  if (dot(normals[0], points[2]) < 0) {
+    normals = normals.map(([x, y, z]) => [-x, -y, -z]);
+  }
+
+  for (const normal of normals) {
+    if (points.some((point) => dot(normal, point) < -1e-12)) {
+      throw new Error("Polygon must be convex");
+    }
+  }
+
+  return normals;
+}
+
 /**
  * Process a single CSV file: stream, parse in chunks, filter, and insert
  */
@@ -189,7 +559,7 @@ export async function processCSVFile(
     for await (
       const chunk of streamGzippedCSV(
         filePath,
-        config.storedColumns,
+        parsedColumns(config),
         config.csvChunkSize,
       )
     ) {
@@ -199,6 +569,9 @@ export async function processCSVFile(
         config.magnitudeLimit,
         config.zeropoints[0],
       );
+      if (config.storeMagnitudes) {
+        addMagnitudes(filteredRecords, config.zeropoints);
+      }
 
       const insertedCount = db.insertGaiaRecords(filteredRecords);
       totalInserted += insertedCount;